@@ -0,0 +1,168 @@
+#include "AudioOutputHost.h"
+#include "esp_timer.h"
+
+#include <string>
+
+static std::string configuredPath;
+static bool configuredRealtime = false;
+static void (*soundCallback)(int64_t beginTime, int64_t soundTime, void *context) = NULL;
+static void *soundContext = NULL;
+
+static inline void putLE16(uint8_t *p, uint16_t value)
+{
+  p[0] = value & 0xff;
+  p[1] = value >> 8;
+}
+
+static inline void putLE32(uint8_t *p, uint32_t value)
+{
+  putLE16(p, value & 0xffff);
+  putLE16(p + 2, value >> 16);
+}
+
+void AudioOutputHost::configure(const char *wavPath, bool realtime)
+{
+  configuredPath = wavPath ? wavPath : "";
+  configuredRealtime = realtime;
+}
+
+void AudioOutputHost::setSoundCallback(void (*callback)(int64_t beginTime, int64_t soundTime, void *context), void *context)
+{
+  soundContext = context;
+  soundCallback = callback;
+}
+
+AudioOutputHost::AudioOutputHost()
+{
+  wav = NULL;
+  wavRate = 0;
+  wavBytes = 0;
+  realtime = configuredRealtime;
+  queueEnd = 0;
+  beginTime = 0;
+  soundSeen = true;
+  totalSamples = 0;
+  audioSeconds = 0;
+  underruns = 0;
+  started = false;
+  hertz = 44100;
+
+  if (!configuredPath.empty()) {
+    wav = fopen(configuredPath.c_str(), "wb");
+    if (!wav) {
+      Serial.printf("Could not create %s, samples are discarded\n", configuredPath.c_str());
+    }
+  }
+}
+
+AudioOutputHost::~AudioOutputHost()
+{
+  finish();
+  if (wav) fclose(wav);
+}
+
+bool AudioOutputHost::SetRate(int hz)
+{
+  if (wav && wavRate && (hz != (int)wavRate)) {
+    Serial.printf("Output: %d Hz stream written to a %u Hz file\n", hz, wavRate);
+  }
+  return AudioOutput::SetRate(hz);
+}
+
+bool AudioOutputHost::begin()
+{
+  if (wav && (wavRate == 0)) {
+    wavRate = hertz;
+    writeHeader();
+  }
+  // Like the I2S output a running DMA queue is kept, only stop() clears it
+  beginTime = esp_timer_get_time();
+  soundSeen = false;
+  return true;
+}
+
+bool AudioOutputHost::ConsumeSample(int16_t sample[2])
+{
+  int64_t now = esp_timer_get_time();
+  int64_t playTime = now;
+
+  if (realtime) {
+    if (queueEnd < now) {
+      // The DMA buffers ran empty
+      if (started) underruns++;
+      queueEnd = now;
+      started = true;
+    } else if (queueEnd - now >= HOST_OUTPUT_BUFFERED_SAMPLES * 1000000.0 / hertz) {
+      // Buffers full, the caller keeps the sample and tries again later
+      delay(1);
+      return false;
+    }
+    playTime = (int64_t)queueEnd;
+    queueEnd += 1000000.0 / hertz;
+  }
+
+  int16_t ms[2] = { sample[0], sample[1] };
+  MakeSampleStereo16(ms);
+  ms[0] = Amplify(ms[0]);
+  ms[1] = Amplify(ms[1]);
+
+  if (!soundSeen && ((abs(ms[0]) >= HOST_OUTPUT_SILENCE_LEVEL) || (abs(ms[1]) >= HOST_OUTPUT_SILENCE_LEVEL))) {
+    soundSeen = true;
+    if (soundCallback) soundCallback(beginTime, playTime, soundContext);
+  }
+
+  if (wav) {
+    uint8_t bytes[4];
+    putLE16(bytes, ms[0]);
+    putLE16(bytes + 2, ms[1]);
+    wavBytes += fwrite(bytes, 1, sizeof(bytes), wav);
+  }
+  totalSamples++;
+  audioSeconds += 1.0 / hertz;
+  return true;
+}
+
+bool AudioOutputHost::stop()
+{
+  // Buffered samples are dropped
+  started = false;
+  queueEnd = 0;
+  if (wav) fflush(wav);
+  return true;
+}
+
+void AudioOutputHost::finish()
+{
+  if (!wav || (wavRate == 0)) return;
+  long pos = ftell(wav);
+  writeHeader();
+  fseek(wav, pos, SEEK_SET);
+  fflush(wav);
+}
+
+void AudioOutputHost::printStats()
+{
+  Serial.printf("Output: %llu samples, %.1f s of audio, %u underruns\n",
+    (unsigned long long)totalSamples, audioSeconds, underruns);
+}
+
+void AudioOutputHost::writeHeader()
+{
+  uint8_t header[44];
+
+  memcpy(header, "RIFF", 4);
+  putLE32(header + 4, 36 + wavBytes);
+  memcpy(header + 8, "WAVEfmt ", 8);
+  putLE32(header + 16, 16);
+  putLE16(header + 20, 1);
+  putLE16(header + 22, 2);
+  putLE32(header + 24, wavRate);
+  putLE32(header + 28, wavRate * 4);
+  putLE16(header + 32, 4);
+  putLE16(header + 34, 16);
+  memcpy(header + 36, "data", 4);
+  putLE32(header + 40, wavBytes);
+
+  fseek(wav, 0, SEEK_SET);
+  fwrite(header, 1, sizeof(header), wav);
+}
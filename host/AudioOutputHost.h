@@ -0,0 +1,61 @@
+#ifndef LITTLESPEAKER_HOST_AUDIOOUTPUTHOST_H
+#define LITTLESPEAKER_HOST_AUDIOOUTPUTHOST_H
+
+#include "AudioOutput.h"
+
+// Samples the simulated I2S DMA buffers hold (10 buffers of 128 frames,
+// as set up in main.cpp), realtime output runs at most this far ahead
+#define HOST_OUTPUT_BUFFERED_SAMPLES (10 * 128)
+
+// Samples below this level count as silence for the sound callback
+#define HOST_OUTPUT_SILENCE_LEVEL 64
+
+//
+// End of the output chain on the host. Samples are written to a 16 bit
+// stereo WAV file or discarded. In realtime mode they are taken at the
+// rate of the sample clock like the I2S DMA does, otherwise as fast as
+// the decoders deliver them.
+//
+// The firmware creates its output itself, so the settings are made once
+// by the host main before setup() runs.
+//
+class AudioOutputHost : public AudioOutput
+{
+  public:
+    AudioOutputHost();
+    virtual ~AudioOutputHost() override;
+
+    // NULL discards the samples, the WAV file takes the first sample rate
+    static void configure(const char *wavPath, bool realtime);
+
+    // Called for the first audible sample after each begin(), with the
+    // time of that begin() and the time the sample leaves the DMA buffers
+    static void setSoundCallback(void (*callback)(int64_t beginTime, int64_t soundTime, void *context), void *context);
+
+    virtual bool SetRate(int hz) override;
+    virtual bool begin() override;
+    virtual bool ConsumeSample(int16_t sample[2]) override;
+    virtual bool stop() override;
+
+    // Fixes up the WAV header, also done by the destructor
+    void finish();
+    void printStats();
+
+  private:
+    void writeHeader();
+
+    FILE *wav;
+    uint32_t wavRate;
+    uint32_t wavBytes;
+    bool realtime;
+
+    double queueEnd;        // When the buffered samples have been played, in us
+    int64_t beginTime;
+    bool soundSeen;         // Since the last begin()
+    uint64_t totalSamples;
+    double audioSeconds;    // Sample rates may change between tracks
+    uint32_t underruns;
+    bool started;
+};
+
+#endif
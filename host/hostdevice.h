@@ -0,0 +1,36 @@
+#ifndef LITTLESPEAKER_HOST_HOSTDEVICE_H
+#define LITTLESPEAKER_HOST_HOSTDEVICE_H
+
+#include <Arduino.h>
+#include "driver/pcnt.h"
+
+//
+// Controls of the simulated device, used by the host main and scenario
+// scripts. Everything the firmware reads from hardware comes from here.
+//
+
+// Directory that stands in for the SD card, "sd-card" if not set
+void hostSetSDRoot(const char *path);
+const char *hostGetSDRoot();
+
+// Sets the level of an input pin, an edge calls the interrupt attached
+// to the pin from the calling thread. Pins are HIGH until set, like the
+// pulled up buttons of the device.
+void hostSetPinLevel(uint8_t pin, int level);
+
+// One encoder detent, +1 clockwise and -1 counterclockwise. Raises the
+// PCNT limit event the unit would see after a full quadrature cycle.
+void hostTurnEncoder(pcnt_unit_t unit, int direction);
+
+// Heap figures reported by ESP and heap_caps, the defaults are those of
+// a freshly booted ESP32 without PSRAM. What the process allocates after
+// the call (or its start) is taken from them, where malloc can tell.
+void hostSetHeap(uint32_t freeBytes, uint32_t largestBlock);
+
+// Bytes the process has allocated, 0 where the allocator can not tell
+size_t hostHeapInUse();
+
+// Called by ESP.restart() right before the process ends
+void hostSetRestartHandler(void (*handler)(void));
+
+#endif
@@ -0,0 +1,125 @@
+#include <Arduino.h>
+#include "hostdevice.h"
+#include "AudioOutputI2S.h"
+#include "scenario.h"
+#include "benchmark.h"
+#include "formats.h"
+
+#include <unistd.h>
+
+//
+// Runs the firmware on the host: setup() once, then loop() until the time
+// is up. Everything else comes from the shims.
+//
+
+// From src/main.cpp
+void setup();
+void loop();
+extern AudioOutputI2S *output;
+
+static void usage(const char *name) {
+    printf("Usage: %s [--sd DIR] [--wav FILE] [--realtime] [--seconds N] [--scenario FILE]\n"
+        "       [--decode-benchmark] [--playback-benchmark] [--dsp-benchmark [--record]]\n", name);
+    printf("  --sd DIR      directory with the SD card content (sd-card)\n");
+    printf("  --wav FILE    write the output to a WAV file instead of discarding it\n");
+    printf("  --realtime    consume samples at the sample rate like the I2S output\n");
+    printf("  --seconds N   stop after N seconds, 0 runs until interrupted (0)\n");
+    printf("  --scenario F  play the inputs of script F and report the latencies,\n");
+    printf("                see scenario.h, stops at the end of the script\n");
+    printf("  --decode-benchmark  decode the files in /benchmark with every decoder\n");
+    printf("                instead of running the firmware\n");
+    printf("  --playback-benchmark  decode the prompts in /system through the playback\n");
+    printf("                chain instead of running the firmware\n");
+    printf("  --dsp-benchmark  time the DSP kernels and check their output against the\n");
+    printf("                references in src/benchmark.cpp instead of running the firmware\n");
+    printf("  --record      with --dsp-benchmark, print new references instead of checking\n");
+}
+
+static void finishOutput() {
+    if (output == NULL) return;
+    // Not part of the library output, only of the host one
+    AudioOutputHost *host = output;
+    host->printStats();
+    host->finish();
+}
+
+int main(int argc, char **argv) {
+    const char *wavPath = NULL;
+    bool realtime = false;
+    uint32_t seconds = 0;
+    ScenarioRunner *scenario = NULL;
+    bool decodeBenchmark = false;
+    bool playbackBenchmark = false;
+    bool dspBenchmark = false;
+    bool record = false;
+
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = (i + 1 < argc);
+        if ((strcmp(argv[i], "--sd") == 0) && hasValue) {
+            hostSetSDRoot(argv[++i]);
+        } else if ((strcmp(argv[i], "--wav") == 0) && hasValue) {
+            wavPath = argv[++i];
+        } else if (strcmp(argv[i], "--realtime") == 0) {
+            realtime = true;
+        } else if ((strcmp(argv[i], "--seconds") == 0) && hasValue) {
+            seconds = atoi(argv[++i]);
+        } else if ((strcmp(argv[i], "--scenario") == 0) && hasValue) {
+            scenario = new ScenarioRunner();
+            if (!scenario->load(argv[++i])) return 1;
+        } else if (strcmp(argv[i], "--decode-benchmark") == 0) {
+            decodeBenchmark = true;
+        } else if (strcmp(argv[i], "--playback-benchmark") == 0) {
+            playbackBenchmark = true;
+        } else if (strcmp(argv[i], "--dsp-benchmark") == 0) {
+            dspBenchmark = true;
+        } else if (strcmp(argv[i], "--record") == 0) {
+            record = true;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    // Output is line buffered even into a pipe, like the serial monitor
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    AudioOutputHost::configure(wavPath, realtime);
+    hostSetRestartHandler(finishOutput);
+
+    if (decodeBenchmark) {
+        // Decoders are found through the registry like in setup()
+        registerDefaultFormats();
+        uint32_t failed = benchmarkDecodeDirectory();
+        fflush(stdout);
+        _exit(failed ? 2 : 0);
+    }
+    if (playbackBenchmark) {
+        // The card is only a directory, nothing to mount
+        uint32_t failed = benchmarkPlaybackDirectory();
+        fflush(stdout);
+        _exit(failed ? 2 : 0);
+    }
+    if (dspBenchmark) {
+        // A kernel no longer matching its reference, or having none, fails
+        // like a missed input
+        uint32_t failed = benchmarkDspAll(record);
+        fflush(stdout);
+        _exit(failed ? 2 : 0);
+    }
+
+    if (scenario) scenario->start();
+    setup();
+    while ((seconds == 0) || (millis() < seconds * 1000ul)) {
+        if (scenario && scenario->isFinished()) break;
+        loop();
+    }
+
+    finishOutput();
+    int result = 0;
+    if (scenario && (scenario->printReport() > 0)) {
+        // Some input never made a sound
+        result = 2;
+    }
+    // Tasks are still running, static destructors must not run under them
+    fflush(stdout);
+    _exit(result);
+}
@@ -0,0 +1,269 @@
+#include "scenario.h"
+#include "hostdevice.h"
+#include "AudioOutputHost.h"
+#include "esp_timer.h"
+
+#include <algorithm>
+#include <math.h>
+
+typedef struct _ScenarioButton {
+    const char *name;
+    uint8_t pin;
+} ScenarioButton;
+
+// Wired as in main.cpp
+static const ScenarioButton buttons[] = {
+    { "encoder", 21 },
+    { "yellow", 36 },
+    { "black", 39 },
+    { "blue", 34 }
+};
+
+static const ScenarioButton *buttonNamed(const std::string &name) {
+    for (size_t i = 0; i < sizeof(buttons) / sizeof(buttons[0]); i++) {
+        if (name == buttons[i].name) return buttons + i;
+    }
+    return NULL;
+}
+
+ScenarioRunner::ScenarioRunner() {
+    this->groups.push_back("boot");
+    this->currentGroup = 0;
+    this->finished = false;
+}
+
+bool ScenarioRunner::load(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        Serial.printf("Scenario %s not found\n", path);
+        return false;
+    }
+
+    std::vector<size_t> repeats;
+    char line[256];
+    int number = 0;
+    bool valid = true;
+
+    while (valid && fgets(line, sizeof(line), file)) {
+        char verb[32] = { 0 };
+        char argument[64] = { 0 };
+        char time[16] = { 0 };
+
+        number++;
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+        int fields = sscanf(line, "%31s %63s %15s", verb, argument, time);
+        if (fields <= 0) continue;
+
+        ScenarioCommand command;
+        command.line = number;
+        command.verb = verb;
+        command.argument = argument;
+        command.value = atoi(argument);
+        command.time = (fields > 2) ? atoi(time) : -1;
+        command.end = 0;
+
+        if (command.verb == "repeat") {
+            repeats.push_back(this->commands.size());
+        } else if (command.verb == "end") {
+            if (repeats.empty()) {
+                Serial.printf("Scenario line %d: end without repeat\n", number);
+                valid = false;
+            } else {
+                this->commands[repeats.back()].end = this->commands.size();
+                repeats.pop_back();
+            }
+        } else if (command.verb == "click") {
+            if (buttonNamed(command.argument) == NULL) {
+                Serial.printf("Scenario line %d: no button %s\n", number, argument);
+                valid = false;
+            }
+        } else if ((command.verb != "scenario") && (command.verb != "turn") && (command.verb != "wait")) {
+            Serial.printf("Scenario line %d: unknown command %s\n", number, verb);
+            valid = false;
+        }
+        this->commands.push_back(command);
+    }
+    fclose(file);
+
+    if (valid && !repeats.empty()) {
+        Serial.printf("Scenario line %d: repeat without end\n", this->commands[repeats.back()].line);
+        valid = false;
+    }
+    return valid;
+}
+
+void ScenarioRunner::start() {
+    AudioOutputHost::setSoundCallback(soundCallback, this);
+    // The process has just started, that is the boot input
+    this->addEvent("boot", 0);
+    this->thread = std::thread(&ScenarioRunner::run, this);
+    this->thread.detach();
+}
+
+bool ScenarioRunner::isFinished() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->finished;
+}
+
+void ScenarioRunner::run() {
+    this->execute(0, this->commands.size());
+    this->waitForSound(0);
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->finished = true;
+}
+
+void ScenarioRunner::execute(size_t first, size_t last) {
+    for (size_t i = first; i < last; i++) {
+        const ScenarioCommand &command = this->commands[i];
+
+        if (command.verb == "repeat") {
+            for (int32_t n = 0; n < command.value; n++) {
+                this->execute(i + 1, command.end);
+            }
+            i = command.end;
+        } else if (command.verb == "scenario") {
+            std::vector<std::string>::iterator group = std::find(this->groups.begin(), this->groups.end(), command.argument);
+            this->currentGroup = group - this->groups.begin();
+            if (group == this->groups.end()) this->groups.push_back(command.argument);
+        } else if (command.verb == "click") {
+            this->click(command);
+        } else if (command.verb == "turn") {
+            this->turn(command);
+        } else if (command.argument == "sound") {
+            this->waitForSound((command.time >= 0) ? command.time : SCENARIO_SOUND_TIMEOUT_MS);
+        } else {
+            delay(command.value);
+        }
+    }
+}
+
+void ScenarioRunner::click(const ScenarioCommand &command) {
+    const ScenarioButton *button = buttonNamed(command.argument);
+
+    hostSetPinLevel(button->pin, LOW);
+    delay((command.time >= 0) ? command.time : SCENARIO_CLICK_MS);
+    this->addEvent("click " + command.argument, esp_timer_get_time());
+    hostSetPinLevel(button->pin, HIGH);
+}
+
+void ScenarioRunner::turn(const ScenarioCommand &command) {
+    int direction = (command.value < 0) ? -1 : 1;
+
+    for (int32_t n = 0; n < abs(command.value); n++) {
+        if (n > 0) delay((command.time >= 0) ? command.time : SCENARIO_DETENT_MS);
+        this->addEvent((direction > 0) ? "turn right" : "turn left", esp_timer_get_time());
+        hostTurnEncoder(PCNT_UNIT_0, direction);
+    }
+}
+
+// Inputs still silent after the timeout are given up
+void ScenarioRunner::waitForSound(uint32_t ms) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+
+    this->resolved.wait_for(lock, std::chrono::milliseconds(ms), [this]() {
+        for (const ScenarioEvent &event : this->events) {
+            if (!event.resolved) return false;
+        }
+        return true;
+    });
+    for (ScenarioEvent &event : this->events) {
+        event.resolved = true;
+    }
+}
+
+void ScenarioRunner::addEvent(const std::string &label, int64_t time) {
+    ScenarioEvent event;
+    event.group = this->currentGroup;
+    event.label = label;
+    event.time = time;
+    event.latency = -1;
+    event.superseded = false;
+    event.resolved = false;
+
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->events.push_back(event);
+}
+
+// The sound belongs to the last input before the item was started, older
+// inputs without sound of their own were overtaken by it
+void ScenarioRunner::soundStarted(int64_t beginTime, int64_t soundTime) {
+    ScenarioEvent *latest = NULL;
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        for (ScenarioEvent &event : this->events) {
+            if (event.resolved || (event.time > beginTime)) continue;
+            if (latest) {
+                latest->superseded = true;
+                latest->resolved = true;
+            }
+            latest = &event;
+        }
+        if (latest == NULL) return;
+        latest->latency = soundTime - latest->time;
+        latest->resolved = true;
+    }
+    this->resolved.notify_all();
+}
+
+void ScenarioRunner::soundCallback(int64_t beginTime, int64_t soundTime, void *context) {
+    reinterpret_cast<ScenarioRunner *>(context)->soundStarted(beginTime, soundTime);
+}
+
+static double percentile(const std::vector<int64_t> &sorted, double p) {
+    size_t rank = (size_t)ceil(p / 100.0 * sorted.size());
+    return sorted[rank > 0 ? rank - 1 : 0] / 1000.0;
+}
+
+uint32_t ScenarioRunner::printReport() {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    uint32_t totalMissed = 0;
+
+    Serial.println();
+    Serial.println("Inputs:");
+    for (const ScenarioEvent &event : this->events) {
+        Serial.printf("%10.1f ms  %-20s %-14s ", event.time / 1000.0, this->groups[event.group].c_str(), event.label.c_str());
+        if (event.latency >= 0) {
+            Serial.printf("%.1f ms\n", event.latency / 1000.0);
+        } else {
+            Serial.println(event.superseded ? "superseded" : "missed");
+        }
+    }
+
+    Serial.println();
+    Serial.println("Input to sound latency in ms:");
+    Serial.println("scenario             inputs      p50      p90      p99      max  superseded  missed");
+    for (size_t group = 0; group < this->groups.size(); group++) {
+        std::vector<int64_t> latencies;
+        uint32_t inputs = 0;
+        uint32_t superseded = 0;
+        uint32_t missed = 0;
+
+        for (const ScenarioEvent &event : this->events) {
+            if (event.group != group) continue;
+            inputs++;
+            if (event.latency >= 0) {
+                latencies.push_back(event.latency);
+            } else if (event.superseded) {
+                superseded++;
+            } else {
+                missed++;
+            }
+        }
+        if (inputs == 0) continue;
+        totalMissed += missed;
+
+        Serial.printf("%-20s %6u", this->groups[group].c_str(), inputs);
+        if (latencies.empty()) {
+            Serial.printf("%9s%9s%9s%9s", "-", "-", "-", "-");
+        } else {
+            std::sort(latencies.begin(), latencies.end());
+            Serial.printf("%9.1f%9.1f%9.1f%9.1f", percentile(latencies, 50), percentile(latencies, 90),
+                percentile(latencies, 99), latencies.back() / 1000.0);
+        }
+        Serial.printf("%12u%8u\n", superseded, missed);
+    }
+    return totalMissed;
+}
@@ -0,0 +1,91 @@
+#ifndef LITTLESPEAKER_HOST_SCENARIO_H
+#define LITTLESPEAKER_HOST_SCENARIO_H
+
+#include <Arduino.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Default for "wait sound", events still silent afterwards count as missed
+#define SCENARIO_SOUND_TIMEOUT_MS 5000
+
+// How long a click holds the button down
+#define SCENARIO_CLICK_MS 100
+
+// Time between the detents of one "turn"
+#define SCENARIO_DETENT_MS 30
+
+typedef struct _ScenarioCommand {
+    int line;
+    std::string verb;
+    std::string argument;
+    int32_t value;
+    int32_t time;       // Optional milliseconds, -1 if not given
+    size_t end;         // Index of the matching "end" for "repeat"
+} ScenarioCommand;
+
+typedef struct _ScenarioEvent {
+    size_t group;
+    std::string label;
+    int64_t time;       // Device time of the input
+    int64_t latency;    // Until the first audible sample, -1 if none
+    bool superseded;    // The next input came before any sound
+    bool resolved;
+} ScenarioEvent;
+
+//
+// Plays a script of button clicks and encoder detents into the firmware
+// and measures for every input how long it takes until the first audible
+// sample of an item started after it leaves the output. All times are
+// device times (esp_timer), with --realtime the output timing includes
+// the I2S DMA buffers.
+//
+// Script commands, one per line, # starts a comment:
+//
+//   scenario NAME       following inputs are reported as group NAME
+//   click BUTTON [MS]   encoder, yellow, black or blue, held MS (100)
+//   turn N [MS]         N detents, negative turns left, MS apart (30)
+//   wait MS             let the device run
+//   wait sound [MS]     until every input had its sound, at most MS (5000)
+//   repeat N ... end    run the enclosed commands N times
+//
+// The start of the process is an input of group "boot". Clicks are taken
+// by the firmware on release, their latency counts from the release.
+//
+class ScenarioRunner {
+    public:
+        ScenarioRunner();
+
+        bool load(const char *path);
+        void start();
+        bool isFinished();
+
+        // Percentile table per group, returns the number of missed inputs
+        uint32_t printReport();
+
+    private:
+        void run();
+        void execute(size_t first, size_t last);
+        void click(const ScenarioCommand &command);
+        void turn(const ScenarioCommand &command);
+        void waitForSound(uint32_t ms);
+        void addEvent(const std::string &label, int64_t time);
+        void soundStarted(int64_t beginTime, int64_t soundTime);
+
+        static void soundCallback(int64_t beginTime, int64_t soundTime, void *context);
+
+        std::vector<ScenarioCommand> commands;
+        std::vector<std::string> groups;
+        size_t currentGroup;
+
+        std::mutex mutex;
+        std::condition_variable resolved;
+        std::vector<ScenarioEvent> events;
+        bool finished;
+        std::thread thread;
+};
+
+#endif
@@ -0,0 +1,393 @@
+#include <Arduino.h>
+#include "esp_system.h"
+#include "hostdevice.h"
+
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <poll.h>
+#include <unistd.h>
+
+HardwareSerial Serial;
+EspClass ESP;
+
+//
+// Time
+//
+
+static const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+int64_t esp_timer_get_time(void) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+unsigned long millis(void) {
+    return (unsigned long)(esp_timer_get_time() / 1000);
+}
+
+unsigned long micros(void) {
+    return (unsigned long)esp_timer_get_time();
+}
+
+void delay(uint32_t ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(uint32_t us) {
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void yield(void) {
+    std::this_thread::yield();
+}
+
+uint32_t getCpuFrequencyMhz(void) {
+    return 240;
+}
+
+uint32_t esp_random(void) {
+    return ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+}
+
+esp_reset_reason_t esp_reset_reason(void) {
+    return ESP_RST_POWERON;
+}
+
+//
+// Pins
+//
+
+#define HOST_PIN_COUNT 40
+
+typedef struct _HostPin {
+    int level;
+    int mode;
+    void (*handler)(void *);
+    void *arg;
+} HostPin;
+
+static std::mutex pinMutex;
+static HostPin pins[HOST_PIN_COUNT];
+static bool pinsInitialized = false;
+
+static HostPin *pinFor(uint8_t pin) {
+    if (pin >= HOST_PIN_COUNT) return NULL;
+    if (!pinsInitialized) {
+        for (int i = 0; i < HOST_PIN_COUNT; i++) {
+            pins[i].level = HIGH;
+            pins[i].mode = 0;
+            pins[i].handler = NULL;
+            pins[i].arg = NULL;
+        }
+        pinsInitialized = true;
+    }
+    return pins + pin;
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    (void)pin;
+    (void)mode;
+}
+
+int digitalRead(uint8_t pin) {
+    std::lock_guard<std::mutex> lock(pinMutex);
+    HostPin *hostPin = pinFor(pin);
+    return hostPin ? hostPin->level : LOW;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+    hostSetPinLevel(pin, value);
+}
+
+void attachInterruptArg(uint8_t pin, void (*handler)(void *), void *arg, int mode) {
+    std::lock_guard<std::mutex> lock(pinMutex);
+    HostPin *hostPin = pinFor(pin);
+    if (hostPin == NULL) return;
+    hostPin->handler = handler;
+    hostPin->arg = arg;
+    hostPin->mode = mode;
+}
+
+void detachInterrupt(uint8_t pin) {
+    std::lock_guard<std::mutex> lock(pinMutex);
+    HostPin *hostPin = pinFor(pin);
+    if (hostPin == NULL) return;
+    hostPin->handler = NULL;
+}
+
+void hostSetPinLevel(uint8_t pin, int level) {
+    void (*handler)(void *) = NULL;
+    void *arg = NULL;
+
+    {
+        std::lock_guard<std::mutex> lock(pinMutex);
+        HostPin *hostPin = pinFor(pin);
+        if ((hostPin == NULL) || (hostPin->level == level)) return;
+        hostPin->level = level;
+
+        bool rising = (level == HIGH);
+        if ((hostPin->mode == CHANGE) || ((hostPin->mode == RISING) && rising) || ((hostPin->mode == FALLING) && !rising)) {
+            handler = hostPin->handler;
+            arg = hostPin->arg;
+        }
+    }
+    // Outside the lock, the handler reads the pin again
+    if (handler) handler(arg);
+}
+
+//
+// Bluetooth controller
+//
+
+static bool btRunning = false;
+
+bool btStart(void) {
+    btRunning = true;
+    return true;
+}
+
+bool btStop(void) {
+    btRunning = false;
+    return true;
+}
+
+bool btStarted(void) {
+    return btRunning;
+}
+
+//
+// Print and Stream
+//
+
+size_t Print::write(const uint8_t *buffer, size_t size) {
+    size_t written = 0;
+    while (size--) {
+        written += this->write(*buffer++);
+    }
+    return written;
+}
+
+static size_t vprintTo(Print *print, const char *format, va_list args) {
+    char buffer[256];
+    va_list copy;
+
+    va_copy(copy, args);
+    int length = vsnprintf(buffer, sizeof(buffer), format, copy);
+    va_end(copy);
+    if (length < 0) return 0;
+    if ((size_t)length < sizeof(buffer)) {
+        return print->write(reinterpret_cast<uint8_t *>(buffer), length);
+    }
+
+    char *large = reinterpret_cast<char *>(malloc(length + 1));
+    if (large == NULL) return 0;
+    vsnprintf(large, length + 1, format, args);
+    size_t written = print->write(reinterpret_cast<uint8_t *>(large), length);
+    free(large);
+    return written;
+}
+
+size_t Print::printf(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    size_t written = vprintTo(this, format, args);
+    va_end(args);
+    return written;
+}
+
+size_t Print::printf_P(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    size_t written = vprintTo(this, format, args);
+    va_end(args);
+    return written;
+}
+
+int Stream::timedRead() {
+    unsigned long start = millis();
+    do {
+        int c = this->read();
+        if (c >= 0) return c;
+        yield();
+    } while (millis() - start < this->timeout);
+    return -1;
+}
+
+size_t Stream::readBytes(char *buffer, size_t length) {
+    size_t count = 0;
+    while (count < length) {
+        int c = this->timedRead();
+        if (c < 0) break;
+        buffer[count++] = (char)c;
+    }
+    return count;
+}
+
+size_t Stream::readBytesUntil(char terminator, char *buffer, size_t length) {
+    size_t count = 0;
+    while (count < length) {
+        int c = this->timedRead();
+        if ((c < 0) || (c == terminator)) break;
+        buffer[count++] = (char)c;
+    }
+    return count;
+}
+
+//
+// Serial
+//
+
+static int serialPeeked = -1;
+
+size_t HardwareSerial::write(uint8_t c) {
+    return fwrite(&c, 1, 1, stdout);
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size) {
+    return fwrite(buffer, 1, size, stdout);
+}
+
+int HardwareSerial::available() {
+    if (serialPeeked >= 0) return 1;
+
+    struct pollfd fd = { STDIN_FILENO, POLLIN, 0 };
+    return (poll(&fd, 1, 0) > 0) && (fd.revents & POLLIN) ? 1 : 0;
+}
+
+int HardwareSerial::read() {
+    int c = this->peek();
+    serialPeeked = -1;
+    return c;
+}
+
+int HardwareSerial::peek() {
+    if (serialPeeked >= 0) return serialPeeked;
+    if (!this->available()) return -1;
+
+    uint8_t c;
+    if (::read(STDIN_FILENO, &c, 1) != 1) return -1;
+    serialPeeked = c;
+    return c;
+}
+
+void HardwareSerial::flush() {
+    fflush(stdout);
+}
+
+String IPAddress::toString() const {
+    char buffer[16];
+    snprintf(buffer, sizeof(buffer), "%u.%u.%u.%u", (*this)[0], (*this)[1], (*this)[2], (*this)[3]);
+    return String(buffer);
+}
+
+//
+// Heap
+//
+
+// The device figures below are for this much heap in use, what the
+// process allocates beyond it is taken from them
+static size_t heapBaseline = hostHeapInUse();
+
+static uint32_t heapFree = 290 * 1024;
+static uint32_t heapLargest = 110 * 1024;
+static uint32_t heapMinimum = 290 * 1024;
+static esp_alloc_failed_hook_t allocFailedHook = NULL;
+static void (*restartHandler)(void) = NULL;
+
+static uint32_t currentHeapFree() {
+    int64_t used = (int64_t)hostHeapInUse() - (int64_t)heapBaseline;
+    int64_t available = (int64_t)heapFree - used;
+    uint32_t result = (available > 0) ? (uint32_t)available : 0;
+
+    uint32_t minimum = __atomic_load_n(&heapMinimum, __ATOMIC_RELAXED);
+    while ((result < minimum) && !__atomic_compare_exchange_n(&heapMinimum, &minimum, result, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        // Another task lowered it meanwhile
+    }
+    return result;
+}
+
+static uint32_t currentHeapLargest() {
+    uint32_t available = currentHeapFree();
+    return (heapLargest < available) ? heapLargest : available;
+}
+
+void hostSetHeap(uint32_t freeBytes, uint32_t largestBlock) {
+    heapBaseline = hostHeapInUse();
+    heapFree = freeBytes;
+    heapLargest = largestBlock;
+    if (freeBytes < heapMinimum) heapMinimum = freeBytes;
+}
+
+esp_err_t heap_caps_register_failed_alloc_callback(esp_alloc_failed_hook_t callback) {
+    allocFailedHook = callback;
+    return ESP_OK;
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps) {
+    void *ptr = malloc(size);
+    if ((ptr == NULL) && allocFailedHook) {
+        allocFailedHook(size, caps, __func__);
+    }
+    return ptr;
+}
+
+void heap_caps_free(void *ptr) {
+    free(ptr);
+}
+
+size_t heap_caps_get_free_size(uint32_t caps) {
+    (void)caps;
+    return currentHeapFree();
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps) {
+    (void)caps;
+    currentHeapFree();
+    return heapMinimum;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps) {
+    (void)caps;
+    return currentHeapLargest();
+}
+
+void heap_caps_get_info(multi_heap_info_t *info, uint32_t caps) {
+    memset(info, 0, sizeof(multi_heap_info_t));
+    info->total_free_bytes = heap_caps_get_free_size(caps);
+    info->largest_free_block = heap_caps_get_largest_free_block(caps);
+    info->minimum_free_bytes = heap_caps_get_minimum_free_size(caps);
+}
+
+//
+// ESP
+//
+
+void hostSetRestartHandler(void (*handler)(void)) {
+    restartHandler = handler;
+}
+
+void EspClass::restart() {
+    Serial.println("Restart requested, ending the host process");
+    Serial.flush();
+    if (restartHandler) restartHandler();
+    // Tasks are still running, static destructors must not run under them
+    fflush(stdout);
+    _exit(0);
+}
+
+uint32_t EspClass::getFreeHeap() {
+    return currentHeapFree();
+}
+
+uint32_t EspClass::getMinFreeHeap() {
+    currentHeapFree();
+    return heapMinimum;
+}
+
+uint32_t EspClass::getMaxAllocHeap() {
+    return currentHeapLargest();
+}
+
+uint32_t EspClass::getCycleCount() {
+    return (uint32_t)(esp_timer_get_time() * 240);
+}
@@ -0,0 +1,188 @@
+#ifndef LITTLESPEAKER_HOST_ARDUINO_H
+#define LITTLESPEAKER_HOST_ARDUINO_H
+
+//
+// The part of the Arduino core the firmware uses, on top of the host C
+// library. Also included by the C sources of the codec libraries, so
+// everything C++ is fenced off.
+//
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "pgmspace.h"
+#include "esp_attr.h"
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+#define INPUT 0x01
+#define OUTPUT 0x03
+#define PULLUP 0x04
+#define INPUT_PULLUP 0x05
+
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+#define LOW 0x0
+#define HIGH 0x1
+
+#define digitalPinToInterrupt(p) (p)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield(void);
+
+// Pins are simulated, see hostdevice.h
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t value);
+void attachInterruptArg(uint8_t pin, void (*handler)(void *), void *arg, int mode);
+void detachInterrupt(uint8_t pin);
+
+uint32_t getCpuFrequencyMhz(void);
+uint32_t esp_random(void);
+
+// Bluetooth controller, there is none
+bool btStart(void);
+bool btStop(void);
+bool btStarted(void);
+
+#ifdef __cplusplus
+}
+
+#include <string>
+
+class Print {
+    public:
+        virtual ~Print() {}
+
+        virtual size_t write(uint8_t c) = 0;
+        virtual size_t write(const uint8_t *buffer, size_t size);
+        size_t write(const char *str) { return this->write(reinterpret_cast<const uint8_t *>(str), strlen(str)); }
+
+        size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+        size_t printf_P(const char *format, ...) __attribute__((format(printf, 2, 3)));
+        size_t print(const char *str) { return this->write(str); }
+        size_t print(char c) { return this->write((uint8_t)c); }
+        size_t print(int value) { return this->printf("%d", value); }
+        size_t print(unsigned int value) { return this->printf("%u", value); }
+        size_t print(long value) { return this->printf("%ld", value); }
+        size_t print(unsigned long value) { return this->printf("%lu", value); }
+        size_t println() { return this->write("\r\n"); }
+        size_t println(const char *str) { return this->print(str) + this->println(); }
+        size_t println(char c) { return this->print(c) + this->println(); }
+        size_t println(int value) { return this->print(value) + this->println(); }
+        size_t println(unsigned int value) { return this->print(value) + this->println(); }
+        size_t println(long value) { return this->print(value) + this->println(); }
+        size_t println(unsigned long value) { return this->print(value) + this->println(); }
+        virtual void flush() {}
+};
+
+class Stream : public Print {
+    public:
+        Stream() { this->timeout = 1000; }
+
+        virtual int available() = 0;
+        virtual int read() = 0;
+        virtual int peek() = 0;
+
+        void setTimeout(unsigned long timeout) { this->timeout = timeout; }
+        size_t readBytes(char *buffer, size_t length);
+        size_t readBytes(uint8_t *buffer, size_t length) { return this->readBytes(reinterpret_cast<char *>(buffer), length); }
+        size_t readBytesUntil(char terminator, char *buffer, size_t length);
+
+    protected:
+        int timedRead();
+
+        unsigned long timeout;
+};
+
+// Output goes to stdout, input comes from stdin
+class HardwareSerial : public Stream {
+    public:
+        void begin(unsigned long baud) { (void)baud; }
+        void end() {}
+
+        using Print::write;
+        virtual size_t write(uint8_t c) override;
+        virtual size_t write(const uint8_t *buffer, size_t size) override;
+        virtual int available() override;
+        virtual int read() override;
+        virtual int peek() override;
+        virtual void flush() override;
+};
+
+extern HardwareSerial Serial;
+
+class String {
+    public:
+        String(const char *str = "") : value(str ? str : "") {}
+        String(const std::string &str) : value(str) {}
+        String(int number) : value(std::to_string(number)) {}
+
+        const char *c_str() const { return this->value.c_str(); }
+        unsigned int length() const { return this->value.length(); }
+        int toInt() const { return atoi(this->value.c_str()); }
+        bool startsWith(const char *prefix) const { return this->value.compare(0, strlen(prefix), prefix) == 0; }
+        bool operator==(const char *str) const { return this->value == str; }
+        String &operator+=(const char *str) { this->value += str; return *this; }
+        String operator+(const char *str) const { return String(this->value + str); }
+
+    private:
+        std::string value;
+};
+
+class IPAddress {
+    public:
+        IPAddress() { this->address = 0; }
+        IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) { this->address = a | (b << 8) | (c << 16) | ((uint32_t)d << 24); }
+        IPAddress(uint32_t address) { this->address = address; }
+
+        operator uint32_t() const { return this->address; }
+        uint8_t operator[](int index) const { return (this->address >> (index * 8)) & 0xff; }
+        String toString() const;
+
+    private:
+        uint32_t address;
+};
+
+class EspClass {
+    public:
+        // Ends the host process, there is nothing to reboot
+        void restart();
+
+        uint32_t getFreeHeap();
+        uint32_t getMinFreeHeap();
+        uint32_t getMaxAllocHeap();
+        uint32_t getCycleCount();
+};
+
+extern EspClass ESP;
+
+#endif
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef LITTLESPEAKER_HOST_AUDIOFILESOURCEHTTPSTREAM_H
+#define LITTLESPEAKER_HOST_AUDIOFILESOURCEHTTPSTREAM_H
+
+#include "AudioFileSource.h"
+#include <HTTPClient.h>
+
+// Opening fails like the library source does without a connection. The
+// access of the members is the one of ESP8266Audio 1.9.7, the connection
+// is private and only the ICY source is a friend.
+class AudioFileSourceHTTPStream : public AudioFileSource
+{
+  friend class AudioFileSourceICYStream;
+
+  public:
+    AudioFileSourceHTTPStream() { pos = 0; size = 0; }
+    AudioFileSourceHTTPStream(const char *url) { pos = 0; size = 0; open(url); }
+    virtual ~AudioFileSourceHTTPStream() override {}
+
+    virtual bool open(const char *url) override
+    {
+      if (!http.begin(client, url)) return false;
+      if (http.GET() != 200) {
+        http.end();
+        cb.st(STATUS_HTTPFAIL, "Can't open HTTP request");
+        return false;
+      }
+      return true;
+    }
+    virtual uint32_t read(void *data, uint32_t len) override { (void)data; (void)len; return 0; }
+    virtual uint32_t readNonBlock(void *data, uint32_t len) override { (void)data; (void)len; return 0; }
+    virtual bool seek(int32_t pos, int dir) override { (void)pos; (void)dir; return false; }
+    virtual bool close() override
+    {
+      http.end();
+      return true;
+    }
+    virtual bool isOpen() override { return false; }
+    virtual uint32_t getSize() override { return size; }
+    virtual uint32_t getPos() override { return pos; }
+    bool SetReconnect(int tries, int delayms) { reconnectTries = tries; reconnectDelayMs = delayms; return true; }
+    void useHTTP10() {}
+
+    enum { STATUS_HTTPFAIL=2, STATUS_DISCONNECTED, STATUS_RECONNECTING, STATUS_RECONNECTED, STATUS_NODATA };
+
+  private:
+    WiFiClient client;
+    HTTPClient http;
+    int pos;
+    int size;
+    int reconnectTries;
+    int reconnectDelayMs;
+};
+
+#endif
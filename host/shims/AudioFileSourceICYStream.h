@@ -0,0 +1,25 @@
+#ifndef LITTLESPEAKER_HOST_AUDIOFILESOURCEICYSTREAM_H
+#define LITTLESPEAKER_HOST_AUDIOFILESOURCEICYSTREAM_H
+
+#include "AudioFileSourceHTTPStream.h"
+
+class AudioFileSourceICYStream : public AudioFileSourceHTTPStream
+{
+  public:
+    AudioFileSourceICYStream() { icyMetaInt = 0; icyByteCount = 0; }
+    AudioFileSourceICYStream(const char *url) : AudioFileSourceICYStream() { open(url); }
+    virtual ~AudioFileSourceICYStream() override {}
+
+    virtual bool open(const char *url) override
+    {
+      icyMetaInt = 0;
+      icyByteCount = 0;
+      return AudioFileSourceHTTPStream::open(url);
+    }
+
+  private:
+    int icyMetaInt;
+    int icyByteCount;
+};
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef LITTLESPEAKER_HOST_AUDIOFILESOURCESD_H
+#define LITTLESPEAKER_HOST_AUDIOFILESOURCESD_H
+
+#include "AudioFileSource.h"
+#include <SD.h>
+
+// Same as the library source, on top of the host SD card
+class AudioFileSourceSD : public AudioFileSource
+{
+  public:
+    AudioFileSourceSD() {}
+    AudioFileSourceSD(const char *filename) { open(filename); }
+    virtual ~AudioFileSourceSD() override { close(); }
+
+    virtual bool open(const char *filename) override
+    {
+      f = SD.open(filename, FILE_READ);
+      return f;
+    }
+    virtual uint32_t read(void *data, uint32_t len) override
+    {
+      return f.read(reinterpret_cast<uint8_t *>(data), len);
+    }
+    virtual bool seek(int32_t pos, int dir) override
+    {
+      return f.seek(pos, (dir == SEEK_SET) ? SeekSet : (dir == SEEK_CUR) ? SeekCur : SeekEnd);
+    }
+    virtual bool close() override
+    {
+      f.close();
+      return true;
+    }
+    virtual bool isOpen() override { return f; }
+    virtual uint32_t getSize() override { return f ? f.size() : 0; }
+    virtual uint32_t getPos() override { return f ? f.position() : 0; }
+
+  private:
+    File f;
+};
+
+#endif
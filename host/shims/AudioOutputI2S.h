@@ -0,0 +1,63 @@
+#ifndef LITTLESPEAKER_HOST_AUDIOOUTPUTI2S_H
+#define LITTLESPEAKER_HOST_AUDIOOUTPUTI2S_H
+
+#include "AudioOutputHost.h"
+
+// Takes the place of the library output, samples go to AudioOutputHost.
+// The public methods are the ones of ESP8266Audio 1.9.7 on the ESP32, the
+// host additions are hidden so the firmware cannot call them by mistake.
+class AudioOutputI2S : public AudioOutputHost
+{
+  public:
+    enum : int { APLL_AUTO = -1, APLL_ENABLE = 1, APLL_DISABLE = 0 };
+    enum : int { EXTERNAL_I2S = 0, INTERNAL_DAC = 1, INTERNAL_PDM = 2 };
+
+    AudioOutputI2S(int port = 0, int outputMode = EXTERNAL_I2S, int dmaBufCount = 8, int useApll = APLL_DISABLE)
+    {
+      (void)port;
+      (void)outputMode;
+      (void)dmaBufCount;
+      (void)useApll;
+    }
+
+    bool SetPinout(int bclkPin, int wclkPin, int doutPin)
+    {
+      (void)bclkPin;
+      (void)wclkPin;
+      (void)doutPin;
+      return true;
+    }
+    virtual bool begin() override { return begin(true); }
+    bool begin(bool txDAC)
+    {
+      (void)txDAC;
+      return AudioOutputHost::begin();
+    }
+    bool SetOutputModeMono(bool mono)
+    {
+      (void)mono;
+      return true;
+    }
+    bool SetLsbJustified(bool lsbJustified)
+    {
+      (void)lsbJustified;
+      return true;
+    }
+    bool SetMclk(bool enabled)
+    {
+      (void)enabled;
+      return true;
+    }
+    bool SwapClocks(bool swapClocks)
+    {
+      (void)swapClocks;
+      return true;
+    }
+
+  private:
+    // Only for the host main, through AudioOutputHost
+    using AudioOutputHost::finish;
+    using AudioOutputHost::printStats;
+};
+
+#endif
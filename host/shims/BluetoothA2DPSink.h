@@ -0,0 +1,47 @@
+#ifndef LITTLESPEAKER_HOST_BLUETOOTHA2DPSINK_H
+#define LITTLESPEAKER_HOST_BLUETOOTHA2DPSINK_H
+
+#include <Arduino.h>
+#include "driver/i2s.h"
+
+typedef enum {
+    ESP_AVRC_PLAYBACK_STOPPED = 0,
+    ESP_AVRC_PLAYBACK_PLAYING = 1,
+    ESP_AVRC_PLAYBACK_PAUSED = 2,
+    ESP_AVRC_PLAYBACK_FWD_SEEK = 3,
+    ESP_AVRC_PLAYBACK_REV_SEEK = 4,
+    ESP_AVRC_PLAYBACK_ERROR = 0xFF
+} esp_avrc_playback_stat_t;
+
+//
+// Stands in for the vendored A2DP sink: it can be started and stopped,
+// but no source ever connects, so none of the callbacks are called. The
+// signatures are the ones of lib/bluetoothA2DP/BluetoothA2DPSink.h.
+//
+class BluetoothA2DPSink {
+    public:
+        virtual ~BluetoothA2DPSink() {}
+
+        virtual void set_pin_config(i2s_pin_config_t config) { (void)config; }
+        virtual void set_mono_downmix(bool enabled) { (void)enabled; }
+        virtual void set_volume(uint8_t volume) { (void)volume; }
+        virtual void set_avrc_connection_state_callback(void (*callback)(bool, void *)) { (void)callback; }
+        virtual void set_avrc_rn_playstatus_callback(void (*callback)(esp_avrc_playback_stat_t playback, void *)) { (void)callback; }
+        virtual void set_stream_reader(void (*callback)(const uint8_t *, uint32_t, void *), bool i2sOutput = true) { (void)callback; (void)i2sOutput; }
+        void set_callback_context(void *context) { (void)context; }
+
+        virtual void start(const char *name, bool autoReconnect) { (void)autoReconnect; start(name); }
+        virtual void start(const char *name) { (void)name; btStart(); }
+        virtual void end(bool releaseMemory = false) { (void)releaseMemory; }
+        virtual void init_i2s() {}
+        virtual void set_i2s_active(bool active) { (void)active; }
+        virtual uint16_t sample_rate() { return 44100; }
+
+        virtual void play() {}
+        virtual void pause() {}
+        virtual void stop() {}
+        virtual void next() {}
+        virtual void previous() {}
+};
+
+#endif
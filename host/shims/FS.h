@@ -0,0 +1,78 @@
+#ifndef LITTLESPEAKER_HOST_FS_H
+#define LITTLESPEAKER_HOST_FS_H
+
+#include <Arduino.h>
+#include <memory>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+enum SeekMode {
+    SeekSet = 0,
+    SeekCur = 1,
+    SeekEnd = 2
+};
+
+namespace fs {
+
+// Open file or directory of the host file system, see sd.cpp
+class FileImpl;
+typedef std::shared_ptr<FileImpl> FileImplPtr;
+
+//
+// Same value semantics as the ESP32 core: copies share the open file, it
+// is closed by close() or when the last copy goes away.
+//
+class File : public Stream {
+    public:
+        File(FileImplPtr impl = FileImplPtr()) : impl(impl) {}
+
+        using Print::write;
+        virtual size_t write(uint8_t c) override;
+        virtual size_t write(const uint8_t *buffer, size_t size) override;
+        virtual int available() override;
+        virtual int read() override;
+        virtual int peek() override;
+        virtual void flush() override;
+
+        size_t read(uint8_t *buffer, size_t size);
+        bool seek(uint32_t pos, SeekMode mode);
+        bool seek(uint32_t pos) { return this->seek(pos, SeekSet); }
+        size_t position() const;
+        size_t size() const;
+        void close();
+        operator bool() const;
+        time_t getLastWrite();
+
+        // Full path on the card and the last part of it
+        const char *path() const;
+        const char *name() const;
+
+        // Entries come in name order, the card returns them in FAT order
+        bool isDirectory();
+        File openNextFile(const char *mode = FILE_READ);
+        void rewindDirectory();
+
+    private:
+        FileImplPtr impl;
+};
+
+class FS {
+    public:
+        File open(const char *path, const char *mode = FILE_READ, bool create = false);
+        File open(const String &path, const char *mode = FILE_READ, bool create = false) { return this->open(path.c_str(), mode, create); }
+        bool exists(const char *path);
+        bool exists(const String &path) { return this->exists(path.c_str()); }
+        bool remove(const char *path);
+        bool rename(const char *from, const char *to);
+        bool mkdir(const char *path);
+        bool rmdir(const char *path);
+};
+
+}
+
+using fs::File;
+using fs::FS;
+
+#endif
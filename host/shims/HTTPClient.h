@@ -0,0 +1,42 @@
+#ifndef LITTLESPEAKER_HOST_HTTPCLIENT_H
+#define LITTLESPEAKER_HOST_HTTPCLIENT_H
+
+#include <WiFi.h>
+
+#define HTTPC_ERROR_CONNECTION_REFUSED (-1)
+
+typedef enum {
+    HTTPC_DISABLE_FOLLOW_REDIRECTS,
+    HTTPC_STRICT_FOLLOW_REDIRECTS,
+    HTTPC_FORCE_FOLLOW_REDIRECTS
+} followRedirects_t;
+
+// Every request fails to connect, there is no network on the host
+class HTTPClient {
+    public:
+        HTTPClient() { this->client = NULL; }
+
+        bool begin(WiFiClient &client, const char *url) { (void)url; this->client = &client; return true; }
+        bool begin(WiFiClient &client, const String &url) { return this->begin(client, url.c_str()); }
+        void end() { this->client = NULL; }
+
+        void setReuse(bool reuse) { (void)reuse; }
+        void setFollowRedirects(followRedirects_t follow) { (void)follow; }
+        void setTimeout(uint16_t timeout) { (void)timeout; }
+        void setConnectTimeout(int32_t timeout) { (void)timeout; }
+        void setUserAgent(const String &userAgent) { (void)userAgent; }
+        void addHeader(const String &name, const String &value) { (void)name; (void)value; }
+        void collectHeaders(const char *headers[], size_t count) { (void)headers; (void)count; }
+
+        int GET() { return HTTPC_ERROR_CONNECTION_REFUSED; }
+        String header(const char *name) { (void)name; return String(); }
+        bool hasHeader(const char *name) { (void)name; return false; }
+        int getSize() { return -1; }
+        WiFiClient *getStreamPtr() { return this->client; }
+        String getLocation() { return String(); }
+
+    private:
+        WiFiClient *client;
+};
+
+#endif
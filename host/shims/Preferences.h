@@ -0,0 +1,40 @@
+#ifndef LITTLESPEAKER_HOST_PREFERENCES_H
+#define LITTLESPEAKER_HOST_PREFERENCES_H
+
+#include <Arduino.h>
+
+//
+// NVS namespaces kept in memory, everything is gone when the process
+// ends like after erasing the flash
+//
+class Preferences {
+    public:
+        Preferences() { this->name[0] = '\0'; this->readOnly = true; }
+
+        bool begin(const char *name, bool readOnly = false);
+        void end();
+        bool clear();
+        bool remove(const char *key);
+        bool isKey(const char *key);
+
+        size_t putUChar(const char *key, uint8_t value);
+        size_t putUInt(const char *key, uint32_t value);
+        size_t putString(const char *key, const char *value);
+        size_t putBytes(const char *key, const void *value, size_t length);
+
+        uint8_t getUChar(const char *key, uint8_t defaultValue = 0);
+        uint32_t getUInt(const char *key, uint32_t defaultValue = 0);
+        // Length including the terminating zero, 0 if missing or too long
+        size_t getString(const char *key, char *value, size_t maxLength);
+        size_t getBytesLength(const char *key);
+        size_t getBytes(const char *key, void *buffer, size_t maxLength);
+
+    private:
+        size_t put(const char *key, const void *value, size_t length);
+        size_t get(const char *key, void *buffer, size_t maxLength);
+
+        char name[16];
+        bool readOnly;
+};
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef LITTLESPEAKER_HOST_SD_H
+#define LITTLESPEAKER_HOST_SD_H
+
+#include "FS.h"
+
+class SPIClass {
+    public:
+        void begin() {}
+        void end() {}
+};
+
+extern SPIClass SPI;
+
+typedef enum {
+    CARD_NONE,
+    CARD_MMC,
+    CARD_SD,
+    CARD_SDHC,
+    CARD_UNKNOWN
+} sdcard_type_t;
+
+// The card is a host directory, see hostSetSDRoot()
+class SDFS : public fs::FS {
+    public:
+        bool begin(uint8_t ssPin = 0, SPIClass &spi = SPI, uint32_t frequency = 4000000, const char *mountpoint = "/sd", uint8_t maxFiles = 5, bool formatIfMountFailed = false);
+        void end() {}
+        sdcard_type_t cardType();
+        uint64_t cardSize();
+        uint64_t totalBytes();
+        uint64_t usedBytes();
+};
+
+extern SDFS SD;
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef LITTLESPEAKER_HOST_WIFI_H
+#define LITTLESPEAKER_HOST_WIFI_H
+
+#include <Arduino.h>
+#include <functional>
+
+//
+// There is no network on the host: every connection attempt fails after
+// a short delay with "no AP found", like a device out of range.
+//
+
+typedef enum {
+    WIFI_MODE_NULL = 0,
+    WIFI_MODE_STA,
+    WIFI_MODE_AP,
+    WIFI_MODE_APSTA
+} wifi_mode_t;
+
+#define WIFI_OFF WIFI_MODE_NULL
+#define WIFI_STA WIFI_MODE_STA
+#define WIFI_AP WIFI_MODE_AP
+
+typedef enum {
+    WL_IDLE_STATUS = 0,
+    WL_NO_SSID_AVAIL = 1,
+    WL_CONNECTED = 3,
+    WL_CONNECT_FAILED = 4,
+    WL_DISCONNECTED = 6
+} wl_status_t;
+
+typedef enum {
+    ARDUINO_EVENT_WIFI_STA_START = 0,
+    ARDUINO_EVENT_WIFI_STA_STOP,
+    ARDUINO_EVENT_WIFI_STA_CONNECTED,
+    ARDUINO_EVENT_WIFI_STA_DISCONNECTED,
+    ARDUINO_EVENT_WIFI_STA_GOT_IP,
+    ARDUINO_EVENT_WIFI_STA_LOST_IP,
+    ARDUINO_EVENT_MAX
+} arduino_event_id_t;
+
+#define WIFI_REASON_ASSOC_LEAVE 8
+#define WIFI_REASON_NO_AP_FOUND 201
+
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t ssid_len;
+    uint8_t bssid[6];
+    uint8_t reason;
+} wifi_event_sta_disconnected_t;
+
+typedef union {
+    wifi_event_sta_disconnected_t wifi_sta_disconnected;
+} arduino_event_info_t;
+
+typedef std::function<void(arduino_event_id_t event, arduino_event_info_t info)> WiFiEventFuncCb;
+typedef size_t wifi_event_id_t;
+
+typedef enum {
+    WIFI_PS_NONE = 0,
+    WIFI_PS_MIN_MODEM,
+    WIFI_PS_MAX_MODEM
+} wifi_ps_type_t;
+
+class WiFiClass {
+    public:
+        bool mode(wifi_mode_t mode);
+        wifi_mode_t getMode();
+        void persistent(bool persistent) { (void)persistent; }
+        bool setAutoReconnect(bool autoReconnect) { (void)autoReconnect; return true; }
+        bool setSleep(bool enabled) { (void)enabled; return true; }
+        bool setSleep(wifi_ps_type_t type) { (void)type; return true; }
+
+        bool config(IPAddress localIP, IPAddress gateway, IPAddress subnet, IPAddress dns1 = IPAddress(), IPAddress dns2 = IPAddress());
+        wl_status_t begin(const char *ssid, const char *password = NULL, int32_t channel = 0, const uint8_t *bssid = NULL, bool connect = true);
+        bool disconnect(bool wifiOff = false, bool eraseAP = false);
+        bool softAPdisconnect(bool wifiOff = false);
+        wl_status_t status();
+
+        IPAddress localIP() { return IPAddress(); }
+        IPAddress gatewayIP() { return IPAddress(); }
+        IPAddress subnetMask() { return IPAddress(); }
+        IPAddress dnsIP(uint8_t index = 0) { (void)index; return IPAddress(); }
+        uint8_t *BSSID();
+        int32_t channel() { return 0; }
+        int8_t RSSI() { return 0; }
+
+        // Handlers run on the event thread, like on the Arduino event task
+        wifi_event_id_t onEvent(WiFiEventFuncCb callback, arduino_event_id_t event = ARDUINO_EVENT_MAX);
+        void removeEvent(wifi_event_id_t id);
+};
+
+extern WiFiClass WiFi;
+
+// Never connects
+class WiFiClient : public Stream {
+    public:
+        int connect(const char *host, uint16_t port) { (void)host; (void)port; return 0; }
+        uint8_t connected() { return 0; }
+        void stop() {}
+        void setNoDelay(bool noDelay) { (void)noDelay; }
+
+        virtual size_t write(uint8_t c) override { (void)c; return 0; }
+        virtual size_t write(const uint8_t *buffer, size_t size) override { (void)buffer; (void)size; return 0; }
+        virtual int available() override { return 0; }
+        virtual int read() override { return -1; }
+        virtual int peek() override { return -1; }
+};
+
+#endif
@@ -0,0 +1,146 @@
+#include "driver/i2s.h"
+#include "driver/pcnt.h"
+#include "hostdevice.h"
+
+#include <mutex>
+
+//
+// I2S
+//
+
+esp_err_t i2s_driver_install(i2s_port_t port, const i2s_config_t *config, int queueSize, QueueHandle_t *queue) {
+    (void)port;
+    (void)config;
+    (void)queueSize;
+    if (queue) *queue = NULL;
+    return ESP_OK;
+}
+
+esp_err_t i2s_driver_uninstall(i2s_port_t port) {
+    (void)port;
+    return ESP_OK;
+}
+
+esp_err_t i2s_set_pin(i2s_port_t port, const i2s_pin_config_t *pins) {
+    (void)port;
+    (void)pins;
+    return ESP_OK;
+}
+
+esp_err_t i2s_set_sample_rates(i2s_port_t port, uint32_t rate) {
+    (void)port;
+    (void)rate;
+    return ESP_OK;
+}
+
+esp_err_t i2s_zero_dma_buffer(i2s_port_t port) {
+    (void)port;
+    return ESP_OK;
+}
+
+esp_err_t i2s_write(i2s_port_t port, const void *src, size_t size, size_t *written, TickType_t ticks) {
+    (void)port;
+    (void)src;
+    (void)ticks;
+    *written = size;
+    return ESP_OK;
+}
+
+//
+// PCNT
+//
+
+typedef struct _HostCounter {
+    void (*handler)(void *);
+    void *arg;
+    uint32_t status;
+} HostCounter;
+
+static std::mutex counterMutex;
+static HostCounter counters[PCNT_UNIT_MAX];
+
+esp_err_t pcnt_unit_config(const pcnt_config_t *config) {
+    return (config->unit < PCNT_UNIT_MAX) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t pcnt_set_filter_value(pcnt_unit_t unit, uint16_t value) {
+    (void)unit;
+    (void)value;
+    return ESP_OK;
+}
+
+esp_err_t pcnt_filter_enable(pcnt_unit_t unit) {
+    (void)unit;
+    return ESP_OK;
+}
+
+esp_err_t pcnt_event_enable(pcnt_unit_t unit, pcnt_evt_type_t event) {
+    (void)unit;
+    (void)event;
+    return ESP_OK;
+}
+
+esp_err_t pcnt_counter_pause(pcnt_unit_t unit) {
+    (void)unit;
+    return ESP_OK;
+}
+
+esp_err_t pcnt_counter_resume(pcnt_unit_t unit) {
+    (void)unit;
+    return ESP_OK;
+}
+
+esp_err_t pcnt_counter_clear(pcnt_unit_t unit) {
+    (void)unit;
+    return ESP_OK;
+}
+
+esp_err_t pcnt_get_counter_value(pcnt_unit_t unit, int16_t *count) {
+    (void)unit;
+    *count = 0;
+    return ESP_OK;
+}
+
+esp_err_t pcnt_isr_service_install(int flags) {
+    (void)flags;
+    return ESP_OK;
+}
+
+esp_err_t pcnt_isr_handler_add(pcnt_unit_t unit, void (*handler)(void *), void *arg) {
+    if (unit >= PCNT_UNIT_MAX) return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::mutex> lock(counterMutex);
+    counters[unit].handler = handler;
+    counters[unit].arg = arg;
+    return ESP_OK;
+}
+
+esp_err_t pcnt_isr_handler_remove(pcnt_unit_t unit) {
+    if (unit >= PCNT_UNIT_MAX) return ESP_ERR_INVALID_ARG;
+    std::lock_guard<std::mutex> lock(counterMutex);
+    counters[unit].handler = NULL;
+    return ESP_OK;
+}
+
+esp_err_t pcnt_intr_enable(pcnt_unit_t unit) {
+    (void)unit;
+    return ESP_OK;
+}
+
+esp_err_t pcnt_get_event_status(pcnt_unit_t unit, uint32_t *status) {
+    if (unit >= PCNT_UNIT_MAX) return ESP_ERR_INVALID_ARG;
+    *status = counters[unit].status;
+    return ESP_OK;
+}
+
+// Calls the handler like the ISR service would, status is only valid
+// while the handler runs
+void hostTurnEncoder(pcnt_unit_t unit, int direction) {
+    if (unit >= PCNT_UNIT_MAX) return;
+    std::lock_guard<std::mutex> lock(counterMutex);
+    HostCounter *counter = counters + unit;
+    if (counter->handler == NULL) return;
+
+    counter->status = (direction > 0) ? PCNT_EVT_H_LIM : PCNT_EVT_L_LIM;
+    counter->handler(counter->arg);
+    counter->status = 0;
+}
@@ -0,0 +1,82 @@
+#ifndef LITTLESPEAKER_HOST_DRIVER_I2S_H
+#define LITTLESPEAKER_HOST_DRIVER_I2S_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+//
+// I2S driver, samples never reach it on the host. AudioOutputI2S is
+// replaced by AudioOutputHost, see AudioOutputI2S.h.
+//
+
+typedef enum {
+    I2S_NUM_0 = 0,
+    I2S_NUM_1,
+    I2S_NUM_MAX
+} i2s_port_t;
+
+#define I2S_PIN_NO_CHANGE (-1)
+
+typedef struct {
+    int mck_io_num;
+    int bck_io_num;
+    int ws_io_num;
+    int data_out_num;
+    int data_in_num;
+} i2s_pin_config_t;
+
+typedef enum {
+    I2S_MODE_MASTER = 1 << 0,
+    I2S_MODE_SLAVE = 1 << 1,
+    I2S_MODE_TX = 1 << 2,
+    I2S_MODE_RX = 1 << 3
+} i2s_mode_t;
+
+typedef enum {
+    I2S_BITS_PER_SAMPLE_16BIT = 16,
+    I2S_BITS_PER_SAMPLE_32BIT = 32
+} i2s_bits_per_sample_t;
+
+typedef enum {
+    I2S_CHANNEL_FMT_RIGHT_LEFT = 0,
+    I2S_CHANNEL_FMT_ONLY_LEFT = 3
+} i2s_channel_fmt_t;
+
+typedef enum {
+    I2S_COMM_FORMAT_STAND_I2S = 1
+} i2s_comm_format_t;
+
+typedef struct {
+    i2s_mode_t mode;
+    uint32_t sample_rate;
+    i2s_bits_per_sample_t bits_per_sample;
+    i2s_channel_fmt_t channel_format;
+    i2s_comm_format_t communication_format;
+    int intr_alloc_flags;
+    int dma_buf_count;
+    int dma_buf_len;
+    bool use_apll;
+    bool tx_desc_auto_clear;
+    int fixed_mclk;
+} i2s_config_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+esp_err_t i2s_driver_install(i2s_port_t port, const i2s_config_t *config, int queueSize, QueueHandle_t *queue);
+esp_err_t i2s_driver_uninstall(i2s_port_t port);
+esp_err_t i2s_set_pin(i2s_port_t port, const i2s_pin_config_t *pins);
+esp_err_t i2s_set_sample_rates(i2s_port_t port, uint32_t rate);
+esp_err_t i2s_zero_dma_buffer(i2s_port_t port);
+esp_err_t i2s_write(i2s_port_t port, const void *src, size_t size, size_t *written, TickType_t ticks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef LITTLESPEAKER_HOST_ESP_ATTR_H
+#define LITTLESPEAKER_HOST_ESP_ATTR_H
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define RTC_DATA_ATTR
+#define RTC_NOINIT_ATTR
+
+#endif
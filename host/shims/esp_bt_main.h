@@ -0,0 +1,10 @@
+#ifndef LITTLESPEAKER_HOST_ESP_BT_MAIN_H
+#define LITTLESPEAKER_HOST_ESP_BT_MAIN_H
+
+#include "esp_err.h"
+
+// There is no Bluedroid stack on the host, shutting it down always works
+static inline esp_err_t esp_bluedroid_disable(void) { return ESP_OK; }
+static inline esp_err_t esp_bluedroid_deinit(void) { return ESP_OK; }
+
+#endif
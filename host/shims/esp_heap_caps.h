@@ -0,0 +1,50 @@
+#ifndef LITTLESPEAKER_HOST_ESP_HEAP_CAPS_H
+#define LITTLESPEAKER_HOST_ESP_HEAP_CAPS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define MALLOC_CAP_EXEC (1 << 0)
+#define MALLOC_CAP_32BIT (1 << 1)
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_DMA (1 << 3)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+#define MALLOC_CAP_DEFAULT (1 << 12)
+
+typedef void (*esp_alloc_failed_hook_t)(size_t size, uint32_t caps, const char *function_name);
+
+typedef struct {
+    size_t total_free_bytes;
+    size_t total_allocated_bytes;
+    size_t largest_free_block;
+    size_t minimum_free_bytes;
+    size_t allocated_blocks;
+    size_t free_blocks;
+    size_t total_blocks;
+} multi_heap_info_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//
+// The host heap is practically unlimited, so the numbers reported are
+// those of a freshly booted ESP32 without PSRAM. Decisions depending on
+// free memory take the same path as on the device. See hostdevice.h to
+// change them.
+//
+esp_err_t heap_caps_register_failed_alloc_callback(esp_alloc_failed_hook_t callback);
+void *heap_caps_malloc(size_t size, uint32_t caps);
+void heap_caps_free(void *ptr);
+size_t heap_caps_get_free_size(uint32_t caps);
+size_t heap_caps_get_minimum_free_size(uint32_t caps);
+size_t heap_caps_get_largest_free_block(uint32_t caps);
+void heap_caps_get_info(multi_heap_info_t *info, uint32_t caps);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef LITTLESPEAKER_HOST_ESP_LOG_H
+#define LITTLESPEAKER_HOST_ESP_LOG_H
+
+// The vendored A2DP headers log through these, the host drops it
+#define ESP_LOGE(tag, format, ...) ((void)(tag))
+#define ESP_LOGW(tag, format, ...) ((void)(tag))
+#define ESP_LOGI(tag, format, ...) ((void)(tag))
+#define ESP_LOGD(tag, format, ...) ((void)(tag))
+#define ESP_LOGV(tag, format, ...) ((void)(tag))
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef LITTLESPEAKER_HOST_ESP_TIMER_H
+#define LITTLESPEAKER_HOST_ESP_TIMER_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Microseconds since the start of the process
+int64_t esp_timer_get_time(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
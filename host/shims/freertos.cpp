@@ -0,0 +1,492 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/timers.h"
+#include "esp_timer.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+typedef std::chrono::steady_clock Clock;
+
+// Deadline for a FreeRTOS timeout, false if it waits forever
+static bool deadlineFor(TickType_t ticks, Clock::time_point *deadline) {
+    if (ticks == portMAX_DELAY) return false;
+    *deadline = Clock::now() + std::chrono::milliseconds(ticks);
+    return true;
+}
+
+// Waits until the predicate holds or the timeout passes, returns the predicate
+template<typename Predicate>
+static bool waitFor(std::condition_variable &changed, std::unique_lock<std::mutex> &lock, TickType_t ticks, Predicate predicate) {
+    Clock::time_point deadline;
+    if (!deadlineFor(ticks, &deadline)) {
+        changed.wait(lock, predicate);
+        return true;
+    }
+    return changed.wait_until(lock, deadline, predicate);
+}
+
+//
+// Tasks
+//
+
+typedef struct _HostTask {
+    std::string name;
+    BaseType_t core;
+    BaseType_t affinity;
+    UBaseType_t priority;
+    UBaseType_t number;
+    uint32_t stackDepth;
+    clockid_t clock;
+    bool running;
+    std::mutex mutex;
+    std::condition_variable notified;
+    uint32_t notifications;
+} HostTask;
+
+// Thrown by vTaskDelete(NULL) to leave the task function
+struct HostTaskDeleted {};
+
+static const std::thread::id mainThread = std::this_thread::get_id();
+static thread_local HostTask *currentTask = NULL;
+
+// Every task ever made, for the run time stats
+static std::mutex tasksMutex;
+static std::vector<HostTask *> tasks;
+
+static HostTask *makeTask(const char *name, UBaseType_t priority, BaseType_t core, uint32_t stackDepth) {
+    HostTask *task = new HostTask();
+    task->name = name;
+    task->priority = priority;
+    task->core = (core == tskNO_AFFINITY) ? 0 : core;
+    task->affinity = core;
+    task->stackDepth = stackDepth;
+    task->running = false;
+    task->notifications = 0;
+
+    std::lock_guard<std::mutex> lock(tasksMutex);
+    task->number = tasks.size() + 1;
+    tasks.push_back(task);
+    return task;
+}
+
+// Called on the thread of the task
+static void attachTask(HostTask *task) {
+    std::lock_guard<std::mutex> lock(tasksMutex);
+    task->running = (pthread_getcpuclockid(pthread_self(), &task->clock) == 0);
+    currentTask = task;
+}
+
+static void detachTask(HostTask *task) {
+    std::lock_guard<std::mutex> lock(tasksMutex);
+    task->running = false;
+}
+
+// Threads not created through the API, like the one running setup() and loop()
+static HostTask *runningTask() {
+    if (currentTask == NULL) {
+        bool isMain = (std::this_thread::get_id() == mainThread);
+        attachTask(makeTask(isMain ? "loopTask" : "thread", 1, 1, 8192));
+    }
+    return currentTask;
+}
+
+// Shows up in the run time stats before it calls into the API
+static HostTask *const loopTask = runningTask();
+
+static void startTask(HostTask *task, TaskFunction_t code, void *parameters) {
+    std::thread thread([task, code, parameters]() {
+        attachTask(task);
+        try {
+            code(parameters);
+        } catch (HostTaskDeleted &) {
+        }
+        detachTask(task);
+    });
+    thread.detach();
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char *name, uint32_t stackDepth, void *parameters, UBaseType_t priority, TaskHandle_t *created, BaseType_t core) {
+    HostTask *task = makeTask(name, priority, core, stackDepth);
+    if (created) *created = task;
+    startTask(task, code, parameters);
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stackDepth, void *parameters, UBaseType_t priority, TaskHandle_t *created) {
+    return xTaskCreatePinnedToCore(code, name, stackDepth, parameters, priority, created, tskNO_AFFINITY);
+}
+
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t code, const char *name, uint32_t stackDepth, void *parameters, UBaseType_t priority, StackType_t *stack, StaticTask_t *buffer, BaseType_t core) {
+    (void)stack;
+    (void)buffer;
+    TaskHandle_t task = NULL;
+    xTaskCreatePinnedToCore(code, name, stackDepth, parameters, priority, &task, core);
+    return task;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    if ((task == NULL) || (task == currentTask)) {
+        throw HostTaskDeleted();
+    }
+    // A thread can not be stopped from outside, it keeps running
+}
+
+void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return (TickType_t)(esp_timer_get_time() / 1000);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    return runningTask();
+}
+
+const char *pcTaskGetName(TaskHandle_t task) {
+    HostTask *hostTask = task ? reinterpret_cast<HostTask *>(task) : runningTask();
+    return hostTask->name.c_str();
+}
+
+TaskHandle_t xTaskGetHandle(const char *name) {
+    std::lock_guard<std::mutex> lock(tasksMutex);
+    for (HostTask *task : tasks) {
+        if (task->running && (task->name == name)) return task;
+    }
+    return NULL;
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task) {
+    HostTask *hostTask = task ? reinterpret_cast<HostTask *>(task) : runningTask();
+    return hostTask->priority;
+}
+
+BaseType_t xPortGetCoreID(void) {
+    return runningTask()->core;
+}
+
+UBaseType_t uxTaskGetNumberOfTasks(void) {
+    std::lock_guard<std::mutex> lock(tasksMutex);
+    UBaseType_t count = 0;
+    for (HostTask *task : tasks) {
+        if (task->running) count++;
+    }
+    return count;
+}
+
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *states, UBaseType_t size, uint32_t *totalRunTime) {
+    std::lock_guard<std::mutex> lock(tasksMutex);
+    UBaseType_t count = 0;
+
+    for (HostTask *task : tasks) {
+        if (task->running) count++;
+    }
+    if (count > size) return 0;
+
+    count = 0;
+    for (HostTask *task : tasks) {
+        if (!task->running) continue;
+        struct timespec time = { 0, 0 };
+        clock_gettime(task->clock, &time);
+
+        TaskStatus_t *state = states + count++;
+        memset(state, 0, sizeof(TaskStatus_t));
+        state->xHandle = task;
+        state->pcTaskName = task->name.c_str();
+        state->xTaskNumber = task->number;
+        state->eCurrentState = eRunning;
+        state->uxCurrentPriority = task->priority;
+        state->uxBasePriority = task->priority;
+        state->ulRunTimeCounter = (uint32_t)((uint64_t)time.tv_sec * 1000000 + time.tv_nsec / 1000);
+        state->usStackHighWaterMark = task->stackDepth;
+        state->xCoreID = task->affinity;
+    }
+    if (totalRunTime) *totalRunTime = (uint32_t)esp_timer_get_time();
+    return count;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+    HostTask *hostTask = task ? reinterpret_cast<HostTask *>(task) : runningTask();
+    return hostTask->stackDepth;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    HostTask *hostTask = reinterpret_cast<HostTask *>(task);
+    {
+        std::lock_guard<std::mutex> lock(hostTask->mutex);
+        hostTask->notifications++;
+    }
+    hostTask->notified.notify_all();
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks) {
+    HostTask *task = runningTask();
+    std::unique_lock<std::mutex> lock(task->mutex);
+
+    if (!waitFor(task->notified, lock, ticks, [task]() { return task->notifications > 0; })) {
+        return 0;
+    }
+    uint32_t value = task->notifications;
+    task->notifications = clearOnExit ? 0 : value - 1;
+    return value;
+}
+
+//
+// Queues
+//
+
+typedef struct _HostQueue {
+    std::mutex mutex;
+    std::condition_variable changed;
+    size_t itemSize;
+    size_t length;
+    std::deque<std::vector<uint8_t>> items;
+} HostQueue;
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+    HostQueue *queue = new HostQueue();
+    queue->itemSize = itemSize;
+    queue->length = length;
+    return queue;
+}
+
+QueueHandle_t xQueueCreateStatic(UBaseType_t length, UBaseType_t itemSize, uint8_t *storage, StaticQueue_t *buffer) {
+    (void)storage;
+    (void)buffer;
+    return xQueueCreate(length, itemSize);
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+    delete reinterpret_cast<HostQueue *>(queue);
+}
+
+BaseType_t xQueueSend(QueueHandle_t handle, const void *item, TickType_t ticks) {
+    HostQueue *queue = reinterpret_cast<HostQueue *>(handle);
+    std::unique_lock<std::mutex> lock(queue->mutex);
+
+    if (!waitFor(queue->changed, lock, ticks, [queue]() { return queue->items.size() < queue->length; })) {
+        return pdFALSE;
+    }
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(item);
+    queue->items.emplace_back(bytes, bytes + queue->itemSize);
+    lock.unlock();
+    queue->changed.notify_all();
+    return pdTRUE;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken) {
+    if (woken) *woken = pdFALSE;
+    return xQueueSend(queue, item, 0);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t handle, void *item, TickType_t ticks) {
+    HostQueue *queue = reinterpret_cast<HostQueue *>(handle);
+    std::unique_lock<std::mutex> lock(queue->mutex);
+
+    if (!waitFor(queue->changed, lock, ticks, [queue]() { return !queue->items.empty(); })) {
+        return pdFALSE;
+    }
+    memcpy(item, queue->items.front().data(), queue->itemSize);
+    queue->items.pop_front();
+    lock.unlock();
+    queue->changed.notify_all();
+    return pdTRUE;
+}
+
+BaseType_t xQueueReset(QueueHandle_t handle) {
+    HostQueue *queue = reinterpret_cast<HostQueue *>(handle);
+    {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        queue->items.clear();
+    }
+    queue->changed.notify_all();
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t handle) {
+    HostQueue *queue = reinterpret_cast<HostQueue *>(handle);
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    return queue->items.size();
+}
+
+//
+// Semaphores
+//
+
+typedef struct _HostSemaphore {
+    std::mutex mutex;
+    std::condition_variable changed;
+    UBaseType_t count;
+} HostSemaphore;
+
+static SemaphoreHandle_t makeSemaphore(UBaseType_t count) {
+    HostSemaphore *semaphore = new HostSemaphore();
+    semaphore->count = count;
+    return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    return makeSemaphore(1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buffer) {
+    (void)buffer;
+    return makeSemaphore(1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+    return makeSemaphore(0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t *buffer) {
+    (void)buffer;
+    return makeSemaphore(0);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+    delete reinterpret_cast<HostSemaphore *>(semaphore);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t handle, TickType_t ticks) {
+    HostSemaphore *semaphore = reinterpret_cast<HostSemaphore *>(handle);
+    std::unique_lock<std::mutex> lock(semaphore->mutex);
+
+    if (!waitFor(semaphore->changed, lock, ticks, [semaphore]() { return semaphore->count > 0; })) {
+        return pdFALSE;
+    }
+    semaphore->count--;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t handle) {
+    HostSemaphore *semaphore = reinterpret_cast<HostSemaphore *>(handle);
+    {
+        std::lock_guard<std::mutex> lock(semaphore->mutex);
+        if (semaphore->count > 0) return pdFALSE;
+        semaphore->count++;
+    }
+    semaphore->changed.notify_one();
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t *woken) {
+    if (woken) *woken = pdFALSE;
+    return xSemaphoreGive(semaphore);
+}
+
+//
+// Software timers
+//
+
+typedef struct _HostTimer {
+    TimerCallbackFunction_t callback;
+    void *id;
+    TickType_t period;
+    bool autoReload;
+    bool active;
+    Clock::time_point expiry;
+} HostTimer;
+
+static std::mutex timerMutex;
+static std::condition_variable timersChanged;
+static std::vector<HostTimer *> timers;
+static bool timerServiceRunning = false;
+
+static void timerService() {
+    attachTask(makeTask("Tmr Svc", 1, 0, 2048));
+    std::unique_lock<std::mutex> lock(timerMutex);
+
+    while (true) {
+        HostTimer *next = NULL;
+        for (HostTimer *timer : timers) {
+            if (timer->active && ((next == NULL) || (timer->expiry < next->expiry))) next = timer;
+        }
+        if (next == NULL) {
+            timersChanged.wait(lock);
+            continue;
+        }
+        if (Clock::now() < next->expiry) {
+            timersChanged.wait_until(lock, next->expiry);
+            continue;
+        }
+
+        if (next->autoReload) {
+            next->expiry += std::chrono::milliseconds(next->period);
+        } else {
+            next->active = false;
+        }
+        lock.unlock();
+        next->callback(next);
+        lock.lock();
+    }
+}
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t autoReload, void *id, TimerCallbackFunction_t callback) {
+    (void)name;
+    HostTimer *timer = new HostTimer();
+    timer->callback = callback;
+    timer->id = id;
+    timer->period = period;
+    timer->autoReload = autoReload;
+    timer->active = false;
+
+    std::lock_guard<std::mutex> lock(timerMutex);
+    timers.push_back(timer);
+    if (!timerServiceRunning) {
+        std::thread(timerService).detach();
+        timerServiceRunning = true;
+    }
+    return timer;
+}
+
+TimerHandle_t xTimerCreateStatic(const char *name, TickType_t period, UBaseType_t autoReload, void *id, TimerCallbackFunction_t callback, StaticTimer_t *buffer) {
+    (void)buffer;
+    return xTimerCreate(name, period, autoReload, id, callback);
+}
+
+static BaseType_t updateTimer(TimerHandle_t handle, bool active, TickType_t period) {
+    HostTimer *timer = reinterpret_cast<HostTimer *>(handle);
+    {
+        std::lock_guard<std::mutex> lock(timerMutex);
+        timer->period = period;
+        timer->active = active;
+        timer->expiry = Clock::now() + std::chrono::milliseconds(period);
+    }
+    timersChanged.notify_all();
+    return pdPASS;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t ticks) {
+    (void)ticks;
+    return updateTimer(timer, true, reinterpret_cast<HostTimer *>(timer)->period);
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t ticks) {
+    (void)ticks;
+    return updateTimer(timer, false, reinterpret_cast<HostTimer *>(timer)->period);
+}
+
+BaseType_t xTimerReset(TimerHandle_t timer, TickType_t ticks) {
+    return xTimerStart(timer, ticks);
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t ticks) {
+    (void)ticks;
+    return updateTimer(timer, true, period);
+}
+
+void *pvTimerGetTimerID(TimerHandle_t timer) {
+    return reinterpret_cast<HostTimer *>(timer)->id;
+}
@@ -0,0 +1,52 @@
+#ifndef LITTLESPEAKER_HOST_FREERTOS_H
+#define LITTLESPEAKER_HOST_FREERTOS_H
+
+//
+// FreeRTOS API on host threads, see freertos.cpp. One tick is one
+// millisecond like in the Arduino core. Priorities and core affinity are
+// recorded but not enforced, tasks run as plain threads.
+//
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint8_t StackType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+
+#define configTICK_RATE_HZ 1000
+#define configMAX_PRIORITIES 25
+#define portMAX_DELAY ((TickType_t)0xffffffffu)
+#define portTICK_PERIOD_MS 1
+#define portTICK_RATE_MS portTICK_PERIOD_MS
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define tskNO_AFFINITY 0x7fffffff
+#define configMAX_TASK_NAME_LEN 16
+
+// Run time counters are the CPU time of the threads in microseconds, stack
+// use is not measured. Define them as 0 to build without, like the
+// framework does
+#ifndef configUSE_TRACE_FACILITY
+#define configUSE_TRACE_FACILITY 1
+#endif
+#ifndef configGENERATE_RUN_TIME_STATS
+#define configGENERATE_RUN_TIME_STATS 1
+#endif
+#define configTASKLIST_INCLUDE_COREID 1
+
+// Interrupts are simulated by plain calls, there is nothing to yield to
+#define portYIELD_FROM_ISR(...)
+
+// Storage for the static variants is not used, the objects live on the heap
+typedef struct { void *unused; } StaticQueue_t;
+typedef StaticQueue_t StaticSemaphore_t;
+typedef struct { void *unused; } StaticTask_t;
+typedef struct { void *unused; } StaticTimer_t;
+
+#endif
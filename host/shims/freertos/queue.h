@@ -0,0 +1,28 @@
+#ifndef LITTLESPEAKER_HOST_FREERTOS_QUEUE_H
+#define LITTLESPEAKER_HOST_FREERTOS_QUEUE_H
+
+#include "FreeRTOS.h"
+
+typedef void *QueueHandle_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize);
+QueueHandle_t xQueueCreateStatic(UBaseType_t length, UBaseType_t itemSize, uint8_t *storage, StaticQueue_t *buffer);
+void vQueueDelete(QueueHandle_t queue);
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks);
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item, BaseType_t *woken);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks);
+BaseType_t xQueueReset(QueueHandle_t queue);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+
+#define xQueueSendToBack xQueueSend
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
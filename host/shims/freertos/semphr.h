@@ -0,0 +1,28 @@
+#ifndef LITTLESPEAKER_HOST_FREERTOS_SEMPHR_H
+#define LITTLESPEAKER_HOST_FREERTOS_SEMPHR_H
+
+#include "FreeRTOS.h"
+#include "queue.h"
+
+typedef void *SemaphoreHandle_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Mutexes are binary semaphores that start given, there is no priority inheritance
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buffer);
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t *buffer);
+void vSemaphoreDelete(SemaphoreHandle_t semaphore);
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t *woken);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
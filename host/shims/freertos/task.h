@@ -0,0 +1,62 @@
+#ifndef LITTLESPEAKER_HOST_FREERTOS_TASK_H
+#define LITTLESPEAKER_HOST_FREERTOS_TASK_H
+
+#include "FreeRTOS.h"
+
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+typedef enum {
+    eRunning = 0,
+    eReady,
+    eBlocked,
+    eSuspended,
+    eDeleted,
+    eInvalid
+} eTaskState;
+
+typedef struct xTASK_STATUS {
+    TaskHandle_t xHandle;
+    const char *pcTaskName;
+    UBaseType_t xTaskNumber;
+    eTaskState eCurrentState;
+    UBaseType_t uxCurrentPriority;
+    UBaseType_t uxBasePriority;
+    uint32_t ulRunTimeCounter;
+    StackType_t *pxStackBase;
+    uint32_t usStackHighWaterMark;
+    BaseType_t xCoreID;
+} TaskStatus_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stackDepth, void *parameters, UBaseType_t priority, TaskHandle_t *created);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char *name, uint32_t stackDepth, void *parameters, UBaseType_t priority, TaskHandle_t *created, BaseType_t core);
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t code, const char *name, uint32_t stackDepth, void *parameters, UBaseType_t priority, StackType_t *stack, StaticTask_t *buffer, BaseType_t core);
+
+// Only the calling task can really be deleted, other tasks are left running
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+
+TickType_t xTaskGetTickCount(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+const char *pcTaskGetName(TaskHandle_t task);
+TaskHandle_t xTaskGetHandle(const char *name);
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task);
+BaseType_t xPortGetCoreID(void);
+
+// Every task is reported as running, the high water mark is the stack size
+UBaseType_t uxTaskGetNumberOfTasks(void);
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *states, UBaseType_t size, uint32_t *totalRunTime);
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef LITTLESPEAKER_HOST_FREERTOS_TIMERS_H
+#define LITTLESPEAKER_HOST_FREERTOS_TIMERS_H
+
+#include "FreeRTOS.h"
+
+typedef void *TimerHandle_t;
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t timer);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Callbacks run on one timer service thread like the FreeRTOS timer task
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t autoReload, void *id, TimerCallbackFunction_t callback);
+TimerHandle_t xTimerCreateStatic(const char *name, TickType_t period, UBaseType_t autoReload, void *id, TimerCallbackFunction_t callback, StaticTimer_t *buffer);
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t ticks);
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t ticks);
+BaseType_t xTimerReset(TimerHandle_t timer, TickType_t ticks);
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t ticks);
+void *pvTimerGetTimerID(TimerHandle_t timer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,107 @@
+#include <Arduino.h>
+#include "hostdevice.h"
+
+#include <errno.h>
+
+//
+// What the process has allocated, so the heap figures of the shims go
+// down when the firmware allocates. mallinfo() can not be used with
+// glibc, it counts the blocks kept in the per thread caches as used, the
+// allocator functions are wrapped instead.
+//
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void *__libc_valloc(size_t size);
+void *__libc_pvalloc(size_t size);
+void __libc_free(void *ptr);
+}
+
+static size_t inUse = 0;
+
+static void *counted(void *ptr) {
+    if (ptr) __atomic_fetch_add(&inUse, malloc_usable_size(ptr), __ATOMIC_RELAXED);
+    return ptr;
+}
+
+static void uncount(void *ptr) {
+    if (ptr) __atomic_fetch_sub(&inUse, malloc_usable_size(ptr), __ATOMIC_RELAXED);
+}
+
+extern "C" {
+
+void *malloc(size_t size) {
+    return counted(__libc_malloc(size));
+}
+
+void *calloc(size_t count, size_t size) {
+    return counted(__libc_calloc(count, size));
+}
+
+void *realloc(void *ptr, size_t size) {
+    size_t before = ptr ? malloc_usable_size(ptr) : 0;
+    void *result = __libc_realloc(ptr, size);
+
+    // On failure the old block is still there
+    if ((result == NULL) && (size > 0)) return NULL;
+    __atomic_fetch_sub(&inUse, before, __ATOMIC_RELAXED);
+    return counted(result);
+}
+
+void free(void *ptr) {
+    uncount(ptr);
+    __libc_free(ptr);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    return counted(__libc_memalign(alignment, size));
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    return counted(__libc_memalign(alignment, size));
+}
+
+int posix_memalign(void **result, size_t alignment, size_t size) {
+    if ((alignment % sizeof(void *)) || (alignment & (alignment - 1))) return EINVAL;
+    void *ptr = __libc_memalign(alignment, size);
+    if (ptr == NULL) return ENOMEM;
+    *result = counted(ptr);
+    return 0;
+}
+
+void *valloc(size_t size) {
+    return counted(__libc_valloc(size));
+}
+
+void *pvalloc(size_t size) {
+    return counted(__libc_pvalloc(size));
+}
+
+}
+
+size_t hostHeapInUse() {
+    return __atomic_load_n(&inUse, __ATOMIC_RELAXED);
+}
+
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+
+size_t hostHeapInUse() {
+    malloc_statistics_t info;
+    malloc_zone_statistics(NULL, &info);
+    return info.size_in_use;
+}
+
+#else
+
+size_t hostHeapInUse() {
+    return 0;
+}
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef LITTLESPEAKER_HOST_PGMSPACE_H
+#define LITTLESPEAKER_HOST_PGMSPACE_H
+
+// Flash and RAM share one address space on the host
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+#define FPSTR(p) (p)
+
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+#define pgm_read_float(addr) (*(const float *)(addr))
+#define pgm_read_ptr(addr) (*(void * const *)(addr))
+
+#define memcpy_P memcpy
+#define strcpy_P strcpy
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define sprintf_P sprintf
+#define snprintf_P snprintf
+#define vsnprintf_P vsnprintf
+
+#endif
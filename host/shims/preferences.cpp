@@ -0,0 +1,102 @@
+#include <Preferences.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+typedef std::map<std::string, std::vector<uint8_t>> HostNamespace;
+
+static std::mutex storeMutex;
+static std::map<std::string, HostNamespace> store;
+
+bool Preferences::begin(const char *name, bool readOnly) {
+    // NVS namespace names are limited to 15 characters
+    if (strlen(name) > 15) return false;
+    strcpy(this->name, name);
+    this->readOnly = readOnly;
+    return true;
+}
+
+void Preferences::end() {
+    this->name[0] = '\0';
+}
+
+bool Preferences::clear() {
+    if (!this->name[0] || this->readOnly) return false;
+    std::lock_guard<std::mutex> lock(storeMutex);
+    store[this->name].clear();
+    return true;
+}
+
+bool Preferences::remove(const char *key) {
+    if (!this->name[0] || this->readOnly) return false;
+    std::lock_guard<std::mutex> lock(storeMutex);
+    return store[this->name].erase(key) > 0;
+}
+
+bool Preferences::isKey(const char *key) {
+    if (!this->name[0]) return false;
+    std::lock_guard<std::mutex> lock(storeMutex);
+    return store[this->name].count(key) > 0;
+}
+
+size_t Preferences::put(const char *key, const void *value, size_t length) {
+    if (!this->name[0] || this->readOnly) return 0;
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(value);
+    std::lock_guard<std::mutex> lock(storeMutex);
+    store[this->name][key] = std::vector<uint8_t>(bytes, bytes + length);
+    return length;
+}
+
+size_t Preferences::get(const char *key, void *buffer, size_t maxLength) {
+    if (!this->name[0]) return 0;
+    std::lock_guard<std::mutex> lock(storeMutex);
+    HostNamespace &space = store[this->name];
+    HostNamespace::iterator entry = space.find(key);
+    if ((entry == space.end()) || (entry->second.size() > maxLength)) return 0;
+    memcpy(buffer, entry->second.data(), entry->second.size());
+    return entry->second.size();
+}
+
+size_t Preferences::putUChar(const char *key, uint8_t value) {
+    return this->put(key, &value, sizeof(value));
+}
+
+size_t Preferences::putUInt(const char *key, uint32_t value) {
+    return this->put(key, &value, sizeof(value));
+}
+
+size_t Preferences::putString(const char *key, const char *value) {
+    return this->put(key, value, strlen(value) + 1) ? strlen(value) : 0;
+}
+
+size_t Preferences::putBytes(const char *key, const void *value, size_t length) {
+    return this->put(key, value, length);
+}
+
+uint8_t Preferences::getUChar(const char *key, uint8_t defaultValue) {
+    uint8_t value;
+    return (this->get(key, &value, sizeof(value)) == sizeof(value)) ? value : defaultValue;
+}
+
+uint32_t Preferences::getUInt(const char *key, uint32_t defaultValue) {
+    uint32_t value;
+    return (this->get(key, &value, sizeof(value)) == sizeof(value)) ? value : defaultValue;
+}
+
+size_t Preferences::getString(const char *key, char *value, size_t maxLength) {
+    return this->get(key, value, maxLength);
+}
+
+size_t Preferences::getBytesLength(const char *key) {
+    if (!this->name[0]) return 0;
+    std::lock_guard<std::mutex> lock(storeMutex);
+    HostNamespace &space = store[this->name];
+    HostNamespace::iterator entry = space.find(key);
+    return (entry == space.end()) ? 0 : entry->second.size();
+}
+
+size_t Preferences::getBytes(const char *key, void *buffer, size_t maxLength) {
+    return this->get(key, buffer, maxLength);
+}
@@ -0,0 +1,252 @@
+#include <SD.h>
+#include "hostdevice.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+namespace stdfs = std::filesystem;
+
+SPIClass SPI;
+SDFS SD;
+
+static std::string sdRoot = "sd-card";
+
+void hostSetSDRoot(const char *path) {
+    sdRoot = path;
+}
+
+const char *hostGetSDRoot() {
+    return sdRoot.c_str();
+}
+
+// Card paths start with a slash, the host path is relative to the root
+static std::string hostPath(const std::string &path) {
+    return sdRoot + (path.empty() || (path[0] != '/') ? "/" : "") + path;
+}
+
+namespace fs {
+
+class FileImpl {
+    public:
+        FileImpl(const std::string &path, FILE *file) {
+            this->cardPath = path;
+            size_t slash = path.find_last_of('/');
+            this->baseName = (slash == std::string::npos) ? path : path.substr(slash + 1);
+            this->file = file;
+            this->directory = false;
+            this->nextEntry = 0;
+        }
+
+        ~FileImpl() {
+            this->close();
+        }
+
+        void close() {
+            if (this->file) fclose(this->file);
+            this->file = NULL;
+            this->entries.clear();
+        }
+
+        bool isOpen() {
+            return this->file || this->directory;
+        }
+
+        std::string cardPath;
+        std::string baseName;
+        FILE *file;
+        bool directory;
+        std::vector<std::string> entries;
+        size_t nextEntry;
+};
+
+size_t File::write(uint8_t c) {
+    return this->write(&c, 1);
+}
+
+size_t File::write(const uint8_t *buffer, size_t size) {
+    if (!this->impl || !this->impl->file) return 0;
+    return fwrite(buffer, 1, size, this->impl->file);
+}
+
+int File::available() {
+    if (!this->impl || !this->impl->file) return 0;
+    size_t size = this->size();
+    size_t pos = this->position();
+    return (pos < size) ? (int)(size - pos) : 0;
+}
+
+int File::read() {
+    uint8_t c;
+    return (this->read(&c, 1) == 1) ? c : -1;
+}
+
+int File::peek() {
+    if (!this->impl || !this->impl->file) return -1;
+    int c = fgetc(this->impl->file);
+    if (c != EOF) ungetc(c, this->impl->file);
+    return (c == EOF) ? -1 : c;
+}
+
+void File::flush() {
+    if (this->impl && this->impl->file) fflush(this->impl->file);
+}
+
+size_t File::read(uint8_t *buffer, size_t size) {
+    if (!this->impl || !this->impl->file) return 0;
+    return fread(buffer, 1, size, this->impl->file);
+}
+
+bool File::seek(uint32_t pos, SeekMode mode) {
+    if (!this->impl || !this->impl->file) return false;
+    int whence = (mode == SeekSet) ? SEEK_SET : (mode == SeekCur) ? SEEK_CUR : SEEK_END;
+    // Offsets relative to the current position or the end may be negative
+    long offset = (mode == SeekSet) ? (long)pos : (long)(int32_t)pos;
+    return fseek(this->impl->file, offset, whence) == 0;
+}
+
+size_t File::position() const {
+    if (!this->impl || !this->impl->file) return 0;
+    long pos = ftell(this->impl->file);
+    return (pos < 0) ? 0 : (size_t)pos;
+}
+
+size_t File::size() const {
+    if (!this->impl || !this->impl->file) return 0;
+    struct stat info;
+    if (fstat(fileno(this->impl->file), &info) != 0) return 0;
+    return (size_t)info.st_size;
+}
+
+void File::close() {
+    if (this->impl) this->impl->close();
+    this->impl.reset();
+}
+
+File::operator bool() const {
+    return this->impl && this->impl->isOpen();
+}
+
+time_t File::getLastWrite() {
+    if (!this->impl) return 0;
+    struct stat info;
+    if (stat(hostPath(this->impl->cardPath).c_str(), &info) != 0) return 0;
+    return info.st_mtime;
+}
+
+const char *File::path() const {
+    return this->impl ? this->impl->cardPath.c_str() : NULL;
+}
+
+const char *File::name() const {
+    return this->impl ? this->impl->baseName.c_str() : NULL;
+}
+
+bool File::isDirectory() {
+    return this->impl && this->impl->directory;
+}
+
+File File::openNextFile(const char *mode) {
+    if (!this->impl || !this->impl->directory) return File();
+    FileImpl *dir = this->impl.get();
+
+    while (dir->nextEntry < dir->entries.size()) {
+        const std::string &entry = dir->entries[dir->nextEntry++];
+        std::string path = dir->cardPath + ((dir->cardPath == "/") ? "" : "/") + entry;
+        File file = SD.open(path.c_str(), mode);
+        if (file) return file;
+    }
+    return File();
+}
+
+void File::rewindDirectory() {
+    if (this->impl) this->impl->nextEntry = 0;
+}
+
+File FS::open(const char *path, const char *mode, bool create) {
+    std::string host = hostPath(path);
+    std::error_code error;
+
+    if (stdfs::is_directory(host, error)) {
+        FileImplPtr impl = std::make_shared<FileImpl>(path, (FILE *)NULL);
+        impl->directory = true;
+        for (const stdfs::directory_entry &entry : stdfs::directory_iterator(host, error)) {
+            impl->entries.push_back(entry.path().filename().string());
+        }
+        std::sort(impl->entries.begin(), impl->entries.end());
+        return File(impl);
+    }
+
+    if (create && (mode[0] != 'r')) {
+        stdfs::create_directories(stdfs::path(host).parent_path(), error);
+    }
+    const char *hostMode = (mode[0] == 'w') ? "wb" : (mode[0] == 'a') ? "ab" : "rb";
+    FILE *file = fopen(host.c_str(), hostMode);
+    if (file == NULL) return File();
+    return File(std::make_shared<FileImpl>(path, file));
+}
+
+bool FS::exists(const char *path) {
+    std::error_code error;
+    return stdfs::exists(hostPath(path), error);
+}
+
+bool FS::remove(const char *path) {
+    std::error_code error;
+    return stdfs::remove(hostPath(path), error);
+}
+
+bool FS::rename(const char *from, const char *to) {
+    std::error_code error;
+    stdfs::rename(hostPath(from), hostPath(to), error);
+    return !error;
+}
+
+bool FS::mkdir(const char *path) {
+    std::error_code error;
+    return stdfs::create_directory(hostPath(path), error);
+}
+
+bool FS::rmdir(const char *path) {
+    return this->remove(path);
+}
+
+}
+
+bool SDFS::begin(uint8_t ssPin, SPIClass &spi, uint32_t frequency, const char *mountpoint, uint8_t maxFiles, bool formatIfMountFailed) {
+    (void)ssPin;
+    (void)spi;
+    (void)frequency;
+    (void)mountpoint;
+    (void)maxFiles;
+    (void)formatIfMountFailed;
+
+    std::error_code error;
+    if (!stdfs::is_directory(sdRoot, error)) {
+        Serial.printf("SD card directory %s not found\n", sdRoot.c_str());
+        return false;
+    }
+    return true;
+}
+
+sdcard_type_t SDFS::cardType() {
+    std::error_code error;
+    return stdfs::is_directory(sdRoot, error) ? CARD_SDHC : CARD_NONE;
+}
+
+uint64_t SDFS::cardSize() {
+    std::error_code error;
+    return stdfs::space(sdRoot, error).capacity;
+}
+
+uint64_t SDFS::totalBytes() {
+    return this->cardSize();
+}
+
+uint64_t SDFS::usedBytes() {
+    std::error_code error;
+    stdfs::space_info space = stdfs::space(sdRoot, error);
+    return space.capacity - space.free;
+}
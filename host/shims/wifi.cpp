@@ -0,0 +1,128 @@
+#include <WiFi.h>
+
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// How long a connection attempt takes to fail
+#define HOST_WIFI_FAIL_MS 100
+
+WiFiClass WiFi;
+
+typedef struct _HostWifiHandler {
+    wifi_event_id_t id;
+    arduino_event_id_t event;
+    WiFiEventFuncCb callback;
+} HostWifiHandler;
+
+static std::mutex wifiMutex;
+static std::vector<HostWifiHandler> handlers;
+static wifi_event_id_t nextHandlerId = 1;
+static wifi_mode_t wifiMode = WIFI_MODE_NULL;
+static uint32_t wifiAttempt = 0;
+static uint8_t bssid[6] = { 0 };
+
+static void raiseEvent(arduino_event_id_t event, arduino_event_info_t info) {
+    std::vector<HostWifiHandler> current;
+    {
+        std::lock_guard<std::mutex> lock(wifiMutex);
+        current = handlers;
+    }
+    for (const HostWifiHandler &handler : current) {
+        if ((handler.event == ARDUINO_EVENT_MAX) || (handler.event == event)) {
+            handler.callback(event, info);
+        }
+    }
+}
+
+static void raiseDisconnected(uint8_t reason) {
+    arduino_event_info_t info;
+    memset(&info, 0, sizeof(info));
+    info.wifi_sta_disconnected.reason = reason;
+    raiseEvent(ARDUINO_EVENT_WIFI_STA_DISCONNECTED, info);
+}
+
+bool WiFiClass::mode(wifi_mode_t mode) {
+    std::lock_guard<std::mutex> lock(wifiMutex);
+    wifiMode = mode;
+    return true;
+}
+
+wifi_mode_t WiFiClass::getMode() {
+    std::lock_guard<std::mutex> lock(wifiMutex);
+    return wifiMode;
+}
+
+bool WiFiClass::config(IPAddress localIP, IPAddress gateway, IPAddress subnet, IPAddress dns1, IPAddress dns2) {
+    (void)localIP;
+    (void)gateway;
+    (void)subnet;
+    (void)dns1;
+    (void)dns2;
+    return true;
+}
+
+wl_status_t WiFiClass::begin(const char *ssid, const char *password, int32_t channel, const uint8_t *bssid, bool connect) {
+    (void)ssid;
+    (void)password;
+    (void)channel;
+    (void)bssid;
+    if (!connect) return WL_DISCONNECTED;
+
+    uint32_t attempt;
+    {
+        std::lock_guard<std::mutex> lock(wifiMutex);
+        attempt = ++wifiAttempt;
+    }
+    std::thread([attempt]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(HOST_WIFI_FAIL_MS));
+        {
+            // Cancelled by disconnect() or a newer attempt
+            std::lock_guard<std::mutex> lock(wifiMutex);
+            if (attempt != wifiAttempt) return;
+        }
+        raiseDisconnected(WIFI_REASON_NO_AP_FOUND);
+    }).detach();
+    return WL_DISCONNECTED;
+}
+
+bool WiFiClass::disconnect(bool wifiOff, bool eraseAP) {
+    (void)eraseAP;
+    {
+        std::lock_guard<std::mutex> lock(wifiMutex);
+        wifiAttempt++;
+        if (wifiOff) wifiMode = WIFI_MODE_NULL;
+    }
+    return true;
+}
+
+bool WiFiClass::softAPdisconnect(bool wifiOff) {
+    if (wifiOff) this->mode(WIFI_MODE_NULL);
+    return true;
+}
+
+wl_status_t WiFiClass::status() {
+    return WL_DISCONNECTED;
+}
+
+uint8_t *WiFiClass::BSSID() {
+    return bssid;
+}
+
+wifi_event_id_t WiFiClass::onEvent(WiFiEventFuncCb callback, arduino_event_id_t event) {
+    std::lock_guard<std::mutex> lock(wifiMutex);
+    HostWifiHandler handler = { nextHandlerId++, event, callback };
+    handlers.push_back(handler);
+    return handler.id;
+}
+
+void WiFiClass::removeEvent(wifi_event_id_t id) {
+    std::lock_guard<std::mutex> lock(wifiMutex);
+    for (std::vector<HostWifiHandler>::iterator it = handlers.begin(); it != handlers.end(); ++it) {
+        if (it->id == id) {
+            handlers.erase(it);
+            return;
+        }
+    }
+}
@@ -90,8 +90,8 @@ class A2DPDefaultVolumeControl : public A2DPVolumeControl {
         virtual void set_volume(uint8_t volume) override {
             constexpr double base = 1.4;
             constexpr double bits = 12;
-            constexpr double zero_ofs = pow(base, -bits);
-            constexpr double scale = pow(2.0, bits);
+            const double zero_ofs = pow(base, -bits);
+            const double scale = pow(2.0, bits);
             double volumeFactorFloat = (pow(base, volume * bits / 127.0 - bits) - zero_ofs) * scale / (1.0 - zero_ofs);
             volumeFactor = volumeFactorFloat;
             if (volumeFactor > 0x1000) {
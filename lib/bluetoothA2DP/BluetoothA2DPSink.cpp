@@ -1155,21 +1155,15 @@ void BluetoothA2DPSink::app_a2d_callback(esp_a2d_cb_event_t event, esp_a2d_cb_pa
 }
 
 void BluetoothA2DPSink::audio_data_callback(const uint8_t *data, uint32_t len) {
-    ESP_LOGD(BT_AV_TAG, "%s", __func__);
+    // Runs for every packet, nothing is logged here so it never waits for the UART
 
     // swap left and right channels
     if (swap_left_right){
-        Frame *frame = (Frame*)data;
-        for (int i=0; i<len/4; i++) {
-            int16_t temp = frame[i].channel1;
-            frame[i].channel1 = frame[i].channel2;
-            frame[i].channel2 = temp;
-        }
+        swap_left_right_channels((Frame*)data, len/4);
     }
 
     // make data available via callback, before volume control
     if (raw_stream_reader!=nullptr){
-        ESP_LOGD(BT_AV_TAG, "raw_stream_reader");
         (*raw_stream_reader)(data, len, this->callbackContext);
     }
 
@@ -1178,7 +1172,6 @@ void BluetoothA2DPSink::audio_data_callback(const uint8_t *data, uint32_t len) {
 
     // make data available via callback
     if (stream_reader!=nullptr){
-        ESP_LOGD(BT_AV_TAG, "stream_reader");
         (*stream_reader)(data, len, this->callbackContext);
     }
 
@@ -1198,7 +1191,6 @@ void BluetoothA2DPSink::audio_data_callback(const uint8_t *data, uint32_t len) {
 
     // data_received callback
     if (data_received!=nullptr){
-        ESP_LOGD(BT_AV_TAG, "data_received");
            (*data_received)(this->callbackContext);
     }
 }
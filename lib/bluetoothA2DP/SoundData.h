@@ -41,6 +41,17 @@ struct __attribute__((packed)) Frame {
 // support for legacy name;
 using Channels = Frame;
 
+/**
+ * @brief Exchanges the left and right channel of the frames in place
+ */
+inline void swap_left_right_channels(Frame *frames, uint32_t frameCount) {
+  for (uint32_t i=0; i<frameCount; i++) {
+    int16_t temp = frames[i].channel1;
+    frames[i].channel1 = frames[i].channel2;
+    frames[i].channel2 = temp;
+  }
+}
+
 /**
  * @brief Channel Information
  * @author Phil Schatzmann
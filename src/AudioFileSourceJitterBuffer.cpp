@@ -0,0 +1,268 @@
+#include "AudioFileSourceJitterBuffer.h"
+#include "logger.h"
+#include "heapstats.h"
+#include "telemetry.h"
+#include "esp_heap_caps.h"
+
+// A blocking refill gives up when the stream delivers nothing for this long
+#define JITTER_STALL_TIMEOUT_MS 5000
+
+AudioFileSourceJitterBuffer::AudioFileSourceJitterBuffer()
+{
+  src = NULL;
+  buffer = NULL;
+  allocated = 0;
+  external = NULL;
+  externalSize = 0;
+  capacity = 0;
+  readPtr = 0;
+  writePtr = 0;
+  length = 0;
+  watermark = 0;
+  pos = 0;
+  prefilled = false;
+  memset(&ownStats, 0, sizeof(ownStats));
+  stats = &ownStats;
+}
+
+AudioFileSourceJitterBuffer::~AudioFileSourceJitterBuffer()
+{
+  release();
+}
+
+bool AudioFileSourceJitterBuffer::begin(AudioFileSource *src, uint32_t bitrate, JitterBufferStats *stats)
+{
+  this->src = src;
+  this->stats = stats ? stats : &ownStats;
+  memset(this->stats, 0, sizeof(JitterBufferStats));
+  this->stats->bitrate = bitrate ? bitrate : JITTER_DEFAULT_BITRATE;
+
+  readPtr = 0;
+  writePtr = 0;
+  length = 0;
+  pos = 0;
+  prefilled = false;
+
+  if (!resize(JITTER_TARGET_MS)) {
+    this->src = NULL;
+    return false;
+  }
+  return true;
+}
+
+void AudioFileSourceJitterBuffer::release()
+{
+  if (buffer != external) heapFree(buffer);
+  buffer = NULL;
+  allocated = 0;
+  capacity = 0;
+}
+
+void AudioFileSourceJitterBuffer::useMemory(uint8_t *memory, uint32_t size)
+{
+  release();
+  external = memory;
+  externalSize = memory ? size : 0;
+}
+
+uint32_t AudioFileSourceJitterBuffer::bytesForMs(uint32_t ms)
+{
+  // kbit/s * ms / 8 = bytes
+  return (stats->bitrate * ms) / 8;
+}
+
+// Only called while the buffer is empty, so nothing has to be moved
+bool AudioFileSourceJitterBuffer::resize(uint32_t targetMs)
+{
+  uint32_t size = bytesForMs(targetMs);
+  if (size > JITTER_HEAP_BUDGET) size = JITTER_HEAP_BUDGET;
+
+  if (external) {
+    if (size > externalSize) size = externalSize;
+    buffer = external;
+    allocated = externalSize;
+  } else if (size > allocated) {
+    uint32_t previous = allocated;
+    release();
+
+    // Leave enough room in the heap for everything else
+    uint32_t available = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    available = (available > JITTER_HEAP_RESERVE) ? available - JITTER_HEAP_RESERVE : 0;
+    if (size > available) size = (available > previous) ? available : previous;
+
+    if (size) buffer = reinterpret_cast<uint8_t *>(heapAlloc(HeapTagWebradio, size));
+    if (!buffer && previous) {
+      size = previous;
+      buffer = reinterpret_cast<uint8_t *>(heapAlloc(HeapTagWebradio, size));
+    }
+    if (!buffer) {
+      capacity = 0;
+      return false;
+    }
+    allocated = size;
+  }
+
+  capacity = size;
+  watermark = (capacity * JITTER_PREFILL_PERCENT) / 100;
+  readPtr = 0;
+  writePtr = 0;
+  length = 0;
+  updateStats();
+  return true;
+}
+
+void AudioFileSourceJitterBuffer::updateStats()
+{
+  stats->capacity = capacity;
+  stats->fill = length;
+  stats->fillMs = (length * 8) / stats->bitrate;
+  stats->targetMs = (capacity * 8) / stats->bitrate;
+}
+
+bool AudioFileSourceJitterBuffer::fill()
+{
+  if (!src || !buffer) return false;
+
+  while (length < capacity) {
+    uint32_t space = capacity - length;
+    if (space > capacity - writePtr) space = capacity - writePtr;
+
+    uint32_t bytes = src->readNonBlock(buffer + writePtr, space);
+    if (bytes == 0) break;
+
+    writePtr = (writePtr + bytes) % capacity;
+    length += bytes;
+  }
+
+  if (!prefilled && (length >= watermark)) {
+    prefilled = true;
+  }
+  updateStats();
+  return prefilled;
+}
+
+bool AudioFileSourceJitterBuffer::isPrefilled()
+{
+  return prefilled;
+}
+
+const uint8_t *AudioFileSourceJitterBuffer::peek(uint32_t *len)
+{
+  if (!buffer) {
+    *len = 0;
+    return NULL;
+  }
+
+  *len = length;
+  if (*len > capacity - readPtr) *len = capacity - readPtr;
+  return buffer + readPtr;
+}
+
+uint32_t AudioFileSourceJitterBuffer::readFromBuffer(uint8_t *data, uint32_t len)
+{
+  uint32_t bytes = 0;
+
+  while ((len > 0) && (length > 0)) {
+    uint32_t chunk = length;
+    if (chunk > capacity - readPtr) chunk = capacity - readPtr;
+    if (chunk > len) chunk = len;
+
+    memcpy(data, buffer + readPtr, chunk);
+    readPtr = (readPtr + chunk) % capacity;
+    length -= chunk;
+    data += chunk;
+    len -= chunk;
+    bytes += chunk;
+  }
+  return bytes;
+}
+
+uint32_t AudioFileSourceJitterBuffer::read(void *data, uint32_t len)
+{
+  if (!src) return 0;
+  if (!buffer) return src->read(data, len);
+
+  telemetryRecord(TelemetryStreamFill, (uint32_t)((uint64_t)length * 100 / capacity));
+
+  uint8_t *ptr = reinterpret_cast<uint8_t *>(data);
+  uint32_t bytes = readFromBuffer(ptr, len);
+
+  if (bytes < len) {
+    // Ran empty, a short read would end the decoder so wait for data
+    if (prefilled) {
+      prefilled = false;
+      stats->underruns++;
+      telemetryCount(TelemetryStreamUnderruns);
+      uint32_t previous = capacity;
+      if ((stats->targetMs < JITTER_MAX_MS) && resize(stats->targetMs + JITTER_GROW_MS) && (capacity > previous)) {
+        stats->grows++;
+      }
+      LOGW(LogModuleStream, "Jitter buffer underrun %u, refilling %u ms", stats->underruns, stats->targetMs);
+    }
+    if (!buffer) {
+      // Lost the memory while resizing, continue unbuffered
+      return bytes + src->read(ptr + bytes, len - bytes);
+    }
+
+    uint32_t lastData = millis();
+    while (!fill()) {
+      uint32_t space = capacity - length;
+      if (space > capacity - writePtr) space = capacity - writePtr;
+
+      uint32_t got = src->read(buffer + writePtr, space);
+      if (got > 0) {
+        writePtr = (writePtr + got) % capacity;
+        length += got;
+        lastData = millis();
+      } else if (!src->isOpen() || (millis() - lastData > JITTER_STALL_TIMEOUT_MS)) {
+        break; // Stream is gone, hand out what is left
+      }
+    }
+    bytes += readFromBuffer(ptr + bytes, len - bytes);
+  }
+
+  updateStats();
+  pos += bytes;
+  return bytes;
+}
+
+bool AudioFileSourceJitterBuffer::seek(int32_t pos, int dir)
+{
+  (void) pos;
+  (void) dir;
+  return false;
+}
+
+bool AudioFileSourceJitterBuffer::close()
+{
+  // The source is closed by its owner, the memory is kept for the next stream
+  src = NULL;
+  readPtr = 0;
+  writePtr = 0;
+  length = 0;
+  prefilled = false;
+  return true;
+}
+
+bool AudioFileSourceJitterBuffer::isOpen()
+{
+  return src ? src->isOpen() : false;
+}
+
+uint32_t AudioFileSourceJitterBuffer::getSize()
+{
+  return src ? src->getSize() : 0;
+}
+
+uint32_t AudioFileSourceJitterBuffer::getPos()
+{
+  return pos;
+}
+
+bool AudioFileSourceJitterBuffer::loop()
+{
+  if (!src) return false;
+  if (!src->loop()) return false;
+  fill();
+  return true;
+}
@@ -0,0 +1,96 @@
+#ifndef LITTLESPEAKER_AUDIOFILESOURCEJITTERBUFFER_H
+#define LITTLESPEAKER_AUDIOFILESOURCEJITTERBUFFER_H
+
+#include "AudioFileSource.h"
+
+// Buffered audio in milliseconds, the buffer holds the target amount
+// and playback starts when the prefill part of it is available
+#define JITTER_TARGET_MS 1500
+#define JITTER_PREFILL_PERCENT 75
+
+// After an underrun the target grows by this much up to the maximum
+#define JITTER_GROW_MS 500
+#define JITTER_MAX_MS 4000
+
+// Bytes the buffer may use at most and bytes that have to stay free
+// in the largest heap block for everything else (decoder, WiFi, ...)
+#define JITTER_HEAP_BUDGET (48 * 1024)
+#define JITTER_HEAP_RESERVE (24 * 1024)
+
+// Assumed if the stream does not send an icy-br header
+#define JITTER_DEFAULT_BITRATE 128
+
+typedef struct _JitterBufferStats {
+    uint32_t bitrate;       // kbit/s
+    uint32_t capacity;      // bytes
+    uint32_t fill;          // bytes
+    uint32_t fillMs;
+    uint32_t targetMs;
+    uint32_t underruns;
+    uint32_t grows;
+} JitterBufferStats;
+
+//
+// Ring buffer in front of a network stream. The size is derived from the
+// stream bitrate and a target duration instead of a fixed byte count.
+// The buffer is topped up without blocking from loop(), only when it
+// runs empty a read blocks until the prefill watermark is reached again.
+// Every underrun grows the target, as far as the heap budget allows.
+//
+// The object is meant to be reused, the buffer memory is kept between
+// streams until release() is called. Alternatively it can be given a fixed
+// block of memory, the target then never grows beyond that block.
+//
+class AudioFileSourceJitterBuffer : public AudioFileSource
+{
+  public:
+    AudioFileSourceJitterBuffer();
+    virtual ~AudioFileSourceJitterBuffer() override;
+
+    bool begin(AudioFileSource *src, uint32_t bitrate, JitterBufferStats *stats = NULL);
+    void release();
+
+    // Memory owned by someone else, NULL to allocate from the heap again.
+    // Only while no stream is buffered.
+    void useMemory(uint8_t *memory, uint32_t size);
+
+    virtual uint32_t read(void *data, uint32_t len) override;
+    virtual bool seek(int32_t pos, int dir) override;
+    virtual bool close() override;
+    virtual bool isOpen() override;
+    virtual uint32_t getSize() override;
+    virtual uint32_t getPos() override;
+    virtual bool loop() override;
+
+    // Non-blocking top up, returns true when enough data to start playback
+    bool fill();
+    bool isPrefilled();
+
+    // Buffered data that has not been read yet, without consuming it. Only
+    // the contiguous part up to the end of the ring is returned.
+    const uint8_t *peek(uint32_t *len);
+
+  private:
+    bool resize(uint32_t targetMs);
+    uint32_t bytesForMs(uint32_t ms);
+    uint32_t readFromBuffer(uint8_t *data, uint32_t len);
+    void updateStats();
+
+    AudioFileSource *src;
+    uint8_t *buffer;
+    uint32_t allocated;
+    uint8_t *external;
+    uint32_t externalSize;
+    uint32_t capacity;
+    uint32_t readPtr;
+    uint32_t writePtr;
+    uint32_t length;
+    uint32_t watermark;
+    uint32_t pos;
+    bool prefilled;
+
+    JitterBufferStats ownStats;
+    JitterBufferStats *stats;
+};
+
+#endif
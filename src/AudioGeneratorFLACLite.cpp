@@ -0,0 +1,542 @@
+#include "AudioGeneratorFLACLite.h"
+#include "arena.h"
+#include "logger.h"
+
+#define FLAC_METADATA_STREAMINFO 0
+#define FLAC_METADATA_SEEKTABLE 3
+
+static const uint8_t sampleSizes[8] = { 0, 8, 12, 0, 16, 20, 24, 0 };
+
+AudioGeneratorFLACLite::AudioGeneratorFLACLite()
+{
+  running = false;
+  file = NULL;
+  output = NULL;
+  samples = NULL;
+  allocated = 0;
+  numSeekPoints = 0;
+  pending = false;
+  resetBits();
+}
+
+AudioGeneratorFLACLite::~AudioGeneratorFLACLite()
+{
+  if (allocated) free(samples);
+}
+
+bool AudioGeneratorFLACLite::begin(AudioFileSource *source, AudioOutput *output)
+{
+  if (!source || !output) return false;
+  file = source;
+  this->output = output;
+  if (!file->isOpen()) return false;
+
+  resetBits();
+  if (!readMetadata()) return false;
+
+  // The arena of the mode comes first, an own buffer is kept when the
+  // decoder is reused for the next file and it fits
+  uint32_t needed = maxBlocksize * channels;
+  uint32_t regionSize;
+  int32_t *region = reinterpret_cast<int32_t *>(getArenaRegion(ArenaRegionDecoder, &regionSize));
+  if (region && (regionSize >= sizeof(int32_t) * needed)) {
+    if (allocated) free(samples);
+    samples = region;
+    allocated = 0;
+  } else if (needed > allocated) {
+    if (allocated) free(samples);
+    samples = reinterpret_cast<int32_t *>(malloc(sizeof(int32_t) * needed));
+    allocated = samples ? needed : 0;
+  }
+  if (!samples) {
+    LOGE(LogModuleCodec, "FLAC: no memory for %u samples", needed);
+    return false;
+  }
+
+  frameSize = 0;
+  framePos = 0;
+  frameStart = 0;
+  pending = false;
+  decodedSamples = 0;
+  decodeUs = 0;
+
+  // Mono is sent as stereo, the output chain always gets two channels
+  output->SetRate(sampleRate);
+  output->SetBitsPerSample(16);
+  output->SetChannels(2);
+  if (!output->begin()) return false;
+
+  running = true;
+  return true;
+}
+
+//
+// Metadata
+//
+
+bool AudioGeneratorFLACLite::readMetadata()
+{
+  if (readBits(32) != 0x664c6143) return false;   // "fLaC"
+
+  bool haveInfo = false;
+  bool last = false;
+  numSeekPoints = 0;
+  while (!last) {
+    last = readBits(1);
+    uint8_t type = readBits(7);
+    uint32_t length = readBits(24);
+    if (eof) return false;
+
+    if (type == FLAC_METADATA_STREAMINFO) {
+      readBits(16);                         // min blocksize
+      maxBlocksize = readBits(16);
+      readBits(24);                         // min frame size
+      readBits(24);                         // max frame size
+      sampleRate = readBits(20);
+      channels = readBits(3) + 1;
+      bitsPerSample = readBits(5) + 1;
+      totalSamples = ((uint64_t)readBits(4) << 32) | readBits(32);
+      for (int i = 0; i < 4; i++) readBits(32);     // MD5
+      length -= 34;
+      haveInfo = true;
+    } else if (type == FLAC_METADATA_SEEKTABLE) {
+      uint32_t count = length / 18;
+      uint32_t step = (count + FLAC_MAX_SEEKPOINTS - 1) / FLAC_MAX_SEEKPOINTS;
+      for (uint32_t i = 0; i < count; i++) {
+        uint64_t sample = ((uint64_t)readBits(32) << 32) | readBits(32);
+        uint64_t offset = ((uint64_t)readBits(32) << 32) | readBits(32);
+        readBits(16);
+        // Placeholders are all ones, offsets beyond 4 GB are of no use here
+        if ((i % step) || (sample >> 32) || (offset >> 32) || (numSeekPoints >= FLAC_MAX_SEEKPOINTS)) continue;
+        seekPoints[numSeekPoints].sample = sample;
+        seekPoints[numSeekPoints].offset = offset;
+        numSeekPoints++;
+      }
+      length -= count * 18;
+    }
+    while (length--) readBits(8);
+  }
+  if (eof || !haveInfo) return false;
+
+  // The bit reader is byte aligned here, the audio starts at the current
+  // file position minus what is still buffered
+  audioStart = file->getPos() - (inputLen - inputPos) - cacheBits / 8;
+
+  if ((maxBlocksize == 0) || (maxBlocksize > FLAC_MAX_BLOCKSIZE) || (channels > 2) || (bitsPerSample < 8) || (bitsPerSample > 24)) {
+    LOGW(LogModuleCodec, "FLAC: unsupported stream, blocksize %u, %u channels, %u bit", maxBlocksize, channels, bitsPerSample);
+    return false;
+  }
+  LOGI(LogModuleCodec, "FLAC %u Hz, %u bit, %u channels, blocksize %u, %u seek points", sampleRate, bitsPerSample, channels, maxBlocksize, numSeekPoints);
+  return true;
+}
+
+//
+// Frames
+//
+
+bool AudioGeneratorFLACLite::decodeFrame()
+{
+  uint8_t strategy;
+
+  while (true) {
+    if (!findSync(&strategy)) return false;
+
+    uint8_t blocksizeCode = readBits(4);
+    uint8_t rateCode = readBits(4);
+    uint8_t assignment = readBits(4);
+    uint8_t sizeCode = readBits(3);
+    readBits(1);
+
+    // Frame or sample number, UTF-8 style coded
+    uint64_t number = readBits(8);
+    uint8_t extra = 0;
+    if (number & 0x80) {
+      uint8_t mask = 0x40;
+      while ((number & mask) && (extra < 6)) {
+        extra++;
+        mask >>= 1;
+      }
+      number &= mask - 1;
+      for (uint8_t i = 0; i < extra; i++) {
+        number = (number << 6) | (readBits(8) & 0x3f);
+      }
+    }
+
+    uint32_t blocksize = 0;
+    if (blocksizeCode == 1) blocksize = 192;
+    else if ((blocksizeCode >= 2) && (blocksizeCode <= 5)) blocksize = 576 << (blocksizeCode - 2);
+    else if (blocksizeCode == 6) blocksize = readBits(8) + 1;
+    else if (blocksizeCode == 7) blocksize = readBits(16) + 1;
+    else if (blocksizeCode >= 8) blocksize = 256 << (blocksizeCode - 8);
+
+    if (rateCode == 12) readBits(8);
+    else if ((rateCode == 13) || (rateCode == 14)) readBits(16);
+    readBits(8);    // CRC-8
+
+    uint8_t bps = sizeCode ? sampleSizes[sizeCode] : bitsPerSample;
+    uint8_t frameChannels = (assignment < 8) ? assignment + 1 : 2;
+    if (eof) return false;
+    if ((blocksize == 0) || (blocksize > maxBlocksize) || (bps == 0) || (rateCode == 15) || (assignment > 10) || (frameChannels != channels)) {
+      // Not a frame header after all, search on
+      continue;
+    }
+
+    uint32_t start = micros();
+    int32_t *left = samples;
+    int32_t *right = samples + maxBlocksize;
+    bool ok = true;
+    for (uint8_t c = 0; ok && (c < channels); c++) {
+      // The side channel needs one more bit
+      uint8_t channelBps = bps;
+      if (((assignment == 8) || (assignment == 10)) && (c == 1)) channelBps++;
+      if ((assignment == 9) && (c == 0)) channelBps++;
+      ok = decodeSubframe(samples + c * maxBlocksize, blocksize, channelBps);
+    }
+    if (!ok) {
+      if (eof) return false;
+      continue;
+    }
+
+    switch (assignment) {
+      case 8:     // left, side
+        for (uint32_t i = 0; i < blocksize; i++) right[i] = left[i] - right[i];
+        break;
+      case 9:     // side, right
+        for (uint32_t i = 0; i < blocksize; i++) left[i] += right[i];
+        break;
+      case 10:    // mid, side
+        for (uint32_t i = 0; i < blocksize; i++) {
+          int32_t side = right[i];
+          int32_t mid = ((uint32_t)left[i] << 1) | (side & 1);
+          left[i] = (mid + side) >> 1;
+          right[i] = (mid - side) >> 1;
+        }
+        break;
+    }
+
+    alignToByte();
+    readBits(16);   // CRC-16
+    decodeUs += micros() - start;
+    decodedSamples += blocksize;
+
+    frameStart = strategy ? number : number * maxBlocksize;
+    frameSize = blocksize;
+    frameBps = bps;
+    framePos = 0;
+    return true;
+  }
+}
+
+bool AudioGeneratorFLACLite::decodeSubframe(int32_t *out, uint32_t blocksize, uint8_t bps)
+{
+  int32_t coefs[32];
+
+  if (readBits(1)) return false;
+  uint8_t type = readBits(6);
+  uint8_t wasted = 0;
+  if (readBits(1)) {
+    wasted = readUnary() + 1;
+    if (wasted >= bps) return false;
+    bps -= wasted;
+  }
+
+  if (type == 0) {
+    int32_t value = readSigned(bps);
+    for (uint32_t i = 0; i < blocksize; i++) out[i] = value;
+  } else if (type == 1) {
+    for (uint32_t i = 0; i < blocksize; i++) out[i] = readSigned(bps);
+  } else if ((type >= 8) && (type <= 12)) {
+    uint8_t order = type - 8;
+    if (order > blocksize) return false;
+    for (uint8_t i = 0; i < order; i++) out[i] = readSigned(bps);
+    if (!decodeResidual(out, blocksize, order)) return false;
+    restoreFixed(out, blocksize, order);
+  } else if (type >= 32) {
+    uint8_t order = type - 31;
+    if (order > blocksize) return false;
+    for (uint8_t i = 0; i < order; i++) out[i] = readSigned(bps);
+    uint8_t precision = readBits(4) + 1;
+    if (precision == 16) return false;
+    int8_t shift = readSigned(5);
+    if (shift < 0) return false;
+    for (uint8_t i = 0; i < order; i++) coefs[i] = readSigned(precision);
+    if (!decodeResidual(out, blocksize, order)) return false;
+    restoreLPC(out, blocksize, order, coefs, precision, shift, bps);
+  } else {
+    return false;
+  }
+  if (eof) return false;
+
+  if (wasted) {
+    for (uint32_t i = 0; i < blocksize; i++) out[i] <<= wasted;
+  }
+  return true;
+}
+
+// Rice coded residual, written behind the warmup samples
+bool AudioGeneratorFLACLite::decodeResidual(int32_t *residual, uint32_t blocksize, uint8_t order)
+{
+  uint8_t method = readBits(2);
+  if (method > 1) return false;
+  uint8_t paramBits = method ? 5 : 4;
+  uint8_t escape = method ? 31 : 15;
+
+  uint8_t partitionOrder = readBits(4);
+  uint32_t partitionSize = blocksize >> partitionOrder;
+  if ((partitionSize << partitionOrder != blocksize) || (partitionSize < order)) return false;
+
+  uint32_t i = order;
+  for (uint32_t p = 0; p < (1u << partitionOrder); p++) {
+    uint32_t end = (p + 1) * partitionSize;
+    uint8_t k = readBits(paramBits);
+
+    if (k == escape) {
+      uint8_t bits = readBits(5);
+      for (; i < end; i++) residual[i] = bits ? readSigned(bits) : 0;
+    } else {
+      for (; i < end; i++) {
+        uint32_t value = (readUnary() << k) | readBits(k);
+        residual[i] = (value >> 1) ^ -(int32_t)(value & 1);
+      }
+    }
+    if (eof) return false;
+  }
+  return true;
+}
+
+void AudioGeneratorFLACLite::restoreFixed(int32_t *x, uint32_t blocksize, uint8_t order)
+{
+  switch (order) {
+    case 1:
+      for (uint32_t i = 1; i < blocksize; i++) x[i] += x[i - 1];
+      break;
+    case 2:
+      for (uint32_t i = 2; i < blocksize; i++) x[i] += 2 * x[i - 1] - x[i - 2];
+      break;
+    case 3:
+      for (uint32_t i = 3; i < blocksize; i++) x[i] += 3 * (x[i - 1] - x[i - 2]) + x[i - 3];
+      break;
+    case 4:
+      for (uint32_t i = 4; i < blocksize; i++) x[i] += 4 * (x[i - 1] + x[i - 3]) - 6 * x[i - 2] - x[i - 4];
+      break;
+  }
+}
+
+void AudioGeneratorFLACLite::restoreLPC(int32_t *x, uint32_t blocksize, uint8_t order, const int32_t *coefs, uint8_t precision, int8_t shift, uint8_t bps)
+{
+  uint8_t orderBits = 0;
+  while ((2u << orderBits) <= order) orderBits++;
+
+  if (bps + precision + orderBits <= 32) {
+    // Fits the 32 bit accumulator, true for all usual 16 bit encodings
+    for (uint32_t i = order; i < blocksize; i++) {
+      int32_t sum = 0;
+      for (uint8_t j = 0; j < order; j++) sum += coefs[j] * x[i - 1 - j];
+      x[i] += sum >> shift;
+    }
+  } else {
+    for (uint32_t i = order; i < blocksize; i++) {
+      int64_t sum = 0;
+      for (uint8_t j = 0; j < order; j++) sum += (int64_t)coefs[j] * x[i - 1 - j];
+      x[i] += (int32_t)(sum >> shift);
+    }
+  }
+}
+
+//
+// Playback
+//
+
+bool AudioGeneratorFLACLite::nextSample(int16_t sample[2])
+{
+  if ((framePos >= frameSize) && !decodeFrame()) return false;
+
+  int32_t left = samples[framePos];
+  int32_t right = samples[(channels - 1) * maxBlocksize + framePos];
+  if (frameBps > 16) {
+    left >>= frameBps - 16;
+    right >>= frameBps - 16;
+  } else if (frameBps < 16) {
+    left <<= 16 - frameBps;
+    right <<= 16 - frameBps;
+  }
+  sample[0] = left;
+  sample[1] = right;
+  framePos++;
+  return true;
+}
+
+bool AudioGeneratorFLACLite::loop()
+{
+  if (!running) goto done;
+
+  // The output was full the last time, hand over the sample that was left
+  if (pending) {
+    if (!output->ConsumeSample(lastSample)) goto done;
+    pending = false;
+  }
+
+  while (nextSample(lastSample)) {
+    if (!output->ConsumeSample(lastSample)) {
+      pending = true;
+      goto done;
+    }
+  }
+  stop();
+
+done:
+  file->loop();
+  output->loop();
+  return running;
+}
+
+bool AudioGeneratorFLACLite::seekTo(uint32_t ms)
+{
+  if (!running || (numSeekPoints == 0)) return false;
+
+  uint64_t target = ((uint64_t)ms * sampleRate) / 1000;
+  if (totalSamples && (target >= totalSamples)) return false;
+
+  uint8_t point = 0;
+  for (uint8_t i = 1; i < numSeekPoints; i++) {
+    if (seekPoints[i].sample <= target) point = i;
+  }
+  if (!file->seek(audioStart + seekPoints[point].offset, SEEK_SET)) return false;
+  resetBits();
+  pending = false;
+
+  // Decode up to the frame holding the target sample
+  do {
+    if (!decodeFrame()) {
+      stop();
+      return false;
+    }
+  } while (frameStart + frameSize <= target);
+  framePos = (target > frameStart) ? target - frameStart : 0;
+  return true;
+}
+
+bool AudioGeneratorFLACLite::stop()
+{
+  if (running && decodedSamples && sampleRate) {
+    uint32_t audioMs = (decodedSamples * 1000) / sampleRate;
+    uint32_t load = audioMs ? (decodeUs / 10) / audioMs : 0;
+    LOGI(LogModuleCodec, "FLAC: %u ms of audio decoded in %u ms, %u%% of one core%s",
+      audioMs, (uint32_t)(decodeUs / 1000), load, (load < 100) ? "" : ", NOT realtime");
+  }
+  running = false;
+  pending = false;
+  output->stop();
+  return file->close();
+}
+
+bool AudioGeneratorFLACLite::isRunning()
+{
+  return running;
+}
+
+//
+// Bit reader
+//
+
+void AudioGeneratorFLACLite::resetBits()
+{
+  inputPos = 0;
+  inputLen = 0;
+  cache = 0;
+  cacheBits = 0;
+  eof = false;
+}
+
+bool AudioGeneratorFLACLite::refill()
+{
+  while (cacheBits <= 56) {
+    if (inputPos >= inputLen) {
+      inputLen = file->read(input, FLAC_INPUT_SIZE);
+      inputPos = 0;
+      if (inputLen == 0) return cacheBits > 0;
+    }
+    cache |= (uint64_t)input[inputPos++] << (56 - cacheBits);
+    cacheBits += 8;
+  }
+  return true;
+}
+
+uint32_t AudioGeneratorFLACLite::readBits(uint8_t n)
+{
+  if (n == 0) return 0;
+  if (cacheBits < n) {
+    refill();
+    if (cacheBits < n) {
+      eof = true;
+      cache = 0;
+      cacheBits = 0;
+      return 0;
+    }
+  }
+  uint32_t value = cache >> (64 - n);
+  cache <<= n;
+  cacheBits -= n;
+  return value;
+}
+
+int32_t AudioGeneratorFLACLite::readSigned(uint8_t n)
+{
+  if (n == 0) return 0;
+  uint32_t value = readBits(n);
+  return (int32_t)(value << (32 - n)) >> (32 - n);
+}
+
+uint32_t AudioGeneratorFLACLite::readUnary()
+{
+  uint32_t count = 0;
+
+  while (true) {
+    if (cacheBits == 0) {
+      refill();
+      if (cacheBits == 0) {
+        eof = true;
+        return 0;
+      }
+    }
+    if (cache == 0) {
+      // Only zeros in the cache
+      count += cacheBits;
+      cacheBits = 0;
+      continue;
+    }
+    uint8_t zeros = __builtin_clzll(cache);
+    if (zeros >= cacheBits) {
+      count += cacheBits;
+      cache = 0;
+      cacheBits = 0;
+      continue;
+    }
+    cache <<= zeros + 1;
+    cacheBits -= zeros + 1;
+    return count + zeros;
+  }
+}
+
+void AudioGeneratorFLACLite::alignToByte()
+{
+  readBits(cacheBits & 7);
+}
+
+bool AudioGeneratorFLACLite::findSync(uint8_t *strategy)
+{
+  alignToByte();
+  uint32_t byte = readBits(8);
+  while (!eof) {
+    if (byte != 0xff) {
+      byte = readBits(8);
+      continue;
+    }
+    byte = readBits(8);
+    if ((byte & 0xfe) == 0xf8) {
+      *strategy = byte & 0x01;
+      return true;
+    }
+  }
+  return false;
+}
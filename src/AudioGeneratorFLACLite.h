@@ -0,0 +1,96 @@
+#ifndef LITTLESPEAKER_AUDIOGENERATORFLACLITE_H
+#define LITTLESPEAKER_AUDIOGENERATORFLACLITE_H
+
+#include "AudioGenerator.h"
+
+// Largest block size accepted, the sample buffer is sized from STREAMINFO
+// (4096 stereo = 32 KB), anything larger is refused instead of allocated
+#define FLAC_MAX_BLOCKSIZE 4608
+
+// Largest sample buffer, taken from the decoder region of the memory arena
+// if the mode has one
+#define FLAC_SAMPLE_BUFFER_SIZE (FLAC_MAX_BLOCKSIZE * 2 * sizeof(int32_t))
+
+// File data is read in chunks of this size
+#define FLAC_INPUT_SIZE 1024
+
+// SEEKTABLE entries kept, larger tables are thinned out evenly
+#define FLAC_MAX_SEEKPOINTS 64
+
+typedef struct _FLACSeekPoint {
+  uint32_t sample;    // First sample of the target frame
+  uint32_t offset;    // Bytes from the first frame
+} FLACSeekPoint;
+
+//
+// Streaming FLAC decoder for files, integer arithmetic only. One frame is
+// decoded at a time into a buffer bounded by FLAC_MAX_BLOCKSIZE, the file
+// itself is read through a small input buffer. CRCs are not checked, a
+// broken frame is skipped by searching the next frame sync.
+//
+// The time spent decoding is measured, at the end of a track the share of
+// one core needed for realtime playback is printed.
+//
+class AudioGeneratorFLACLite : public AudioGenerator
+{
+  public:
+    AudioGeneratorFLACLite();
+    virtual ~AudioGeneratorFLACLite() override;
+
+    virtual bool begin(AudioFileSource *source, AudioOutput *output) override;
+    virtual bool loop() override;
+    virtual bool stop() override;
+    virtual bool isRunning() override;
+
+    // Only possible if the file has a SEEKTABLE
+    bool seekTo(uint32_t ms);
+
+  private:
+    bool readMetadata();
+    bool decodeFrame();
+    bool decodeSubframe(int32_t *samples, uint32_t blocksize, uint8_t bps);
+    bool decodeResidual(int32_t *residual, uint32_t blocksize, uint8_t order);
+    void restoreFixed(int32_t *samples, uint32_t blocksize, uint8_t order);
+    void restoreLPC(int32_t *samples, uint32_t blocksize, uint8_t order, const int32_t *coefs, uint8_t precision, int8_t shift, uint8_t bps);
+    bool nextSample(int16_t sample[2]);
+
+    // Bit reader, MSB first
+    void resetBits();
+    bool refill();
+    uint32_t readBits(uint8_t n);
+    int32_t readSigned(uint8_t n);
+    uint32_t readUnary();
+    void alignToByte();
+    bool findSync(uint8_t *strategy);
+
+    // STREAMINFO
+    uint16_t maxBlocksize;
+    uint32_t sampleRate;
+    uint8_t channels;
+    uint8_t bitsPerSample;
+    uint64_t totalSamples;
+
+    FLACSeekPoint seekPoints[FLAC_MAX_SEEKPOINTS];
+    uint8_t numSeekPoints;
+    uint32_t audioStart;
+
+    int32_t *samples;   // channels * maxBlocksize
+    uint32_t allocated; // Owned by the decoder, 0 if samples is in the arena
+    uint32_t frameSize;
+    uint32_t framePos;
+    uint64_t frameStart;
+    uint8_t frameBps;
+    bool pending;
+
+    uint8_t input[FLAC_INPUT_SIZE];
+    uint32_t inputPos;
+    uint32_t inputLen;
+    uint64_t cache;
+    uint8_t cacheBits;
+    bool eof;
+
+    uint64_t decodedSamples;
+    uint64_t decodeUs;
+};
+
+#endif
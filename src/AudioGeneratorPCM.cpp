@@ -0,0 +1,246 @@
+#include "AudioGeneratorPCM.h"
+#include "logger.h"
+
+static const int16_t stepTable[89] = {
+  7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+  50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+  253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+  1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+  3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+  11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+  32767
+};
+
+static const int8_t indexTable[8] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+
+static inline uint16_t le16(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t le32(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+AudioGeneratorPCM::AudioGeneratorPCM()
+{
+  running = false;
+  file = NULL;
+  output = NULL;
+  pending = false;
+  bufferPos = 0;
+  bufferLen = 0;
+}
+
+AudioGeneratorPCM::~AudioGeneratorPCM()
+{
+}
+
+bool AudioGeneratorPCM::begin(AudioFileSource *source, AudioOutput *output)
+{
+  if (!source || !output) return false;
+  file = source;
+  this->output = output;
+  if (!file->isOpen()) return false;
+
+  if (!readHeader()) return false;
+
+  bufferPos = 0;
+  bufferLen = 0;
+  blockSamples = 0;
+  sampleIndex = 0;
+  pending = false;
+
+  // Mono is sent as stereo, the output chain always gets two channels
+  output->SetRate(sampleRate);
+  output->SetBitsPerSample(16);
+  output->SetChannels(2);
+  if (!output->begin()) return false;
+
+  running = true;
+  return true;
+}
+
+bool AudioGeneratorPCM::readHeader()
+{
+  uint8_t header[20];
+
+  if (file->read(header, 12) != 12) return false;
+  if ((memcmp(header, "RIFF", 4) != 0) || (memcmp(header + 8, "WAVE", 4) != 0)) return false;
+
+  bool haveFormat = false;
+  while (true) {
+    if (file->read(header, 8) != 8) return false;
+    uint32_t size = le32(header + 4);
+
+    if (memcmp(header, "data", 4) == 0) {
+      dataRemaining = size;
+      break;
+    }
+
+    uint32_t skip = size + (size & 1);
+    if (memcmp(header, "fmt ", 4) == 0) {
+      uint32_t len = (size < sizeof(header)) ? size : sizeof(header);
+      if ((len < 16) || (file->read(header, len) != len)) return false;
+      format = (PCMFormat)le16(header);
+      channels = le16(header + 2);
+      sampleRate = le32(header + 4);
+      blockAlign = le16(header + 12);
+      uint16_t bits = le16(header + 14);
+      skip -= len;
+
+      if ((channels < 1) || (channels > 2)) return false;
+      if ((format == PCMFormatLinear16) && (bits == 16)) {
+        haveFormat = true;
+      } else if ((format == PCMFormatIMAADPCM) && (bits == 4) && (blockAlign > 4 * channels) && (blockAlign <= PCM_BUFFER_SIZE)) {
+        haveFormat = true;
+      } else {
+        LOGW(LogModuleCodec, "Unsupported WAV format 0x%x, %u bit", format, bits);
+        return false;
+      }
+    }
+    if (skip && !file->seek(skip, SEEK_CUR)) return false;
+  }
+
+  if (!haveFormat) return false;
+  LOGI(LogModuleCodec, "WAV %s, %u Hz, %u channels", (format == PCMFormatLinear16) ? "PCM" : "IMA-ADPCM", sampleRate, channels);
+  return true;
+}
+
+bool AudioGeneratorPCM::loop()
+{
+  if (!running) goto done;
+
+  // The output was full the last time, hand over the sample that was left
+  if (pending) {
+    if (!output->ConsumeSample(lastSample)) goto done;
+    pending = false;
+  }
+
+  while (nextSample(lastSample)) {
+    if (!output->ConsumeSample(lastSample)) {
+      pending = true;
+      goto done;
+    }
+  }
+  stop();
+
+done:
+  file->loop();
+  output->loop();
+  return running;
+}
+
+bool AudioGeneratorPCM::nextSample(int16_t sample[2])
+{
+  if (format == PCMFormatLinear16) {
+    return nextLinear(sample);
+  }
+  return nextADPCM(sample);
+}
+
+bool AudioGeneratorPCM::nextLinear(int16_t sample[2])
+{
+  uint32_t frameBytes = 2 * channels;
+
+  if (bufferPos + frameBytes > bufferLen) {
+    // Keep a partial frame from the last read
+    uint32_t left = bufferLen - bufferPos;
+    memmove(buffer, buffer + bufferPos, left);
+    uint32_t want = PCM_BUFFER_SIZE - left;
+    if (want > dataRemaining) want = dataRemaining;
+
+    uint32_t bytes = want ? file->read(buffer + left, want) : 0;
+    dataRemaining -= bytes;
+    bufferPos = 0;
+    bufferLen = left + bytes;
+    if (bufferLen < frameBytes) return false;
+  }
+
+  sample[0] = (int16_t)le16(buffer + bufferPos);
+  sample[1] = (channels == 2) ? (int16_t)le16(buffer + bufferPos + 2) : sample[0];
+  bufferPos += frameBytes;
+  return true;
+}
+
+bool AudioGeneratorPCM::readBlock()
+{
+  uint32_t want = blockAlign;
+  if (want > dataRemaining) want = dataRemaining;
+
+  bufferLen = file->read(buffer, want);
+  dataRemaining -= bufferLen;
+  if (bufferLen <= 4u * channels) return false;
+
+  // The last block may be short
+  blockSamples = ((bufferLen - 4 * channels) * 2) / channels + 1;
+  sampleIndex = 0;
+  for (uint8_t c = 0; c < channels; c++) {
+    predictor[c] = (int16_t)le16(buffer + 4 * c);
+    // Clamped before it becomes signed, a corrupt header must not index
+    // outside of the step table
+    uint8_t index = buffer[4 * c + 2];
+    stepIndex[c] = (index > 88) ? 88 : index;
+  }
+  return true;
+}
+
+bool AudioGeneratorPCM::nextADPCM(int16_t sample[2])
+{
+  if ((sampleIndex >= blockSamples) && !readBlock()) return false;
+
+  if (sampleIndex == 0) {
+    // First sample of a block is stored in the block header
+    sample[0] = predictor[0];
+    sample[1] = predictor[channels - 1];
+  } else {
+    // Nibbles come in 4 byte groups per channel, 8 samples each
+    uint32_t n = sampleIndex - 1;
+    uint32_t group = n >> 3;
+    uint32_t shift = (n & 1) ? 4 : 0;
+    for (uint8_t c = 0; c < channels; c++) {
+      uint8_t byte = buffer[4 * channels + (group * channels + c) * 4 + ((n & 7) >> 1)];
+      sample[c] = decodeNibble(c, (byte >> shift) & 0x0f);
+    }
+    if (channels == 1) sample[1] = sample[0];
+  }
+  sampleIndex++;
+  return true;
+}
+
+int16_t AudioGeneratorPCM::decodeNibble(uint8_t channel, uint8_t nibble)
+{
+  int32_t step = stepTable[stepIndex[channel]];
+  int32_t diff = step >> 3;
+
+  if (nibble & 1) diff += step >> 2;
+  if (nibble & 2) diff += step >> 1;
+  if (nibble & 4) diff += step;
+  if (nibble & 8) diff = -diff;
+
+  int32_t value = predictor[channel] + diff;
+  if (value > 32767) value = 32767;
+  if (value < -32768) value = -32768;
+  predictor[channel] = value;
+
+  int8_t index = stepIndex[channel] + indexTable[nibble & 7];
+  if (index < 0) index = 0;
+  if (index > 88) index = 88;
+  stepIndex[channel] = index;
+
+  return value;
+}
+
+bool AudioGeneratorPCM::stop()
+{
+  running = false;
+  pending = false;
+  output->stop();
+  return file->close();
+}
+
+bool AudioGeneratorPCM::isRunning()
+{
+  return running;
+}
@@ -0,0 +1,57 @@
+#ifndef LITTLESPEAKER_AUDIOGENERATORPCM_H
+#define LITTLESPEAKER_AUDIOGENERATORPCM_H
+
+#include "AudioGenerator.h"
+
+// Read buffer for PCM data, also holds one IMA-ADPCM block
+#define PCM_BUFFER_SIZE 2048
+
+typedef enum _PCMFormat {
+  PCMFormatLinear16 = 1,      // WAVE_FORMAT_PCM, 16 bit
+  PCMFormatIMAADPCM = 0x11    // WAVE_FORMAT_DVI_ADPCM, 4 bit
+} PCMFormat;
+
+//
+// WAV player for 16 bit PCM and IMA-ADPCM, mono or stereo. PCM samples go
+// from the file buffer straight to the output, ADPCM only needs a table
+// lookup and a few adds per sample. There is no decoder state besides the
+// read buffer, so setup costs nothing and a prompt starts immediately.
+//
+class AudioGeneratorPCM : public AudioGenerator
+{
+  public:
+    AudioGeneratorPCM();
+    virtual ~AudioGeneratorPCM() override;
+
+    virtual bool begin(AudioFileSource *source, AudioOutput *output) override;
+    virtual bool loop() override;
+    virtual bool stop() override;
+    virtual bool isRunning() override;
+
+  private:
+    bool readHeader();
+    bool nextSample(int16_t sample[2]);
+    bool nextLinear(int16_t sample[2]);
+    bool nextADPCM(int16_t sample[2]);
+    bool readBlock();
+    int16_t decodeNibble(uint8_t channel, uint8_t nibble);
+
+    PCMFormat format;
+    uint16_t channels;
+    uint32_t sampleRate;
+    uint16_t blockAlign;
+    uint32_t dataRemaining;
+    bool pending;       // lastSample has not been taken by the output yet
+
+    uint8_t buffer[PCM_BUFFER_SIZE];
+    uint32_t bufferPos;
+    uint32_t bufferLen;
+
+    // IMA-ADPCM state per channel
+    uint32_t blockSamples;
+    uint32_t sampleIndex;
+    int32_t predictor[2];
+    int8_t stepIndex[2];
+};
+
+#endif
@@ -1,5 +1,8 @@
 #include <Arduino.h>
 #include "AudioOutputFilter3BandEQ.h"
+#include "trace.h"
+#include "logger.h"
+#include "telemetry.h"
 
 static const PRECISION vsa = PRECISION(1.0 / 536870911.0);   // Very small amount (Denormal Fix)
 
@@ -8,7 +11,7 @@ AudioOutputFilter3BandEQ::AudioOutputFilter3BandEQ(AudioOutput *sink, int lowFre
     this->lowFreq = lowFreq;
     this->highFreq = highFreq;
 
-    Serial.printf("EQ initialized with low = %d, high = %d\n", lowFreq, highFreq);
+    LOGI(LogModuleCodec, "EQ initialized with low = %d, high = %d", lowFreq, highFreq);
 
     for (int i = 0; i < 2; i++) {
         EQState *state = this->state + i;
@@ -25,7 +28,7 @@ AudioOutputFilter3BandEQ::AudioOutputFilter3BandEQ(AudioOutput *sink, int lowFre
         state->hg = PRECISION(1.0);
     }
 
-    Serial.printf("Value test: vsa = %d.%d (%f)\n", vsa.getInteger(), vsa.getFraction(), (float)vsa);
+    LOGD(LogModuleCodec, "Value test: vsa = %d.%d (%f)", vsa.getInteger(), vsa.getFraction(), (float)vsa);
 }
 
 
@@ -39,22 +42,27 @@ bool AudioOutputFilter3BandEQ::SetRate(int hz) {
         this->state[i].hf = PRECISION(2.0f * sin(M_PI * ((double)highFreq / (double)hz)));
     }
 
-    Serial.printf("Low freq %0.2f (%d.%d), high freq %0.2f (%d.%d)\n",
+    LOGD(LogModuleCodec, "Low freq %0.2f (%d.%d), high freq %0.2f (%d.%d)",
         (float)this->state[0].lf, this->state[0].lf.getInteger(), this->state[0].lf.getFraction(),
         (float)this->state[0].hf, this->state[0].hf.getInteger(), this->state[0].hf.getFraction()
     );
 
     this->sample_rate = hz;
+    if (this->telemetry) telemetryOutputRate(hz);
     return sink->SetRate(hz);
 }
 
+void AudioOutputFilter3BandEQ::setTelemetry(bool enabled) {
+    this->telemetry = enabled;
+}
+
 void AudioOutputFilter3BandEQ::setBandGains(float low, float mid, float high) {
     for(int i = 0; i < 2; i++) {
         this->state[i].lg = PRECISION((float)low);
         this->state[i].mg = PRECISION((float)mid);
         this->state[i].hg = PRECISION((float)high);
     }
-    Serial.printf("EQ gains set to %0.2f (%d.%d), %0.2f (%d.%d), %0.2f (%d.%d)\n",
+    LOGI(LogModuleCodec, "EQ gains set to %0.2f (%d.%d), %0.2f (%d.%d), %0.2f (%d.%d)",
         (float)this->state[0].lg, this->state[0].lg.getInteger(), this->state[0].lg.getFraction(),
         (float)this->state[0].mg, this->state[0].mg.getInteger(), this->state[0].mg.getFraction(),
         (float)this->state[0].hg, this->state[0].hg.getInteger(), this->state[0].hg.getFraction()
@@ -119,7 +127,29 @@ bool AudioOutputFilter3BandEQ::ConsumeSample(int16_t sample[2]) {
     if (this->channels == 1) {
         sample[1] = sample[0];
     }
-    return sink->ConsumeSample(sample);
+    bool accepted = sink->ConsumeSample(sample);
+
+    if (!this->telemetry) return accepted;
+
+    // The I2S output takes one sample at a time, only the time it is full
+    // is worth a record
+    if (!accepted && !this->outputFull) {
+        this->outputFull = true;
+        telemetryOutputFull();
+#if TRACING
+        this->fullSince = traceClock();
+#endif
+    } else if (accepted) {
+#if TRACING
+        if (this->outputFull) TRACE_COMPLETE(TraceEventI2SWait, this->fullSince);
+#endif
+        this->outputFull = false;
+        if (++this->pendingFrames >= TELEMETRY_OUTPUT_BATCH) {
+            telemetryOutputFrames(this->pendingFrames);
+            this->pendingFrames = 0;
+        }
+    }
+    return accepted;
 }
 
 bool AudioOutputFilter3BandEQ::stop() {
@@ -138,6 +168,8 @@ bool AudioOutputFilter3BandEQ::stop() {
         state->hg = PRECISION(1.0);
     }
 
+    if (this->telemetry) telemetryOutputStop();
+    this->pendingFrames = 0;
     return sink->stop();
 }
 
@@ -146,6 +178,9 @@ void AudioOutputFilter3BandEQ::processBuffer(int16_t *samples, int len, int stri
     PRECISION l(0), m(0), h(0);      // Low / Mid / High - Sample Values
     int32_t result;
 
+    TRACE_SCOPE(TraceEventEQ);
+    uint32_t start = traceClock();
+
     for(int j = 0; j < len; j+=stride) {
         int16_t *sample = samples + j;
 
@@ -187,4 +222,5 @@ void AudioOutputFilter3BandEQ::processBuffer(int16_t *samples, int len, int stri
             sample[1] = sample[0];
         }
     }
+    if (this->telemetry) telemetryRecord(TelemetryEQBlock, (traceClock() - start) / traceClockPerUs());
 }
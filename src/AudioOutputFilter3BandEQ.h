@@ -38,6 +38,10 @@ class AudioOutputFilter3BandEQ : public AudioOutput
     void setBandGains(float low, float mid, float high);
     void processBuffer(int16_t *samples, int len, int stride, int channels);
 
+    // Only the EQ in front of the I2S output reports to the telemetry, off
+    // by default so that benchmark instances leave the estimate alone
+    void setTelemetry(bool enabled);
+
   protected:
     AudioOutput *sink;
 
@@ -47,6 +51,10 @@ class AudioOutputFilter3BandEQ : public AudioOutput
     int highFreq = 5000;
     uint8_t channels = 2;
     int sample_rate;
+    bool telemetry = false;
+    bool outputFull = false;
+    uint32_t fullSince = 0;
+    uint32_t pendingFrames = 0;     // Accepted, not yet passed to the telemetry
 
 };
 
@@ -0,0 +1,56 @@
+#include "allocstats.h"
+#include "heapstats.h"
+#include <new>
+
+#if ALLOC_STATS
+
+static uint32_t allocs = 0;
+static uint32_t frees = 0;
+static uint32_t bytes = 0;
+
+void getAllocStats(AllocStats *stats) {
+    stats->allocs = __atomic_load_n(&allocs, __ATOMIC_RELAXED);
+    stats->frees = __atomic_load_n(&frees, __ATOMIC_RELAXED);
+    stats->bytes = __atomic_load_n(&bytes, __ATOMIC_RELAXED);
+}
+
+static void *countedAlloc(size_t size) {
+    __atomic_fetch_add(&allocs, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&bytes, size, __ATOMIC_RELAXED);
+    return heapAlloc(heapScopeTag(), size);
+}
+
+static void countedFree(void *ptr) {
+    if (ptr) __atomic_fetch_add(&frees, 1, __ATOMIC_RELAXED);
+    heapFree(ptr);
+}
+
+// Exceptions are off, a failed allocation ends up in abort() like the
+// default implementation does
+void *operator new(size_t size) {
+    void *ptr = countedAlloc(size);
+    if (!ptr) abort();
+    return ptr;
+}
+
+void *operator new[](size_t size) {
+    void *ptr = countedAlloc(size);
+    if (!ptr) abort();
+    return ptr;
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept { return countedAlloc(size); }
+void *operator new[](size_t size, const std::nothrow_t &) noexcept { return countedAlloc(size); }
+
+void operator delete(void *ptr) noexcept { countedFree(ptr); }
+void operator delete[](void *ptr) noexcept { countedFree(ptr); }
+void operator delete(void *ptr, size_t) noexcept { countedFree(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { countedFree(ptr); }
+
+#else
+
+void getAllocStats(AllocStats *stats) {
+    memset(stats, 0, sizeof(AllocStats));
+}
+
+#endif
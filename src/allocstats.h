@@ -0,0 +1,22 @@
+#ifndef LITTLESPEAKER_ALLOCSTATS_H
+#define LITTLESPEAKER_ALLOCSTATS_H
+
+#include <Arduino.h>
+
+// Count every C++ heap allocation, replaces the global operator new/delete.
+// The allocations are booked in heapstats.h under the tag of their scope.
+#ifndef ALLOC_STATS
+#define ALLOC_STATS 0
+#endif
+
+typedef struct _AllocStats {
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t bytes;         // Sum of all allocation sizes
+} AllocStats;
+
+// All zero if ALLOC_STATS is off. Plain malloc() calls, e.g. inside
+// the codec libraries, are not counted.
+void getAllocStats(AllocStats *stats);
+
+#endif
@@ -0,0 +1,87 @@
+#include "arena.h"
+#include "heapstats.h"
+#include "logger.h"
+#include "esp_heap_caps.h"
+#include "AudioFileSourceJitterBuffer.h"
+#include "AudioGeneratorFLACLite.h"
+
+static const ArenaBudget budgets[ArenaModeCount] = {
+    { "menu", { 0, 0 } },
+    { "sd", { FLAC_SAMPLE_BUFFER_SIZE, 0 } },
+    { "webradio", { 0, JITTER_HEAP_BUDGET } },
+    // The A2DP stack needs everything that is left
+    { "bluetooth", { 0, 0 } }
+};
+
+static ArenaMode currentMode = ArenaModeMenu;
+static uint8_t *block = NULL;
+
+static uint32_t totalBytes(ArenaMode mode) {
+    uint32_t total = 0;
+    for (int i = 0; i < ArenaRegionCount; i++) {
+        total += budgets[mode].bytes[i];
+    }
+    return total;
+}
+
+bool reserveArena(ArenaMode mode) {
+    if ((mode == currentMode) && (block || (totalBytes(mode) == 0))) return true;
+
+    heapFree(block);
+    block = NULL;
+    currentMode = mode;
+
+    uint32_t total = totalBytes(mode);
+    if (total) {
+        block = reinterpret_cast<uint8_t *>(heapAlloc(HeapTagArena, total));
+        // Called from the playback loop on every mode switch, so no
+        // blocking Serial here
+        if (block == NULL) {
+            LOGW(LogModuleSystem, "Arena for %s: %u bytes not available, largest block %u",
+                budgets[mode].name, total, heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+        } else {
+            LOGI(LogModuleSystem, "Arena for %s: %u bytes reserved", budgets[mode].name, total);
+        }
+    }
+
+    // What the mode starts with, after the previous one let go
+    heapSnapshot(budgets[mode].name);
+    return (total == 0) || (block != NULL);
+}
+
+ArenaMode getArenaMode() {
+    return currentMode;
+}
+
+void *getArenaRegion(ArenaRegion region, uint32_t *size) {
+    uint32_t offset = 0;
+
+    if ((block == NULL) || (budgets[currentMode].bytes[region] == 0)) {
+        *size = 0;
+        return NULL;
+    }
+    for (int i = 0; i < region; i++) {
+        offset += budgets[currentMode].bytes[i];
+    }
+    *size = budgets[currentMode].bytes[region];
+    return block + offset;
+}
+
+const ArenaBudget *getArenaBudget(ArenaMode mode) {
+    return &budgets[mode];
+}
+
+void printArenaBudgets(Print *out) {
+    // At boot no mode has reserved its block yet, later the current one has
+    uint32_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+
+    out->printf("Memory arenas (heap free %u, largest block %u):\n", (unsigned)heap_caps_get_free_size(MALLOC_CAP_8BIT), largest);
+    out->println("mode        decoder   stream    total");
+    for (int mode = 0; mode < ArenaModeCount; mode++) {
+        const ArenaBudget *budget = &budgets[mode];
+        uint32_t total = totalBytes((ArenaMode)mode);
+        out->printf("%-10s %8u %8u %8u%s\n", budget->name,
+            budget->bytes[ArenaRegionDecoder], budget->bytes[ArenaRegionStream], total,
+            (total > largest) ? "  does not fit" : "");
+    }
+}
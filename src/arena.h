@@ -0,0 +1,50 @@
+#ifndef LITTLESPEAKER_ARENA_H
+#define LITTLESPEAKER_ARENA_H
+
+#include <Arduino.h>
+
+typedef enum _ArenaMode {
+    ArenaModeMenu = 0,      // Main menu, only prompts are played
+    ArenaModeSD = 1,
+    ArenaModeWebradio = 2,
+    ArenaModeBluetooth = 3,
+    ArenaModeCount
+} ArenaMode;
+
+typedef enum _ArenaRegion {
+    ArenaRegionDecoder = 0, // Sample buffers of our own decoders
+    ArenaRegionStream = 1,  // Webradio jitter buffer
+    ArenaRegionCount
+} ArenaRegion;
+
+typedef struct _ArenaBudget {
+    const char *name;
+    uint32_t bytes[ArenaRegionCount];
+} ArenaBudget;
+
+//
+// Every mode owns one block of memory, sized for its worst case and split
+// into fixed regions. It is reserved in one piece when the mode is entered
+// and freed in one piece when the next mode is reserved, so the large
+// buffers of a mode neither grow nor fragment the heap while it runs.
+//
+// If the block can not be reserved the mode still works, the users of a
+// region then fall back to the heap.
+//
+// Only used from the playback loop, users have to let go of their region
+// before another mode is reserved.
+//
+
+// Frees the block of the current mode and reserves the one of the new mode
+bool reserveArena(ArenaMode mode);
+ArenaMode getArenaMode();
+
+// NULL and a size of 0 if the current mode has no such region
+void *getArenaRegion(ArenaRegion region, uint32_t *size);
+
+const ArenaBudget *getArenaBudget(ArenaMode mode);
+
+// Table of all modes, printed at boot and by the console
+void printArenaBudgets(Print *out);
+
+#endif
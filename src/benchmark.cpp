@@ -0,0 +1,597 @@
+#include "benchmark.h"
+#include "formats.h"
+#include <SD.h>
+
+#include "allocstats.h"
+#include "trace.h"
+#include "AudioFileSourceSD.h"
+#include "AudioFileSourceID3.h"
+#include "AudioGeneratorMP3a.h"
+#include "AudioOutput.h"
+#include "AudioOutputFilter3BandEQ.h"
+#include "A2DPVolumeControl.h"
+#include "SoundData.h"
+
+//
+// Output that accepts everything immediately and only counts
+//
+class AudioOutputCount : public AudioOutput
+{
+  public:
+    AudioOutputCount() { hertz = 0; samples = 0; firstSample = 0; }
+
+    virtual bool begin() override { return true; }
+    virtual bool ConsumeSample(int16_t sample[2]) override
+    {
+      if (samples++ == 0) firstSample = micros();
+      return true;
+    }
+    virtual bool stop() override { return true; }
+
+    uint32_t getRate() { return hertz; }
+    uint32_t samples;
+    uint32_t firstSample;
+};
+
+// Configured like the EQ in main.cpp
+static AudioOutputFilter3BandEQ *createEQ(AudioOutput *sink) {
+    AudioOutputFilter3BandEQ *eq = new AudioOutputFilter3BandEQ(sink, 500, 5000);
+    eq->setBandGains(1.5, 0.9, 1.3);
+    return eq;
+}
+
+bool benchmarkDecode(const char *filename, DecodeBenchmark *result) {
+    const SourceFactory *sourceFactory = findSource(filename);
+    if (!sourceFactory || (sourceFactory->kind != SourceKindFile)) return false;
+
+    AudioFileSource *source = sourceFactory->open(filename);
+    if (!source) return false;
+
+    AudioCodec codec = probeSource(source);
+    const DecoderFactory *decoderFactory = findDecoder(codec);
+    if (!decoderFactory) {
+        sourceFactory->release(source);
+        return false;
+    }
+    AudioOutputCount *output = new AudioOutputCount();
+
+    // Not from the pool, the cold start is measured
+    uint32_t start = micros();
+    AudioGenerator *decoder = decoderFactory->create();
+    if (decoder->begin(source, output)) {
+        while (decoder->isRunning() && decoder->loop()) {
+            // Decode until the file ends
+        }
+        if (decoder->isRunning()) decoder->stop();
+    }
+    uint32_t duration = micros() - start;
+
+    result->codec = codec;
+    result->sampleRate = output->getRate();
+    result->samples = output->samples;
+    result->audioMs = result->sampleRate ? ((uint64_t)result->samples * 1000) / result->sampleRate : 0;
+    result->startUs = output->samples ? output->firstSample - start : 0;
+    result->cpuUs = duration;
+
+    delete decoder;
+    delete output;
+    sourceFactory->release(source);
+    return result->audioMs > 0;
+}
+
+uint32_t benchmarkDecodeDirectory(const char *path) {
+    char filename[256];
+    DecodeBenchmark result;
+    uint32_t files = 0;
+    uint32_t failed = 0;
+
+    File dir = SD.open(path);
+    if (!dir || !dir.isDirectory()) {
+        Serial.printf("No benchmark directory %s\n", path);
+        return 1;
+    }
+
+    Serial.println("codec  rate   audio ms  cpu ms   ms/s  realtime  start us  file");
+    while (File entry = dir.openNextFile()) {
+        if (entry.isDirectory()) continue;
+        snprintf(filename, sizeof(filename), "%s/%s", path, entry.name());
+        entry.close();
+
+        files++;
+        if (!benchmarkDecode(filename, &result)) {
+            Serial.printf("Could not decode %s\n", filename);
+            failed++;
+            continue;
+        }
+
+        // CPU milliseconds per second of audio and how many times faster
+        // than realtime the decoder runs
+        float perSecond = (float)result.cpuUs / result.audioMs;
+        float realtime = result.cpuUs ? (result.audioMs * 1000.0f) / result.cpuUs : 0.0f;
+        Serial.printf("%-5s  %5u  %8u  %6u  %5.1f  %7.1fx  %8u  %s\n",
+            codecName(result.codec), result.sampleRate, result.audioMs, result.cpuUs / 1000,
+            perSecond, realtime, result.startUs, filename);
+    }
+    dir.close();
+
+    if (files == 0) {
+        Serial.printf("Nothing to decode in %s\n", path);
+        return 1;
+    }
+    return failed;
+}
+
+//
+// Playback chain
+//
+
+bool benchmarkPlayback(const char *filename, PlaybackBenchmark *result) {
+    AllocStats allocsBefore;
+    AllocStats allocsAfter;
+
+    memset(result, 0, sizeof(PlaybackBenchmark));
+    uint32_t heapBefore = ESP.getFreeHeap();
+    uint32_t heapLowest = heapBefore;
+    getAllocStats(&allocsBefore);
+
+    uint32_t start = micros();
+    AudioFileSourceSD *file = new AudioFileSourceSD(filename);
+    AudioFileSourceID3 *id3 = new AudioFileSourceID3(file);
+    AudioOutputCount *sink = new AudioOutputCount();
+    AudioOutputFilter3BandEQ *eq = createEQ(sink);
+    AudioGeneratorMP3a *decoder = new AudioGeneratorMP3a();
+
+    bool running = file->isOpen() && decoder->begin(id3, eq);
+    while (running) {
+        running = decoder->isRunning() && decoder->loop();
+
+        // The heap is lowest somewhere in the middle of a frame, after
+        // each one is as close as it gets without hooking malloc
+        uint32_t heap = ESP.getFreeHeap();
+        if (heap < heapLowest) heapLowest = heap;
+    }
+    if (decoder->isRunning()) decoder->stop();
+    uint32_t duration = micros() - start;
+    getAllocStats(&allocsAfter);
+
+    result->sampleRate = sink->getRate();
+    result->samples = sink->samples;
+    result->audioMs = result->sampleRate ? ((uint64_t)result->samples * 1000) / result->sampleRate : 0;
+    result->cpuUs = duration;
+    result->peakHeap = heapBefore - heapLowest;
+    result->allocs = allocsAfter.allocs - allocsBefore.allocs;
+    result->allocBytes = allocsAfter.bytes - allocsBefore.bytes;
+
+    delete decoder;
+    delete eq;
+    delete sink;
+    delete id3;
+    delete file;
+    return result->audioMs > 0;
+}
+
+uint32_t benchmarkPlaybackDirectory(const char *path) {
+    char filename[256];
+    PlaybackBenchmark result;
+    uint32_t failed = 0;
+    uint32_t files = 0;
+    uint64_t totalAudioMs = 0;
+    uint64_t totalCpuUs = 0;
+    float worstRtf = 0;
+    uint32_t peakHeap = 0;
+
+    File dir = SD.open(path);
+    if (!dir || !dir.isDirectory()) {
+        Serial.printf("No benchmark directory %s\n", path);
+        return 0;
+    }
+
+    // The real time factor is CPU time per audio time, below 1 plays
+    Serial.println(" rate   audio ms  cpu ms    rtf  peak heap  allocs  alloc bytes  file");
+    while (File entry = dir.openNextFile()) {
+        const char *ext = strrchr(entry.name(), '.');
+        if (entry.isDirectory() || !ext || (strcasecmp(ext, ".mp3") != 0)) continue;
+        snprintf(filename, sizeof(filename), "%s/%s", path, entry.name());
+        entry.close();
+
+        if (!benchmarkPlayback(filename, &result)) {
+            Serial.printf("%s could not be played\n", filename);
+            failed++;
+            continue;
+        }
+
+        float rtf = (float)result.cpuUs / (result.audioMs * 1000.0f);
+#if ALLOC_STATS
+        Serial.printf("%5u  %8u  %6u  %5.3f  %9u  %6u  %11u  %s\n",
+            result.sampleRate, result.audioMs, result.cpuUs / 1000, rtf,
+            result.peakHeap, result.allocs, result.allocBytes, filename);
+#else
+        Serial.printf("%5u  %8u  %6u  %5.3f  %9u  %6s  %11s  %s\n",
+            result.sampleRate, result.audioMs, result.cpuUs / 1000, rtf,
+            result.peakHeap, "-", "-", filename);
+#endif
+
+        files++;
+        totalAudioMs += result.audioMs;
+        totalCpuUs += result.cpuUs;
+        if (rtf > worstRtf) worstRtf = rtf;
+        if (result.peakHeap > peakHeap) peakHeap = result.peakHeap;
+    }
+    dir.close();
+
+    if (files > 0) {
+        float rtf = (float)totalCpuUs / (totalAudioMs * 1000.0f);
+        Serial.printf("%u files, %llu ms audio, rtf %.3f (worst %.3f), headroom %.0f%% of one core, peak heap %u\n",
+            files, (unsigned long long)totalAudioMs, rtf, worstRtf, (1.0f - rtf) * 100.0f, peakHeap);
+    }
+    return failed;
+}
+
+//
+// DSP kernels
+//
+
+typedef struct _DspKernel {
+    const char *name;
+    void *(*create)(uint32_t sampleRate);
+    void (*process)(void *kernel, int16_t *samples, uint32_t frames);
+    void (*destroy)(void *kernel);
+} DspKernel;
+
+typedef struct _EQKernel {
+    AudioOutputCount *sink;
+    AudioOutputFilter3BandEQ *eq;
+} EQKernel;
+
+static void *createEQKernel(uint32_t sampleRate) {
+    EQKernel *kernel = new EQKernel;
+    kernel->sink = new AudioOutputCount();
+    kernel->eq = createEQ(kernel->sink);
+    kernel->eq->SetChannels(2);
+    kernel->eq->SetRate(sampleRate);
+    return kernel;
+}
+
+// The SD player feeds the EQ one stereo frame at a time
+static void processEQ(void *kernel, int16_t *samples, uint32_t frames) {
+    AudioOutputFilter3BandEQ *eq = reinterpret_cast<EQKernel *>(kernel)->eq;
+    for (uint32_t i = 0; i < frames; i++) {
+        eq->ConsumeSample(samples + 2 * i);
+    }
+}
+
+// The Bluetooth stream reader filters the downmixed left channel in place
+static void processEQBuffer(void *kernel, int16_t *samples, uint32_t frames) {
+    reinterpret_cast<EQKernel *>(kernel)->eq->processBuffer(samples, frames * 2, 2, 1);
+}
+
+static void destroyEQKernel(void *kernel) {
+    EQKernel *eqKernel = reinterpret_cast<EQKernel *>(kernel);
+    delete eqKernel->eq;
+    delete eqKernel->sink;
+    delete eqKernel;
+}
+
+typedef struct _VolumeKernel {
+    A2DPDefaultVolumeControl control;
+} VolumeKernel;
+
+// Configured like the A2DP sink in bluetooth.cpp
+static void *createVolume(uint32_t sampleRate) {
+    VolumeKernel *kernel = new VolumeKernel;
+    A2DPVolumeControl *control = &kernel->control;
+    control->set_mono_downmix(true);
+    control->set_volume(0x18);
+    control->set_enabled(true);
+    return kernel;
+}
+
+static void processVolume(void *kernel, int16_t *samples, uint32_t frames) {
+    reinterpret_cast<VolumeKernel *>(kernel)->control.update_audio_data((Frame *)samples, frames);
+}
+
+static void destroyVolume(void *kernel) {
+    delete reinterpret_cast<VolumeKernel *>(kernel);
+}
+
+static void *createSwap(uint32_t sampleRate) {
+    return NULL;
+}
+
+static void processSwap(void *kernel, int16_t *samples, uint32_t frames) {
+    swap_left_right_channels((Frame *)samples, frames);
+}
+
+static void destroySwap(void *kernel) {
+}
+
+static const DspKernel dspKernels[] = {
+    { "eq", createEQKernel, processEQ, destroyEQKernel },
+    { "eq-bt", createEQKernel, processEQBuffer, destroyEQKernel },
+    { "volume", createVolume, processVolume, destroyVolume },
+    { "swap", createSwap, processSwap, destroySwap }
+};
+
+#define DSP_KERNEL_COUNT (sizeof(dspKernels) / sizeof(dspKernels[0]))
+
+static const DspKernel *findKernel(const char *name) {
+    for (size_t i = 0; i < DSP_KERNEL_COUNT; i++) {
+        if (strcmp(dspKernels[i].name, name) == 0) return dspKernels + i;
+    }
+    return NULL;
+}
+
+//
+// References, the output checksum of every run. Replace the table with
+// what "bench dsp record" (or --dsp-benchmark --record on the PC) prints,
+// only after listening to the changed kernel.
+//
+
+typedef struct _DspReference {
+    const char *kernel;
+    BenchmarkSignal signal;
+    uint32_t sampleRate;
+    uint32_t checksum;
+} DspReference;
+
+static const DspReference dspReferences[] = {
+    { "eq", BenchmarkSignalSweep, 44100, 0x264b83b0 },
+    { "eq", BenchmarkSignalSweep, 48000, 0xfe3056f7 },
+    { "eq", BenchmarkSignalPinkNoise, 44100, 0x8e9c30e5 },
+    { "eq", BenchmarkSignalPinkNoise, 48000, 0xc784f89e },
+    { "eq", BenchmarkSignalSquare, 44100, 0x3a973c38 },
+    { "eq", BenchmarkSignalSquare, 48000, 0xbe046c78 },
+    { "eq-bt", BenchmarkSignalSweep, 44100, 0x83284d81 },
+    { "eq-bt", BenchmarkSignalSweep, 48000, 0x78e25cf9 },
+    { "eq-bt", BenchmarkSignalPinkNoise, 44100, 0x4ced4fed },
+    { "eq-bt", BenchmarkSignalPinkNoise, 48000, 0xac45fa45 },
+    { "eq-bt", BenchmarkSignalSquare, 44100, 0x3d044285 },
+    { "eq-bt", BenchmarkSignalSquare, 48000, 0x40332579 },
+    { "volume", BenchmarkSignalSweep, 44100, 0x592ba8ad },
+    { "volume", BenchmarkSignalSweep, 48000, 0x01c132bd },
+    { "volume", BenchmarkSignalPinkNoise, 44100, 0x417a6b81 },
+    { "volume", BenchmarkSignalPinkNoise, 48000, 0x3dc6a135 },
+    { "volume", BenchmarkSignalSquare, 44100, 0xddc46aa1 },
+    { "volume", BenchmarkSignalSquare, 48000, 0xe3f33421 },
+    { "swap", BenchmarkSignalSweep, 44100, 0xa902a65e },
+    { "swap", BenchmarkSignalSweep, 48000, 0xd50d087e },
+    { "swap", BenchmarkSignalPinkNoise, 44100, 0x514bcd8d },
+    { "swap", BenchmarkSignalPinkNoise, 48000, 0xb5f36289 },
+    { "swap", BenchmarkSignalSquare, 44100, 0x2ad67a21 },
+    { "swap", BenchmarkSignalSquare, 48000, 0x6b14b0a1 },
+};
+
+static uint32_t findReference(const char *kernel, BenchmarkSignal signal, uint32_t sampleRate) {
+    for (size_t i = 0; i < sizeof(dspReferences) / sizeof(dspReferences[0]); i++) {
+        const DspReference *reference = dspReferences + i;
+        if ((strcmp(reference->kernel, kernel) == 0) && (reference->signal == signal) && (reference->sampleRate == sampleRate)) {
+            return reference->checksum;
+        }
+    }
+    return 0;
+}
+
+// Bytes in little endian order, like the samples are on the device
+static uint32_t checksumSamples(uint32_t hash, const int16_t *samples, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        uint16_t sample = samples[i];
+        hash = (hash ^ (sample & 0xff)) * 16777619u;
+        hash = (hash ^ (sample >> 8)) * 16777619u;
+    }
+    return hash;
+}
+
+//
+// Test signals
+//
+
+#define PINK_ROWS 12
+
+typedef struct _SignalGenerator {
+    BenchmarkSignal signal;
+    uint32_t phase[2];      // 2^32 is a full turn
+    uint32_t increment[2];
+    uint32_t step;          // Sweep, added to the increment every frame
+    uint32_t counter;
+    uint32_t random;
+    int32_t rows[2][PINK_ROWS];
+    int32_t sum[2];
+} SignalGenerator;
+
+static const char *signalName(BenchmarkSignal signal) {
+    switch (signal) {
+        case BenchmarkSignalSweep: return "sweep";
+        case BenchmarkSignalPinkNoise: return "pink";
+        case BenchmarkSignalSquare: return "square";
+    }
+    return "?";
+}
+
+// Sine in Q15 as cos(pi/2 y) around the peak of each half turn, Taylor
+// series up to y^10 in Q30, the error is below one LSB
+static int32_t benchmarkSine(uint32_t phase) {
+    static const int64_t coefficients[] = { 27060, 987048, 22401992, 272375560, 1324675879, 1073741824 };
+    int64_t y = (int64_t)(phase & 0x7fffffff) - 0x40000000;
+    int64_t y2 = (y * y) >> 30;
+    int64_t result = coefficients[0];
+
+    for (size_t i = 1; i < sizeof(coefficients) / sizeof(coefficients[0]); i++) {
+        result = coefficients[i] - ((result * y2) >> 30);
+    }
+    result >>= 15;
+    return (phase & 0x80000000) ? -result : result;
+}
+
+// xorshift32, uniform from -2048 to 2047
+static int32_t benchmarkNoise(SignalGenerator *generator) {
+    uint32_t x = generator->random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    generator->random = x;
+    return (int32_t)(x >> 20) - 2048;
+}
+
+static void startSignal(SignalGenerator *generator, BenchmarkSignal signal, uint32_t sampleRate, uint32_t frames) {
+    memset(generator, 0, sizeof(SignalGenerator));
+    generator->signal = signal;
+    generator->random = 0x2545f491;
+
+    switch (signal) {
+        case BenchmarkSignalSweep: {
+            uint32_t last = ((uint64_t)20000 << 32) / sampleRate;
+            generator->increment[0] = ((uint64_t)20 << 32) / sampleRate;
+            generator->step = (last - generator->increment[0]) / frames;
+            break;
+        }
+        case BenchmarkSignalSquare:
+            generator->increment[0] = ((uint64_t)1000 << 32) / sampleRate;
+            generator->increment[1] = ((uint64_t)500 << 32) / sampleRate;
+            break;
+        case BenchmarkSignalPinkNoise:
+            break;
+    }
+}
+
+static void nextFrame(SignalGenerator *generator, int16_t *frame) {
+    switch (generator->signal) {
+        case BenchmarkSignalSweep:
+            // Sine left, cosine right
+            frame[0] = (benchmarkSine(generator->phase[0]) * 16384) >> 15;
+            frame[1] = (benchmarkSine(generator->phase[0] + 0x40000000) * 16384) >> 15;
+            generator->phase[0] += generator->increment[0];
+            generator->increment[0] += generator->step;
+            break;
+        case BenchmarkSignalPinkNoise: {
+            // Row n is renewed every 2^(n+1) frames, plus white noise on top
+            int row = __builtin_ctz(++generator->counter);
+            for (int i = 0; i < 2; i++) {
+                if (row < PINK_ROWS) {
+                    generator->sum[i] -= generator->rows[i][row];
+                    generator->rows[i][row] = benchmarkNoise(generator);
+                    generator->sum[i] += generator->rows[i][row];
+                }
+                frame[i] = generator->sum[i] + benchmarkNoise(generator);
+            }
+            break;
+        }
+        case BenchmarkSignalSquare:
+            for (int i = 0; i < 2; i++) {
+                frame[i] = (generator->phase[i] & 0x80000000) ? INT16_MIN : INT16_MAX;
+                generator->phase[i] += generator->increment[i];
+            }
+            break;
+    }
+}
+
+//
+// DSP benchmark
+//
+
+bool benchmarkDsp(const char *kernelName, BenchmarkSignal signal, uint32_t sampleRate, DspBenchmark *result) {
+    const DspKernel *kernel = findKernel(kernelName);
+    if (!kernel || (sampleRate == 0)) return false;
+
+    memset(result, 0, sizeof(DspBenchmark));
+    result->kernel = kernel->name;
+    result->signal = signal;
+    result->sampleRate = sampleRate;
+    result->frames = ((uint64_t)sampleRate * BENCHMARK_DSP_MS) / 1000;
+    result->bestBlock = UINT32_MAX;
+    result->checksum = 2166136261u;
+
+    int16_t *samples = new int16_t[BENCHMARK_DSP_BLOCK * 2];
+    SignalGenerator generator;
+    uint32_t count;
+
+    startSignal(&generator, signal, sampleRate, result->frames);
+    void *state = kernel->create(sampleRate);
+
+    for (uint32_t frame = 0; frame < result->frames; frame += count) {
+        count = result->frames - frame;
+        if (count > BENCHMARK_DSP_BLOCK) count = BENCHMARK_DSP_BLOCK;
+        for (uint32_t i = 0; i < count; i++) {
+            nextFrame(&generator, samples + 2 * i);
+        }
+
+        uint32_t start = traceClock();
+        kernel->process(state, samples, count);
+        uint32_t ticks = traceClock() - start;
+
+        result->ticks += ticks;
+        if ((count == BENCHMARK_DSP_BLOCK) && (ticks < result->bestBlock)) {
+            result->bestBlock = ticks;
+        }
+
+        // Outside of the measurement
+        result->checksum = checksumSamples(result->checksum, samples, count * 2);
+    }
+
+    kernel->destroy(state);
+    delete[] samples;
+
+    result->expected = findReference(kernel->name, signal, sampleRate);
+    if (result->expected == 0) {
+        result->golden = GoldenMissing;
+    } else {
+        result->golden = (result->checksum == result->expected) ? GoldenMatch : GoldenMismatch;
+    }
+    return true;
+}
+
+uint32_t benchmarkDspAll(bool record) {
+    static const BenchmarkSignal signals[] = { BenchmarkSignalSweep, BenchmarkSignalPinkNoise, BenchmarkSignalSquare };
+    static const char *signalSources[] = { "BenchmarkSignalSweep", "BenchmarkSignalPinkNoise", "BenchmarkSignalSquare" };
+    static const uint32_t rates[] = { 44100, 48000 };
+    uint32_t checksums[DSP_KERNEL_COUNT][sizeof(signals) / sizeof(signals[0])][sizeof(rates) / sizeof(rates[0])] = { };
+    DspBenchmark result;
+    uint32_t failed = 0;
+
+    // Load is the share of one core the kernel needs at the sample rate
+    Serial.printf("kernel  signal  rate   %6s/frame    best   load  reference\n", TRACE_CLOCK_UNIT);
+    for (size_t k = 0; k < DSP_KERNEL_COUNT; k++) {
+        for (size_t s = 0; s < sizeof(signals) / sizeof(signals[0]); s++) {
+            for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+                if (!benchmarkDsp(dspKernels[k].name, signals[s], rates[r], &result)) continue;
+
+                float perFrame = (float)result.ticks / result.frames;
+                float best = (result.bestBlock != UINT32_MAX) ? (float)result.bestBlock / BENCHMARK_DSP_BLOCK : perFrame;
+                float load = perFrame * result.sampleRate * 100.0f / (traceClockPerUs() * 1000000.0f);
+                Serial.printf("%-6s  %-6s  %5u  %12.1f  %6.1f  %4.1f%%  ",
+                    result.kernel, signalName(result.signal), result.sampleRate, perFrame, best, load);
+
+                if (record) {
+                    Serial.printf("%08x\n", result.checksum);
+                    checksums[k][s][r] = result.checksum;
+                    continue;
+                }
+                switch (result.golden) {
+                    case GoldenMatch:
+                        Serial.println("ok");
+                        break;
+                    case GoldenMismatch:
+                        Serial.printf("DIFFERS, %08x instead of %08x\n", result.checksum, result.expected);
+                        failed++;
+                        break;
+                    case GoldenMissing:
+                        Serial.println("MISSING");
+                        failed++;
+                        break;
+                }
+            }
+        }
+    }
+    if (!record) return failed;
+
+    Serial.println("New references for dspReferences in src/benchmark.cpp:");
+    for (size_t k = 0; k < DSP_KERNEL_COUNT; k++) {
+        for (size_t s = 0; s < sizeof(signals) / sizeof(signals[0]); s++) {
+            for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+                if (!checksums[k][s][r]) continue;
+                Serial.printf("    { \"%s\", %s, %u, 0x%08x },\n",
+                    dspKernels[k].name, signalSources[s], rates[r], checksums[k][s][r]);
+            }
+        }
+    }
+    return 0;
+}
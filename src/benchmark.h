@@ -0,0 +1,108 @@
+#ifndef LITTLESPEAKER_BENCHMARK_H
+#define LITTLESPEAKER_BENCHMARK_H
+
+#include <Arduino.h>
+#include "codec.h"
+
+// Files in this directory are decoded by benchmarkDecodeDirectory()
+#define BENCHMARK_DIRECTORY "/benchmark"
+
+typedef struct _DecodeBenchmark {
+    AudioCodec codec;
+    uint32_t sampleRate;
+    uint32_t samples;       // Stereo frames written by the decoder
+    uint32_t audioMs;       // Duration of the decoded audio
+    uint32_t startUs;       // Decoder creation and begin() until the first sample
+    uint32_t cpuUs;         // Time spent decoding
+} DecodeBenchmark;
+
+//
+// Decode cost measurement. A file is decoded as fast as possible into an
+// output that only counts samples, the result is the CPU time needed per
+// second of audio and the time until the first sample. Having the same
+// content in several formats compares the decoders, the card comes with
+// the same music as MP3 and AAC. Nothing in here depends on the hardware
+// besides the SD card, so the same code can run on the host.
+//
+bool benchmarkDecode(const char *filename, DecodeBenchmark *result);
+
+// Benchmarks every file with a registered decoder and prints a report,
+// returns the number of files that could not be decoded
+uint32_t benchmarkDecodeDirectory(const char *path = BENCHMARK_DIRECTORY);
+
+// Decoded through the full playback chain by benchmarkPlaybackDirectory()
+#define BENCHMARK_PLAYBACK_DIRECTORY "/system"
+
+typedef struct _PlaybackBenchmark {
+    uint32_t sampleRate;
+    uint32_t samples;
+    uint32_t audioMs;
+    uint32_t cpuUs;
+    uint32_t peakHeap;      // Largest drop of the free heap while playing
+    uint32_t allocs;        // C++ allocations, only with ALLOC_STATS
+    uint32_t allocBytes;
+} PlaybackBenchmark;
+
+//
+// End to end cost of an MP3 file: SD source, ID3 skipping, the MP3
+// decoder and the EQ into an output that discards the samples. Everything
+// is created for the file like it would be without the decoder pool, so
+// allocations and heap include the cold start. Run after a library update
+// to see whether decoding got slower, the headroom is what is left of one
+// core for WiFi or Bluetooth while playing.
+//
+bool benchmarkPlayback(const char *filename, PlaybackBenchmark *result);
+
+// Benchmarks every MP3 file and prints a report, returns the number of
+// files that could not be played
+uint32_t benchmarkPlaybackDirectory(const char *path = BENCHMARK_PLAYBACK_DIRECTORY);
+
+// Length of each DSP run and the frames handed to a kernel at once
+#define BENCHMARK_DSP_MS 1000
+#define BENCHMARK_DSP_BLOCK 256
+
+typedef enum _BenchmarkSignal {
+    BenchmarkSignalSweep = 0,       // Linear 20 Hz to 20 kHz, -6 dBFS
+    BenchmarkSignalPinkNoise = 1,   // Voss-McCartney, independent channels
+    BenchmarkSignalSquare = 2       // Full scale, 1 kHz left and 500 Hz right
+} BenchmarkSignal;
+
+typedef enum _GoldenResult {
+    GoldenMatch = 0,
+    GoldenMismatch = 1,
+    GoldenMissing = 2       // No reference for this run, fails like a mismatch
+} GoldenResult;
+
+typedef struct _DspBenchmark {
+    const char *kernel;
+    BenchmarkSignal signal;
+    uint32_t sampleRate;
+    uint32_t frames;
+    uint64_t ticks;         // Cycles on the device, nanoseconds on the host
+    uint32_t bestBlock;     // Fewest ticks one block took, without interrupts
+    GoldenResult golden;
+    uint32_t checksum;      // FNV-1a of the output samples, little endian
+    uint32_t expected;      // Of the reference, 0 if missing
+} DspBenchmark;
+
+//
+// Micro benchmarks of the per-sample kernels: the EQ as the SD player and
+// the Bluetooth stream use it, the A2DP volume control and the A2DP
+// channel swap. Each runs over generated test signals in blocks, the
+// checksum of the output is compared against the reference of the same
+// run compiled into the firmware, so an optimized kernel can not change
+// the sound unnoticed. A deliberate change means recording new references
+// and committing them, see benchmarkDspAll().
+//
+// The signals are made with integer arithmetic only and are bit identical
+// on the device and the host.
+//
+bool benchmarkDsp(const char *kernel, BenchmarkSignal signal, uint32_t sampleRate, DspBenchmark *result);
+
+// Runs every kernel over every signal at 44.1 and 48 kHz and prints a
+// report, returns the number of runs that did not match their reference.
+// Recording prints the checksums as source lines for the reference table
+// in benchmark.cpp instead of checking them.
+uint32_t benchmarkDspAll(bool record = false);
+
+#endif
@@ -1,5 +1,12 @@
 #include "bluetooth.h"
+#include "trace.h"
+#include "logger.h"
+#include "telemetry.h"
+#include "heapstats.h"
 #include <WiFi.h>
+#include "esp_bt_main.h"
+#include "esp_a2dp_api.h"
+#include "esp_timer.h"
 
 // FIXME: Pin config as template?
 
@@ -12,12 +19,25 @@ static void runBluetooth(void *context);
 static void bluetoothDevConnCallback(bool connected, void *context);
 static void bluetoothAVRCCallback(esp_avrc_playback_stat_t state, void *context);
 static void bluetoothStream(const uint8_t *data, uint32_t len, void *context);
+static void bluetoothConnectionHandler(const Event *event, void *context);
+static void bluetoothPlayStateHandler(const Event *event, void *context);
 
 
-BluetoothPlayer::BluetoothPlayer(Playlist *playlist, AudioOutputFilter3BandEQ *eq) {
+BluetoothPlayer::BluetoothPlayer(Playlist *playlist, EventBus *bus, AudioOutputFilter3BandEQ *eq) {
     this->playlist = playlist;
+    this->bus = bus;
     this->eq = eq;
     this->a2dp = NULL;
+    this->state = BTStateStopped;
+    this->heapBeforeStart = 0;
+    this->heapAccounted = 0;
+    this->restartCallback = NULL;
+    this->restartContext = NULL;
+
+    // Bluetooth stack callbacks run in the BT task, state changes are
+    // deferred to the event dispatcher
+    this->bus->subscribe(EventBluetoothConnection, bluetoothConnectionHandler, this);
+    this->bus->subscribe(EventBluetoothPlayState, bluetoothPlayStateHandler, this);
 }
     
 BluetoothPlayer::~BluetoothPlayer() {
@@ -32,9 +52,15 @@ Menu* BluetoothPlayer::makeMenu() {
     return bluetoothMenu;
 }
 
+void BluetoothPlayer::registerRestartCallback(void (*callback)(void *), void *context) {
+    this->restartCallback = callback;
+    this->restartContext = context;
+}
+
 BluetoothA2DPSink* BluetoothPlayer::makeSink() {
     if (this->a2dp) return this->a2dp;
 
+    this->heapBeforeStart = ESP.getFreeHeap();
     this->a2dp = new BluetoothA2DPSink();
     i2s_pin_config_t cfg = {
       .mck_io_num = I2S_PIN_NO_CHANGE,
@@ -43,7 +69,7 @@ BluetoothA2DPSink* BluetoothPlayer::makeSink() {
       .data_out_num = 14,
       .data_in_num = I2S_PIN_NO_CHANGE
     };
-    Serial.println("Creating A2DP sink...");
+    LOGI(LogModuleBluetooth, "Creating A2DP sink...");
     this->a2dp->set_pin_config(cfg);
     this->a2dp->set_mono_downmix(true);
     this->a2dp->set_volume(0x18);
@@ -55,19 +81,68 @@ BluetoothA2DPSink* BluetoothPlayer::makeSink() {
     this->a2dp->set_callback_context(reinterpret_cast<void *>(this));
     this->a2dp->start("LittleBox");
 
+    // The stack allocates in its own tasks, only the difference tells
+    uint32_t heap = ESP.getFreeHeap();
+    this->heapAccounted = (heap < this->heapBeforeStart) ? this->heapBeforeStart - heap : 0;
+    heapAccount(HeapTagBluetooth, this->heapAccounted);
+    heapSnapshot("bluetooth started");
+
     return this->a2dp;
 }
 
 void BluetoothPlayer::destroySink() {
     if (!this->a2dp) return;
+    int64_t start = esp_timer_get_time();
+
+    bool clean = this->shutdownStack();
+    heapAccount(HeapTagBluetooth, -(int32_t)this->heapAccounted);
+    this->heapAccounted = 0;
+    heapSnapshot("bluetooth stopped");
+    uint32_t heap = ESP.getFreeHeap();
+    uint32_t missing = (heap < this->heapBeforeStart) ? this->heapBeforeStart - heap : 0;
+    LOGI(LogModuleBluetooth, "Bluetooth stopped in %u ms, heap %u bytes free, %u bytes less than before",
+        (uint32_t)((esp_timer_get_time() - start) / 1000), heap, missing);
+
+    if (!clean || (missing > BLUETOOTH_HEAP_TOLERANCE)) {
+        LOGE(LogModuleBluetooth, "Bluetooth stack did not shut down cleanly, restarting");
+        if (this->restartCallback) {
+            this->restartCallback(this->restartContext);
+        }
+        logFlush();
+        ESP.restart();
+    }
+}
+
+// Takes everything down in the reverse order of start(), but keeps the
+// controller memory so Bluetooth can be started again without a reboot
+bool BluetoothPlayer::shutdownStack() {
+    bool clean = true;
 
     this->a2dp->stop();
-    this->a2dp->end(true);
-    vTaskDelay(20);
+
+    // Disconnects, stops AVRC and the application task
+    this->a2dp->end(false);
+    if (esp_a2d_sink_deinit() != ESP_OK) {
+        LOGE(LogModuleBluetooth, "A2DP deinit failed");
+        clean = false;
+    }
     delete this->a2dp;
     this->a2dp = NULL;
-    vTaskDelay(100);
-    ESP.restart();
+    this->state = BTStateStopped;
+
+    if ((esp_bluedroid_disable() != ESP_OK) || (esp_bluedroid_deinit() != ESP_OK)) {
+        LOGE(LogModuleBluetooth, "Bluedroid shutdown failed");
+        clean = false;
+    }
+
+    // Controller back to idle, the counterpart of btStart() in the library
+    btStop();
+
+    // The port belongs to AudioOutputI2S again, the playlist installs
+    // its driver on the next reset
+    i2s_driver_uninstall(I2S_NUM_0);
+
+    return clean;
 }
 
 void BluetoothPlayer::previous() {
@@ -112,30 +187,36 @@ static void activateBluetooth(Menu *item) {
     BluetoothPlayer *player = reinterpret_cast<BluetoothPlayer *>(item->getContext());
 
     // switch to bluetooth mode
-    Serial.println("Disabling Wifi");
+    LOGI(LogModuleBluetooth, "Disabling Wifi");
     WiFi.disconnect();
     WiFi.softAPdisconnect(true);
     WiFi.mode(WIFI_MODE_NULL);
     
+    player->playlist->setDecoderBudget(BLUETOOTH_DECODER_CPU, BLUETOOTH_DECODER_RAM);
+    player->playlist->setArenaMode(ArenaModeBluetooth);
     player->playlist->addFilename("/system/bluetooth_on.mp3");
     player->playlist->registerPlaylistEndCallback(runBluetooth, player);
     player->playlist->play();
 }
 
 static void deactivateBluetooth(Menu *item) {
-    Serial.println("Disabling Bluetooth");
+    LOGI(LogModuleBluetooth, "Disabling Bluetooth");
     BluetoothPlayer *player = reinterpret_cast<BluetoothPlayer *>(item->getContext());
+    player->playlist->measureStartLatency("Leaving Bluetooth");
     player->destroySink();
+
+    player->playlist->setDecoderBudget(DECODER_BUDGET_CPU_UNLIMITED, DECODER_BUDGET_RAM_UNLIMITED);
+    player->playlist->setArenaMode(ArenaModeMenu);
 }
 
 static void runBluetooth(void *context) {
     BluetoothPlayer *player = reinterpret_cast<BluetoothPlayer *>(context);
 
-    Serial.println("Freeing buffers");
-    player->playlist->stopAndClear();
+    // Playlist has run empty when we get here, the audio chain is gone already
+    LOGD(LogModuleBluetooth, "Freeing buffers");
     player->playlist->freeAllBuffers();
 
-    Serial.println("A2DP enable");
+    LOGI(LogModuleBluetooth, "A2DP enable");
     player->makeSink();
 }
 
@@ -147,6 +228,19 @@ static void bluetoothReinitI2S(void *context) {
 
 static void bluetoothDevConnCallback(bool connected, void *context) {
     BluetoothPlayer *player = reinterpret_cast<BluetoothPlayer *>(context);
+    player->bus->post(EventBluetoothConnection, connected);
+}
+
+static void bluetoothAVRCCallback(esp_avrc_playback_stat_t state, void *context) {
+    BluetoothPlayer *player = reinterpret_cast<BluetoothPlayer *>(context);
+    player->bus->post(EventBluetoothPlayState, state);
+}
+
+static void bluetoothConnectionHandler(const Event *event, void *context) {
+    BluetoothPlayer *player = reinterpret_cast<BluetoothPlayer *>(context);
+    bool connected = event->value;
+
+    if (!player->a2dp) return;
 
     player->a2dp->set_i2s_active(false);
     if (connected) {
@@ -159,10 +253,10 @@ static void bluetoothDevConnCallback(bool connected, void *context) {
     }
 }
 
-static void bluetoothAVRCCallback(esp_avrc_playback_stat_t state, void *context) {
+static void bluetoothPlayStateHandler(const Event *event, void *context) {
     BluetoothPlayer *player = reinterpret_cast<BluetoothPlayer *>(context);
 
-    switch (state) {
+    switch (event->value) {
         case ESP_AVRC_PLAYBACK_STOPPED:
             player->setState(BTStateStopped);
             break;
@@ -181,6 +275,8 @@ static void bluetoothAVRCCallback(esp_avrc_playback_stat_t state, void *context)
 }
 
 static void bluetoothStream(const uint8_t *data, uint32_t len, void *context) {
+    TRACE_SCOPE(TraceEventBTCallback);
     BluetoothPlayer *player = reinterpret_cast<BluetoothPlayer *>(context);
+    telemetryBTPacket(len / 4, player->a2dp->sample_rate());
     player->eq->processBuffer((int16_t *)data, len/2, 2, 1); 
 }
@@ -4,9 +4,18 @@
 #include <Arduino.h>
 #include "BluetoothA2DPSink.h"
 #include "AudioOutputFilter3BandEQ.h"
+#include "eventbus.h"
 #include "menu.h"
 #include "playlist.h"
 
+// Only the prompts are decoded, the A2DP stack needs the rest
+#define BLUETOOTH_DECODER_CPU 30
+#define BLUETOOTH_DECODER_RAM (24 * 1024)
+
+// Heap the stack may keep after it has been shut down, if more is missing
+// the device is restarted instead
+#define BLUETOOTH_HEAP_TOLERANCE (8 * 1024)
+
 typedef enum _BTState {
     BTStateStopped = 0,
     BTStatePlaying = 1,
@@ -15,12 +24,17 @@ typedef enum _BTState {
 
 class BluetoothPlayer {
     public:
-        BluetoothPlayer(Playlist *playlist, AudioOutputFilter3BandEQ *eq = NULL);
+        BluetoothPlayer(Playlist *playlist, EventBus *bus, AudioOutputFilter3BandEQ *eq = NULL);
         ~BluetoothPlayer();
 
         Menu *makeMenu();
         Playlist *playlist;
+        EventBus *bus;
     
+        // Called if the Bluetooth stack could not be shut down cleanly,
+        // has to restart the device
+        void registerRestartCallback(void (*callback)(void *context), void *context);
+
         // Internal for menu handling
         BluetoothA2DPSink *makeSink();
         void destroySink();
@@ -34,7 +48,13 @@ class BluetoothPlayer {
         void setState(BTState state);
 
         private:
+            bool shutdownStack();
+
             BTState state;
+            uint32_t heapBeforeStart;
+            uint32_t heapAccounted;     // Booked for the stack in heapstats.h
+            void (*restartCallback)(void *);
+            void *restartContext;
 };
 
 #endif
\ No newline at end of file
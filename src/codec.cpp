@@ -0,0 +1,97 @@
+#include "codec.h"
+
+static const char *names[AudioCodecCount] = {
+    "unknown",
+    "MP3",
+    "AAC",
+    "WAV",
+    "FLAC",
+    "Ogg"
+};
+
+// MPEG audio layer III bitrates in kbit/s, MPEG-1 and MPEG-2/2.5
+static const uint16_t mp3Bitrates[2][15] = {
+    { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 },
+    { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 }
+};
+static const uint16_t mp3SampleRates[3] = { 44100, 48000, 32000 };
+
+const char *codecName(AudioCodec codec) {
+    return names[codec];
+}
+
+AudioCodec codecForContentType(const char *contentType) {
+    if (!contentType || !contentType[0]) return AudioCodecUnknown;
+
+    // audio/aac, audio/aacp, audio/x-aac
+    if (strstr(contentType, "aac")) return AudioCodecAAC;
+    if (strstr(contentType, "mpeg") || strstr(contentType, "mp3")) return AudioCodecMP3;
+    return AudioCodecUnknown;
+}
+
+// Length of the ADTS frame starting at data, 0 if there is none
+static size_t adtsFrameLength(const uint8_t *data, size_t len) {
+    if (len < 7) return 0;
+    if ((data[0] != 0xff) || ((data[1] & 0xf6) != 0xf0)) return 0;
+
+    size_t length = ((data[3] & 0x03) << 11) | (data[4] << 3) | (data[5] >> 5);
+    return (length >= 7) ? length : 0;
+}
+
+// Length of the MPEG layer III frame starting at data, 0 if there is none
+static size_t mp3FrameLength(const uint8_t *data, size_t len) {
+    if (len < 4) return 0;
+    if ((data[0] != 0xff) || ((data[1] & 0xe0) != 0xe0)) return 0;
+
+    uint8_t version = (data[1] >> 3) & 0x03;    // 0: 2.5, 2: 2, 3: 1
+    uint8_t layer = (data[1] >> 1) & 0x03;      // 1: layer III
+    uint8_t bitrateIndex = data[2] >> 4;
+    uint8_t rateIndex = (data[2] >> 2) & 0x03;
+    uint8_t padding = (data[2] >> 1) & 0x01;
+
+    if ((version == 1) || (layer != 1) || (bitrateIndex == 0) || (bitrateIndex == 15) || (rateIndex == 3)) return 0;
+
+    uint32_t bitrate = mp3Bitrates[(version == 3) ? 0 : 1][bitrateIndex] * 1000;
+    uint32_t sampleRate = mp3SampleRates[rateIndex] >> ((version == 3) ? 0 : (version == 2) ? 1 : 2);
+    uint32_t samples = (version == 3) ? 144 : 72;
+
+    return (samples * bitrate) / sampleRate + padding;
+}
+
+AudioCodec sniffCodec(const uint8_t *data, size_t len) {
+    AudioCodec candidate = AudioCodecUnknown;
+
+    if (len > CODEC_SNIFF_SIZE) len = CODEC_SNIFF_SIZE;
+
+    // Files start with a container header
+    if ((len >= 3) && (memcmp(data, "ID3", 3) == 0)) return AudioCodecMP3;
+    if ((len >= 12) && (memcmp(data, "RIFF", 4) == 0) && (memcmp(data + 8, "WAVE", 4) == 0)) return AudioCodecWAV;
+    if ((len >= 4) && (memcmp(data, "fLaC", 4) == 0)) return AudioCodecFLAC;
+    if ((len >= 4) && (memcmp(data, "OggS", 4) == 0)) return AudioCodecOgg;
+
+    // A sync word may appear by chance, so it only counts if the next
+    // frame starts right where this one ends
+    for (size_t i = 0; i + 4 <= len; i++) {
+        if (data[i] != 0xff) continue;
+
+        size_t length = adtsFrameLength(data + i, len - i);
+        if (length) {
+            if (i + length + 7 > len) {
+                if (candidate == AudioCodecUnknown) candidate = AudioCodecAAC;
+            } else if (adtsFrameLength(data + i + length, len - i - length)) {
+                return AudioCodecAAC;
+            }
+            continue;
+        }
+
+        length = mp3FrameLength(data + i, len - i);
+        if (length) {
+            if (i + length + 4 > len) {
+                if (candidate == AudioCodecUnknown) candidate = AudioCodecMP3;
+            } else if (mp3FrameLength(data + i + length, len - i - length)) {
+                return AudioCodecMP3;
+            }
+        }
+    }
+    return candidate;
+}
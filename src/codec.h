@@ -0,0 +1,29 @@
+#ifndef LITTLESPEAKER_CODEC_H
+#define LITTLESPEAKER_CODEC_H
+
+#include <Arduino.h>
+
+typedef enum _AudioCodec {
+    AudioCodecUnknown = 0,
+    AudioCodecMP3 = 1,
+    AudioCodecAAC = 2,      // ADTS framed AAC and HE-AAC (AAC+)
+    AudioCodecWAV = 3,
+    AudioCodecFLAC = 4,
+    AudioCodecOgg = 5,      // Vorbis or Opus, not told apart
+    AudioCodecCount
+} AudioCodec;
+
+// Bytes looked at when searching for a frame sync
+#define CODEC_SNIFF_SIZE 2048
+
+const char *codecName(AudioCodec codec);
+
+// Codec announced by the HTTP Content-Type header
+AudioCodec codecForContentType(const char *contentType);
+
+// Codec found by the container magic at the start of the data or by
+// looking for frame sync words, stream data may start in the middle of
+// a frame
+AudioCodec sniffCodec(const uint8_t *data, size_t len);
+
+#endif
@@ -0,0 +1,250 @@
+#include "console.h"
+#include "logger.h"
+#include "telemetry.h"
+#include "heapstats.h"
+#include "profiler.h"
+#include "trace.h"
+#include "arena.h"
+#include "benchmark.h"
+
+static const ConsoleCommand *commands[CONSOLE_MAX_COMMANDS];
+static uint8_t numCommands = 0;
+static TaskHandle_t consoleTask = NULL;
+
+bool registerConsoleCommand(const ConsoleCommand *command) {
+    if (numCommands >= CONSOLE_MAX_COMMANDS) return false;
+    commands[numCommands++] = command;
+    return true;
+}
+
+static const ConsoleCommand *findCommand(const char *name) {
+    for (uint8_t i = 0; i < numCommands; i++) {
+        if (strcmp(name, commands[i]->name) == 0) return commands[i];
+        if (commands[i]->alias && (strcmp(name, commands[i]->alias) == 0)) return commands[i];
+    }
+    return NULL;
+}
+
+static void printUsage(Print *out, const ConsoleCommand *command) {
+    out->printf("Usage: %s %s\n", command->name, command->arguments ? command->arguments : "");
+}
+
+// Splits the line at spaces in place and runs the command
+static void execute(Print *out, char *line) {
+    char *argv[CONSOLE_MAX_ARGUMENTS];
+    int argc = 0;
+
+    char *position = line;
+    while (*position) {
+        while (*position == ' ') *position++ = '\0';
+        if (*position == '\0') break;
+        if (argc == CONSOLE_MAX_ARGUMENTS) {
+            out->println("Too many arguments");
+            return;
+        }
+        argv[argc++] = position;
+        while (*position && (*position != ' ')) position++;
+    }
+    if (argc == 0) return;
+
+    const ConsoleCommand *command = findCommand(argv[0]);
+    if (command == NULL) {
+        out->printf("Unknown command '%s', try help\n", argv[0]);
+        return;
+    }
+    LOGD(LogModuleSystem, "Console: %s", argv[0]);
+    if (!command->run(out, argc, argv)) {
+        printUsage(out, command);
+    }
+}
+
+// The failure hook only counts, the report is printed here where a
+// failing allocation cannot recurse into it
+static void reportAllocFailures() {
+    static uint32_t reported = 0;
+    uint32_t failures = getHeapAllocFailures();
+    if (failures == reported) return;
+
+    Serial.printf("%u failed allocations since boot\n", (unsigned)failures);
+    printHeapStats(&Serial);
+
+    // Failures of the report itself are not reported again
+    reported = getHeapAllocFailures();
+}
+
+static void runConsole(void *context) {
+    char line[CONSOLE_LINE_LENGTH];
+    size_t length = 0;
+    bool overflow = false;
+
+    while (true) {
+        if (!Serial.available()) {
+            reportAllocFailures();
+            vTaskDelay(pdMS_TO_TICKS(CONSOLE_POLL_INTERVAL_MS));
+            continue;
+        }
+
+        int c = Serial.read();
+        if ((c == '\r') || (c == '\n')) {
+            line[length] = '\0';
+            if (overflow) {
+                Serial.printf("Line longer than %d characters, ignored\n", CONSOLE_LINE_LENGTH - 1);
+            } else {
+                execute(&Serial, line);
+            }
+            length = 0;
+            overflow = false;
+        } else if ((c == '\b') || (c == 0x7f)) {
+            if (length > 0) length--;
+        } else if ((c == '\t') || (c >= ' ')) {
+            if (length < sizeof(line) - 1) {
+                line[length++] = (c == '\t') ? ' ' : c;
+            } else {
+                overflow = true;
+            }
+        }
+    }
+}
+
+void consoleBegin(UBaseType_t priority, BaseType_t core) {
+    if (consoleTask) return;
+    xTaskCreatePinnedToCore(runConsole, "console", CONSOLE_TASK_STACK_SIZE, NULL, priority, &consoleTask, core);
+}
+
+//
+// Built in commands
+//
+
+static bool runHelp(Print *out, int argc, char **argv) {
+    for (uint8_t i = 0; i < numCommands; i++) {
+        const ConsoleCommand *command = commands[i];
+        char usage[40];
+        snprintf(usage, sizeof(usage), "%s %s", command->name, command->arguments ? command->arguments : "");
+        out->printf("%-28s %s %s\n", usage, command->alias ? command->alias : " ", command->help);
+    }
+    return true;
+}
+
+static bool runHealth(Print *out, int argc, char **argv) {
+    printTelemetry(out);
+    return true;
+}
+
+static bool runHeap(Print *out, int argc, char **argv) {
+    printHeapStats(out);
+    return true;
+}
+
+static bool runTasks(Print *out, int argc, char **argv) {
+    printTaskProfile(out);
+    return true;
+}
+
+static bool runArena(Print *out, int argc, char **argv) {
+    printArenaBudgets(out);
+    out->printf("Current mode: %s\n", getArenaBudget(getArenaMode())->name);
+    return true;
+}
+
+static void printLevels(Print *out) {
+    for (int i = 0; i < LogModuleCount; i++) {
+        LogModule module = (LogModule)i;
+        out->printf("%-10s %s\n", logModuleName(module), logLevelName(logGetLevel(module)));
+    }
+}
+
+static bool runLog(Print *out, int argc, char **argv) {
+    if (argc == 1) {
+        printLevels(out);
+        return true;
+    }
+    if (argc != 3) return false;
+
+    int level = logLevelNamed(argv[2]);
+    if (level < 0) {
+        out->printf("Unknown level '%s'\n", argv[2]);
+        return false;
+    }
+    if (strcmp(argv[1], "all") == 0) {
+        for (int i = 0; i < LogModuleCount; i++) {
+            logSetLevel((LogModule)i, (LogLevel)level);
+        }
+        return true;
+    }
+
+    LogModule module = logModuleNamed(argv[1]);
+    if (module == LogModuleCount) {
+        out->printf("Unknown module '%s'\n", argv[1]);
+        return false;
+    }
+    logSetLevel(module, (LogLevel)level);
+    return true;
+}
+
+static bool runTrace(Print *out, int argc, char **argv) {
+    if (argc != 1) return false;
+    traceDump(out);
+    return true;
+}
+
+static bool runStream(Print *out, int argc, char **argv) {
+    bool enabled = !isTraceStreaming();
+
+    if (argc == 2) {
+        if (strcmp(argv[1], "on") == 0) {
+            enabled = true;
+        } else if (strcmp(argv[1], "off") == 0) {
+            enabled = false;
+        } else {
+            return false;
+        }
+    } else if (argc != 1) {
+        return false;
+    }
+    traceStream(enabled);
+#if !TRACING
+    out->println("Tracing is not compiled in, build with -DTRACING=1");
+#endif
+    return true;
+}
+
+static bool runBenchmark(Print *out, int argc, char **argv) {
+    if ((argc < 2) || (argc > 3)) return false;
+
+    if (argc == 3) {
+        // Only the DSP benchmark has references to record
+        if ((strcmp(argv[1], "dsp") != 0) || (strcmp(argv[2], "record") != 0)) return false;
+        benchmarkDspAll(true);
+    } else if (strcmp(argv[1], "dsp") == 0) {
+        benchmarkDspAll();
+    } else if (strcmp(argv[1], "decode") == 0) {
+        benchmarkDecodeDirectory();
+    } else if (strcmp(argv[1], "playback") == 0) {
+        benchmarkPlaybackDirectory();
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static const ConsoleCommand helpCommand = { "help", NULL, NULL, "this list", runHelp };
+static const ConsoleCommand healthCommand = { "health", "h", NULL, "audio health since boot and the last interval", runHealth };
+static const ConsoleCommand heapCommand = { "heap", "m", NULL, "heap use by subsystem and fragmentation snapshots", runHeap };
+static const ConsoleCommand tasksCommand = { "tasks", "p", NULL, "CPU load and stack headroom of the tasks", runTasks };
+static const ConsoleCommand arenaCommand = { "arena", NULL, NULL, "memory arenas of the modes", runArena };
+static const ConsoleCommand logCommand = { "log", NULL, "[MODULE|all LEVEL]", "show or set the log levels", runLog };
+static const ConsoleCommand traceCommand = { "trace", "t", NULL, "dump the trace for chrome://tracing", runTrace };
+static const ConsoleCommand streamCommand = { "stream", "s", "[on|off]", "stream the trace, toggles without argument", runStream };
+static const ConsoleCommand benchmarkCommand = { "bench", NULL, "dsp [record]|decode|playback", "run a benchmark, slower while playing", runBenchmark };
+
+void registerDefaultCommands() {
+    registerConsoleCommand(&helpCommand);
+    registerConsoleCommand(&healthCommand);
+    registerConsoleCommand(&heapCommand);
+    registerConsoleCommand(&tasksCommand);
+    registerConsoleCommand(&arenaCommand);
+    registerConsoleCommand(&logCommand);
+    registerConsoleCommand(&traceCommand);
+    registerConsoleCommand(&streamCommand);
+    registerConsoleCommand(&benchmarkCommand);
+}
@@ -0,0 +1,37 @@
+#ifndef LITTLESPEAKER_CONSOLE_H
+#define LITTLESPEAKER_CONSOLE_H
+
+#include <Arduino.h>
+
+#define CONSOLE_MAX_COMMANDS 24
+#define CONSOLE_MAX_ARGUMENTS 6
+#define CONSOLE_LINE_LENGTH 96
+
+// The benchmarks run on this stack
+#define CONSOLE_TASK_STACK_SIZE 8192
+#define CONSOLE_POLL_INTERVAL_MS 20
+
+typedef struct _ConsoleCommand {
+    const char *name;
+    const char *alias;      // Single letter shortcut, NULL if none
+    const char *arguments;  // For the usage line, NULL if none
+    const char *help;
+    // Prints the usage if false is returned, argv[0] is the command
+    bool (*run)(Print *out, int argc, char **argv);
+} ConsoleCommand;
+
+//
+// Line based command console on the serial port, for scripted tests on
+// the hardware. Lines are read and commands run by a low priority task.
+// Commands that change playback do not call into the players but post
+// events to the bus, like the buttons do, so they take the same path.
+//
+// The reports and benchmarks are built in, the commands that need the
+// players are registered by main.cpp.
+//
+bool registerConsoleCommand(const ConsoleCommand *command);
+void registerDefaultCommands();
+
+void consoleBegin(UBaseType_t priority = 1, BaseType_t core = 0);
+
+#endif
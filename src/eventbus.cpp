@@ -0,0 +1,125 @@
+#include "eventbus.h"
+#include "logger.h"
+#include "esp_timer.h"
+
+static void dispatchTask(void *context);
+
+static const char *eventNames[EventTypeCount] = {
+    "button",
+    "encoder",
+    "playlist end",
+    "bt connection",
+    "bt play state",
+    "wifi",
+    "console"
+};
+
+EventBus::EventBus() {
+    memset(this->subscribers, 0, sizeof(this->subscribers));
+    memset(this->stats, 0, sizeof(this->stats));
+    this->queue = xQueueCreateStatic(EVENT_QUEUE_LENGTH, sizeof(Event), this->queueStorage, &this->queueBuffer);
+    this->task = NULL;
+}
+
+EventBus::~EventBus() {
+    if (this->task) {
+        vTaskDelete(this->task);
+    }
+    vQueueDelete(this->queue);
+}
+
+void EventBus::begin(UBaseType_t priority, BaseType_t core) {
+    if (this->task) return;
+
+    this->task = xTaskCreateStaticPinnedToCore(
+        dispatchTask, "events", EVENT_TASK_STACK_SIZE, this, priority,
+        this->taskStack, &this->taskBuffer, core
+    );
+}
+
+bool EventBus::subscribe(EventType type, EventHandler handler, void *context) {
+    EventSubscriber *slots = this->subscribers[type];
+
+    for (int i = 0; i < MAX_EVENT_SUBSCRIBERS; i++) {
+        if (slots[i].handler == NULL) {
+            slots[i].context = context;
+            slots[i].handler = handler;
+            return true;
+        }
+    }
+
+    LOGE(LogModuleEvents, "Too many subscribers for event '%s'", eventNames[type]);
+    return false;
+}
+
+bool EventBus::post(EventType type, int32_t value, int64_t timestamp) {
+    Event event;
+
+    event.type = type;
+    event.value = value;
+    event.timestamp = timestamp ? timestamp : esp_timer_get_time();
+
+    if (xQueueSend(this->queue, &event, 0) != pdTRUE) {
+        __atomic_fetch_add(&this->stats[type].dropped, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    return true;
+}
+
+void EventBus::run() {
+    Event event;
+
+    while (true) {
+        if (xQueueReceive(this->queue, &event, portMAX_DELAY) == pdTRUE) {
+            this->dispatch(&event);
+        }
+    }
+}
+
+void EventBus::dispatch(const Event *event) {
+    EventStats *stats = this->stats + event->type;
+    EventSubscriber *slots = this->subscribers[event->type];
+    int64_t start = esp_timer_get_time();
+
+    for (int i = 0; i < MAX_EVENT_SUBSCRIBERS; i++) {
+        if (slots[i].handler == NULL) break;
+        slots[i].handler(event, slots[i].context);
+    }
+
+    int64_t end = esp_timer_get_time();
+    uint32_t latency = start - event->timestamp;
+    uint32_t duration = end - start;
+
+    stats->count++;
+    stats->latencySum += latency;
+    stats->handlerSum += duration;
+    if (latency > stats->latencyMax) stats->latencyMax = latency;
+    if (duration > stats->handlerMax) stats->handlerMax = duration;
+
+    if (duration > EVENT_SLOW_HANDLER_US) {
+        LOGW(LogModuleEvents, "Slow event '%s': queued %u us, handled in %u us", eventNames[event->type], latency, duration);
+    }
+}
+
+void EventBus::printStats(Print *out) {
+    out->println("Event            count  drop  avg lat  max lat  avg run  max run (us)");
+    for (int i = 0; i < EventTypeCount; i++) {
+        EventStats *stats = this->stats + i;
+        uint32_t count = stats->count ? stats->count : 1;
+
+        out->printf("%-15s %6u %5u %8u %8u %8u %8u\n",
+            eventNames[i], stats->count, stats->dropped,
+            (uint32_t)(stats->latencySum / count), stats->latencyMax,
+            (uint32_t)(stats->handlerSum / count), stats->handlerMax
+        );
+    }
+}
+
+void EventBus::resetStats() {
+    memset(this->stats, 0, sizeof(this->stats));
+}
+
+static void dispatchTask(void *context) {
+    EventBus *bus = reinterpret_cast<EventBus *>(context);
+    bus->run();
+}
@@ -0,0 +1,83 @@
+#ifndef LITTLESPEAKER_EVENTBUS_H
+#define LITTLESPEAKER_EVENTBUS_H
+
+#include <Arduino.h>
+
+#define EVENT_QUEUE_LENGTH 32
+#define MAX_EVENT_SUBSCRIBERS 4
+#define EVENT_TASK_STACK_SIZE 6144
+
+// Handlers running longer than this are reported on the console
+#define EVENT_SLOW_HANDLER_US 50000
+
+typedef enum _EventType {
+    EventButtonClick = 0,           // value: pin
+    EventEncoderStep = 1,           // value: direction
+    EventPlaylistEnd = 2,           // value: playlist generation
+    EventBluetoothConnection = 3,   // value: connected
+    EventBluetoothPlayState = 4,    // value: esp_avrc_playback_stat_t
+    EventWifi = 5,                  // value: attempt << 4 | WifiSignal
+    EventConsole = 6,               // value: request << 24 | argument << 12 | argument
+    EventTypeCount
+} EventType;
+
+typedef struct _Event {
+    EventType type;
+    int32_t value;
+    int64_t timestamp;  // Origin of the event in microseconds (interrupt or post time)
+} Event;
+
+typedef void (*EventHandler)(const Event *event, void *context);
+
+typedef struct _EventSubscriber {
+    EventHandler handler;
+    void *context;
+} EventSubscriber;
+
+typedef struct _EventStats {
+    uint32_t count;
+    uint32_t dropped;
+    uint32_t latencyMax;    // origin until dispatch in microseconds
+    uint64_t latencySum;
+    uint32_t handlerMax;    // time spent in all handlers in microseconds
+    uint64_t handlerSum;
+} EventStats;
+
+//
+// Small typed event bus: Events may be posted from any task,
+// they are queued in a fixed size queue and dispatched one after another
+// by a single task. All state transitions of the players thus happen
+// in the dispatcher task only.
+//
+class EventBus {
+    public:
+        EventBus();
+        ~EventBus();
+
+        void begin(UBaseType_t priority = 2, BaseType_t core = 1);
+
+        bool subscribe(EventType type, EventHandler handler, void *context = NULL);
+
+        bool post(EventType type, int32_t value = 0, int64_t timestamp = 0);
+
+        void printStats(Print *out);
+        void resetStats();
+
+        void run();
+
+    private:
+        void dispatch(const Event *event);
+
+        EventSubscriber subscribers[EventTypeCount][MAX_EVENT_SUBSCRIBERS];
+        EventStats stats[EventTypeCount];
+
+        QueueHandle_t queue;
+        StaticQueue_t queueBuffer;
+        uint8_t queueStorage[EVENT_QUEUE_LENGTH * sizeof(Event)];
+
+        TaskHandle_t task;
+        StaticTask_t taskBuffer;
+        StackType_t taskStack[EVENT_TASK_STACK_SIZE];
+};
+
+#endif
@@ -0,0 +1,264 @@
+#include "formats.h"
+#include "trace.h"
+#include "heapstats.h"
+
+#include "AudioFileSourceSD.h"
+#include "AudioGeneratorMP3a.h"
+#include "AudioGeneratorAAC.h"
+#include "AudioGeneratorPCM.h"
+#include "AudioGeneratorFLACLite.h"
+
+static const SourceFactory *sources[FORMAT_MAX_SOURCES];
+static const DecoderFactory *decoders[FORMAT_MAX_DECODERS];
+static uint8_t numSources = 0;
+static uint8_t numDecoders = 0;
+
+// Idle decoder per registered factory
+static AudioGenerator *idleDecoders[FORMAT_MAX_DECODERS];
+static SemaphoreHandle_t poolMutex = NULL;
+static StaticSemaphore_t poolMutexBuffer;
+static PoolStats poolStats;
+
+bool registerSource(const SourceFactory *factory) {
+    if (numSources >= FORMAT_MAX_SOURCES) return false;
+    sources[numSources++] = factory;
+    return true;
+}
+
+bool registerDecoder(const DecoderFactory *factory) {
+    if (numDecoders >= FORMAT_MAX_DECODERS) return false;
+    if (poolMutex == NULL) {
+        poolMutex = xSemaphoreCreateMutexStatic(&poolMutexBuffer);
+    }
+    idleDecoders[numDecoders] = NULL;
+    decoders[numDecoders++] = factory;
+    return true;
+}
+
+const SourceFactory *findSource(const char *url) {
+    for (uint8_t i = 0; i < numSources; i++) {
+        if (strncmp(url, sources[i]->prefix, strlen(sources[i]->prefix)) == 0) {
+            return sources[i];
+        }
+    }
+    return NULL;
+}
+
+const DecoderFactory *findDecoder(AudioCodec codec) {
+    for (uint8_t i = 0; i < numDecoders; i++) {
+        if (decoders[i]->codec == codec) {
+            return decoders[i];
+        }
+    }
+    return NULL;
+}
+
+AudioCodec probeSource(AudioFileSource *source) {
+    uint8_t data[FORMAT_PROBE_SIZE];
+    uint32_t start = 0;
+
+    uint32_t length = source->read(data, sizeof(data));
+    if ((length >= 10) && (memcmp(data, "ID3", 3) == 0)) {
+        // Syncsafe size without the header, plus the footer if present
+        start = 10 + ((data[6] & 0x7f) << 21) + ((data[7] & 0x7f) << 14) + ((data[8] & 0x7f) << 7) + (data[9] & 0x7f);
+        if (data[5] & 0x10) start += 10;
+        if (!source->seek(start, SEEK_SET)) return AudioCodecUnknown;
+        length = source->read(data, sizeof(data));
+    }
+    if (!source->seek(start, SEEK_SET)) return AudioCodecUnknown;
+    return sniffCodec(data, length);
+}
+
+//
+// Decoder pool
+//
+
+static int8_t indexOfDecoder(const DecoderFactory *factory) {
+    for (uint8_t i = 0; i < numDecoders; i++) {
+        if (decoders[i] == factory) return i;
+    }
+    return -1;
+}
+
+AudioGenerator *acquireDecoder(const DecoderFactory *factory) {
+    int8_t index = indexOfDecoder(factory);
+    AudioGenerator *decoder = NULL;
+
+    if (index >= 0) {
+        xSemaphoreTake(poolMutex, portMAX_DELAY);
+        decoder = idleDecoders[index];
+        idleDecoders[index] = NULL;
+        if (decoder) {
+            poolStats.hits++;
+            poolStats.idleBytes -= factory->ramBytes;
+        } else {
+            poolStats.misses++;
+        }
+        xSemaphoreGive(poolMutex);
+    }
+    if (decoder == NULL) {
+        decoder = factory->create();
+        if (decoder) heapAccount(HeapTagDecoder, factory->ramBytes);
+    }
+    return decoder;
+}
+
+void releaseDecoder(const DecoderFactory *factory, AudioGenerator *decoder) {
+    int8_t index = indexOfDecoder(factory);
+
+    if (index >= 0) {
+        xSemaphoreTake(poolMutex, portMAX_DELAY);
+        if (idleDecoders[index] == NULL) {
+            idleDecoders[index] = decoder;
+            poolStats.idleBytes += factory->ramBytes;
+            decoder = NULL;
+        }
+        xSemaphoreGive(poolMutex);
+    }
+    if (decoder) heapAccount(HeapTagDecoder, -(int32_t)factory->ramBytes);
+    delete decoder;
+}
+
+void trimPools(uint8_t cpuPercent, uint32_t ramBytes) {
+    AudioGenerator *freed[FORMAT_MAX_DECODERS];
+    uint32_t freedBytes[FORMAT_MAX_DECODERS];
+    uint8_t numFreed = 0;
+
+    if (poolMutex == NULL) return;
+    xSemaphoreTake(poolMutex, portMAX_DELAY);
+    for (uint8_t i = 0; i < numDecoders; i++) {
+        if (!idleDecoders[i]) continue;
+        if ((decoders[i]->cpuPercent <= cpuPercent) && (decoders[i]->ramBytes <= ramBytes)) continue;
+        freedBytes[numFreed] = decoders[i]->ramBytes;
+        freed[numFreed++] = idleDecoders[i];
+        poolStats.idleBytes -= decoders[i]->ramBytes;
+        idleDecoders[i] = NULL;
+    }
+    xSemaphoreGive(poolMutex);
+
+    // Destructors may take a while, not under the lock
+    for (uint8_t i = 0; i < numFreed; i++) {
+        heapAccount(HeapTagDecoder, -(int32_t)freedBytes[i]);
+        delete freed[i];
+    }
+}
+
+void getPoolStats(PoolStats *stats) {
+    if (poolMutex == NULL) {
+        memset(stats, 0, sizeof(PoolStats));
+        return;
+    }
+    xSemaphoreTake(poolMutex, portMAX_DELAY);
+    memcpy(stats, &poolStats, sizeof(PoolStats));
+    xSemaphoreGive(poolMutex);
+}
+
+//
+// Built in formats
+//
+
+// Card reads show up in the trace
+class AudioFileSourceSDTraced : public AudioFileSourceSD
+{
+  public:
+    virtual uint32_t read(void *data, uint32_t len) override
+    {
+      TRACE_SCOPE(TraceEventSDRead);
+      return AudioFileSourceSD::read(data, len);
+    }
+};
+
+// A released file source is kept and opened again for the next file
+static AudioFileSourceSD *idleSDFile = NULL;
+
+static AudioFileSource *openSDFile(const char *url) {
+    AudioFileSourceSD *source = idleSDFile;
+    idleSDFile = NULL;
+
+    if (source == NULL) {
+        source = new AudioFileSourceSDTraced();
+        if (source == NULL) return NULL;
+    }
+    if (!source->open(url)) {
+        idleSDFile = source;
+        return NULL;
+    }
+    return source;
+}
+
+static void releaseSDFile(AudioFileSource *source) {
+    source->close();
+    if (idleSDFile == NULL) {
+        idleSDFile = static_cast<AudioFileSourceSD *>(source);
+    } else {
+        delete source;
+    }
+}
+
+//
+// The library decoders only reset their buffers in the constructor, a
+// pooled one would start with the rest of the previous item
+//
+class AudioGeneratorMP3aPooled : public AudioGeneratorMP3a
+{
+  public:
+    virtual bool begin(AudioFileSource *source, AudioOutput *output) override
+    {
+      buffValid = 0;
+      lastFrameEnd = 0;
+      validSamples = 0;
+      curSample = 0;
+      return AudioGeneratorMP3a::begin(source, output);
+    }
+};
+
+class AudioGeneratorAACPooled : public AudioGeneratorAAC
+{
+  public:
+    virtual bool begin(AudioFileSource *source, AudioOutput *output) override
+    {
+      buffValid = 0;
+      lastFrameEnd = 0;
+      validSamples = 0;
+      curSample = 0;
+      return AudioGeneratorAAC::begin(source, output);
+    }
+};
+
+static AudioGenerator *createMP3() {
+    return new AudioGeneratorMP3aPooled();
+}
+
+static AudioGenerator *createAAC() {
+    return new AudioGeneratorAACPooled();
+}
+
+static AudioGenerator *createPCM() {
+    return new AudioGeneratorPCM();
+}
+
+static AudioGenerator *createFLAC() {
+    return new AudioGeneratorFLACLite();
+}
+
+static bool seekFLAC(AudioGenerator *decoder, uint32_t ms) {
+    return static_cast<AudioGeneratorFLACLite *>(decoder)->seekTo(ms);
+}
+
+static const SourceFactory sdSource = { "/", SourceKindFile, openSDFile, releaseSDFile };
+static const SourceFactory httpSource = { "http://", SourceKindStream, NULL, NULL };
+
+// Rough figures from the decode benchmark, HE-AAC needs the upper end
+static const DecoderFactory mp3Decoder = { AudioCodecMP3, 15, 24 * 1024, createMP3, NULL };
+static const DecoderFactory aacDecoder = { AudioCodecAAC, 25, 36 * 1024, createAAC, NULL };
+static const DecoderFactory wavDecoder = { AudioCodecWAV, 2, sizeof(AudioGeneratorPCM), createPCM, NULL };
+static const DecoderFactory flacDecoder = { AudioCodecFLAC, 30, sizeof(AudioGeneratorFLACLite) + FLAC_SAMPLE_BUFFER_SIZE, createFLAC, seekFLAC };
+
+void registerDefaultFormats() {
+    registerSource(&sdSource);
+    registerSource(&httpSource);
+    registerDecoder(&mp3Decoder);
+    registerDecoder(&aacDecoder);
+    registerDecoder(&wavDecoder);
+    registerDecoder(&flacDecoder);
+}
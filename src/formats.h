@@ -0,0 +1,72 @@
+#ifndef LITTLESPEAKER_FORMATS_H
+#define LITTLESPEAKER_FORMATS_H
+
+#include <Arduino.h>
+#include "AudioFileSource.h"
+#include "AudioGenerator.h"
+#include "codec.h"
+
+#define FORMAT_MAX_SOURCES 4
+#define FORMAT_MAX_DECODERS 8
+
+// Bytes read from the start of a file to find its format
+#define FORMAT_PROBE_SIZE 1024
+
+typedef enum _SourceKind {
+    SourceKindFile = 0,     // Opened right away by the playlist
+    SourceKindStream = 1    // Opened in the background by the stream connector
+} SourceKind;
+
+typedef struct _SourceFactory {
+    const char *prefix;     // URL scheme or path prefix, e.g. "http://" or "/"
+    SourceKind kind;
+    AudioFileSource *(*open)(const char *url);      // NULL for streams
+    void (*release)(AudioFileSource *source);       // Closes, may keep it for the next open
+} SourceFactory;
+
+typedef struct _DecoderFactory {
+    AudioCodec codec;
+    uint8_t cpuPercent;     // One core at 240 MHz, 44.1 kHz stereo
+    uint32_t ramBytes;      // Heap allocated by the decoder
+    AudioGenerator *(*create)();
+    bool (*seek)(AudioGenerator *decoder, uint32_t ms);    // NULL if not seekable
+} DecoderFactory;
+
+typedef struct _PoolStats {
+    uint32_t hits;          // Served by an idle object
+    uint32_t misses;        // Had to be allocated
+    uint32_t idleBytes;     // Held by idle decoders
+} PoolStats;
+
+//
+// Registry of the sources and decoders the playlist can build an audio
+// chain from. Sources are picked by the prefix of the item, decoders by
+// the codec found in the first bytes of the data. A new format only has
+// to register its factory, usually from registerDefaultFormats().
+//
+// Factories are registered during setup, lookups are read only.
+//
+// Decoders are pooled: a released decoder is kept per codec and rebound
+// to the next item with begin(), so a run of tracks in the same format
+// allocates nothing after the first one. The pool is guarded by a mutex,
+// trimPools() may be called from any task.
+//
+bool registerSource(const SourceFactory *factory);
+bool registerDecoder(const DecoderFactory *factory);
+void registerDefaultFormats();
+
+const SourceFactory *findSource(const char *url);
+const DecoderFactory *findDecoder(AudioCodec codec);
+
+// Reads the first bytes of a seekable source and positions it at the
+// start of the audio data, an ID3v2 tag is skipped without reading it
+AudioCodec probeSource(AudioFileSource *source);
+
+AudioGenerator *acquireDecoder(const DecoderFactory *factory);
+void releaseDecoder(const DecoderFactory *factory, AudioGenerator *decoder);
+
+// Frees idle decoders above the budget, trimPools(0, 0) frees all
+void trimPools(uint8_t cpuPercent, uint32_t ramBytes);
+void getPoolStats(PoolStats *stats);
+
+#endif
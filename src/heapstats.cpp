@@ -0,0 +1,203 @@
+#include "heapstats.h"
+#include "logger.h"
+#include "esp_heap_caps.h"
+
+#define HEAP_MAGIC 0x4854
+
+// Keeps the alignment of malloc()
+typedef struct _HeapHeader {
+    uint32_t size;
+    uint16_t tag;
+    uint16_t magic;
+} HeapHeader;
+
+static const char *tagNames[HeapTagCount] = {
+    "other",
+    "playlist",
+    "decoder",
+    "webradio",
+    "menu",
+    "bluetooth",
+    "sd index",
+    "arena"
+};
+
+static HeapTagStats tags[HeapTagCount];
+static HeapSnapshot snapshots[HEAP_SNAPSHOTS];
+static uint32_t numSnapshots = 0;
+static uint32_t numFailures = 0;
+
+static __thread uint8_t scopeTag = HeapTagOther;
+
+//
+// Accounting, any task
+//
+
+static void grow(HeapTag tag, uint32_t bytes) {
+    HeapTagStats *stats = tags + tag;
+
+    uint32_t current = __atomic_add_fetch(&stats->current, bytes, __ATOMIC_RELAXED);
+    uint32_t peak = __atomic_load_n(&stats->peak, __ATOMIC_RELAXED);
+    while ((current > peak) &&
+        !__atomic_compare_exchange_n(&stats->peak, &peak, current, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static void book(HeapTag tag, uint32_t bytes) {
+    __atomic_fetch_add(&tags[tag].count, 1, __ATOMIC_RELAXED);
+    grow(tag, bytes);
+}
+
+static void unbook(HeapTag tag, uint32_t bytes) {
+    __atomic_fetch_sub(&tags[tag].current, bytes, __ATOMIC_RELAXED);
+}
+
+void *heapAlloc(HeapTag tag, size_t size) {
+    HeapHeader *header = reinterpret_cast<HeapHeader *>(malloc(sizeof(HeapHeader) + size));
+    if (header == NULL) return NULL;
+
+    header->size = size;
+    header->tag = tag;
+    header->magic = HEAP_MAGIC;
+    book(tag, size);
+    return header + 1;
+}
+
+// A mismatched pair is a bug, better found here than as a corrupted heap
+static HeapHeader *headerOf(void *ptr) {
+    HeapHeader *header = reinterpret_cast<HeapHeader *>(ptr) - 1;
+    if ((header->magic != HEAP_MAGIC) || (header->tag >= HeapTagCount)) {
+        LOGE(LogModuleSystem, "Block %p was not allocated by heapAlloc()", ptr);
+        logFlush();
+        abort();
+    }
+    return header;
+}
+
+void *heapRealloc(void *ptr, size_t size) {
+    if (ptr == NULL) return NULL;
+
+    HeapHeader *header = headerOf(ptr);
+    HeapTag tag = (HeapTag)header->tag;
+    uint32_t previous = header->size;
+
+    HeapHeader *moved = reinterpret_cast<HeapHeader *>(realloc(header, sizeof(HeapHeader) + size));
+    if (moved == NULL) return NULL;
+
+    moved->size = size;
+    if (size > previous) {
+        grow(tag, size - previous);
+    } else {
+        unbook(tag, previous - size);
+    }
+    return moved + 1;
+}
+
+void heapFree(void *ptr) {
+    if (ptr == NULL) return;
+
+    HeapHeader *header = headerOf(ptr);
+    header->magic = 0;
+    unbook((HeapTag)header->tag, header->size);
+    free(header);
+}
+
+void heapAccount(HeapTag tag, int32_t bytes) {
+    if (bytes > 0) {
+        book(tag, bytes);
+    } else if (bytes < 0) {
+        unbook(tag, -bytes);
+    }
+}
+
+void getHeapTagStats(HeapTag tag, HeapTagStats *stats) {
+    stats->current = __atomic_load_n(&tags[tag].current, __ATOMIC_RELAXED);
+    stats->peak = __atomic_load_n(&tags[tag].peak, __ATOMIC_RELAXED);
+    stats->count = __atomic_load_n(&tags[tag].count, __ATOMIC_RELAXED);
+}
+
+const char *heapTagName(HeapTag tag) {
+    return (tag < HeapTagCount) ? tagNames[tag] : NULL;
+}
+
+HeapScope::HeapScope(HeapTag tag) {
+    this->previous = (HeapTag)scopeTag;
+    scopeTag = tag;
+}
+
+HeapScope::~HeapScope() {
+    scopeTag = this->previous;
+}
+
+HeapTag heapScopeTag() {
+    return (HeapTag)scopeTag;
+}
+
+//
+// Snapshots
+//
+
+static uint32_t fragmentation(uint32_t free, uint32_t largest) {
+    return free ? 100 - (uint32_t)((uint64_t)largest * 100 / free) : 0;
+}
+
+// Slots are claimed atomically, a report printed while one is written may
+// show it half done
+void heapSnapshot(const char *label) {
+    uint32_t index = __atomic_fetch_add(&numSnapshots, 1, __ATOMIC_RELAXED);
+    HeapSnapshot *snapshot = snapshots + (index % HEAP_SNAPSHOTS);
+
+    snapshot->time = millis();
+    snapshot->free = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    snapshot->largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    snapshot->minimum = ESP.getMinFreeHeap();
+    for (int i = 0; i < HeapTagCount; i++) {
+        snapshot->current[i] = __atomic_load_n(&tags[i].current, __ATOMIC_RELAXED);
+    }
+    snapshot->label = label;
+
+    LOGI(LogModuleHealth, "Heap at %s: %u free, largest block %u (%u%% fragmented), minimum %u",
+        label, snapshot->free, snapshot->largest, fragmentation(snapshot->free, snapshot->largest), snapshot->minimum);
+}
+
+void heapAllocFailed() {
+    __atomic_fetch_add(&numFailures, 1, __ATOMIC_RELAXED);
+}
+
+uint32_t getHeapAllocFailures() {
+    return __atomic_load_n(&numFailures, __ATOMIC_RELAXED);
+}
+
+//
+// Report
+//
+
+void printHeapStats(Print *out) {
+    uint32_t free = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    uint32_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+
+    out->printf("Heap free %u, largest block %u (%u%% fragmented), minimum %u\n",
+        free, largest, fragmentation(free, largest), ESP.getMinFreeHeap());
+    out->println("tag          current     peak    count");
+    for (int i = 0; i < HeapTagCount; i++) {
+        HeapTagStats stats;
+        getHeapTagStats((HeapTag)i, &stats);
+        out->printf("%-10s %9u %8u %8u\n", tagNames[i], stats.current, stats.peak, stats.count);
+    }
+
+    uint32_t count = __atomic_load_n(&numSnapshots, __ATOMIC_RELAXED);
+    if (count == 0) return;
+
+    out->println("Snapshots, oldest first:");
+    for (uint32_t index = (count > HEAP_SNAPSHOTS) ? count - HEAP_SNAPSHOTS : 0; index < count; index++) {
+        const HeapSnapshot *snapshot = snapshots + (index % HEAP_SNAPSHOTS);
+        if (snapshot->label == NULL) continue;
+
+        out->printf("%6u s %-18s %7u free, largest %7u (%2u%%), minimum %u\n", snapshot->time / 1000, snapshot->label,
+            snapshot->free, snapshot->largest, fragmentation(snapshot->free, snapshot->largest), snapshot->minimum);
+        out->print("         ");
+        for (int i = 0; i < HeapTagCount; i++) {
+            if (snapshot->current[i]) out->printf(" %s %u", tagNames[i], snapshot->current[i]);
+        }
+        out->println();
+    }
+}
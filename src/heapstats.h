@@ -0,0 +1,81 @@
+#ifndef LITTLESPEAKER_HEAPSTATS_H
+#define LITTLESPEAKER_HEAPSTATS_H
+
+#include <Arduino.h>
+
+// Fragmentation snapshots kept, the oldest is overwritten
+#define HEAP_SNAPSHOTS 8
+
+typedef enum _HeapTag {
+    HeapTagOther = 0,       // C++ allocations outside of a scope, only with ALLOC_STATS
+    HeapTagPlaylist = 1,    // Item ring buffer
+    HeapTagDecoder = 2,     // Live decoders by the size their factory declares
+    HeapTagWebradio = 3,    // Station list, jitter and standby stream buffers
+    HeapTagMenu = 4,
+    HeapTagBluetooth = 5,   // What starting the stack took from the heap
+    HeapTagSDIndex = 6,     // Shuffle table
+    HeapTagArena = 7,       // Block of the current mode
+    HeapTagCount
+} HeapTag;
+
+typedef struct _HeapTagStats {
+    uint32_t current;       // Bytes
+    uint32_t peak;
+    uint32_t count;         // Allocations since boot
+} HeapTagStats;
+
+typedef struct _HeapSnapshot {
+    const char *label;      // Literal, NULL if the slot is unused
+    uint32_t time;          // millis()
+    uint32_t free;
+    uint32_t largest;       // Largest free block
+    uint32_t minimum;       // Lowest free heap since boot
+    uint32_t current[HeapTagCount];
+} HeapSnapshot;
+
+//
+// Heap use by subsystem. Buffers of our own code are allocated through
+// heapAlloc(), which keeps the size and tag in front of the block. Memory
+// that is allocated elsewhere, like by the Bluetooth stack, is measured
+// by its owner and booked with heapAccount().
+//
+// With ALLOC_STATS every C++ allocation is tagged as well, with the tag of
+// the innermost HeapScope of the calling task.
+//
+// heapRealloc() and heapFree() only take pointers from heapAlloc(),
+// anything else aborts. heapRealloc() keeps the tag of the block.
+void *heapAlloc(HeapTag tag, size_t size);
+void *heapRealloc(void *ptr, size_t size);
+void heapFree(void *ptr);
+
+// Bytes taken (positive) or given back (negative) outside of heapAlloc()
+void heapAccount(HeapTag tag, int32_t bytes);
+
+void getHeapTagStats(HeapTag tag, HeapTagStats *stats);
+const char *heapTagName(HeapTag tag);
+
+// Free heap and largest block next to the tags, logged and kept for the
+// report. Taken at every mode transition.
+void heapSnapshot(const char *label);
+
+// Only counts, safe in the allocation failure hook. The console prints the
+// report once the failure is seen, printing allocates itself.
+void heapAllocFailed();
+uint32_t getHeapAllocFailures();
+
+// Tags and snapshots, for the console and after a failed allocation
+void printHeapStats(Print *out);
+
+class HeapScope {
+    public:
+        HeapScope(HeapTag tag);
+        ~HeapScope();
+
+    private:
+        HeapTag previous;
+};
+
+// The tag of the calling task, for the counting operator new
+HeapTag heapScopeTag();
+
+#endif
@@ -0,0 +1,207 @@
+#include "input.h"
+#include "logger.h"
+#include "esp_timer.h"
+
+static void encoderISR(void *arg);
+static void IRAM_ATTR buttonISR(void *arg);
+static void inputTask(void *context);
+
+InputHandler::InputHandler(EventBus *bus, uint8_t encoderPinA, uint8_t encoderPinB, pcnt_unit_t unit) {
+    this->bus = bus;
+    this->encoderPinA = encoderPinA;
+    this->encoderPinB = encoderPinB;
+    this->unit = unit;
+    this->numButtons = 0;
+    this->task = NULL;
+    this->queue = xQueueCreate(INPUT_QUEUE_LENGTH, sizeof(InputEvent));
+}
+
+InputHandler::~InputHandler() {
+    for (int i = 0; i < this->numButtons; i++) {
+        detachInterrupt(this->buttons[i].pin);
+    }
+    pcnt_isr_handler_remove(this->unit);
+    if (this->task) {
+        vTaskDelete(this->task);
+    }
+    vQueueDelete(this->queue);
+}
+
+bool InputHandler::addButton(uint8_t pin) {
+    if (this->numButtons >= MAX_INPUT_BUTTONS) {
+        LOGE(LogModuleEvents, "Too many buttons");
+        return false;
+    }
+
+    InputButton *button = this->buttons + this->numButtons;
+    button->handler = this;
+    button->index = this->numButtons;
+    button->pin = pin;
+    button->pressed = false;
+    button->settling = false;
+    button->lastEdge = 0;
+    button->pressedAt = 0;
+    this->numButtons++;
+
+    return true;
+}
+
+void InputHandler::begin(UBaseType_t priority, BaseType_t core) {
+    // Encoder: both channels count on the edges of one pin and use the other
+    // one as direction control, that gives full x4 quadrature decoding.
+    // The unit resets to zero when reaching a limit, so every limit event
+    // is exactly one detent.
+    pcnt_config_t config = {};
+    config.unit = this->unit;
+    config.counter_h_lim = ENCODER_STEPS_PER_DETENT;
+    config.counter_l_lim = -ENCODER_STEPS_PER_DETENT;
+    config.lctrl_mode = PCNT_MODE_REVERSE;
+    config.hctrl_mode = PCNT_MODE_KEEP;
+
+    config.channel = PCNT_CHANNEL_0;
+    config.pulse_gpio_num = this->encoderPinA;
+    config.ctrl_gpio_num = this->encoderPinB;
+    config.pos_mode = PCNT_COUNT_DEC;
+    config.neg_mode = PCNT_COUNT_INC;
+    pcnt_unit_config(&config);
+
+    config.channel = PCNT_CHANNEL_1;
+    config.pulse_gpio_num = this->encoderPinB;
+    config.ctrl_gpio_num = this->encoderPinA;
+    config.pos_mode = PCNT_COUNT_INC;
+    config.neg_mode = PCNT_COUNT_DEC;
+    pcnt_unit_config(&config);
+
+    pcnt_set_filter_value(this->unit, ENCODER_FILTER_VALUE);
+    pcnt_filter_enable(this->unit);
+
+    pcnt_event_enable(this->unit, PCNT_EVT_H_LIM);
+    pcnt_event_enable(this->unit, PCNT_EVT_L_LIM);
+
+    pcnt_counter_pause(this->unit);
+    pcnt_counter_clear(this->unit);
+    pcnt_isr_service_install(0);
+    pcnt_isr_handler_add(this->unit, encoderISR, this);
+    pcnt_intr_enable(this->unit);
+    pcnt_counter_resume(this->unit);
+
+    // Buttons: pins are active low, take the idle state as the initial state
+    for (int i = 0; i < this->numButtons; i++) {
+        InputButton *button = this->buttons + i;
+        pinMode(button->pin, INPUT);
+        button->pressed = (digitalRead(button->pin) == LOW);
+        attachInterruptArg(button->pin, buttonISR, button, CHANGE);
+    }
+
+    xTaskCreatePinnedToCore(inputTask, "input", 3072, this, priority, &this->task, core);
+    LOGI(LogModuleEvents, "Input handler started, %d buttons", this->numButtons);
+}
+
+void InputHandler::run() {
+    TickType_t timeout = portMAX_DELAY;
+
+    while (true) {
+        InputEvent event;
+
+        if (xQueueReceive(this->queue, &event, timeout) == pdTRUE) {
+            switch (event.type) {
+                case InputEventEncoderStep:
+                    this->bus->post(EventEncoderStep, event.value, event.timestamp);
+                    break;
+                case InputEventButtonEdge: {
+                    InputButton *button = this->buttons + event.value;
+                    button->settling = true;
+                    button->lastEdge = event.timestamp;
+                    break;
+                }
+            }
+        }
+
+        timeout = this->settleButtons();
+    }
+}
+
+//
+// Evaluate buttons whose level had time to settle after the last edge.
+// Returns the time to wait until the next button has to be looked at.
+//
+TickType_t InputHandler::settleButtons() {
+    int64_t now = esp_timer_get_time();
+    int64_t nextCheck = INT64_MAX;
+
+    for (int i = 0; i < this->numButtons; i++) {
+        InputButton *button = this->buttons + i;
+        if (!button->settling) continue;
+
+        int64_t settleTime = button->lastEdge + BUTTON_DEBOUNCE_MS * 1000;
+        if (settleTime > now) {
+            if (settleTime < nextCheck) nextCheck = settleTime;
+            continue;
+        }
+        button->settling = false;
+
+        bool pressed = (digitalRead(button->pin) == LOW);
+        if (pressed == button->pressed) continue; // bounce only
+
+        button->pressed = pressed;
+        if (pressed) {
+            button->pressedAt = button->lastEdge;
+        } else if (button->lastEdge - button->pressedAt <= BUTTON_CLICK_MS * 1000) {
+            this->bus->post(EventButtonClick, button->pin, button->lastEdge);
+        }
+    }
+
+    if (nextCheck == INT64_MAX) {
+        return portMAX_DELAY;
+    }
+    TickType_t ticks = pdMS_TO_TICKS((nextCheck - now + 999) / 1000);
+    return ticks > 0 ? ticks : 1;
+}
+
+//
+// Interrupt handlers
+//
+
+// Runs from the PCNT ISR service which is not placed in IRAM
+static void encoderISR(void *arg) {
+    InputHandler *handler = reinterpret_cast<InputHandler *>(arg);
+    uint32_t status = 0;
+    InputEvent event;
+
+    pcnt_get_event_status(handler->unit, &status);
+    if (status & PCNT_EVT_H_LIM) {
+        event.value = 1;
+    } else if (status & PCNT_EVT_L_LIM) {
+        event.value = -1;
+    } else {
+        return;
+    }
+    event.type = InputEventEncoderStep;
+    event.timestamp = esp_timer_get_time();
+
+    BaseType_t woken = pdFALSE;
+    xQueueSendFromISR(handler->queue, &event, &woken);
+    if (woken) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+static void IRAM_ATTR buttonISR(void *arg) {
+    InputButton *button = reinterpret_cast<InputButton *>(arg);
+    InputEvent event;
+
+    event.type = InputEventButtonEdge;
+    event.value = button->index;
+    event.timestamp = esp_timer_get_time();
+
+    BaseType_t woken = pdFALSE;
+    xQueueSendFromISR(button->handler->queue, &event, &woken);
+    if (woken) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+static void inputTask(void *context) {
+    InputHandler *handler = reinterpret_cast<InputHandler *>(context);
+    handler->run();
+}
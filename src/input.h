@@ -0,0 +1,77 @@
+#ifndef LITTLESPEAKER_INPUT_H
+#define LITTLESPEAKER_INPUT_H
+
+#include <Arduino.h>
+#include "driver/pcnt.h"
+#include "eventbus.h"
+
+#define MAX_INPUT_BUTTONS 4
+#define INPUT_QUEUE_LENGTH 16
+
+// Quadrature steps per encoder detent (4 for the usual gray code encoders)
+#define ENCODER_STEPS_PER_DETENT 4
+
+// PCNT glitch filter in APB clock cycles (80 MHz, max 1023 = ~12.8us)
+#define ENCODER_FILTER_VALUE 1023
+
+#define BUTTON_DEBOUNCE_MS 20
+#define BUTTON_CLICK_MS 500
+
+typedef enum _InputEventType {
+    InputEventButtonEdge = 0,
+    InputEventEncoderStep = 1
+} InputEventType;
+
+typedef struct _InputEvent {
+    InputEventType type;
+    int8_t value;       // Button index for edges, direction for encoder steps
+    int64_t timestamp;  // Time of the interrupt in microseconds
+} InputEvent;
+
+class InputHandler;
+
+typedef struct _InputButton {
+    InputHandler *handler;
+    uint8_t index;
+    uint8_t pin;
+    bool pressed;       // Debounced state
+    bool settling;      // Edge seen, waiting for the level to settle
+    int64_t lastEdge;
+    int64_t pressedAt;
+} InputButton;
+
+//
+// Interrupt driven input handling: The rotary encoder is decoded by the
+// PCNT peripheral, buttons raise GPIO edge interrupts. Both feed a queue
+// that is drained by a dedicated task which debounces and posts clicks
+// and encoder steps to the event bus. Nothing has to be polled from the
+// main loop.
+//
+class InputHandler {
+    public:
+        InputHandler(EventBus *bus, uint8_t encoderPinA, uint8_t encoderPinB, pcnt_unit_t unit = PCNT_UNIT_0);
+        ~InputHandler();
+
+        bool addButton(uint8_t pin);
+        void begin(UBaseType_t priority = 3, BaseType_t core = 1);
+
+        // Internal for interrupt handling
+        QueueHandle_t queue;
+        pcnt_unit_t unit;
+
+        void run();
+
+    private:
+        TickType_t settleButtons();
+
+        EventBus *bus;
+        uint8_t encoderPinA;
+        uint8_t encoderPinB;
+
+        InputButton buttons[MAX_INPUT_BUTTONS];
+        uint8_t numButtons;
+
+        TaskHandle_t task;
+};
+
+#endif
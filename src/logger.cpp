@@ -0,0 +1,408 @@
+#include "logger.h"
+
+uint8_t logLevels[LogModuleCount] = {
+    LOG_DEFAULT_LEVEL, LOG_DEFAULT_LEVEL, LOG_DEFAULT_LEVEL, LOG_DEFAULT_LEVEL, LOG_DEFAULT_LEVEL,
+    LOG_DEFAULT_LEVEL, LOG_DEFAULT_LEVEL, LOG_DEFAULT_LEVEL, LOG_DEFAULT_LEVEL, LOG_DEFAULT_LEVEL,
+    LOG_DEFAULT_LEVEL
+};
+
+static const char *moduleNames[LogModuleCount] = {
+    "system",
+    "playlist",
+    "sd",
+    "webradio",
+    "stream",
+    "wifi",
+    "bluetooth",
+    "codec",
+    "menu",
+    "events",
+    "health"
+};
+
+static const char *levelNames[] = {
+    "none",
+    "error",
+    "warning",
+    "info",
+    "debug",
+    "verbose"
+};
+
+static const char levelLetters[] = "-EWIDV";
+
+// Written by any task, drained by one at a time under the mutex
+static LogRecord *records = NULL;
+static uint32_t head = 0;           // Next index to be reserved
+static uint32_t tail = 0;           // Next index to be printed
+static uint32_t written = 0;
+static uint32_t dropped = 0;
+static uint32_t droppedReported = 0;
+static SemaphoreHandle_t flushMutex = NULL;
+
+//
+// Capture, any task
+//
+
+LogCapture::LogCapture(LogModule module, LogLevel level, const char *format) {
+    this->record = NULL;
+    this->index = 0;
+    this->full = false;
+
+    if (records == NULL) {
+        this->record = &this->local;
+    } else {
+        // Reserve a slot, a full ring drops the message instead of waiting
+        uint32_t index = __atomic_load_n(&head, __ATOMIC_RELAXED);
+        do {
+            if (index - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) >= LOG_BUFFER_RECORDS) {
+                __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+                return;
+            }
+        } while (!__atomic_compare_exchange_n(&head, &index, index + 1, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+        this->index = index;
+        this->record = records + (index % LOG_BUFFER_RECORDS);
+    }
+
+    this->record->format = format;
+    this->record->time = millis();
+    this->record->module = module;
+    this->record->level = level;
+    this->record->count = 0;
+    this->record->length = 0;
+}
+
+static void printRecord(const LogRecord *record);
+
+LogCapture::~LogCapture() {
+    if (this->record == NULL) return;
+
+    if (this->record == &this->local) {
+        printRecord(this->record);
+        return;
+    }
+    __atomic_fetch_add(&written, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&this->record->sequence, this->index + 1, __ATOMIC_RELEASE);
+}
+
+void LogCapture::addValue(LogArgument type, const void *value, size_t size) {
+    if ((this->record == NULL) || this->full) return;
+
+    // Later arguments must not take the place of one that did not fit
+    if ((this->record->count >= LOG_MAX_ARGUMENTS) || (this->record->length + size > LOG_RECORD_PAYLOAD)) {
+        this->full = true;
+        return;
+    }
+    memcpy(this->record->payload + this->record->length, value, size);
+    this->record->types[this->record->count++] = type;
+    this->record->length += size;
+}
+
+void LogCapture::add(long value) {
+    if (sizeof(long) == sizeof(int)) {
+        this->add((int)value);
+    } else {
+        this->add((long long)value);
+    }
+}
+
+void LogCapture::add(unsigned long value) {
+    if (sizeof(long) == sizeof(int)) {
+        this->add((unsigned)value);
+    } else {
+        this->add((unsigned long long)value);
+    }
+}
+
+void LogCapture::add(long long value) {
+    this->addValue(LogArgumentInt64, &value, sizeof(value));
+}
+
+void LogCapture::add(unsigned long long value) {
+    this->addValue(LogArgumentUnsigned64, &value, sizeof(value));
+}
+
+void LogCapture::add(const char *value) {
+    if ((this->record == NULL) || this->full) return;
+    if (value == NULL) value = "(null)";
+
+    // Cut to what is left, keeping the terminator
+    size_t room = LOG_RECORD_PAYLOAD - this->record->length;
+    if ((this->record->count >= LOG_MAX_ARGUMENTS) || (room == 0)) {
+        this->full = true;
+        return;
+    }
+    size_t length = strnlen(value, room - 1);
+    char *target = reinterpret_cast<char *>(this->record->payload + this->record->length);
+    memcpy(target, value, length);
+    target[length] = '\0';
+    this->record->types[this->record->count++] = LogArgumentString;
+    this->record->length += length + 1;
+}
+
+//
+// Formatting, flushing task only
+//
+
+typedef struct _LogValue {
+    LogArgument type;
+    int64_t integer;        // Also unsigned, bit for bit
+    double number;
+    const char *string;
+    const void *pointer;
+} LogValue;
+
+static bool nextValue(const LogRecord *record, uint8_t *argument, size_t *offset, LogValue *value) {
+    if (*argument >= record->count) return false;
+
+    const uint8_t *data = record->payload + *offset;
+    value->type = (LogArgument)record->types[(*argument)++];
+    value->integer = 0;
+    value->number = 0;
+    value->string = NULL;
+    value->pointer = NULL;
+
+    switch (value->type) {
+        case LogArgumentInt: {
+            int v;
+            memcpy(&v, data, sizeof(v));
+            value->integer = v;
+            *offset += sizeof(v);
+            break;
+        }
+        case LogArgumentUnsigned: {
+            unsigned v;
+            memcpy(&v, data, sizeof(v));
+            value->integer = v;
+            *offset += sizeof(v);
+            break;
+        }
+        case LogArgumentInt64:
+        case LogArgumentUnsigned64:
+            memcpy(&value->integer, data, sizeof(value->integer));
+            *offset += sizeof(value->integer);
+            break;
+        case LogArgumentDouble:
+            memcpy(&value->number, data, sizeof(value->number));
+            value->integer = (int64_t)value->number;
+            *offset += sizeof(value->number);
+            break;
+        case LogArgumentString:
+            value->string = reinterpret_cast<const char *>(data);
+            *offset += strlen(value->string) + 1;
+            break;
+        case LogArgumentPointer:
+            memcpy(&value->pointer, data, sizeof(value->pointer));
+            value->integer = (intptr_t)value->pointer;
+            *offset += sizeof(value->pointer);
+            break;
+    }
+    return true;
+}
+
+template<typename T>
+static int formatValue(char *out, size_t size, const char *spec, const int *stars, int starCount, T value) {
+    switch (starCount) {
+        case 0:
+            return snprintf(out, size, spec, value);
+        case 1:
+            return snprintf(out, size, spec, stars[0], value);
+        default:
+            return snprintf(out, size, spec, stars[0], stars[1], value);
+    }
+}
+
+size_t logFormat(const LogRecord *record, char *line, size_t size) {
+    const char *p = record->format;
+    uint8_t argument = 0;
+    size_t offset = 0;
+    size_t used = 0;
+
+    if (size == 0) return 0;
+    while (*p && (used < size - 1)) {
+        if (*p != '%') {
+            line[used++] = *(p++);
+            continue;
+        }
+        if (p[1] == '%') {
+            line[used++] = '%';
+            p += 2;
+            continue;
+        }
+
+        // Flags, width and precision are kept, stars taken from the arguments
+        char spec[24];
+        size_t length = 0;
+        int stars[2];
+        int starCount = 0;
+        LogValue value;
+
+        spec[length++] = *(p++);
+        while (*p && strchr("-+ #0123456789.*", *p) && (length < sizeof(spec) - 4)) {
+            if ((*p == '*') && (starCount < 2)) {
+                stars[starCount++] = nextValue(record, &argument, &offset, &value) ? (int)value.integer : 0;
+            }
+            spec[length++] = *(p++);
+        }
+        while (*p && strchr("hlLqjzt", *p)) p++;
+
+        char conversion = *p;
+        if (conversion == '\0') break;
+        p++;
+
+        if (!nextValue(record, &argument, &offset, &value)) {
+            line[used++] = '?';
+            continue;
+        }
+
+        int count;
+        switch (conversion) {
+            case 'd':
+            case 'i':
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+                if ((value.type == LogArgumentInt64) || (value.type == LogArgumentUnsigned64)) {
+                    spec[length++] = 'l';
+                    spec[length++] = 'l';
+                    spec[length++] = conversion;
+                    spec[length] = '\0';
+                    count = formatValue(line + used, size - used, spec, stars, starCount, (long long)value.integer);
+                } else {
+                    spec[length++] = conversion;
+                    spec[length] = '\0';
+                    count = formatValue(line + used, size - used, spec, stars, starCount, (int)value.integer);
+                }
+                break;
+            case 'c':
+                spec[length++] = conversion;
+                spec[length] = '\0';
+                count = formatValue(line + used, size - used, spec, stars, starCount, (int)value.integer);
+                break;
+            case 's':
+                spec[length++] = conversion;
+                spec[length] = '\0';
+                count = formatValue(line + used, size - used, spec, stars, starCount, value.string ? value.string : "?");
+                break;
+            case 'p':
+                spec[length++] = conversion;
+                spec[length] = '\0';
+                count = formatValue(line + used, size - used, spec, stars, starCount, value.pointer);
+                break;
+            default:
+                // Floating point, anything unknown prints as a number too
+                spec[length++] = strchr("fFeEgGaA", conversion) ? conversion : 'g';
+                spec[length] = '\0';
+                if (value.type != LogArgumentDouble) value.number = (double)value.integer;
+                count = formatValue(line + used, size - used, spec, stars, starCount, value.number);
+                break;
+        }
+        if (count > 0) used += ((size_t)count < size - 1 - used) ? (size_t)count : size - 1 - used;
+    }
+    line[used] = '\0';
+    return used;
+}
+
+static void printRecord(const LogRecord *record) {
+    char line[LOG_LINE_LENGTH];
+    int prefix = snprintf(line, sizeof(line), "%c (%u) %s: ", levelLetters[record->level], record->time, moduleNames[record->module]);
+
+    logFormat(record, line + prefix, sizeof(line) - prefix);
+    Serial.println(line);
+}
+
+// Call with the mutex held
+static void drain() {
+    uint32_t index = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+
+    while (index != __atomic_load_n(&head, __ATOMIC_ACQUIRE)) {
+        LogRecord *slot = records + (index % LOG_BUFFER_RECORDS);
+
+        // Reserved but still being written, the rest waits for the next flush
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != index + 1) break;
+
+        // The slot is free again before the serial port is waited for
+        LogRecord record = *slot;
+        index++;
+        __atomic_store_n(&tail, index, __ATOMIC_RELEASE);
+        printRecord(&record);
+    }
+
+    uint32_t lost = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+    if (lost != droppedReported) {
+        Serial.printf("W (%u) log: %u messages dropped\n", (uint32_t)millis(), lost - droppedReported);
+        droppedReported = lost;
+    }
+}
+
+static void logTask(void *context) {
+    while (true) {
+        vTaskDelay(pdMS_TO_TICKS(LOG_FLUSH_INTERVAL_MS));
+        xSemaphoreTake(flushMutex, portMAX_DELAY);
+        drain();
+        xSemaphoreGive(flushMutex);
+    }
+}
+
+void logBegin(UBaseType_t priority, BaseType_t core) {
+    if (records) return;
+
+    LogRecord *buffer = new LogRecord[LOG_BUFFER_RECORDS];
+    memset(buffer, 0, sizeof(LogRecord) * LOG_BUFFER_RECORDS);
+    flushMutex = xSemaphoreCreateMutex();
+    xTaskCreatePinnedToCore(logTask, "log", LOG_TASK_STACK_SIZE, NULL, priority, NULL, core);
+    records = buffer;
+}
+
+void logFlush() {
+    if (records == NULL) return;
+
+    xSemaphoreTake(flushMutex, portMAX_DELAY);
+    drain();
+    xSemaphoreGive(flushMutex);
+    Serial.flush();
+}
+
+//
+// Levels
+//
+
+void logSetLevel(LogModule module, LogLevel level) {
+    if (module >= LogModuleCount) return;
+    logLevels[module] = level;
+}
+
+LogLevel logGetLevel(LogModule module) {
+    if (module >= LogModuleCount) return LogLevelNone;
+    return (LogLevel)logLevels[module];
+}
+
+const char *logModuleName(LogModule module) {
+    if (module >= LogModuleCount) return NULL;
+    return moduleNames[module];
+}
+
+const char *logLevelName(LogLevel level) {
+    if (level > LogLevelVerbose) return NULL;
+    return levelNames[level];
+}
+
+LogModule logModuleNamed(const char *name) {
+    for (int module = 0; module < LogModuleCount; module++) {
+        if (strcasecmp(name, moduleNames[module]) == 0) return (LogModule)module;
+    }
+    return LogModuleCount;
+}
+
+int logLevelNamed(const char *name) {
+    for (int level = LogLevelNone; level <= LogLevelVerbose; level++) {
+        if (strcasecmp(name, levelNames[level]) == 0) return level;
+    }
+    return -1;
+}
+
+void getLogStats(LogStats *stats) {
+    stats->written = __atomic_load_n(&written, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,156 @@
+#ifndef LITTLESPEAKER_LOGGER_H
+#define LITTLESPEAKER_LOGGER_H
+
+#include <Arduino.h>
+
+// Messages waiting to be printed, 96 bytes each on the device
+#define LOG_BUFFER_RECORDS 64
+
+// Bytes for the arguments of one message, longer strings are cut
+#define LOG_RECORD_PAYLOAD 68
+#define LOG_MAX_ARGUMENTS 12
+
+// Longest printed line
+#define LOG_LINE_LENGTH 256
+
+#define LOG_TASK_STACK_SIZE 3072
+#define LOG_FLUSH_INTERVAL_MS 20
+
+typedef enum _LogModule {
+    LogModuleSystem = 0,
+    LogModulePlaylist = 1,
+    LogModuleSD = 2,
+    LogModuleWebradio = 3,
+    LogModuleStream = 4,        // Connections and the jitter buffer
+    LogModuleWifi = 5,
+    LogModuleBluetooth = 6,
+    LogModuleCodec = 7,         // Decoders and the EQ
+    LogModuleMenu = 8,
+    LogModuleEvents = 9,        // Event bus and input
+    LogModuleHealth = 10,       // Telemetry summaries
+    LogModuleCount
+} LogModule;
+
+// Same order as the ESP-IDF levels
+typedef enum _LogLevel {
+    LogLevelNone = 0,
+    LogLevelError = 1,
+    LogLevelWarning = 2,
+    LogLevelInfo = 3,
+    LogLevelDebug = 4,
+    LogLevelVerbose = 5
+} LogLevel;
+
+#define LOG_DEFAULT_LEVEL LogLevelInfo
+
+typedef struct _LogStats {
+    uint32_t written;
+    uint32_t dropped;       // Buffer was full
+} LogStats;
+
+//
+// Deferred logging. The calling task only copies the format pointer and
+// the arguments into a ring, a low priority task formats and prints them,
+// so a slow serial console never stalls the audio. Format strings must be
+// literals, string arguments are copied. Until logBegin() messages are
+// printed right away.
+//
+// Arguments are taken by type, not by the format: ints, doubles, strings
+// and pointers, "%d" of a double prints the truncated value. Length
+// modifiers in the format are not needed and ignored.
+//
+void logBegin(UBaseType_t priority = 1, BaseType_t core = 0);
+
+// Prints what is waiting from the calling task, before a restart
+void logFlush();
+
+void logSetLevel(LogModule module, LogLevel level);
+LogLevel logGetLevel(LogModule module);
+
+// For the console, NULL or LogModuleCount / -1 if unknown
+const char *logModuleName(LogModule module);
+const char *logLevelName(LogLevel level);
+LogModule logModuleNamed(const char *name);
+int logLevelNamed(const char *name);
+
+void getLogStats(LogStats *stats);
+
+//
+// Capturing the arguments
+//
+
+typedef enum _LogArgument {
+    LogArgumentInt = 0,
+    LogArgumentUnsigned = 1,
+    LogArgumentInt64 = 2,
+    LogArgumentUnsigned64 = 3,
+    LogArgumentDouble = 4,
+    LogArgumentString = 5,
+    LogArgumentPointer = 6
+} LogArgument;
+
+typedef struct _LogRecord {
+    const char *format;
+    uint32_t time;          // millis()
+    uint32_t sequence;      // Index + 1 once the record is complete
+    uint8_t module;
+    uint8_t level;
+    uint8_t count;
+    uint8_t length;
+    uint8_t types[LOG_MAX_ARGUMENTS];
+    uint8_t payload[LOG_RECORD_PAYLOAD];
+} LogRecord;
+
+extern uint8_t logLevels[LogModuleCount];
+
+class LogCapture {
+    public:
+        LogCapture(LogModule module, LogLevel level, const char *format);
+        ~LogCapture();
+
+        void add(int value) { this->addValue(LogArgumentInt, &value, sizeof(value)); }
+        void add(unsigned value) { this->addValue(LogArgumentUnsigned, &value, sizeof(value)); }
+        void add(long value);
+        void add(unsigned long value);
+        void add(long long value);
+        void add(unsigned long long value);
+        void add(double value) { this->addValue(LogArgumentDouble, &value, sizeof(value)); }
+        void add(const char *value);
+        void add(char *value) { this->add((const char *)value); }
+        void add(const void *value) { this->addValue(LogArgumentPointer, &value, sizeof(value)); }
+
+        void capture() {}
+
+        template<typename T, typename... Rest>
+        void capture(T value, Rest... rest) {
+            this->add(value);
+            this->capture(rest...);
+        }
+
+    private:
+        void addValue(LogArgument type, const void *value, size_t size);
+
+        LogRecord *record;
+        LogRecord local;        // Before logBegin()
+        uint32_t index;
+        bool full;
+};
+
+// The message of a record without the prefix, returns its length
+size_t logFormat(const LogRecord *record, char *line, size_t size);
+
+#define LOG_AT(module, level, format, ...) do { \
+    if ((level) <= logLevels[module]) { \
+        LogCapture logCapture(module, level, format); \
+        logCapture.capture(__VA_ARGS__); \
+    } \
+} while (0)
+
+// Like ESP_LOGx, without a trailing newline
+#define LOGE(module, ...) LOG_AT(module, LogLevelError, __VA_ARGS__)
+#define LOGW(module, ...) LOG_AT(module, LogLevelWarning, __VA_ARGS__)
+#define LOGI(module, ...) LOG_AT(module, LogLevelInfo, __VA_ARGS__)
+#define LOGD(module, ...) LOG_AT(module, LogLevelDebug, __VA_ARGS__)
+#define LOGV(module, ...) LOG_AT(module, LogLevelVerbose, __VA_ARGS__)
+
+#endif
@@ -19,6 +19,7 @@
  * SCL    22      SD-Card Chip Select
  */
 
+// Swap ENCODER_PIN1 and ENCODER_PIN2 if the knob turns the wrong way
 #define ENCODER_PIN1 17
 #define ENCODER_PIN2 16
 
@@ -38,25 +39,22 @@ AudioOutputI2S *output = NULL;
 #include "AudioOutputFilter3BandEQ.h"
 AudioOutputFilter3BandEQ *eq = NULL;
 
-// 
-// ENCODER
 //
-#include "RotaryEncoder.h"
+// EVENTS
+//
+#include "eventbus.h"
 
-RotaryEncoder encoder(ENCODER_PIN1, ENCODER_PIN2, RotaryEncoder::LatchMode::FOUR3);
+EventBus *bus = NULL;
 
 //
-// BUTTONS
+// ENCODER AND BUTTONS
 //
-#include <AceButton.h>
-using namespace ace_button;
+#include "input.h"
 
-AceButton encoderButton(ENCODER_BTN);
-AceButton yellowButton(YELLOW_BTN);
-AceButton blackButton(BLACK_BTN);
-AceButton blueButton(BLUE_BTN);
+InputHandler *input = NULL;
 
-static void handleEvent(AceButton*, uint8_t, uint8_t);
+static void handleButton(const Event *event, void *context);
+static void handleEncoder(const Event *event, void *context);
 
 //
 // MENU
@@ -71,8 +69,10 @@ Menu *mainMenu = NULL;
 //
 // AUDIO PLAYBACK
 //
+#include "streamconnector.h"
 #include "playlist.h"
 
+StreamConnector *connector = NULL;
 Playlist *playlist = NULL;
 
 //
@@ -85,8 +85,11 @@ BluetoothPlayer *btPlayer;
 //
 // WEBRADIO
 //
+#include "wificonnection.h"
 #include "webradio.h"
 
+WifiConnection *wifi;
+
 WebradioPlayer *webPlayer;
 
 //
@@ -96,47 +99,122 @@ WebradioPlayer *webPlayer;
 
 SDPlayer *sdPlayer;
 
+//
+// CONSOLE
+//
+#include "console.h"
+
+// Requests of the console, carried out by the event dispatcher like the
+// buttons. Arguments are 12 bits each.
+typedef enum _ConsoleRequest {
+  ConsoleRequestMode = 0,       // main menu item, CONSOLE_NO_ARGUMENT for the menu itself
+  ConsoleRequestAlbum = 1,      // album, track
+  ConsoleRequestStation = 2,    // station
+  ConsoleRequestSeek = 3        // position in ms, upper and lower 12 bits
+} ConsoleRequest;
+
+#define CONSOLE_NO_ARGUMENT 0xfff
+
+static void registerCommands();
+static void handleConsole(const Event *event, void *context);
+
+#if DECODE_BENCHMARK || PLAYBACK_BENCHMARK || DSP_BENCHMARK
+#include "benchmark.h"
+#endif
+
+#include "trace.h"
+#include "logger.h"
+#include "telemetry.h"
+#include "heapstats.h"
+#include "profiler.h"
+
 
 #include "esp_heap_caps.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_attr.h"
+#if CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#endif
+
 void heap_caps_alloc_failed_hook(size_t requested_size, uint32_t caps, const char *function_name) {
-  printf("%s called, failed to allocate %d bytes with 0x%X capabilities.\n", function_name, requested_size, caps);
-  printf("heap free: %d, max block: %d\n", 
-    heap_caps_get_free_size(caps),
-    heap_caps_get_largest_free_block(caps)
+  printf("%s called, failed to allocate %u bytes with 0x%X capabilities.\n", function_name, (unsigned)requested_size, (unsigned)caps);
+  printf("heap free: %u, max block: %u\n",
+    (unsigned)heap_caps_get_free_size(caps),
+    (unsigned)heap_caps_get_largest_free_block(caps)
   );
+  heapAllocFailed();
 }
 
 
+//
+// RESTART
+//
+
+// Survives ESP.restart() but not a power cycle, lets a restart continue
+// in the menu instead of starting over
+#define RESUME_MAGIC 0x4c53524du
+
+typedef struct _ResumeState {
+  uint32_t magic;
+  int32_t menuItem;
+} ResumeState;
+
+RTC_NOINIT_ATTR ResumeState resumeState;
+
+static void restartToMenu(void *context);
+
+
 void setup() {
   // Serial
   Serial.begin(115200);
   Serial.println();
+  // Messages are printed by a task from here on
+  logBegin();
   esp_err_t error = heap_caps_register_failed_alloc_callback(heap_caps_alloc_failed_hook);
-  delay(2000);
+  if (error != ESP_OK) {
+    LOGW(LogModuleSystem, "Failed allocations will not be reported: %d", error);
+  }
+
+  bool resume = (esp_reset_reason() == ESP_RST_SW) && (resumeState.magic == RESUME_MAGIC);
+  resumeState.magic = 0;
+  if (resume) {
+    LOGI(LogModuleSystem, "Resuming at menu item %d", resumeState.menuItem);
+  } else {
+    // Time to attach the serial monitor
+    delay(2000);
+  }
+
+  // Before anything that is traced
+  traceBegin();
+  telemetryBegin();
+  profilerBegin();
 
   // Turn off everything
   btStop();
   WiFi.mode(WIFI_MODE_NULL);
 
-  // Buttons, etc.
-  encoder.setPosition(0);
-  
-  pinMode(ENCODER_BTN, INPUT);
-  pinMode(YELLOW_BTN, INPUT);
-  pinMode(BLACK_BTN, INPUT);
-  pinMode(BLUE_BTN, INPUT);
-
-  ButtonConfig* buttonConfig = ButtonConfig::getSystemButtonConfig();
-  buttonConfig->setEventHandler(handleEvent);
-  buttonConfig->setFeature(ButtonConfig::kFeatureClick);
-  buttonConfig->setClickDelay(500);
-  buttonConfig->setLongPressDelay(1000);
-
   // SD-Card access
   if (!SD.begin(22, SPI, SPI_SPEED, "/sd", 5, false)) {
-    Serial.println("SD Card could not be initialized!");
+    LOGE(LogModuleSystem, "SD Card could not be initialized!");
   }
 
+  // Sources and decoders the playlist can build an audio chain from
+  registerDefaultFormats();
+
+  // What each mode reserves when it is entered
+  printArenaBudgets(&Serial);
+
+#if DECODE_BENCHMARK
+  benchmarkDecodeDirectory();
+#endif
+#if PLAYBACK_BENCHMARK
+  benchmarkPlaybackDirectory();
+#endif
+#if DSP_BENCHMARK
+  benchmarkDspAll();
+#endif
+
   // Audio Stuff
   audioLogger = &Serial;  
 
@@ -146,49 +224,80 @@ void setup() {
 
   eq = new AudioOutputFilter3BandEQ(output, 500, 5000);
   eq->setBandGains(1.5, 0.9, 1.3);
-
-  // Audio player
-  playlist = new Playlist(eq, 5);
-  btPlayer = new BluetoothPlayer(playlist, eq);
-  webPlayer = new WebradioPlayer(playlist);
+  eq->setTelemetry(true);
+
+  // Event dispatcher, all UI state changes run on its task
+  bus = new EventBus();
+
+  // Audio player, webradio streams are opened by the connector task
+  connector = new StreamConnector();
+  connector->begin();
+  playlist = new Playlist(eq, bus, connector, 5);
+  btPlayer = new BluetoothPlayer(playlist, bus, eq);
+  btPlayer->registerRestartCallback(restartToMenu, NULL);
+  wifi = new WifiConnection(bus);
+  webPlayer = new WebradioPlayer(playlist, wifi, connector);
   sdPlayer = new SDPlayer(playlist);
 
-  // Menu definition
-
-  MenuItem *mainMenuItems[] = {
-    new MenuItem("sd", "/system/sd.mp3", sdPlayer->makeMenu()),
-    new MenuItem("radio", "/system/webradio.mp3", webPlayer->makeMenu()),
-    new MenuItem("bluetooth", "/system/bluetooth.mp3", btPlayer->makeMenu()),
-    NULL
-  };
-  mainMenu = new Menu(mainMenuItems);
+  // Menu definition, its objects are booked to the menu with ALLOC_STATS
+  {
+    HeapScope scope(HeapTagMenu);
+    MenuItem *mainMenuItems[] = {
+      new MenuItem("sd", "/system/sd.mp3", sdPlayer->makeMenu()),
+      new MenuItem("radio", "/system/webradio.mp3", webPlayer->makeMenu()),
+      new MenuItem("bluetooth", "/system/bluetooth.mp3", btPlayer->makeMenu()),
+      NULL
+    };
+    mainMenu = new Menu(mainMenuItems);
+  }
   mainMenu->setDisplayUpdateCallback(debugMenu);
   mainMenu->setAudioAnnounceCallback(announceMenu);
 
+  // Buttons, etc.
+  bus->subscribe(EventButtonClick, handleButton);
+  bus->subscribe(EventEncoderStep, handleEncoder);
+  bus->subscribe(EventConsole, handleConsole);
+  bus->begin();
+
+  input = new InputHandler(bus, ENCODER_PIN1, ENCODER_PIN2);
+  input->addButton(ENCODER_BTN);
+  input->addButton(YELLOW_BTN);
+  input->addButton(BLACK_BTN);
+  input->addButton(BLUE_BTN);
+  input->begin();
+
+  // Commands on the serial port, "help" lists them
+  registerDefaultCommands();
+  registerCommands();
+  consoleBegin();
+
+#if CONFIG_PM_ENABLE
+  // Only available if the framework has been built with power management,
+  // the CPU then light-sleeps whenever all tasks are blocked.
+  esp_pm_config_esp32_t pm = { .max_freq_mhz = 240, .min_freq_mhz = 80, .light_sleep_enable = true };
+  esp_pm_configure(&pm);
+#endif
+
+  heapSnapshot("setup");
+
+  if (resume && mainMenu->selectItem(resumeState.menuItem)) {
+    // The menu has announced the item already
+    return;
+  }
   playlist->addFilename("/system/hello.mp3");
   playlist->addFilename("/system/sd.mp3");
   playlist->play();
 }
 
 
-// Basically Input handling
+// Input is handled by the input task, this only drives playback
 void loop() {
-  encoder.tick();
-  encoderButton.check();
-  yellowButton.check();
-  blackButton.check();
-  blueButton.check();
- 
-  if (encoder.getPosition() != 0) {
-    if (encoder.getPosition() < 0) {
-      mainMenu->selectPreviousItem();
-    } else {
-      mainMenu->selectNextItem();
-    }
-    encoder.setPosition(0);
-  }
-
   playlist->loop();
+
+  if (playlist->getState() == PlaybackStateStopped) {
+    // Nothing to decode, do not spin
+    delay(10);
+  }
 }
 
 
@@ -197,7 +306,13 @@ void loop() {
 //
 
 static void debugMenu(const char *text) {
-    Serial.printf_P(PSTR("Menu item '%s' selected...\n"), text);
+    LOGI(LogModuleMenu, "Menu item '%s' selected...", text);
+}
+
+// Called right before the restart, the submenu has already been left
+static void restartToMenu(void *context) {
+  resumeState.menuItem = mainMenu->getSelectedIndex();
+  resumeState.magic = RESUME_MAGIC;
 }
 
 static void announceMenu(const char *filename) {
@@ -206,28 +321,183 @@ static void announceMenu(const char *filename) {
     playlist->play();
 }
 
-static void handleEvent(AceButton* button, uint8_t eventType, uint8_t buttonState) {
-  switch (eventType) {
-    case AceButton::kEventClicked:
-      if (button->getPin() == ENCODER_BTN) {
-        Serial.println("Encoder button pressed");
-        mainMenu->leaveItem();
-      }
-
-      if (button->getPin() == YELLOW_BTN) {
-        Serial.println("Yellow button pressed");
-        mainMenu->selectPreviousItem();
-      }
-
-      if (button->getPin() == BLACK_BTN) {
-        Serial.println("Black button pressed");
-        mainMenu->enterItem();
-      }
-
-      if (button->getPin() == BLUE_BTN) {
-        Serial.println("Blue button pressed");
-        mainMenu->selectNextItem();
-      }
+static void handleButton(const Event *event, void *context) {
+  switch (event->value) {
+    case ENCODER_BTN:
+      LOGI(LogModuleMenu, "Encoder button pressed");
+      mainMenu->leaveItem();
+      break;
+    case YELLOW_BTN:
+      LOGI(LogModuleMenu, "Yellow button pressed");
+      mainMenu->selectPreviousItem();
+      break;
+    case BLACK_BTN:
+      LOGI(LogModuleMenu, "Black button pressed");
+      mainMenu->enterItem();
+      break;
+    case BLUE_BTN:
+      LOGI(LogModuleMenu, "Blue button pressed");
+      mainMenu->selectNextItem();
+      break;
+  }
+}
+
+static void handleEncoder(const Event *event, void *context) {
+  if (event->value < 0) {
+    mainMenu->selectPreviousItem();
+  } else {
+    mainMenu->selectNextItem();
+  }
+}
+
+
+//
+// Console
+//
+
+static int32_t consoleRequest(ConsoleRequest request, uint32_t first, uint32_t second) {
+  return ((int32_t)request << 24) | ((first & 0xfff) << 12) | (second & 0xfff);
+}
+
+static int menuIndexOf(const char *title) {
+  for (int i = 0; mainMenu->getItem(i); i++) {
+    if (strcmp(mainMenu->getItem(i)->getDisplayTitle(), title) == 0) return i;
+  }
+  return -1;
+}
+
+// Leaves the current mode like the encoder button does and enters the
+// given one from the main menu
+static void enterMode(int index) {
+  if (mainMenu->isInSubmenu() && (mainMenu->getSelectedIndex() == index)) return;
+
+  for (int i = 0; (i < 4) && mainMenu->isInSubmenu(); i++) {
+    mainMenu->leaveItem();
+  }
+  if ((index < 0) || (index == CONSOLE_NO_ARGUMENT)) return;
+
+  mainMenu->selectItem(index);
+  mainMenu->enterItem();
+}
+
+static void handleConsole(const Event *event, void *context) {
+  ConsoleRequest request = (ConsoleRequest)(event->value >> 24);
+  int first = (event->value >> 12) & 0xfff;
+  int second = event->value & 0xfff;
+
+  switch (request) {
+    case ConsoleRequestMode:
+      enterMode(first);
+      break;
+    case ConsoleRequestAlbum:
+      enterMode(menuIndexOf("sd"));
+      sdPlayer->play(first, second, true);
+      break;
+    case ConsoleRequestStation:
+      enterMode(menuIndexOf("radio"));
+      webPlayer->play(first);
+      break;
+    case ConsoleRequestSeek:
+      playlist->seek((first << 12) | second);
       break;
   }
 }
+
+// Decimal only, false for trailing garbage or a value out of range
+static bool parseNumber(const char *text, long min, long max, long *value) {
+  char *end = NULL;
+  long number = strtol(text, &end, 10);
+  if ((end == text) || (*end != '\0') || (number < min) || (number > max)) return false;
+  *value = number;
+  return true;
+}
+
+static bool runClick(Print *out, int argc, char **argv) {
+  static const struct { const char *name; uint8_t pin; } buttons[] = {
+    { "encoder", ENCODER_BTN },
+    { "yellow", YELLOW_BTN },
+    { "black", BLACK_BTN },
+    { "blue", BLUE_BTN }
+  };
+
+  if (argc != 2) return false;
+  for (size_t i = 0; i < sizeof(buttons) / sizeof(buttons[0]); i++) {
+    if (strcmp(argv[1], buttons[i].name) == 0) {
+      bus->post(EventButtonClick, buttons[i].pin, esp_timer_get_time());
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool runTurn(Print *out, int argc, char **argv) {
+  long steps;
+  if ((argc != 2) || !parseNumber(argv[1], -50, 50, &steps) || (steps == 0)) return false;
+
+  for (int i = 0; i < abs(steps); i++) {
+    bus->post(EventEncoderStep, (steps < 0) ? -1 : 1, esp_timer_get_time());
+  }
+  return true;
+}
+
+static bool runMode(Print *out, int argc, char **argv) {
+  if (argc != 2) return false;
+
+  int index = CONSOLE_NO_ARGUMENT;
+  if (strcmp(argv[1], "menu") != 0) {
+    index = menuIndexOf(argv[1]);
+    if (index < 0) return false;
+  }
+  bus->post(EventConsole, consoleRequest(ConsoleRequestMode, index, 0), esp_timer_get_time());
+  return true;
+}
+
+static bool runPlay(Print *out, int argc, char **argv) {
+  long album;
+  long track = 0;
+  if ((argc < 2) || (argc > 3)) return false;
+  if (!parseNumber(argv[1], 0, MAX_ALBUMS - 1, &album)) return false;
+  if ((argc == 3) && !parseNumber(argv[2], 0, MAX_TRACKS - 1, &track)) return false;
+
+  bus->post(EventConsole, consoleRequest(ConsoleRequestAlbum, album, track), esp_timer_get_time());
+  return true;
+}
+
+static bool runStation(Print *out, int argc, char **argv) {
+  long station;
+  if ((argc != 2) || !parseNumber(argv[1], 0, CONSOLE_NO_ARGUMENT - 1, &station)) return false;
+
+  bus->post(EventConsole, consoleRequest(ConsoleRequestStation, station, 0), esp_timer_get_time());
+  return true;
+}
+
+static bool runSeek(Print *out, int argc, char **argv) {
+  long ms;
+  if ((argc != 2) || !parseNumber(argv[1], 0, 0xffffff, &ms)) return false;
+
+  bus->post(EventConsole, consoleRequest(ConsoleRequestSeek, ms >> 12, ms), esp_timer_get_time());
+  return true;
+}
+
+static bool runEvents(Print *out, int argc, char **argv) {
+  bus->printStats(out);
+  return true;
+}
+
+static const ConsoleCommand clickCommand = { "click", NULL, "encoder|yellow|black|blue", "press a button", runClick };
+static const ConsoleCommand turnCommand = { "turn", NULL, "STEPS", "turn the knob, negative to the left", runTurn };
+static const ConsoleCommand modeCommand = { "mode", NULL, "sd|radio|bluetooth|menu", "enter a mode or go back to the menu", runMode };
+static const ConsoleCommand playCommand = { "play", NULL, "ALBUM [TRACK]", "play from the card, counting from 0", runPlay };
+static const ConsoleCommand stationCommand = { "station", NULL, "INDEX", "play a webradio station, counting from 0", runStation };
+static const ConsoleCommand seekCommand = { "seek", NULL, "MS", "jump within the current track, FLAC only", runSeek };
+static const ConsoleCommand eventsCommand = { "events", NULL, NULL, "event bus counters and latencies", runEvents };
+
+static void registerCommands() {
+  registerConsoleCommand(&clickCommand);
+  registerConsoleCommand(&turnCommand);
+  registerConsoleCommand(&modeCommand);
+  registerConsoleCommand(&playCommand);
+  registerConsoleCommand(&stationCommand);
+  registerConsoleCommand(&seekCommand);
+  registerConsoleCommand(&eventsCommand);
+}
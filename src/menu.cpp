@@ -1,4 +1,7 @@
 #include "menu.h"
+#include "trace.h"
+#include "logger.h"
+#include "heapstats.h"
 
 //
 // MenuItem implementation
@@ -76,7 +79,7 @@ Menu::~Menu() {
     for (int i = 0; i < numItems; i++) {
         delete items[i];
     }
-    free(items);
+    heapFree(items);
 }
 
 void* Menu::getContext() {
@@ -92,19 +95,19 @@ void Menu::setItems(MenuItem **items) {
         item = items[numItems];
     }
 
-    Serial.printf_P(PSTR("Menu created, %d items\n"), numItems);
+    LOGD(LogModuleMenu, "Menu created, %d items", numItems);
 
     // cleanup internal state
     if (this->numItems > 0) {
         for(int i = 0; i < this->numItems; i++) {
             delete this->items[i];
         }
-        free(this->items);
+        heapFree(this->items);
     }
     
     // copy items over
     this->numItems = numItems;
-    this->items = (MenuItem**)malloc(sizeof(MenuItem*) * numItems);
+    this->items = (MenuItem**)heapAlloc(HeapTagMenu, sizeof(MenuItem*) * numItems);
     for(int i = 0; i < numItems; i++) {
         this->items[i] = items[i];
     }
@@ -155,13 +158,14 @@ int Menu::indexOfItem(MenuItem *item) {
 MenuItem* Menu::selectNextItem() {
     MenuItem *item = NULL;
 
-    Serial.printf_P(PSTR("Select next item: current = %d, state = %d\n"), this->selectedItem, this->state);
+    LOGD(LogModuleMenu, "Select next item: current = %d, state = %d", this->selectedItem, this->state);
 
     // If in this menu, select next item, wrap around at end
     if (this->state == StateInMenu) {
         this->selectedItem++;
         if (this->selectedItem >= this->numItems) this->selectedItem = 0;
         item = this->items[this->selectedItem];
+        TRACE_INSTANT(TraceEventMenuNext, this->selectedItem);
     }
 
     // If in a submenu, forward the call to the submenu
@@ -183,16 +187,44 @@ MenuItem* Menu::selectNextItem() {
     return item;
 };
 
+MenuItem* Menu::selectItem(int index) {
+    if ((this->state != StateInMenu) || (index < 0) || (index >= this->numItems)) {
+        return NULL;
+    }
+
+    this->selectedItem = index;
+    MenuItem *item = this->items[this->selectedItem];
+
+    // run callbacks to update UI
+    if (this->displayCallback) {
+        this->displayCallback(item->getDisplayTitle());
+    }
+    if (this->audioCallback) {
+        this->audioCallback(item->getAudioFile());
+    }
+
+    return item;
+}
+
+int Menu::getSelectedIndex() {
+    return this->selectedItem;
+}
+
+bool Menu::isInSubmenu() {
+    return this->state == StateInSubmenu;
+}
+
 MenuItem* Menu::selectPreviousItem() {
     MenuItem *item = NULL;
 
-    Serial.printf_P(PSTR("Select prev item: current = %d, state = %d\n"), this->selectedItem, this->state);
+    LOGD(LogModuleMenu, "Select prev item: current = %d, state = %d", this->selectedItem, this->state);
 
     // If in this menu, select previous item, wrap around at beginning
     if (this->state == StateInMenu) {
         this->selectedItem--;
         if (this->selectedItem < 0) this->selectedItem = this->numItems - 1;
         item = this->items[this->selectedItem];
+        TRACE_INSTANT(TraceEventMenuPrevious, this->selectedItem);
     }
 
     // If in a submenu, forward the call to the submenu
@@ -217,7 +249,7 @@ MenuItem* Menu::selectPreviousItem() {
 Menu* Menu::enterItem() {
     Menu *submenu = NULL;
 
-    Serial.printf_P(PSTR("Enter item: current = %d, state = %d\n"), this->selectedItem, this->state);
+    LOGD(LogModuleMenu, "Enter item: current = %d, state = %d", this->selectedItem, this->state);
 
     if (this->state == StateInSubmenu) {
         Menu *mySubmenu = this->items[this->selectedItem]->getSubmenu();
@@ -225,6 +257,7 @@ Menu* Menu::enterItem() {
     }
 
     if (this->state == StateInMenu) {
+        TRACE_INSTANT(TraceEventMenuEnter, this->selectedItem);
         submenu = this->items[this->selectedItem]->call();
         if (submenu) {
             this->state = StateInSubmenu;
@@ -253,7 +286,7 @@ Menu* Menu::enterItem() {
 }
 
 Menu* Menu::leaveItem() {
-    Serial.printf_P(PSTR("Leave item: current = %d, state = %d\n"), this->selectedItem, this->state);
+    LOGD(LogModuleMenu, "Leave item: current = %d, state = %d", this->selectedItem, this->state);
 
     if (this->state == StateInMenu) {
         this->selectedItem = 0;
@@ -261,12 +294,13 @@ Menu* Menu::leaveItem() {
 
     if (this->state == StateInSubmenu) {
         MenuItem *item = NULL;
-        Serial.printf(" - In submenu %s\n", this->items[this->selectedItem]->getDisplayTitle());
+        LOGD(LogModuleMenu, " - In submenu %s", this->items[this->selectedItem]->getDisplayTitle());
         Menu *submenu = this->items[this->selectedItem]->getSubmenu();
-        Serial.printf(" - Sub item %d\n", submenu);
+        LOGD(LogModuleMenu, " - Sub item %d", submenu);
         Menu *newMenu = submenu->leaveItem();
-        Serial.printf(" - New menu %d\n", newMenu);
+        LOGD(LogModuleMenu, " - New menu %d", newMenu);
         if (!newMenu) {
+            TRACE_INSTANT(TraceEventMenuLeave, this->selectedItem);
             this->state = StateInMenu;
             item = this->items[this->selectedItem];
             if (submenu->leaveCallback) {
@@ -312,6 +346,7 @@ ButtonMenu::~ButtonMenu() {
 }
 
 MenuItem* ButtonMenu::selectNextItem() {
+    TRACE_INSTANT(TraceEventMenuNext, -1);
     if (this->nextCallback) {
         this->nextCallback(this);
     }
@@ -320,6 +355,7 @@ MenuItem* ButtonMenu::selectNextItem() {
 }
 
 MenuItem* ButtonMenu::selectPreviousItem() {
+    TRACE_INSTANT(TraceEventMenuPrevious, -1);
     if (this->prevCallback) {
         this->prevCallback(this);
     }
@@ -328,6 +364,7 @@ MenuItem* ButtonMenu::selectPreviousItem() {
 }
 
 Menu* ButtonMenu::enterItem() {
+    TRACE_INSTANT(TraceEventMenuEnter, -1);
     if (this->enterCallback) {
         this->enterCallback(this);
     }
@@ -336,7 +373,7 @@ Menu* ButtonMenu::enterItem() {
 }
 
 Menu* ButtonMenu::leaveItem() {
-    Serial.println("Buttonmenu leave");
+    LOGD(LogModuleMenu, "Buttonmenu leave");
     if (this->leaveCallback) {
         bool leave = this->leaveCallback(this);
         if (leave) {
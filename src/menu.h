@@ -20,7 +20,7 @@ class Menu {
   public:
     Menu(MenuItem **items = NULL, void *context = NULL);
     Menu(void *context = NULL): Menu(NULL, context) {};
-    ~Menu();
+    virtual ~Menu();
 
     void setItems(MenuItem **item); // close off menu with NULL value
     virtual MenuItem *getItem(int index);
@@ -28,6 +28,11 @@ class Menu {
 
     virtual MenuItem *selectNextItem();
     virtual MenuItem *selectPreviousItem();
+
+    // Jumps to an item of this menu, only while no submenu is entered
+    MenuItem *selectItem(int index);
+    int getSelectedIndex();
+    bool isInSubmenu();
     virtual Menu *enterItem();
     virtual Menu *leaveItem();
 
@@ -1,79 +1,149 @@
 #include "driver/i2s.h"
 #include "playlist.h"
+#include "trace.h"
+#include "logger.h"
+#include "heapstats.h"
+#include "telemetry.h"
 #include <SD.h>
 
-#include "AudioFileSourceICYStream.h"
-#include "AudioFileSourceBuffer.h"
-#include "AudioFileSourceID3.h"
-#include "AudioFileSourceSD.h"
-#include "AudioGeneratorMP3a.h"
+#include "esp_timer.h"
 
 const int maxFilenameLength = 256;
-const int preallocateBufferSize = 6*1024;
+
+// Give up on a stream that connected but does not deliver enough data to start
+const int64_t streamPrefillTimeout = 10000000;
 
 static void metadataCallback(void *cbData, const char *type, bool isUnicode, const char *string);
 static void statusCallback(void *cbData, int code, const char *string);
+static void playlistEndHandler(const Event *event, void *context);
 
 //
 // Playlist implementation
 //
 
-Playlist::Playlist(AudioOutput *output, int maxEntries) {
+Playlist::Playlist(AudioOutput *output, EventBus *bus, StreamConnector *connector, int maxEntries) {
     this->output = output;
+    this->bus = bus;
+    this->connector = connector;
+    this->connectTicket = 0;
+    this->connectStart = 0;
+    this->streamCodec = AudioCodecUnknown;
+    this->jitterBuffer = new AudioFileSourceJitterBuffer();
+    memset(&this->streamStats, 0, sizeof(JitterBufferStats));
+    this->cpuBudget = DECODER_BUDGET_CPU_UNLIMITED;
+    this->ramBudget = DECODER_BUDGET_RAM_UNLIMITED;
+    this->arenaMode = ArenaModeMenu;
     this->ringbufferSize = maxEntries;
-    this->itemRingbuffer = (char **)malloc(sizeof(char *) * maxEntries);
+    this->itemRingbuffer = (char **)heapAlloc(HeapTagPlaylist, sizeof(char *) * maxEntries);
     for(int i = 0; i < this->ringbufferSize; i++) {
-        this->itemRingbuffer[i] = (char *)malloc(sizeof(char) * (maxFilenameLength + 1));
+        this->itemRingbuffer[i] = (char *)heapAlloc(HeapTagPlaylist, sizeof(char) * (maxFilenameLength + 1));
     }
-    this->ringBufferMutex = xSemaphoreCreateBinary();
-    xSemaphoreGive(this->ringBufferMutex);
+    this->currentItem = (char *)heapAlloc(HeapTagPlaylist, sizeof(char) * (maxFilenameLength + 1));
+    this->mutex = xSemaphoreCreateMutex();
 
     this->readMarker = -1;
     this->writeMarker = 0;
     this->state = PlaybackStateStopped;
+    this->generation = 0;
 
-    this->preallocateBuffer = NULL;
     this->base = NULL;
     this->source = NULL;
     this->decoder = NULL;
+    this->decoderFactory = NULL;
+    this->sourceFactory = NULL;
+    this->seekRequest = -1;
+    this->latencyLabel = NULL;
+    this->latencyStart = 0;
     this->endCallback = NULL;
     this->endContext = NULL;
+
+    this->bus->subscribe(EventPlaylistEnd, playlistEndHandler, this);
 }
 
 Playlist::~Playlist() {
     for(int i = 0; i < this->ringbufferSize; i++) {
-        free(this->itemRingbuffer[i]);
-    }
-    free(this->itemRingbuffer);
-    if (this->preallocateBuffer) {
-        free(this->preallocateBuffer);
+        heapFree(this->itemRingbuffer[i]);
     }
+    heapFree(this->itemRingbuffer);
+    heapFree(this->currentItem);
+    delete this->jitterBuffer;
+    vSemaphoreDelete(this->mutex);
 }
 
 void Playlist::freeAllBuffers() {
-    if (this->preallocateBuffer) {
-        free(this->preallocateBuffer);
-        this->preallocateBuffer = NULL;
+    this->jitterBuffer->release();
+    trimPools(0, 0);
+}
+
+void Playlist::getStreamStats(JitterBufferStats *stats) {
+    memcpy(stats, &this->streamStats, sizeof(JitterBufferStats));
+}
+
+void Playlist::setDecoderBudget(uint8_t cpuPercent, uint32_t ramBytes) {
+    xSemaphoreTake(this->mutex, portMAX_DELAY);
+    this->cpuBudget = cpuPercent;
+    this->ramBudget = ramBytes;
+    xSemaphoreGive(this->mutex);
+
+    // Pooled decoders that are not allowed anymore only block memory
+    trimPools(cpuPercent, ramBytes);
+}
+
+void Playlist::setArenaMode(ArenaMode mode) {
+    xSemaphoreTake(this->mutex, portMAX_DELAY);
+    this->arenaMode = mode;
+    xSemaphoreGive(this->mutex);
+}
+
+// Only called without an audio chain, so nothing reads from the block of
+// the previous mode anymore. Idle decoders fetch their region again on begin().
+void Playlist::applyArenaMode() {
+    xSemaphoreTake(this->mutex, portMAX_DELAY);
+    ArenaMode mode = this->arenaMode;
+    xSemaphoreGive(this->mutex);
+
+    this->jitterBuffer->useMemory(NULL, 0);
+    reserveArena(mode);
+
+    uint32_t size;
+    uint8_t *region = reinterpret_cast<uint8_t *>(getArenaRegion(ArenaRegionStream, &size));
+    if (region) {
+        this->jitterBuffer->useMemory(region, size);
+    }
+}
+
+void Playlist::measureStartLatency(const char *label) {
+    xSemaphoreTake(this->mutex, portMAX_DELAY);
+    this->latencyLabel = label;
+    this->latencyStart = esp_timer_get_time();
+    xSemaphoreGive(this->mutex);
+}
+
+void Playlist::reportStartLatency() {
+    xSemaphoreTake(this->mutex, portMAX_DELAY);
+    const char *label = this->latencyLabel;
+    int64_t start = this->latencyStart;
+    this->latencyLabel = NULL;
+    xSemaphoreGive(this->mutex);
+
+    if (label) {
+        LOGI(LogModulePlaylist, "%s: %u ms until the next item plays", label, (uint32_t)((esp_timer_get_time() - start) / 1000));
     }
 }
 
 bool Playlist::addFilename(const char *filename) {
     if (strlen(filename) > maxFilenameLength) {
         // Name too long
-        Serial.println("Filename too long");
+        LOGW(LogModulePlaylist, "Filename too long");
         return false;
     }
 
-    if (xSemaphoreTake(this->ringBufferMutex, 20) == pdFALSE) {
-        // Could not acquire mutex
-        Serial.println("Could not acquire mutex");
-        return false;
-    }
+    xSemaphoreTake(this->mutex, portMAX_DELAY);
 
     if (this->writeMarker == this->readMarker - 1) {
         // Buffer full
-        Serial.println("Buffer full");
-        xSemaphoreGive(this->ringBufferMutex);
+        LOGW(LogModulePlaylist, "Buffer full");
+        xSemaphoreGive(this->mutex);
         return false;
     }
     
@@ -88,256 +158,370 @@ bool Playlist::addFilename(const char *filename) {
         readMarker = 0;
     }
 
-    xSemaphoreGive(this->ringBufferMutex);
+    // Content changed, pending end notifications are outdated
+    this->generation++;
+
+    xSemaphoreGive(this->mutex);
     return true;
 }
 
 char* Playlist::consumeItem() {
-    if (xSemaphoreTake(this->ringBufferMutex, 20) == pdFALSE) {
-        // Could not acquire mutex
-        return NULL;
-    }
+    xSemaphoreTake(this->mutex, portMAX_DELAY);
 
-    if (this->readMarker == this->writeMarker) {
+    if ((this->readMarker < 0) || (this->readMarker == this->writeMarker)) {
         // Buffer empty
-        xSemaphoreGive(this->ringBufferMutex);
+        xSemaphoreGive(this->mutex);
         return NULL;
     }
 
-    char *item = NULL;
-    if (this->readMarker >= 0) {
-        item = this->itemRingbuffer[this->readMarker];
-        this->readMarker++;
-        if (this->readMarker >= this->ringbufferSize) {
-            this->readMarker = 0;
-        }
-    } else {
-        xSemaphoreGive(this->ringBufferMutex);
-        return NULL;
+    // Copy the item, the slot may be re-used as soon as we release the lock
+    strcpy(this->currentItem, this->itemRingbuffer[this->readMarker]);
+    this->readMarker++;
+    if (this->readMarker >= this->ringbufferSize) {
+        this->readMarker = 0;
     }
-    xSemaphoreGive(this->ringBufferMutex);
+    xSemaphoreGive(this->mutex);
 
-    Serial.printf_P(PSTR("Consume '%s'\n"), item);
-    return item;
+    LOGI(LogModulePlaylist, "Consume '%s'", this->currentItem);
+    return this->currentItem;
 }
 
-PlaybackState Playlist::getState() {
-    return this->state;
-}
+void Playlist::finishPlayback() {
+    xSemaphoreTake(this->mutex, portMAX_DELAY);
 
-void Playlist::play() {
-    if (this->state == PlaybackStateReset) {
-        // wait for reset to finish
-        Serial.println("Waiting for reset...");
+    if ((this->readMarker >= 0) && (this->readMarker != this->writeMarker)) {
+        // Items have been added in the meantime, play them on the next loop
+        xSemaphoreGive(this->mutex);
         return;
     }
-    if (this->state == PlaybackStateSkipping) {
-        Serial.println("Switching from skipping to playing...");
-        this->state = PlaybackStatePlaying;
+    if ((this->state == PlaybackStateStopped) || (this->state == PlaybackStateReset)) {
+        xSemaphoreGive(this->mutex);
         return;
     }
-    if (this->state == PlaybackStatePlaying) {
-        Serial.println("Already playing...");
+
+    this->state = PlaybackStateStopped;
+    int32_t generation = this->generation;
+    bool notify = (this->endCallback != NULL);
+    xSemaphoreGive(this->mutex);
+
+    LOGI(LogModulePlaylist, "All items played!");
+    if (notify) {
+        this->bus->post(EventPlaylistEnd, generation);
+    }
+}
+
+void Playlist::dispatchEndCallback(int32_t generation) {
+    xSemaphoreTake(this->mutex, portMAX_DELAY);
+
+    if (generation != this->generation) {
+        // Playlist has been changed since the end was reached
+        xSemaphoreGive(this->mutex);
         return;
     }
 
-    Serial.println("Play...");
-    this->state = PlaybackStatePlaying;
+    void (*callback)(void *context) = this->endCallback;
+    void *context = this->endContext;
+    this->endCallback = NULL;
+    this->endContext = NULL;
+    xSemaphoreGive(this->mutex);
+
+    if (callback) {
+        callback(context);
+    }
+}
+
+bool Playlist::changeState(PlaybackState from, PlaybackState to) {
+    bool changed = false;
+
+    xSemaphoreTake(this->mutex, portMAX_DELAY);
+    if (this->state == from) {
+        this->state = to;
+        changed = true;
+    }
+    xSemaphoreGive(this->mutex);
+
+    return changed;
+}
+
+PlaybackState Playlist::getState() {
+    return this->state;
+}
+
+void Playlist::play() {
+    xSemaphoreTake(this->mutex, portMAX_DELAY);
+    switch (this->state) {
+        case PlaybackStateReset:
+            // Reset switches to playing when done
+            LOGD(LogModulePlaylist, "Waiting for reset...");
+            break;
+        case PlaybackStateSkipping:
+            LOGD(LogModulePlaylist, "Switching from skipping to playing...");
+            this->state = PlaybackStatePlaying;
+            break;
+        case PlaybackStatePlaying:
+            LOGD(LogModulePlaylist, "Already playing...");
+            break;
+        default:
+            LOGD(LogModulePlaylist, "Play...");
+            this->state = PlaybackStatePlaying;
+            break;
+    }
+    xSemaphoreGive(this->mutex);
 }
 
 void Playlist::pause() {
+    xSemaphoreTake(this->mutex, portMAX_DELAY);
     if (this->state == PlaybackStatePlaying) {
-        Serial.println("Pausing...");
+        LOGD(LogModulePlaylist, "Pausing...");
         this->state = PlaybackStatePaused;
-        return;
-    }
-    if (this->state == PlaybackStatePaused) {
-        Serial.println("Restarting Playback...");
+    } else if (this->state == PlaybackStatePaused) {
+        LOGD(LogModulePlaylist, "Restarting Playback...");
         this->state = PlaybackStatePlaying;
-        return;
     }
+    xSemaphoreGive(this->mutex);
 }
 
 void Playlist::skip() {
-    Serial.println("Skip");
-    if ((this->state == PlaybackStatePlaying) || (this->state = PlaybackStatePaused)) {
+    LOGD(LogModulePlaylist, "Skip");
+    xSemaphoreTake(this->mutex, portMAX_DELAY);
+    if ((this->state == PlaybackStatePlaying) || (this->state == PlaybackStatePaused) || (this->state == PlaybackStateConnecting)) {
         this->state = PlaybackStateSkipping;
     }
+    xSemaphoreGive(this->mutex);
+}
+
+void Playlist::seek(uint32_t ms) {
+    xSemaphoreTake(this->mutex, portMAX_DELAY);
+    this->seekRequest = ms;
+    xSemaphoreGive(this->mutex);
 }
 
 void Playlist::stopAndClear() {
-    Serial.println("Stop and Clear");
-    if (xSemaphoreTake(this->ringBufferMutex, 20) == pdFALSE) {
-        // Could not acquire mutex
-        return;
-    }
+    LOGD(LogModulePlaylist, "Stop and Clear");
+    xSemaphoreTake(this->mutex, portMAX_DELAY);
 
     this->readMarker = -1;
     this->writeMarker = 0;
     this->state = PlaybackStateReset;
     this->endCallback = NULL;
     this->endContext = NULL;
+    this->seekRequest = -1;
+    this->generation++;
 
-    xSemaphoreGive(this->ringBufferMutex);
-    vTaskDelay(100);
+    xSemaphoreGive(this->mutex);
 }
 
-void Playlist::registerPlaylistEndCallback(void (*callback)(void *), void *context, bool autoClear) {
+void Playlist::registerPlaylistEndCallback(void (*callback)(void *), void *context) {
+    xSemaphoreTake(this->mutex, portMAX_DELAY);
     this->endCallback = callback;
     this->endContext = context;
-    this->autoClearEndContext = autoClear;
+    xSemaphoreGive(this->mutex);
 }
 
 
-bool Playlist::setupAudioSourceForFile(const char *filename) {
-    if (strncmp("http://", filename, 7) == 0) {
-        // Webradio station
-        if (!this->preallocateBuffer) {
-            this->preallocateBuffer = reinterpret_cast<char *>(malloc(preallocateBufferSize));
-        }
-        this->base = new AudioFileSourceICYStream(filename);
-        this->base->RegisterMetadataCB(metadataCallback, NULL);
-        if (this->base == NULL) return false;
-        this->source = new AudioFileSourceBuffer(this->base, this->preallocateBuffer, preallocateBufferSize);
-        this->source->RegisterStatusCB(statusCallback, NULL);
-        if (this->source == NULL) {
-            this->base->close();
-            delete this->base;
-            this->base = NULL;
-            return false;
-        }
-        return true;
-    }
-    if (strcasecmp(".mp3", filename + strlen(filename) - 4) == 0) {
-        // MP3 file, get an ID3 source
-        if (this->preallocateBuffer) {
-            free(this->preallocateBuffer);
-            this->preallocateBuffer = NULL;
-        }
-        this->base = new AudioFileSourceSD(filename);
-        if (this->base == NULL) return false;
-        this->source = new AudioFileSourceID3(this->base);
-        if (this->source == NULL) {
-            this->base->close();
-            delete this->base;
-            this->base = NULL;
-            return false;
-        }
-        this->source->RegisterMetadataCB(metadataCallback, (void*)"ID3TAG");
+bool Playlist::setupAudioSourceForFile(const SourceFactory *factory, const char *filename, AudioCodec *codec) {
+    // The stream buffer is not needed for files
+    this->jitterBuffer->release();
+    this->source = factory->open(filename);
+    if (this->source == NULL) return false;
+    this->sourceFactory = factory;
+
+    // Also skips an ID3 tag, the decoder reads the file directly
+    *codec = probeSource(this->source);
+
+    LOGI(LogModulePlaylist, "File '%s' is %s, source opened", filename, codecName(*codec));
+    return true;
+}
 
-        Serial.printf_P(PSTR("File '%s' is MP3, source created\n"), filename);
-        return true;
+// Puts the jitter buffer in front of a stream opened by the connector
+bool Playlist::setupAudioSourceForStream(AudioFileSource *stream, uint32_t bitrate) {
+    this->base = stream;
+    this->base->RegisterMetadataCB(metadataCallback, NULL);
+    if (!this->jitterBuffer->begin(this->base, bitrate, &this->streamStats)) {
+        this->base->close();
+        delete this->base;
+        this->base = NULL;
+        return false;
     }
-    return false;
+    this->source = this->jitterBuffer;
+    LOGI(LogModulePlaylist, "Stream buffer %u bytes for %u kbit/s", this->streamStats.capacity, this->streamStats.bitrate);
+    return true;
 }
 
-bool Playlist::setupDecoderForFile(const char *filename) {
-    if ((strcasecmp(".mp3", filename + strlen(filename) - 4) == 0) || (strncmp("http://", filename, 7) == 0)) {
-        this->decoder = new AudioGeneratorMP3a();
-        if (this->decoder == NULL) {
-            return false;
-        }
-        this->decoder->RegisterStatusCB(statusCallback, NULL);
-        Serial.printf_P(PSTR("'%s' is MP3, decoder created\n"), filename);
-        return true;
+bool Playlist::setupDecoderForCodec(AudioCodec codec) {
+    const DecoderFactory *factory = findDecoder(codec);
+    if (factory == NULL) {
+        LOGE(LogModulePlaylist, "No decoder for %s", codecName(codec));
+        return false;
+    }
+
+    xSemaphoreTake(this->mutex, portMAX_DELAY);
+    bool fits = (factory->cpuPercent <= this->cpuBudget) && (factory->ramBytes <= this->ramBudget);
+    xSemaphoreGive(this->mutex);
+    if (!fits) {
+        LOGW(LogModulePlaylist, "%s decoder (%u%% CPU, %u bytes) exceeds the budget of this mode",
+            codecName(codec), factory->cpuPercent, factory->ramBytes);
+        return false;
+    }
+
+    this->decoder = acquireDecoder(factory);
+    if (this->decoder == NULL) {
+        return false;
     }
-    return false;
+    this->decoderFactory = factory;
+    this->decoder->RegisterStatusCB(statusCallback, NULL);
+    LOGD(LogModulePlaylist, "%s decoder ready", codecName(codec));
+    return true;
 }
 
 void Playlist::destroyAudioChain() {
+    bool hadDecoder = (this->decoder != NULL);
+
     if (this->decoder) {
         if (this->decoder->isRunning()) {
             this->decoder->stop();
         }
-        delete this->decoder;
+        releaseDecoder(this->decoderFactory, this->decoder);
         this->decoder = NULL;
+        this->decoderFactory = NULL;
     }
     if (this->source) {
-        this->source->close();
-        delete this->source;
+        if (this->source == this->jitterBuffer) {
+            this->source->close();
+        } else if (this->sourceFactory && this->sourceFactory->release) {
+            this->sourceFactory->release(this->source);
+        } else {
+            this->source->close();
+            delete this->source;
+        }
         this->source = NULL;
+        this->sourceFactory = NULL;
     }
     if (this->base) {
         this->base->close();
         delete this->base;
         this->base = NULL;
     }
+
+    if (hadDecoder) {
+        PoolStats pool;
+        getPoolStats(&pool);
+#if ALLOC_STATS
+        AllocStats allocs;
+        getAllocStats(&allocs);
+        LOGI(LogModulePlaylist, "Item done, %u heap allocations, decoder pool %u hits, %u misses",
+            allocs.allocs - this->itemAllocs.allocs, pool.hits - this->itemPool.hits, pool.misses - this->itemPool.misses);
+#else
+        LOGI(LogModulePlaylist, "Item done, decoder pool %u hits, %u misses",
+            pool.hits - this->itemPool.hits, pool.misses - this->itemPool.misses);
+#endif
+    }
 }
 
 void Playlist::loop() {
-    bool closeCurrentItem = false;
+    if ((this->decoder == NULL) && (this->base == NULL) && (this->arenaMode != getArenaMode())) {
+        this->applyArenaMode();
+    }
 
-    if ((this->decoder == NULL) && (this->state != PlaybackStateStopped) && (this->state != PlaybackStateReset)) {
+    if ((this->decoder == NULL) && (this->state == PlaybackStatePlaying)) {
         char *filename = this->consumeItem();
         if (filename == NULL) {
-            if (this->state != PlaybackStateStopped) {
-                Serial.println("All items played!");
-                this->state = PlaybackStateStopped;
-                if (this->endCallback) {
-                    if (this->autoClearEndContext) {
-                        void (*savedCallback)(void *context) = this->endCallback;
-                        this->endCallback = NULL;
-                        savedCallback(this->endContext);
-                        if (this->endCallback == NULL) { 
-                            // if no new callback has been set here, we NULL the context too
-                            this->endContext = NULL;
-                        }
-                    } else {
-                        this->endCallback(this->endContext);
-                    }
-                }
+            this->finishPlayback();
+            return;
+        }
+        getAllocStats(&this->itemAllocs);
+        getPoolStats(&this->itemPool);
+
+        const SourceFactory *factory = findSource(filename);
+        if (factory == NULL) {
+            LOGW(LogModulePlaylist, "No source for '%s', skipping", filename);
+            return;
+        }
+
+        if (factory->kind == SourceKindStream) {
+            // Webradio station, connect in the background
+            if (this->changeState(PlaybackStatePlaying, PlaybackStateConnecting)) {
+                this->connectTicket = this->connector->request(filename);
             }
             return;
         }
 
-        if (!this->setupAudioSourceForFile(filename)) {
-            Serial.println("Could not create source, bailing out");
+        AudioCodec codec;
+        if (!this->setupAudioSourceForFile(factory, filename, &codec)) {
+            LOGE(LogModulePlaylist, "Could not create source, bailing out");
             this->destroyAudioChain();
             return;
         }
         
-        if (!this->setupDecoderForFile(filename)) {
-            Serial.println("Could not create decoder, bailing out");
+        if (!this->setupDecoderForCodec(codec)) {
+            LOGE(LogModulePlaylist, "Could not create decoder, bailing out");
             this->destroyAudioChain();
             return;
         }
         this->decoder->begin(this->source, this->output);
+        this->reportStartLatency();
     }
 
     switch (this->state) {
         case PlaybackStateReset:
             if ((this->decoder) && (this->decoder->isRunning())) {
-                Serial.println("Responding to playback reset...");
+                LOGD(LogModulePlaylist, "Responding to playback reset...");
             }
+            this->connector->cancel();
             this->destroyAudioChain();
             // HACK: force remove driver
             this->output->stop();
             i2s_driver_uninstall(I2S_NUM_0);
             this->output->begin();
-            this->state = PlaybackStatePlaying;
+            this->changeState(PlaybackStateReset, PlaybackStatePlaying);
             break;
         case PlaybackStateStopped:
             if ((this->decoder) && (this->decoder->isRunning())) {
-                Serial.println("Responding to playback stop...");
+                LOGD(LogModulePlaylist, "Responding to playback stop...");
             }
             this->destroyAudioChain();
             break;
         case PlaybackStateSkipping:
-            Serial.println("Responding to skip...");
+            LOGD(LogModulePlaylist, "Responding to skip...");
+            this->connector->cancel();
             this->destroyAudioChain();
-            this->state = PlaybackStatePlaying;
+            this->changeState(PlaybackStateSkipping, PlaybackStatePlaying);
             break;
         case PlaybackStatePaused:
             return; // Do nothing
+        case PlaybackStateConnecting:
+            this->connected();
+            break;
         case PlaybackStatePlaying:
+            if (this->seekRequest >= 0) {
+                xSemaphoreTake(this->mutex, portMAX_DELAY);
+                uint32_t ms = this->seekRequest;
+                this->seekRequest = -1;
+                xSemaphoreGive(this->mutex);
+
+                if (this->decoder && this->decoderFactory->seek && this->decoder->isRunning()) {
+                    bool done = this->decoderFactory->seek(this->decoder, ms);
+                    LOGI(LogModulePlaylist, "Seek to %u ms %s", ms, done ? "done" : "failed");
+                } else {
+                    LOGW(LogModulePlaylist, "Current item is not seekable");
+                }
+            }
             if (this->decoder) {
                 if (this->decoder->isRunning()) {
-                    if (!this->decoder->loop()) {
-                        Serial.println("Playback finished.");
+                    bool running;
+                    uint32_t start = traceClock();
+                    {
+                        TRACE_SCOPE_OVER(TraceEventDecode, TRACE_DECODE_MIN_US);
+                        running = this->decoder->loop();
+                    }
+                    uint32_t us = (traceClock() - start) / traceClockPerUs();
+                    if (us >= TELEMETRY_DECODE_MIN_US) telemetryRecord(TelemetryDecode, us);
+                    if (!running) {
+                        LOGI(LogModulePlaylist, "Playback finished.");
                         this->destroyAudioChain();
                     }
                 } else {
-                    Serial.println("Playback finished.");
+                    LOGI(LogModulePlaylist, "Playback finished.");
                     this->destroyAudioChain();
                 }
             }
@@ -345,31 +529,96 @@ void Playlist::loop() {
     }
 }
 
+// Picks up the stream from the connector once it is ready and waits
+// until the jitter buffer is filled far enough to start decoding
+void Playlist::connected() {
+    if (this->base == NULL) {
+        StreamResult result;
+
+        // Short wait instead of spinning while the connection is being set up
+        if (!this->connector->poll(this->connectTicket, &result, pdMS_TO_TICKS(10))) return;
+
+        if (result.stream == NULL) {
+            // Continue with the next item
+            LOGE(LogModulePlaylist, "Could not connect to stream");
+            this->changeState(PlaybackStateConnecting, PlaybackStatePlaying);
+            return;
+        }
+        if (!this->setupAudioSourceForStream(result.stream, result.bitrate)) {
+            LOGE(LogModulePlaylist, "Could not create source, bailing out");
+            this->changeState(PlaybackStateConnecting, PlaybackStatePlaying);
+            return;
+        }
+        this->connectStart = esp_timer_get_time();
+        this->streamCodec = result.codec;
+    }
+
+    if (!this->jitterBuffer->fill()) {
+        if (!this->base->isOpen() || (esp_timer_get_time() - this->connectStart > streamPrefillTimeout)) {
+            LOGE(LogModulePlaylist, "Stream does not deliver data, bailing out");
+            this->destroyAudioChain();
+            this->changeState(PlaybackStateConnecting, PlaybackStatePlaying);
+            return;
+        }
+        delay(10);
+        return;
+    }
+    LOGI(LogModulePlaylist, "Stream prefilled in %u ms", (uint32_t)((esp_timer_get_time() - this->connectStart) / 1000));
+
+    // Skipped or stopped in the meantime, the chain is torn down by the next loop
+    if (!this->changeState(PlaybackStateConnecting, PlaybackStatePlaying)) return;
+
+    // Servers often announce the wrong Content-Type, so the data decides
+    // and the header is only used if no frame sync was found
+    uint32_t length;
+    const uint8_t *data = this->jitterBuffer->peek(&length);
+    AudioCodec codec = sniffCodec(data, length);
+    if (codec == AudioCodecUnknown) codec = this->streamCodec;
+    if (codec == AudioCodecUnknown) codec = AudioCodecMP3;
+    if ((this->streamCodec != AudioCodecUnknown) && (codec != this->streamCodec)) {
+        LOGW(LogModulePlaylist, "Stream announced %s but contains %s", codecName(this->streamCodec), codecName(codec));
+    }
+
+    if (!this->setupDecoderForCodec(codec)) {
+        LOGE(LogModulePlaylist, "Could not create decoder, bailing out");
+        this->destroyAudioChain();
+        return;
+    }
+    this->decoder->begin(this->source, this->output);
+    this->reportStartLatency();
+}
+
 //
 // Audio player implementation
 //
 
 static void metadataCallback(void *cbData, const char *type, bool isUnicode, const char *string) {
     (void)cbData;
-    Serial.printf("metadata for: %s = '", type);
+    char value[LOG_RECORD_PAYLOAD];
+    size_t length = 0;
 
     if (isUnicode) {
         string += 2;
     }
 
-    while (*string) {
-        char a = *(string++);
+    // Low bytes of UTF-16 are enough for the console
+    while (*string && (length < sizeof(value) - 1)) {
+        value[length++] = *(string++);
         if (isUnicode) {
             string++;
         }
-        Serial.printf("%c", a);
     }
-    Serial.printf("'\n");
-    Serial.flush();
+    value[length] = '\0';
+    LOGI(LogModulePlaylist, "metadata for: %s = '%s'", type, value);
 }
 
 static void statusCallback(void *cbData, int code, const char *string) {
     const char *ptr = reinterpret_cast<const char *>(cbData);
     (void) ptr;
-    Serial.printf("status: %d '%s'\n", code, string);
+    LOGI(LogModulePlaylist, "status: %d '%s'", code, string);
+}
+
+static void playlistEndHandler(const Event *event, void *context) {
+    Playlist *playlist = reinterpret_cast<Playlist *>(context);
+    playlist->dispatchEndCallback(event->value);
 }
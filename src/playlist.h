@@ -3,18 +3,29 @@
 
 #include "AudioFileSource.h"
 #include "AudioGenerator.h"
+#include "eventbus.h"
+#include "streamconnector.h"
+#include "AudioFileSourceJitterBuffer.h"
+#include "formats.h"
+#include "allocstats.h"
+#include "arena.h"
 
 typedef enum _PlaybackState {
     PlaybackStateStopped = 0,
     PlaybackStatePlaying = 1,
     PlaybackStatePaused = 2,
     PlaybackStateSkipping = 3,
-    PlaybackStateReset = 4
+    PlaybackStateReset = 4,
+    PlaybackStateConnecting = 5     // Waiting for the stream connector
 } PlaybackState;
 
+// No decoder is too expensive, see setDecoderBudget()
+#define DECODER_BUDGET_CPU_UNLIMITED 100
+#define DECODER_BUDGET_RAM_UNLIMITED UINT32_MAX
+
 class Playlist {
     public:
-        Playlist(AudioOutput *output, int maxEntries = 10);
+        Playlist(AudioOutput *output, EventBus *bus, StreamConnector *connector, int maxEntries = 10);
         ~Playlist();
 
         bool addFilename(const char *filename);
@@ -22,34 +33,80 @@ class Playlist {
         void play();
         void pause();
         void skip();
+
+        // Jumps within the current item if its decoder supports it, done
+        // by the playback loop
+        void seek(uint32_t ms);
         void stopAndClear();
         void freeAllBuffers();
 
+        // Jitter buffer state of the current or last webradio stream
+        void getStreamStats(JitterBufferStats *stats);
+
+        // Items whose decoder costs more are skipped, set by the players
+        // for what is left next to their mode (WiFi, Bluetooth, ...)
+        void setDecoderBudget(uint8_t cpuPercent, uint32_t ramBytes);
+
+        // Memory arena of the mode, switched by the playback loop as soon
+        // as the current item is done
+        void setArenaMode(ArenaMode mode);
+
+        // Prints the time from now until the next item starts playing, once
+        void measureStartLatency(const char *label);
+
         void loop();
 
-        void registerPlaylistEndCallback(void (*callback)(void *context), void *context, bool autoClear = true);
+        // The callback is called once from the event dispatcher when all items
+        // have been played, it is dropped if the playlist changes in between.
+        void registerPlaylistEndCallback(void (*callback)(void *context), void *context);
+
+        // Internal for event handling
+        void dispatchEndCallback(int32_t generation);
 
     private:
         char *consumeItem();
-        bool setupDecoderForFile(const char *filename);
-        bool setupAudioSourceForFile(const char *filename);
+        void finishPlayback();
+        bool changeState(PlaybackState from, PlaybackState to);
+        bool setupDecoderForCodec(AudioCodec codec);
+        bool setupAudioSourceForFile(const SourceFactory *factory, const char *filename, AudioCodec *codec);
+        bool setupAudioSourceForStream(AudioFileSource *stream, uint32_t bitrate);
+        void connected();
         void destroyAudioChain();
+        void applyArenaMode();
+        void reportStartLatency();
 
         AudioFileSource *base;
         AudioFileSource *source;
         AudioGenerator *decoder;
+        const DecoderFactory *decoderFactory;
+        const SourceFactory *sourceFactory;     // File items only
+        AllocStats itemAllocs;                  // At the start of the item
+        PoolStats itemPool;
+        int32_t seekRequest;    // ms, -1 if none
+        const char *latencyLabel;   // NULL if nothing is measured
+        int64_t latencyStart;
         AudioOutput *output;
+        EventBus *bus;
+        StreamConnector *connector;
+        uint32_t connectTicket;
+        int64_t connectStart;
+        AudioCodec streamCodec;
+        AudioFileSourceJitterBuffer *jitterBuffer;
+        JitterBufferStats streamStats;
+        uint8_t cpuBudget;
+        uint32_t ramBudget;
+        ArenaMode arenaMode;    // Requested, see applyArenaMode()
         char **itemRingbuffer;
+        char *currentItem;
         int ringbufferSize;
         int readMarker;
         int writeMarker;
-        SemaphoreHandle_t ringBufferMutex;
+        SemaphoreHandle_t mutex;
         PlaybackState state;
+        int32_t generation;
         TaskHandle_t playbackTask;
-        char *preallocateBuffer;
         void (*endCallback)(void *);
         void *endContext;
-        bool autoClearEndContext;
 };
 
 #endif
@@ -0,0 +1,250 @@
+#include "profiler.h"
+#include "logger.h"
+#include "freertos/timers.h"
+
+typedef struct _TaskRun {
+    uintptr_t id;           // Task number, handles are reused, or the handle without the trace facility
+    uint32_t runtime;
+    uint32_t stackFree;
+} TaskRun;
+
+#if !PROFILER_TASK_LIST
+// Looked up by name, the Arduino loop task decodes, then our own tasks and
+// those of the framework
+static const char *const watchedTasks[] = {
+    "loopTask", "events", "connector", "input", "console", "log", "trace",
+    "BtAppT", "BTC_TASK", "BTU_TASK", "btController",
+    "wifi", "tiT", "sys_evt", "arduino_events", "esp_timer", "Tmr Svc", "ipc0", "ipc1"
+};
+#endif
+
+// Only the timer task samples, it has a small stack
+#if PROFILER_TASK_LIST
+static TaskStatus_t states[PROFILER_MAX_TASKS];
+#endif
+static TaskRun runs[PROFILER_MAX_TASKS];
+static TaskRun previousRuns[PROFILER_MAX_TASKS];
+static uint8_t numPrevious = 0;
+static uint32_t previousTotal = 0;
+static uint32_t previousTime = 0;
+static bool sampled = false;
+static ProfilerReport nextReport;
+
+static ProfilerReport lastReport;
+static bool haveReport = false;
+static SemaphoreHandle_t reportMutex = NULL;
+static TimerHandle_t sampleTimer = NULL;
+static StaticTimer_t sampleTimerBuffer;
+
+static void sampleCallback(TimerHandle_t timer);
+
+#if PROFILER_TASK_LIST
+static int8_t coreOf(const TaskStatus_t *state) {
+#if configTASKLIST_INCLUDE_COREID
+    return (state->xCoreID < PROFILER_CORES) ? state->xCoreID : -1;
+#else
+    return -1;
+#endif
+}
+
+// All tasks with their run time counters, 0 if there are too many
+static UBaseType_t readTasks(ProfilerReport *report, uint32_t *total) {
+    UBaseType_t count = uxTaskGetSystemState(states, PROFILER_MAX_TASKS, total);
+    for (UBaseType_t i = 0; i < count; i++) {
+        const TaskStatus_t *state = states + i;
+        TaskProfile *task = report->tasks + i;
+
+        strncpy(task->name, state->pcTaskName, sizeof(task->name) - 1);
+        task->core = coreOf(state);
+        task->priority = state->uxCurrentPriority;
+        task->stackFree = state->usStackHighWaterMark;
+        runs[i].id = state->xTaskNumber;
+        runs[i].runtime = state->ulRunTimeCounter;
+        runs[i].stackFree = task->stackFree;
+    }
+    return count;
+}
+#else
+// The watched tasks that exist, the core of a task is not known
+static UBaseType_t readTasks(ProfilerReport *report, uint32_t *total) {
+    UBaseType_t count = 0;
+    for (size_t i = 0; i < sizeof(watchedTasks) / sizeof(watchedTasks[0]); i++) {
+        TaskHandle_t handle = xTaskGetHandle(watchedTasks[i]);
+        if (handle == NULL) continue;
+        TaskProfile *task = report->tasks + count;
+
+        strncpy(task->name, watchedTasks[i], sizeof(task->name) - 1);
+        task->core = -1;
+        task->priority = uxTaskPriorityGet(handle);
+        task->stackFree = uxTaskGetStackHighWaterMark(handle);
+        runs[count].id = (uintptr_t)handle;
+        runs[count].runtime = 0;
+        runs[count].stackFree = task->stackFree;
+        count++;
+    }
+    *total = 0;
+    return count;
+}
+#endif
+
+static const TaskRun *findPrevious(uintptr_t id) {
+    for (uint8_t i = 0; i < numPrevious; i++) {
+        if (previousRuns[i].id == id) return previousRuns + i;
+    }
+    return NULL;
+}
+
+// Pinned tasks first by core, then the busiest first
+static bool sortsBefore(const TaskProfile *a, const TaskProfile *b) {
+    int coreA = (a->core < 0) ? PROFILER_CORES : a->core;
+    int coreB = (b->core < 0) ? PROFILER_CORES : b->core;
+    if (coreA != coreB) return coreA < coreB;
+    return a->permille > b->permille;
+}
+
+static void sortTasks(ProfilerReport *report) {
+    for (uint8_t i = 1; i < report->numTasks; i++) {
+        TaskProfile task = report->tasks[i];
+        uint8_t j = i;
+        while ((j > 0) && sortsBefore(&task, report->tasks + j - 1)) {
+            report->tasks[j] = report->tasks[j - 1];
+            j--;
+        }
+        report->tasks[j] = task;
+    }
+}
+
+// Fills the report with what changed since the previous sample, false on
+// the first one if there is a CPU load to compute
+static bool sampleTasks(ProfilerReport *report) {
+    uint32_t total = 0;
+    memset(report, 0, sizeof(ProfilerReport));
+    UBaseType_t count = readTasks(report, &total);
+    uint32_t now = millis();
+    if (count == 0) {
+        LOGW(LogModuleHealth, "More than %d tasks, not profiled", PROFILER_MAX_TASKS);
+        return false;
+    }
+
+    bool first = !sampled;
+    uint32_t elapsed = total - previousTotal;
+    uint32_t idle[PROFILER_CORES] = { 0 };
+    uint32_t busy[PROFILER_CORES] = { 0 };
+    bool haveIdle[PROFILER_CORES] = { false };
+
+    report->time = now;
+    report->interval = now - previousTime;
+    report->numTasks = count;
+    for (UBaseType_t i = 0; i < count; i++) {
+        TaskProfile *task = report->tasks + i;
+        const TaskRun *previous = findPrevious(runs[i].id);
+        uint32_t runtime = runs[i].runtime - (previous ? previous->runtime : 0);
+        task->permille = elapsed ? (uint16_t)((uint64_t)runtime * 1000 / elapsed) : 0;
+
+        if (task->core >= 0) {
+            if (strncmp(task->name, "IDLE", 4) == 0) {
+                idle[task->core] += task->permille;
+                haveIdle[task->core] = true;
+            } else {
+                busy[task->core] += task->permille;
+            }
+        }
+
+        // Once per task and whenever it got closer to the end
+        if ((task->stackFree < PROFILER_STACK_LOW) && (!previous || (task->stackFree < previous->stackFree))) {
+            LOGW(LogModuleHealth, "Task %s has %u bytes of stack left", task->name, task->stackFree);
+        }
+    }
+
+    // Without an idle task, e.g. on the host, the pinned tasks add up
+    for (int core = 0; PROFILER_CPU_LOAD && (core < PROFILER_CORES); core++) {
+        uint32_t load = haveIdle[core] ? ((idle[core] < 1000) ? 1000 - idle[core] : 0) : busy[core];
+        report->corePermille[core] = (load < 1000) ? load : 1000;
+    }
+    sortTasks(report);
+
+    memcpy(previousRuns, runs, sizeof(TaskRun) * count);
+    numPrevious = count;
+    previousTotal = total;
+    previousTime = now;
+    sampled = true;
+    return !first || !PROFILER_CPU_LOAD;
+}
+
+void profilerBegin() {
+    if (sampleTimer) return;
+
+    reportMutex = xSemaphoreCreateMutex();
+    sampleCallback(NULL);
+    sampleTimer = xTimerCreateStatic("profiler", pdMS_TO_TICKS(PROFILER_INTERVAL_MS), pdTRUE, NULL,
+        sampleCallback, &sampleTimerBuffer);
+    xTimerStart(sampleTimer, portMAX_DELAY);
+}
+
+static void sampleCallback(TimerHandle_t timer) {
+    if (!sampleTasks(&nextReport)) return;
+
+    xSemaphoreTake(reportMutex, portMAX_DELAY);
+    lastReport = nextReport;
+    haveReport = true;
+    xSemaphoreGive(reportMutex);
+
+#if PROFILER_CPU_LOAD
+    const TaskProfile *busiest = NULL;
+    for (uint8_t i = 0; i < nextReport.numTasks; i++) {
+        const TaskProfile *task = nextReport.tasks + i;
+        if (strncmp(task->name, "IDLE", 4) == 0) continue;
+        if (!busiest || (task->permille > busiest->permille)) busiest = task;
+    }
+
+    uint16_t core0 = nextReport.corePermille[0];
+    uint16_t core1 = nextReport.corePermille[1];
+    if ((core0 >= PROFILER_BUSY_PERCENT * 10) || (core1 >= PROFILER_BUSY_PERCENT * 10)) {
+        LOGW(LogModuleHealth, "CPU load core 0 %u%%, core 1 %u%%, busiest task %s %u%%",
+            core0 / 10, core1 / 10, busiest ? busiest->name : "-", busiest ? busiest->permille / 10 : 0);
+    } else {
+        LOGD(LogModuleHealth, "CPU load core 0 %u%%, core 1 %u%%, busiest task %s %u%%",
+            core0 / 10, core1 / 10, busiest ? busiest->name : "-", busiest ? busiest->permille / 10 : 0);
+    }
+#endif
+}
+
+bool getProfilerReport(ProfilerReport *report) {
+    if (reportMutex == NULL) return false;
+
+    xSemaphoreTake(reportMutex, portMAX_DELAY);
+    bool valid = haveReport;
+    if (valid) *report = lastReport;
+    xSemaphoreGive(reportMutex);
+    return valid;
+}
+
+void printTaskProfile(Print *out) {
+    // Too large for the stack of the loop task
+    static ProfilerReport report;
+
+    if (!getProfilerReport(&report)) {
+        out->println("No task profile yet, the first one is ready after the first interval");
+        return;
+    }
+
+#if PROFILER_CPU_LOAD
+    out->printf("Tasks during the %u ms before %u s, core 0 %u.%u%%, core 1 %u.%u%% busy\n",
+        report.interval, report.time / 1000, report.corePermille[0] / 10, report.corePermille[0] % 10,
+        report.corePermille[1] / 10, report.corePermille[1] % 10);
+#elif PROFILER_TASK_LIST
+    out->printf("Tasks at %u s, no CPU load without run time counters in the framework\n", report.time / 1000);
+#else
+    out->printf("Known tasks at %u s, no full task list and CPU load without the trace facility in the framework\n",
+        report.time / 1000);
+#endif
+    out->println("task             core prio    cpu %  stack free");
+    for (uint8_t i = 0; i < report.numTasks; i++) {
+        const TaskProfile *task = report.tasks + i;
+        char core[12] = "-";
+        char cpu[12] = "-";
+        if (task->core >= 0) snprintf(core, sizeof(core), "%d", task->core);
+        if (PROFILER_CPU_LOAD) snprintf(cpu, sizeof(cpu), "%u.%u", task->permille / 10, task->permille % 10);
+        out->printf("%-16s %4s %4u %8s %11u\n", task->name, core, task->priority, cpu, task->stackFree);
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef LITTLESPEAKER_PROFILER_H
+#define LITTLESPEAKER_PROFILER_H
+
+#include <Arduino.h>
+
+// What the framework's FreeRTOS build offers. Stack headroom works with
+// neither: without the trace facility only the tasks in profiler.cpp are
+// looked up by name, without run time counters there is no CPU load.
+#if configUSE_TRACE_FACILITY
+#define PROFILER_TASK_LIST 1
+#else
+#define PROFILER_TASK_LIST 0
+#endif
+#if configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS
+#define PROFILER_CPU_LOAD 1
+#else
+#define PROFILER_CPU_LOAD 0
+#endif
+
+// Tasks in the system, the Arduino core with WiFi and Bluetooth has about 20
+#define PROFILER_MAX_TASKS 32
+#define PROFILER_CORES 2
+
+#define PROFILER_INTERVAL_MS 5000
+
+// A core busier than this is logged as a warning
+#define PROFILER_BUSY_PERCENT 90
+
+// Tasks with less stack left than this are logged as a warning
+#define PROFILER_STACK_LOW 256
+
+typedef struct _TaskProfile {
+    char name[16];
+    int8_t core;            // -1 if the task is not pinned
+    uint8_t priority;
+    uint16_t permille;      // Of one core during the interval, 0 without PROFILER_CPU_LOAD
+    uint32_t stackFree;     // Bytes of stack never used since the task started
+} TaskProfile;
+
+typedef struct _ProfilerReport {
+    uint32_t time;          // millis() at the end of the interval
+    uint32_t interval;      // ms
+    uint16_t corePermille[PROFILER_CORES];
+    uint8_t numTasks;
+    TaskProfile tasks[PROFILER_MAX_TASKS];
+} ProfilerReport;
+
+//
+// Stack headroom of the tasks plus, with run time counters, the CPU load
+// per task and core. A timer samples all tasks every PROFILER_INTERVAL_MS
+// and keeps what changed as the last report. The load of a core is the
+// time its idle task did not get, so it includes unpinned tasks and
+// interrupts.
+//
+void profilerBegin();
+
+// false until the first interval is over, or the first sample without
+// run time counters
+bool getProfilerReport(ProfilerReport *report);
+
+// Tasks of the last interval by core and load, with their stack headroom
+void printTaskProfile(Print *out);
+
+#endif
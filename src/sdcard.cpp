@@ -1,4 +1,6 @@
 #include "sdcard.h"
+#include "logger.h"
+#include "heapstats.h"
 
 #include <SD.h>
 
@@ -8,6 +10,7 @@ static void sdPlayPause(Menu *item);
 static bool sdLeave(Menu *item);
 static void sdEnter(Menu *item);
 static void sdPlaylistEnd(void *context);
+static bool isTrackFile(const char *filename);
 
 
 SDPlayer::SDPlayer(Playlist *playlist) {
@@ -15,7 +18,7 @@ SDPlayer::SDPlayer(Playlist *playlist) {
 
     this->currentAlbum = 0;
     this->currentTrack = 0;
-    this->shuffle = reinterpret_cast<uint16_t *>(malloc(sizeof(uint16_t) * MAX_TRACKS));
+    this->shuffle = reinterpret_cast<uint16_t *>(heapAlloc(HeapTagSDIndex, sizeof(uint16_t) * MAX_TRACKS));
     this->state = SDStateAlbumMenu;
 
     // scan SD card
@@ -37,7 +40,8 @@ SDPlayer::SDPlayer(Playlist *playlist) {
             if (filename[0] == '.') continue;
             if (strcasecmp("system", filename) == 0) continue;
             if (strcasecmp("webradio", filename) == 0) continue;
-            Serial.printf("%d, Found directory: %s\n", this->maxAlbum, filename);
+            if (strcasecmp("benchmark", filename) == 0) continue;
+            LOGD(LogModuleSD, "%d, Found directory: %s", this->maxAlbum, filename);
             this->maxAlbum++;
         }
         file.close();
@@ -76,8 +80,9 @@ char* SDPlayer::pathOfAlbumAtIndex(int8_t albumIndex) {
             if (filename[0] == '.') continue;
             if (strcasecmp("system", filename) == 0) continue;
             if (strcasecmp("webradio", filename) == 0) continue;
+            if (strcasecmp("benchmark", filename) == 0) continue;
             if (index == albumIndex) {
-                Serial.printf("Found directory: %s at index %d\n", filename, index);
+                LOGD(LogModuleSD, "Found directory: %s at index %d", filename, index);
                 result = strdup(file.path());
                 finished = true;
             } else {
@@ -106,19 +111,11 @@ char* SDPlayer::nameOfTrackAtIndex(char *path, int16_t trackIndex) {
         }
         if (!file.isDirectory()) {
             const char *filename = file.name();
-            int len = strlen(filename);
 
-            if (filename[0] == '.') continue;
-            if (strcasecmp("album.mp3",filename) == 0) continue;
-            if (strcasecmp(".jpg", filename + len - 4) == 0) continue;
-            if (strcasecmp(".jpeg", filename + len - 5) == 0) continue;
-            if (strcasecmp(".png", filename + len - 4) == 0) continue;
-            if (strcasecmp(".nfo", filename + len - 4) == 0) continue;
-            if (strcasecmp(".m3u", filename + len - 4) == 0) continue;
-            if (strcasecmp(".m3u8", filename + len - 5) == 0) continue;
+            if (!isTrackFile(filename)) continue;
 
             if (index == trackIndex) {
-                Serial.printf("Found file: %s at index %d\n", filename, index);
+                LOGD(LogModuleSD, "Found file: %s at index %d", filename, index);
                 result = strdup(filename);
                 finished = true;
             } else {
@@ -146,19 +143,11 @@ int16_t SDPlayer::indexForFilenameAtPath(char *searchFilename, char *path) {
         }
         if (!file.isDirectory()) {
             const char *filename = file.name();
-            int len = strlen(filename);
 
-            if (filename[0] == '.') continue;
-            if (strcasecmp("album.mp3",filename) == 0) continue;
-            if (strcasecmp(".jpg", filename + len - 4) == 0) continue;
-            if (strcasecmp(".jpeg", filename + len - 5) == 0) continue;
-            if (strcasecmp(".png", filename + len - 4) == 0) continue;
-            if (strcasecmp(".nfo", filename + len - 4) == 0) continue;
-            if (strcasecmp(".m3u", filename + len - 4) == 0) continue;
-            if (strcasecmp(".m3u8", filename + len - 5) == 0) continue;
+            if (!isTrackFile(filename)) continue;
 
             if (strcasecmp(searchFilename, filename) == 0) {
-                Serial.printf("Found file: %s at index %d\n", filename, index);
+                LOGD(LogModuleSD, "Found file: %s at index %d", filename, index);
                 finished = true;
             } else {
                 index++;
@@ -219,18 +208,10 @@ char* SDPlayer::switchAlbum(int8_t albumIndex) {
             }
             if (!file.isDirectory()) {
                 const char *filename = file.name();
-                int len = strlen(filename);
-
-                if (filename[0] == '.') continue;
-                if (strcasecmp("album.mp3",filename) == 0) continue;
-                if (strcasecmp(".jpg", filename + len - 4) == 0) continue;
-                if (strcasecmp(".jpeg", filename + len - 5) == 0) continue;
-                if (strcasecmp(".png", filename + len - 4) == 0) continue;
-                if (strcasecmp(".nfo", filename + len - 4) == 0) continue;
-                if (strcasecmp(".m3u", filename + len - 4) == 0) continue;
-                if (strcasecmp(".m3u8", filename + len - 5) == 0) continue;
-
-                Serial.printf("%d, Found file: %s\n", this->maxTrack, filename);
+
+                if (!isTrackFile(filename)) continue;
+
+                LOGD(LogModuleSD, "%d, Found file: %s", this->maxTrack, filename);
                 this->shuffle[maxTrack] = maxTrack;
                 this->maxTrack++;
             }
@@ -242,9 +223,9 @@ char* SDPlayer::switchAlbum(int8_t albumIndex) {
     }
 
     // debug output
-    Serial.printf("Number of tracks = %d\n", this->maxTrack);
+    LOGI(LogModuleSD, "Number of tracks = %d", this->maxTrack);
     for(int16_t i = 0; i < this->maxTrack; i++) {
-        Serial.printf(" - Track %d at [%d]\n", this->shuffle[i], i);
+        LOGD(LogModuleSD, " - Track %d at [%d]", this->shuffle[i], i);
     }
     return path;
 }
@@ -252,13 +233,13 @@ char* SDPlayer::switchAlbum(int8_t albumIndex) {
 void SDPlayer::play(int8_t albumIndex, int16_t trackIndex, bool reset) {
     if ((albumIndex < 0) || (albumIndex >= this->maxAlbum)) return;
 
-    Serial.printf("Play in state %d, album: %d, track: %d/%d\n", this->state, this->currentAlbum, this->currentTrack, this->maxTrack);
+    LOGD(LogModuleSD, "Play in state %d, album: %d, track: %d/%d", this->state, this->currentAlbum, this->currentTrack, this->maxTrack);
 
     char *path;
     if (albumIndex != this->currentAlbum) {
         // switch album
-        Serial.printf("Switching album to %d: %s\n", albumIndex, path);
         path = this->switchAlbum(albumIndex);
+        LOGI(LogModuleSD, "Switching album to %d: %s", albumIndex, path);
         this->currentTrack = trackIndex >= 0 ? trackIndex : 0;
     } else {
         path = this->pathOfAlbumAtIndex(albumIndex);
@@ -273,7 +254,7 @@ void SDPlayer::play(int8_t albumIndex, int16_t trackIndex, bool reset) {
     // play track from this album
     char *filename = this->nameOfTrackAtIndex(path, shuffle[trackIndex]);
     if (filename) {
-        Serial.printf("Play track index %d: %s\n", trackIndex, filename);
+        LOGI(LogModuleSD, "Play track index %d: %s", trackIndex, filename);
         this->currentTrack = trackIndex;
     }
 
@@ -307,7 +288,7 @@ bool SDPlayer::previous(bool announce, bool loop) {
         this->playlist->stopAndClear();
     }
 
-    Serial.printf("Prev in state %d, album: %d, track: %d\n", this->state, this->currentAlbum, this->currentTrack);
+    LOGD(LogModuleSD, "Prev in state %d, album: %d, track: %d", this->state, this->currentAlbum, this->currentTrack);
 
     if (this->state == SDStateAlbumMenu) {
         this->currentAlbum--;
@@ -338,7 +319,7 @@ bool SDPlayer::previous(bool announce, bool loop) {
 }
 
 bool SDPlayer::next(bool announce, bool loop) {
-    Serial.printf("Next in state %d, album: %d, track: %d\n", this->state, this->currentAlbum, this->currentTrack);
+    LOGD(LogModuleSD, "Next in state %d, album: %d, track: %d", this->state, this->currentAlbum, this->currentTrack);
 
     if (this->state == SDStateAlbumMenu) {
         this->currentAlbum++;
@@ -400,9 +381,9 @@ void SDPlayer::announce(int8_t albumIndex, int16_t trackIndex) {
             // FIXME: number generator
             snprintf(buffer, 128, "/system/%d.mp3", albumIndex + 1);
             this->playlist->addFilename("/system/album.mp3");
-            Serial.printf("Album %d does not have an announcer, using %s\n", albumIndex, buffer);
+            LOGD(LogModuleSD, "Album %d does not have an announcer, using %s", albumIndex, buffer);
         } else {
-            Serial.printf("Album %d has an announcer, using %s\n", albumIndex, buffer);
+            LOGD(LogModuleSD, "Album %d has an announcer, using %s", albumIndex, buffer);
         }
         this->playlist->addFilename(buffer);
     } else {
@@ -428,7 +409,7 @@ void SDPlayer::setState(SDState newState) {
     if ((this->state == SDStateAlbumPlayback) && (newState == SDStateAlbumMenu)) {
         this->announce(this->currentAlbum, -1);
     }
-    Serial.printf("State is now %d\n", newState);
+    LOGD(LogModuleSD, "State is now %d", newState);
     this->state = newState;
 }
 
@@ -449,8 +430,9 @@ static void sdPlayPause(Menu *menu) {
 
 static bool sdLeave(Menu *menu) {
     SDPlayer *player = reinterpret_cast<SDPlayer *>(menu->getContext());
-    Serial.printf("Leave command in state %d\n", player->getState());
+    LOGD(LogModuleSD, "Leave command in state %d", player->getState());
     if (player->getState() == SDStateAlbumMenu) {
+        player->playlist->setArenaMode(ArenaModeMenu);
         return true;
     } else {
         player->setState(SDStateAlbumMenu);
@@ -460,6 +442,8 @@ static bool sdLeave(Menu *menu) {
 
 static void sdEnter(Menu *menu) {
     SDPlayer *player = reinterpret_cast<SDPlayer *>(menu->getContext());
+    player->playlist->setDecoderBudget(DECODER_BUDGET_CPU_UNLIMITED, DECODER_BUDGET_RAM_UNLIMITED);
+    player->playlist->setArenaMode(ArenaModeSD);
     player->reset();
 }
 
@@ -471,4 +455,19 @@ static void sdPlaylistEnd(void *context) {
         player->playlist->addFilename("/system/stopped.mp3");
         player->playlist->play();
     }
-}
\ No newline at end of file
+}
+
+// Album directories also hold covers, playlists and rip logs, everything
+// else is handed to the playlist which finds out the format by itself
+static bool isTrackFile(const char *filename) {
+    static const char *skipped[] = { ".jpg", ".jpeg", ".png", ".nfo", ".m3u", ".m3u8", ".cue", ".log", ".txt" };
+    int len = strlen(filename);
+
+    if (filename[0] == '.') return false;
+    if (strcasecmp("album.mp3", filename) == 0) return false;
+    for (size_t i = 0; i < sizeof(skipped) / sizeof(skipped[0]); i++) {
+        int extLen = strlen(skipped[i]);
+        if ((len > extLen) && (strcasecmp(skipped[i], filename + len - extLen) == 0)) return false;
+    }
+    return true;
+}
@@ -0,0 +1,512 @@
+#include "streamconnector.h"
+#include "streamresolver.h"
+#include "logger.h"
+#include "heapstats.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+
+#include "AudioFileSourceICYStream.h"
+#include "AudioFileSourceJitterBuffer.h"
+
+static void connectorTask(void *context);
+static bool standbyCancelled(void *context);
+
+//
+// Standby connection, keeps the most recent audio of a station in a ring
+// buffer. Once promoted, reads drain the buffer first and then continue
+// on the live connection.
+//
+class StandbyStream : public AudioFileSource {
+    public:
+        StandbyStream(AudioFileSource *src, uint32_t bitrate, AudioCodec codec, uint8_t *buffer, uint32_t capacity) {
+            this->src = src;
+            this->bitrate = bitrate;
+            this->codec = codec;
+            this->buffer = buffer;
+            this->capacity = capacity;
+            this->readPtr = 0;
+            this->writePtr = 0;
+            this->length = 0;
+            this->pos = 0;
+        }
+
+        virtual ~StandbyStream() override {
+            this->src->close();
+            delete this->src;
+            heapFree(this->buffer);
+        }
+
+        // Called by the connector, the oldest data is overwritten when full
+        void receive(uint32_t maxBytes) {
+            while (maxBytes > 0) {
+                uint32_t space = this->capacity - this->writePtr;
+                if (space > maxBytes) space = maxBytes;
+
+                uint32_t bytes = this->src->readNonBlock(this->buffer + this->writePtr, space);
+                if (bytes == 0) break;
+
+                this->writePtr = (this->writePtr + bytes) % this->capacity;
+                this->length += bytes;
+                if (this->length > this->capacity) {
+                    this->readPtr = this->writePtr;
+                    this->length = this->capacity;
+                }
+                maxBytes -= bytes;
+            }
+        }
+
+        virtual uint32_t read(void *data, uint32_t len) override {
+            uint32_t bytes = this->drain(reinterpret_cast<uint8_t *>(data), len);
+            if (bytes < len) bytes += this->src->read(reinterpret_cast<uint8_t *>(data) + bytes, len - bytes);
+            this->pos += bytes;
+            return bytes;
+        }
+
+        virtual uint32_t readNonBlock(void *data, uint32_t len) override {
+            uint32_t bytes = this->drain(reinterpret_cast<uint8_t *>(data), len);
+            if (bytes < len) bytes += this->src->readNonBlock(reinterpret_cast<uint8_t *>(data) + bytes, len - bytes);
+            this->pos += bytes;
+            return bytes;
+        }
+
+        virtual bool seek(int32_t pos, int dir) override { return false; }
+        virtual bool close() override { return this->src->close(); }
+        virtual bool isOpen() override { return this->src->isOpen(); }
+        virtual uint32_t getSize() override { return this->src->getSize(); }
+        virtual uint32_t getPos() override { return this->pos; }
+        virtual bool loop() override { return this->src->loop(); }
+
+        virtual bool RegisterMetadataCB(AudioStatus::metadataCBFn fn, void *data) override {
+            return this->src->RegisterMetadataCB(fn, data);
+        }
+        virtual bool RegisterStatusCB(AudioStatus::statusCBFn fn, void *data) override {
+            return this->src->RegisterStatusCB(fn, data);
+        }
+
+        uint32_t bitrate;
+        AudioCodec codec;
+        uint32_t capacity;
+        uint32_t length;
+
+    private:
+        uint32_t drain(uint8_t *data, uint32_t len) {
+            uint32_t bytes = 0;
+
+            while ((len > 0) && (this->length > 0)) {
+                uint32_t chunk = this->capacity - this->readPtr;
+                if (chunk > this->length) chunk = this->length;
+                if (chunk > len) chunk = len;
+
+                memcpy(data + bytes, this->buffer + this->readPtr, chunk);
+                this->readPtr = (this->readPtr + chunk) % this->capacity;
+                this->length -= chunk;
+                len -= chunk;
+                bytes += chunk;
+            }
+
+            // Buffered audio is used up, the memory is better used elsewhere
+            if ((this->length == 0) && this->buffer) {
+                heapFree(this->buffer);
+                this->buffer = NULL;
+                this->capacity = 0;
+            }
+            return bytes;
+        }
+
+        AudioFileSource *src;
+        uint8_t *buffer;
+        uint32_t readPtr;
+        uint32_t writePtr;
+        uint32_t pos;
+};
+
+StreamConnector::StreamConnector() {
+    this->mutex = xSemaphoreCreateMutex();
+    this->url[0] = '\0';
+    this->ticket = 0;
+    this->pending = false;
+    this->results = xQueueCreateStatic(1, sizeof(StreamResult), this->resultStorage, &this->resultBuffer);
+    this->task = NULL;
+    this->resolver = new StreamResolver();
+
+    memset(this->standby, 0, sizeof(this->standby));
+    memset(this->neighbours, 0, sizeof(this->neighbours));
+    this->neighboursChanged = false;
+}
+
+StreamConnector::~StreamConnector() {
+    StreamResult result;
+
+    if (this->task) {
+        vTaskDelete(this->task);
+    }
+    while (xQueueReceive(this->results, &result, 0) == pdTRUE) {
+        delete result.stream;
+    }
+    for (int i = 0; i < STREAM_STANDBY_SLOTS; i++) {
+        this->closeStandby(this->standby + i);
+    }
+    vQueueDelete(this->results);
+    vSemaphoreDelete(this->mutex);
+    delete this->resolver;
+}
+
+void StreamConnector::begin(UBaseType_t priority, BaseType_t core) {
+    if (this->task) return;
+
+    xTaskCreatePinnedToCore(connectorTask, "connector", STREAM_TASK_STACK_SIZE, this, priority, &this->task, core);
+}
+
+uint32_t StreamConnector::request(const char *url) {
+    xSemaphoreTake(this->mutex, portMAX_DELAY);
+    strncpy(this->url, url, STREAM_MAX_URL_LENGTH);
+    this->url[STREAM_MAX_URL_LENGTH] = '\0';
+    uint32_t ticket = ++this->ticket;
+    this->pending = true;
+    xSemaphoreGive(this->mutex);
+
+    xTaskNotifyGive(this->task);
+    return ticket;
+}
+
+void StreamConnector::cancel() {
+    xSemaphoreTake(this->mutex, portMAX_DELAY);
+    this->ticket++;
+    this->pending = false;
+    xSemaphoreGive(this->mutex);
+}
+
+void StreamConnector::setNeighbours(const char *current, const char *previous, const char *next) {
+    const char *urls[STREAM_STANDBY_SLOTS + 1] = { current, previous, next };
+
+    xSemaphoreTake(this->mutex, portMAX_DELAY);
+    for (int i = 0; i <= STREAM_STANDBY_SLOTS; i++) {
+        strncpy(this->neighbours[i], urls[i] ? urls[i] : "", STREAM_MAX_URL_LENGTH);
+        this->neighbours[i][STREAM_MAX_URL_LENGTH] = '\0';
+    }
+    this->neighboursChanged = true;
+    xSemaphoreGive(this->mutex);
+
+    xTaskNotifyGive(this->task);
+}
+
+bool StreamConnector::poll(uint32_t ticket, StreamResult *result, TickType_t wait) {
+    while (xQueueReceive(this->results, result, wait) == pdTRUE) {
+        if (result->ticket == ticket) {
+            return true;
+        }
+        // Cancelled in the meantime
+        if (result->stream) {
+            result->stream->close();
+            delete result->stream;
+        }
+        wait = 0;
+    }
+    return false;
+}
+
+bool StreamConnector::isPending() {
+    xSemaphoreTake(this->mutex, portMAX_DELAY);
+    bool pending = this->pending;
+    xSemaphoreGive(this->mutex);
+
+    return pending;
+}
+
+bool StreamConnector::isCurrent(uint32_t ticket) {
+    xSemaphoreTake(this->mutex, portMAX_DELAY);
+    bool current = (ticket == this->ticket);
+    xSemaphoreGive(this->mutex);
+
+    return current;
+}
+
+void StreamConnector::run() {
+    char url[STREAM_MAX_URL_LENGTH + 1];
+
+    while (true) {
+        // Standby connections have to be read regularly
+        ulTaskNotifyTake(pdTRUE, this->hasStandby() ? pdMS_TO_TICKS(STREAM_STANDBY_POLL_MS) : portMAX_DELAY);
+
+        xSemaphoreTake(this->mutex, portMAX_DELAY);
+        bool pending = this->pending;
+        uint32_t ticket = this->ticket;
+        if (pending) {
+            strcpy(url, this->url);
+            this->pending = false;
+        }
+        xSemaphoreGive(this->mutex);
+
+        if (pending) {
+            this->connect(url, ticket);
+        }
+        this->serviceStandby();
+    }
+}
+
+void StreamConnector::connect(const char *url, uint32_t ticket) {
+    int64_t start = esp_timer_get_time();
+    uint32_t bitrate = 0;
+    AudioCodec codec = AudioCodecUnknown;
+    AudioFileSource *stream = this->promoteStandby(url, &bitrate, &codec);
+    if (!stream) {
+        stream = this->open(url, &bitrate, &codec);
+    }
+    uint32_t duration = (esp_timer_get_time() - start) / 1000;
+
+    if (!this->isCurrent(ticket)) {
+        LOGI(LogModuleStream, "Connection to %s cancelled after %u ms", url, duration);
+        if (stream) {
+            stream->close();
+            delete stream;
+        }
+        return;
+    }
+    LOGI(LogModuleStream, "Connection to %s %s after %u ms, %u kbit/s", url, stream ? "established" : "failed", duration, bitrate);
+
+    // Anything still queued is outdated by now
+    StreamResult result;
+    while (xQueueReceive(this->results, &result, 0) == pdTRUE) {
+        if (result.stream) {
+            result.stream->close();
+            delete result.stream;
+        }
+    }
+
+    result.ticket = ticket;
+    result.stream = stream;
+    result.bitrate = bitrate;
+    result.codec = codec;
+    xQueueSend(this->results, &result, 0);
+}
+
+//
+// Station URLs may point to playlists or redirect to the actual server.
+// The endpoint found on the first connect is remembered and used directly
+// afterwards, if it stops working the station URL is resolved again.
+//
+AudioFileSource *StreamConnector::open(const char *url, uint32_t *bitrate, AudioCodec *codec, bool standby) {
+    char resolved[STREAM_MAX_URL_LENGTH + 1];
+    AudioFileSource *stream = NULL;
+    bool (*cancelled)(void *context) = standby ? standbyCancelled : NULL;
+
+    if (this->resolver->lookup(url, resolved, codec, bitrate)) {
+        stream = this->openStream(resolved);
+        if (stream) return stream;
+
+        LOGW(LogModuleStream, "Cached endpoint %s failed, resolving again", resolved);
+        this->resolver->forget(url);
+    }
+
+    if (!this->resolver->resolve(url, resolved, codec, bitrate, cancelled, this)) return NULL;
+    if (cancelled && cancelled(this)) return NULL;
+    stream = this->openStream(resolved);
+    if (stream) {
+        this->resolver->store(url, resolved, *codec, *bitrate);
+    }
+    return stream;
+}
+
+AudioFileSource *StreamConnector::openStream(const char *url) {
+    AudioFileSourceICYStream *stream = new AudioFileSourceICYStream();
+    if (stream == NULL) return NULL;
+
+    if (!stream->open(url)) {
+        delete stream;
+        return NULL;
+    }
+    return stream;
+}
+
+//
+// Standby connections, only touched by the connector task
+//
+
+AudioFileSource *StreamConnector::promoteStandby(const char *url, uint32_t *bitrate, AudioCodec *codec) {
+    for (int i = 0; i < STREAM_STANDBY_SLOTS; i++) {
+        StreamStandby *slot = this->standby + i;
+        if (!slot->stream || (strcmp(slot->url, url) != 0)) continue;
+
+        StandbyStream *stream = slot->stream;
+        LOGI(LogModuleStream, "Promoting standby connection, %u bytes buffered", stream->length);
+        *bitrate = stream->bitrate;
+        *codec = stream->codec;
+        slot->stream = NULL;
+        slot->url[0] = '\0';
+        return stream;
+    }
+    return NULL;
+}
+
+bool StreamConnector::hasStandby() {
+    for (int i = 0; i < STREAM_STANDBY_SLOTS; i++) {
+        if (this->standby[i].url[0] && (this->standby[i].stream || !this->standby[i].failed)) return true;
+    }
+    return false;
+}
+
+// Match the slots to the current neighbours
+void StreamConnector::updateStandby() {
+    char wanted[STREAM_STANDBY_SLOTS + 1][STREAM_MAX_URL_LENGTH + 1];
+
+    xSemaphoreTake(this->mutex, portMAX_DELAY);
+    if (!this->neighboursChanged) {
+        xSemaphoreGive(this->mutex);
+        return;
+    }
+    memcpy(wanted, this->neighbours, sizeof(wanted));
+    this->neighboursChanged = false;
+    xSemaphoreGive(this->mutex);
+
+    for (int i = 0; i < STREAM_STANDBY_SLOTS; i++) {
+        StreamStandby *slot = this->standby + i;
+        bool keep = false;
+        for (int j = 0; j <= STREAM_STANDBY_SLOTS; j++) {
+            if (slot->url[0] && (strcmp(slot->url, wanted[j]) == 0)) keep = true;
+        }
+        if (!keep) {
+            this->closeStandby(slot);
+        }
+        slot->failed = false;
+    }
+
+    // The current station is never opened as standby, only kept
+    for (int j = 1; j <= STREAM_STANDBY_SLOTS; j++) {
+        if (!wanted[j][0] || (strcmp(wanted[j], wanted[0]) == 0)) continue;
+
+        StreamStandby *freeSlot = NULL;
+        bool found = false;
+        for (int i = 0; i < STREAM_STANDBY_SLOTS; i++) {
+            if (strcmp(this->standby[i].url, wanted[j]) == 0) found = true;
+            if (!freeSlot && !this->standby[i].url[0]) freeSlot = this->standby + i;
+        }
+        if (!found && freeSlot) {
+            strcpy(freeSlot->url, wanted[j]);
+        }
+    }
+}
+
+void StreamConnector::serviceStandby() {
+    this->updateStandby();
+
+    // Memory got tight, standby connections are the first thing to go
+    if (heap_caps_get_free_size(MALLOC_CAP_8BIT) < STREAM_STANDBY_LOW_HEAP) {
+        for (int i = 0; i < STREAM_STANDBY_SLOTS; i++) {
+            StreamStandby *slot = this->standby + i;
+            if (!slot->stream) continue;
+            LOGW(LogModuleStream, "Low memory, closing standby connection to %s", slot->url);
+            this->closeStandby(slot);
+            slot->failed = true;
+        }
+    }
+
+    for (int i = 0; i < STREAM_STANDBY_SLOTS; i++) {
+        StreamStandby *slot = this->standby + i;
+        if (!slot->stream) continue;
+
+        if (!slot->stream->isOpen()) {
+            LOGW(LogModuleStream, "Standby connection to %s lost", slot->url);
+            this->closeStandby(slot);
+            slot->failed = true;
+            continue;
+        }
+        // Throttled to a bit more than the stream rate, TCP flow control
+        // slows the server down instead of us reading the initial burst
+        slot->stream->receive((slot->stream->bitrate * 125 * STREAM_STANDBY_POLL_MS * 3) / 2000);
+    }
+
+    // One connect per round, so requests do not have to wait for all of them
+    for (int i = 0; i < STREAM_STANDBY_SLOTS; i++) {
+        StreamStandby *slot = this->standby + i;
+        if (slot->url[0] && !slot->stream && !slot->failed) {
+            this->openStandby(slot);
+            break;
+        }
+    }
+}
+
+// Buffer for a standby stream, 0 if it does not fit into what the other
+// standby connections left of the budgets
+static uint32_t standbyBufferSize(uint32_t bitrate, uint32_t usedKbps, uint32_t usedBytes) {
+    uint32_t size = (bitrate * STREAM_STANDBY_BUFFER_MS) / 8;
+    if (size > STREAM_STANDBY_HEAP_BUDGET - usedBytes) size = STREAM_STANDBY_HEAP_BUDGET - usedBytes;
+
+    if ((usedKbps + bitrate > STREAM_STANDBY_MAX_KBPS) || (size < 1024)) return 0;
+    return size;
+}
+
+void StreamConnector::openStandby(StreamStandby *slot) {
+    uint32_t usedBytes = 0;
+    uint32_t usedKbps = 0;
+
+    for (int i = 0; i < STREAM_STANDBY_SLOTS; i++) {
+        if (!this->standby[i].stream) continue;
+        usedBytes += this->standby[i].stream->capacity;
+        usedKbps += this->standby[i].stream->bitrate;
+    }
+
+    slot->failed = true;
+    if (heap_caps_get_free_size(MALLOC_CAP_8BIT) < STREAM_STANDBY_MIN_FREE_HEAP) {
+        LOGW(LogModuleStream, "Not enough memory for a standby connection to %s", slot->url);
+        return;
+    }
+
+    // Check the budgets before connecting, with the bitrate of the last
+    // connect to this station if there was one
+    char resolved[STREAM_MAX_URL_LENGTH + 1];
+    uint32_t bitrate = 0;
+    AudioCodec codec = AudioCodecUnknown;
+    if (!this->resolver->lookup(slot->url, resolved, &codec, &bitrate) || !bitrate) bitrate = JITTER_DEFAULT_BITRATE;
+    if (!standbyBufferSize(bitrate, usedKbps, usedBytes)) {
+        LOGW(LogModuleStream, "Standby connection to %s exceeds the budget", slot->url);
+        return;
+    }
+
+    AudioFileSource *src = this->open(slot->url, &bitrate, &codec, true);
+    if (!src) {
+        if (this->isPending()) {
+            // Tried again once the request is served
+            LOGD(LogModuleStream, "Standby connection to %s gives way to a request", slot->url);
+            slot->failed = false;
+        }
+        return;
+    }
+    if (!bitrate) bitrate = JITTER_DEFAULT_BITRATE;
+
+    // The station may have changed its bitrate since
+    uint32_t size = standbyBufferSize(bitrate, usedKbps, usedBytes);
+    uint8_t *buffer = NULL;
+    if (!size) {
+        LOGW(LogModuleStream, "Standby connection to %s exceeds the budget", slot->url);
+    } else if (heap_caps_get_largest_free_block(MALLOC_CAP_8BIT) >= size + STREAM_STANDBY_LOW_HEAP) {
+        buffer = reinterpret_cast<uint8_t *>(heapAlloc(HeapTagWebradio, size));
+    }
+    if (!buffer) {
+        src->close();
+        delete src;
+        return;
+    }
+
+    slot->stream = new StandbyStream(src, bitrate, codec, buffer, size);
+    slot->failed = false;
+    LOGI(LogModuleStream, "Standby connection to %s, %u bytes buffer", slot->url, size);
+}
+
+void StreamConnector::closeStandby(StreamStandby *slot) {
+    if (slot->stream) {
+        delete slot->stream;
+        slot->stream = NULL;
+    }
+    slot->url[0] = '\0';
+}
+
+static void connectorTask(void *context) {
+    StreamConnector *connector = reinterpret_cast<StreamConnector *>(context);
+    connector->run();
+}
+
+// Standby connects give way to a request of the user
+static bool standbyCancelled(void *context) {
+    StreamConnector *connector = reinterpret_cast<StreamConnector *>(context);
+    return connector->isPending();
+}
@@ -0,0 +1,108 @@
+#ifndef LITTLESPEAKER_STREAMCONNECTOR_H
+#define LITTLESPEAKER_STREAMCONNECTOR_H
+
+#include <Arduino.h>
+#include "AudioFileSource.h"
+#include "codec.h"
+
+#define STREAM_MAX_URL_LENGTH 256
+#define STREAM_TASK_STACK_SIZE 6144
+
+// Warm standby connections to neighbour stations, see setNeighbours()
+#define STREAM_STANDBY_SLOTS 2
+#define STREAM_STANDBY_POLL_MS 50
+#define STREAM_STANDBY_BUFFER_MS 1200           // Recent audio kept per connection
+#define STREAM_STANDBY_HEAP_BUDGET (32 * 1024)  // All standby buffers together
+#define STREAM_STANDBY_MAX_KBPS 256             // All standby streams together
+#define STREAM_STANDBY_MIN_FREE_HEAP (64 * 1024) // Needed to open one
+#define STREAM_STANDBY_LOW_HEAP (32 * 1024)      // Close all below this
+
+typedef struct _StreamResult {
+    uint32_t ticket;
+    AudioFileSource *stream;    // NULL if the connection failed
+    uint32_t bitrate;           // kbit/s from the icy-br header, 0 if unknown
+    AudioCodec codec;           // From the Content-Type header, a hint only
+} StreamResult;
+
+class StreamResolver;
+class StandbyStream;
+
+typedef struct _StreamStandby {
+    char url[STREAM_MAX_URL_LENGTH + 1];    // Station in this slot, empty if unused
+    StandbyStream *stream;                  // NULL until connected
+    bool failed;                            // Not retried until the neighbours change
+} StreamStandby;
+
+//
+// Opens webradio streams in a background task. DNS lookup, TCP connect
+// and the HTTP/ICY header exchange may take seconds, so the playback
+// loop only hands over a URL and polls for the open stream later.
+//
+// Only the most recent request is of interest: a new request or cancel()
+// invalidates the running one, its stream is closed as soon as it is
+// ready instead of being handed over.
+//
+// Optionally the connector keeps throttled standby connections to the
+// neighbour stations, buffering their most recent audio. A request for
+// such a station is answered immediately with the standby connection.
+// Standby connections only use what is left of their heap and bandwidth
+// budget and are the first thing to go when memory gets tight. Connecting
+// one gives way to a request between the steps, a request waits at most
+// for one HTTP round trip.
+//
+class StreamConnector {
+    public:
+        StreamConnector();
+        ~StreamConnector();
+
+        void begin(UBaseType_t priority = 1, BaseType_t core = 0);
+
+        // Returns the ticket to poll for
+        uint32_t request(const char *url);
+        void cancel();
+
+        // Stations to keep warm, NULL for none. A standby connection to the
+        // current station is kept until it has been requested.
+        void setNeighbours(const char *current, const char *previous, const char *next);
+
+        // True when the request with this ticket is done, the stream then
+        // belongs to the caller
+        bool poll(uint32_t ticket, StreamResult *result, TickType_t wait = 0);
+
+        void run();
+
+        // A request is waiting for the connector task
+        bool isPending();
+
+    private:
+        AudioFileSource *open(const char *url, uint32_t *bitrate, AudioCodec *codec, bool standby = false);
+        AudioFileSource *openStream(const char *url);
+        bool isCurrent(uint32_t ticket);
+        void connect(const char *url, uint32_t ticket);
+
+        AudioFileSource *promoteStandby(const char *url, uint32_t *bitrate, AudioCodec *codec);
+        bool hasStandby();
+        void updateStandby();
+        void serviceStandby();
+        void openStandby(StreamStandby *slot);
+        void closeStandby(StreamStandby *slot);
+
+        StreamResolver *resolver;
+
+        StreamStandby standby[STREAM_STANDBY_SLOTS];
+        char neighbours[STREAM_STANDBY_SLOTS + 1][STREAM_MAX_URL_LENGTH + 1];   // current first
+        bool neighboursChanged;
+
+        SemaphoreHandle_t mutex;
+        char url[STREAM_MAX_URL_LENGTH + 1];
+        uint32_t ticket;
+        bool pending;
+
+        QueueHandle_t results;
+        StaticQueue_t resultBuffer;
+        uint8_t resultStorage[sizeof(StreamResult)];
+
+        TaskHandle_t task;
+};
+
+#endif
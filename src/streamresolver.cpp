@@ -0,0 +1,214 @@
+#include "streamresolver.h"
+#include "logger.h"
+#include <HTTPClient.h>
+#include <Preferences.h>
+
+static bool isPlaylist(const char *url, const char *contentType);
+
+// NVS keys are limited to 15 characters, so stations are keyed by a hash
+void StreamResolver::keyForUrl(const char *url, char prefix, char *key) {
+    uint32_t hash = 2166136261u;
+    while (*url) {
+        hash ^= (uint8_t)*url++;
+        hash *= 16777619u;
+    }
+    sprintf(key, "%c%08x", prefix, hash);
+}
+
+StreamResolver::StreamResolver() {
+    this->body[0] = '\0';
+}
+
+bool StreamResolver::lookup(const char *url, char *resolved, AudioCodec *codec, uint32_t *bitrate) {
+    Preferences prefs;
+    char key[12];
+
+    if (!prefs.begin("stations", true)) return false;
+    this->keyForUrl(url, 'u', key);
+    size_t length = prefs.getString(key, resolved, STREAM_MAX_URL_LENGTH + 1);
+    this->keyForUrl(url, 'c', key);
+    *codec = (AudioCodec)prefs.getUChar(key, AudioCodecUnknown);
+    this->keyForUrl(url, 'b', key);
+    *bitrate = prefs.getUInt(key, 0);
+    prefs.end();
+
+    return length > 0;
+}
+
+void StreamResolver::store(const char *url, const char *resolved, AudioCodec codec, uint32_t bitrate) {
+    Preferences prefs;
+    char key[12];
+    char current[STREAM_MAX_URL_LENGTH + 1];
+    AudioCodec currentCodec;
+    uint32_t currentBitrate;
+
+    // Only write if changed, every write wears the flash
+    if (this->lookup(url, current, &currentCodec, &currentBitrate) && (strcmp(current, resolved) == 0) &&
+        (currentCodec == codec) && (currentBitrate == bitrate)) return;
+
+    if (!prefs.begin("stations", false)) return;
+    this->keyForUrl(url, 'u', key);
+    prefs.putString(key, resolved);
+    this->keyForUrl(url, 'c', key);
+    prefs.putUChar(key, codec);
+    this->keyForUrl(url, 'b', key);
+    prefs.putUInt(key, bitrate);
+    prefs.end();
+}
+
+void StreamResolver::forget(const char *url) {
+    Preferences prefs;
+    char key[12];
+
+    if (!prefs.begin("stations", false)) return;
+    this->keyForUrl(url, 'u', key);
+    prefs.remove(key);
+    this->keyForUrl(url, 'c', key);
+    prefs.remove(key);
+    this->keyForUrl(url, 'b', key);
+    prefs.remove(key);
+    prefs.end();
+}
+
+bool StreamResolver::resolve(const char *url, char *resolved, AudioCodec *codec, uint32_t *bitrate,
+    bool (*cancelled)(void *context), void *context) {
+    static const char *headers[] = { "Location", "Content-Type", "icy-br" };
+    char current[STREAM_MAX_URL_LENGTH + 1];
+
+    strncpy(current, url, STREAM_MAX_URL_LENGTH);
+    current[STREAM_MAX_URL_LENGTH] = '\0';
+
+    for (int hop = 0; hop <= STREAM_MAX_HOPS; hop++) {
+        if (cancelled && cancelled(context)) {
+            LOGD(LogModuleStream, "Resolving %s cancelled", url);
+            return false;
+        }
+
+        WiFiClient client;
+        HTTPClient http;
+
+        if (!http.begin(client, current)) return false;
+        http.setReuse(false);
+        http.setFollowRedirects(HTTPC_DISABLE_FOLLOW_REDIRECTS);
+        http.setTimeout(STREAM_RESOLVE_TIMEOUT_MS);
+        http.collectHeaders(headers, 3);
+
+        int code = http.GET();
+        if ((code == 301) || (code == 302) || (code == 303) || (code == 307) || (code == 308)) {
+            String location = http.header("Location");
+            http.end();
+            LOGD(LogModuleStream, "Redirect %d to %s", code, location.c_str());
+            if (!this->makeAbsolute(current, location.c_str(), resolved)) return false;
+            strcpy(current, resolved);
+            continue;
+        }
+        if (code != 200) {
+            LOGW(LogModuleStream, "Resolving %s failed: HTTP %d", current, code);
+            http.end();
+            return false;
+        }
+
+        String contentType = http.header("Content-Type");
+        if (!isPlaylist(current, contentType.c_str())) {
+            // Audio (or at least not something we could follow). Sometimes
+            // icy-br is a list like "128,128", toInt() stops at the comma.
+            *bitrate = http.header("icy-br").toInt();
+            http.end();
+            strcpy(resolved, current);
+            *codec = codecForContentType(contentType.c_str());
+            return true;
+        }
+
+        int size = http.getSize();
+        if ((size < 0) || (size > STREAM_PLAYLIST_MAX_SIZE)) size = STREAM_PLAYLIST_MAX_SIZE;
+        WiFiClient *stream = http.getStreamPtr();
+        stream->setTimeout(STREAM_RESOLVE_TIMEOUT_MS);
+        size_t bytes = stream->readBytes(this->body, size);
+        this->body[bytes] = '\0';
+        http.end();
+
+        if (!this->parsePlaylist(current, resolved)) {
+            LOGW(LogModuleStream, "No usable entry in playlist %s", current);
+            return false;
+        }
+        LOGI(LogModuleStream, "Playlist entry %s", resolved);
+        strcpy(current, resolved);
+    }
+
+    LOGW(LogModuleStream, "Too many redirects for %s", url);
+    return false;
+}
+
+// First http entry of an M3U (plain URL lines) or PLS (FileN=URL) playlist
+bool StreamResolver::parsePlaylist(const char *baseUrl, char *resolved) {
+    char *line = this->body;
+
+    while (*line) {
+        char *next = line + strcspn(line, "\r\n");
+        if (*next) *next++ = '\0';
+
+        while (isspace(*line)) line++;
+        char *value = line;
+        if (strncasecmp(line, "file", 4) == 0) {
+            char *equals = strchr(line, '=');
+            if (equals) value = equals + 1;
+        }
+        size_t length = strlen(value);
+        while ((length > 0) && isspace(value[length - 1])) value[--length] = '\0';
+
+        if ((strncmp(value, "http://", 7) == 0) && this->makeAbsolute(baseUrl, value, resolved)) {
+            return true;
+        }
+        line = next;
+    }
+    return false;
+}
+
+bool StreamResolver::makeAbsolute(const char *baseUrl, const char *location, char *resolved) {
+    char url[STREAM_MAX_URL_LENGTH + 1];
+
+    if (strncmp(location, "http://", 7) == 0) {
+        if (strlen(location) > STREAM_MAX_URL_LENGTH) return false;
+        strcpy(resolved, location);
+        return true;
+    }
+    if (strstr(location, "://")) {
+        LOGW(LogModuleStream, "Unsupported URL %s", location);
+        return false;
+    }
+
+    // Relative to the host or the directory of the current URL
+    strcpy(url, baseUrl);
+    char *host = url + 7;
+    char *path = strchr(host, '/');
+    if (location[0] == '/') {
+        if (path) *path = '\0';
+    } else if (path) {
+        char *query = strchr(path, '?');
+        if (query) *query = '\0';
+        strrchr(path, '/')[1] = '\0';
+    } else {
+        strcat(url, "/");
+    }
+    if (strlen(url) + strlen(location) > STREAM_MAX_URL_LENGTH) return false;
+
+    strcpy(resolved, url);
+    strcat(resolved, location);
+    return true;
+}
+
+static bool isPlaylist(const char *url, const char *contentType) {
+    if (strstr(contentType, "mpegurl") || strstr(contentType, "scpls")) {
+        return true;
+    }
+
+    // Some servers send text/plain or octet-stream, go by the extension
+    size_t length = strcspn(url, "?#");
+    if ((length > 4) && ((strncasecmp(url + length - 4, ".m3u", 4) == 0) || (strncasecmp(url + length - 4, ".pls", 4) == 0))) {
+        return true;
+    }
+    if ((length > 5) && (strncasecmp(url + length - 5, ".m3u8", 5) == 0)) {
+        return true;
+    }
+    return false;
+}
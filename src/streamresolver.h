@@ -0,0 +1,49 @@
+#ifndef LITTLESPEAKER_STREAMRESOLVER_H
+#define LITTLESPEAKER_STREAMRESOLVER_H
+
+#include <Arduino.h>
+#include "streamconnector.h"
+#include "codec.h"
+
+// Redirects and playlist indirections followed before giving up
+#define STREAM_MAX_HOPS 5
+
+// Playlists are only read up to this size, the first entry is enough
+#define STREAM_PLAYLIST_MAX_SIZE 2048
+
+#define STREAM_RESOLVE_TIMEOUT_MS 5000
+
+//
+// Turns a station URL into the URL of the actual audio stream by following
+// HTTP redirects and M3U/PLS playlists. The result is cached per station
+// in NVS together with the codec from the Content-Type header and the
+// bitrate from the icy-br header, so only the first connect pays for the
+// extra requests.
+//
+// Only used from the connector task.
+//
+class StreamResolver {
+    public:
+        StreamResolver();
+
+        // Cached endpoint for this station, false if there is none. The
+        // bitrate is in kbit/s, 0 if the server did not send it.
+        bool lookup(const char *url, char *resolved, AudioCodec *codec, uint32_t *bitrate);
+        void store(const char *url, const char *resolved, AudioCodec codec, uint32_t bitrate);
+        void forget(const char *url);
+
+        // Network round trips to find the endpoint, resolved has to hold
+        // STREAM_MAX_URL_LENGTH + 1 bytes. cancelled is asked between the
+        // hops, resolving stops when it returns true.
+        bool resolve(const char *url, char *resolved, AudioCodec *codec, uint32_t *bitrate,
+            bool (*cancelled)(void *context) = NULL, void *context = NULL);
+
+    private:
+        bool parsePlaylist(const char *baseUrl, char *resolved);
+        bool makeAbsolute(const char *baseUrl, const char *location, char *resolved);
+        void keyForUrl(const char *url, char prefix, char *key);
+
+        char body[STREAM_PLAYLIST_MAX_SIZE + 1];
+};
+
+#endif
@@ -0,0 +1,257 @@
+#include "telemetry.h"
+#include "logger.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "freertos/timers.h"
+
+TelemetrySnapshot telemetry;
+
+static TelemetrySnapshot lastSnapshot;
+static SemaphoreHandle_t snapshotMutex = NULL;
+static TimerHandle_t snapshotTimer = NULL;
+static StaticTimer_t snapshotTimerBuffer;
+
+static const char *histogramNames[TelemetryHistogramCount] = {
+    "decode",
+    "eq block",
+    "bt jitter",
+    "stream fill %"
+};
+
+static void snapshotCallback(TimerHandle_t timer);
+
+// Everything in a snapshot is a 32 bit word, updated atomically one by one
+static void copySnapshot(TelemetrySnapshot *to, const TelemetrySnapshot *from) {
+    const uint32_t *source = reinterpret_cast<const uint32_t *>(from);
+    uint32_t *target = reinterpret_cast<uint32_t *>(to);
+
+    for (size_t i = 0; i < sizeof(TelemetrySnapshot) / sizeof(uint32_t); i++) {
+        target[i] = __atomic_load_n(source + i, __ATOMIC_RELAXED);
+    }
+}
+
+void telemetryBegin() {
+    if (snapshotTimer) return;
+
+    snapshotMutex = xSemaphoreCreateMutex();
+    getTelemetry(&lastSnapshot);
+    snapshotTimer = xTimerCreateStatic("telemetry", pdMS_TO_TICKS(TELEMETRY_SNAPSHOT_MS), pdTRUE, NULL,
+        snapshotCallback, &snapshotTimerBuffer);
+    xTimerStart(snapshotTimer, portMAX_DELAY);
+}
+
+void getTelemetry(TelemetrySnapshot *snapshot) {
+    uint32_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    uint32_t current = __atomic_load_n(&telemetry.largestMinimum, __ATOMIC_RELAXED);
+    while (((current == 0) || (largest < current)) &&
+        !__atomic_compare_exchange_n(&telemetry.largestMinimum, &current, largest, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    copySnapshot(snapshot, &telemetry);
+    snapshot->time = millis();
+    snapshot->heapMinimum = ESP.getMinFreeHeap();
+}
+
+void getTelemetrySnapshot(TelemetrySnapshot *snapshot) {
+    if (snapshotMutex == NULL) {
+        getTelemetry(snapshot);
+        return;
+    }
+    xSemaphoreTake(snapshotMutex, portMAX_DELAY);
+    *snapshot = lastSnapshot;
+    xSemaphoreGive(snapshotMutex);
+}
+
+//
+// Histograms
+//
+
+static uint32_t bucketOf(TelemetryHistogram histogram, uint32_t value) {
+    uint32_t bucket;
+
+    if (histogram == TelemetryStreamFill) {
+        bucket = value / 10;
+    } else {
+        bucket = value ? 32 - __builtin_clz(value) : 0;
+    }
+    return (bucket < TELEMETRY_BUCKETS) ? bucket : TELEMETRY_BUCKETS - 1;
+}
+
+static uint32_t bucketLimit(TelemetryHistogram histogram, uint32_t bucket) {
+    if (histogram == TelemetryStreamFill) {
+        return (bucket >= 10) ? 100 : bucket * 10 + 10;
+    }
+    return 1u << bucket;
+}
+
+void telemetryRecord(TelemetryHistogram histogram, uint32_t value) {
+    TelemetryHistogramData *data = telemetry.histograms + histogram;
+
+    __atomic_fetch_add(&data->buckets[bucketOf(histogram, value)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&data->count, 1, __ATOMIC_RELAXED);
+
+    uint32_t current = __atomic_load_n(&data->maximum, __ATOMIC_RELAXED);
+    while ((value > current) &&
+        !__atomic_compare_exchange_n(&data->maximum, &current, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    // Zero until the first value, the minimum is taken as value + 1
+    current = __atomic_load_n(&data->minimum, __ATOMIC_RELAXED);
+    while (((current == 0) || (value + 1 < current)) &&
+        !__atomic_compare_exchange_n(&data->minimum, &current, value + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+uint32_t telemetryPercentile(TelemetryHistogram histogram, const TelemetryHistogramData *data, uint32_t percent) {
+    uint32_t count = 0;
+    for (int i = 0; i < TELEMETRY_BUCKETS; i++) count += data->buckets[i];
+    if (count == 0) return 0;
+
+    // The rank is rounded up, p99 of a few values is the largest
+    uint32_t rank = ((uint64_t)count * percent + 99) / 100;
+    uint32_t seen = 0;
+    for (int i = 0; i < TELEMETRY_BUCKETS; i++) {
+        seen += data->buckets[i];
+        if ((seen >= rank) && (seen > 0)) return bucketLimit(histogram, i);
+    }
+    return bucketLimit(histogram, TELEMETRY_BUCKETS - 1);
+}
+
+// Histogram of what was recorded between two snapshots, without min and max
+static void histogramDelta(TelemetryHistogramData *delta, const TelemetryHistogramData *now, const TelemetryHistogramData *before) {
+    for (int i = 0; i < TELEMETRY_BUCKETS; i++) {
+        delta->buckets[i] = now->buckets[i] - before->buckets[i];
+    }
+    delta->count = now->count - before->count;
+    delta->minimum = 0;
+    delta->maximum = 0;
+}
+
+//
+// I2S output estimate, only the audio task writes
+//
+
+static uint32_t outputRate = 0;
+static int64_t emptyAt = 0;         // When the DMA buffers run dry, 0 while idle
+
+void telemetryOutputRate(uint32_t rate) {
+    outputRate = rate;
+}
+
+void telemetryOutputFrames(uint32_t frames) {
+    telemetryCount(TelemetryOutputFrames, frames);
+    if (outputRate == 0) return;
+
+    int64_t now = esp_timer_get_time();
+    int64_t late = now - emptyAt;
+    if ((emptyAt == 0) || (late > TELEMETRY_IDLE_US)) {
+        // Starting again, the DMA buffers played silence on purpose
+        emptyAt = now;
+    } else if (late > TELEMETRY_UNDERRUN_SLACK_US) {
+        telemetryCount(TelemetryI2SUnderruns);
+        telemetryCount(TelemetryI2SMissedMs, (uint32_t)(late / 1000));
+        emptyAt = now;
+    } else if (late > 0) {
+        emptyAt = now;
+    }
+    emptyAt += (int64_t)frames * 1000000 / outputRate;
+}
+
+void telemetryOutputFull() {
+    if (outputRate == 0) return;
+    emptyAt = esp_timer_get_time() + (int64_t)TELEMETRY_DMA_FRAMES * 1000000 / outputRate;
+}
+
+void telemetryOutputStop() {
+    emptyAt = 0;
+}
+
+//
+// Bluetooth, BT task only
+//
+
+static int64_t lastPacket = 0;
+static uint32_t lastPacketFrames = 0;
+
+void telemetryBTPacket(uint32_t frames, uint32_t rate) {
+    int64_t now = esp_timer_get_time();
+
+    telemetryCount(TelemetryBTPackets);
+    if ((lastPacket != 0) && (rate != 0) && (now - lastPacket < TELEMETRY_IDLE_US)) {
+        // Packets should come at the pace of the audio they carry
+        int64_t expected = (int64_t)lastPacketFrames * 1000000 / rate;
+        int64_t jitter = (now - lastPacket) - expected;
+        telemetryRecord(TelemetryBTJitter, (uint32_t)((jitter < 0) ? -jitter : jitter));
+    }
+    lastPacket = now;
+    lastPacketFrames = frames;
+}
+
+//
+// Snapshots and reports
+//
+
+static void snapshotCallback(TimerHandle_t timer) {
+    // The timer task has a small stack
+    static TelemetrySnapshot now;
+    static TelemetrySnapshot before;
+
+    xSemaphoreTake(snapshotMutex, portMAX_DELAY);
+    before = lastSnapshot;
+    getTelemetry(&now);
+    lastSnapshot = now;
+    xSemaphoreGive(snapshotMutex);
+
+    uint32_t frames = now.counters[TelemetryOutputFrames] - before.counters[TelemetryOutputFrames];
+    uint32_t underruns = now.counters[TelemetryI2SUnderruns] - before.counters[TelemetryI2SUnderruns];
+    uint32_t streamUnderruns = now.counters[TelemetryStreamUnderruns] - before.counters[TelemetryStreamUnderruns];
+    if (frames == 0) return;
+
+    TelemetryHistogramData decode;
+    TelemetryHistogramData fill;
+    histogramDelta(&decode, now.histograms + TelemetryDecode, before.histograms + TelemetryDecode);
+    histogramDelta(&fill, now.histograms + TelemetryStreamFill, before.histograms + TelemetryStreamFill);
+
+    if (underruns || streamUnderruns) {
+        LOGW(LogModuleHealth, "%u I2S underruns, %u stream underruns, decode p99 < %u us, heap minimum %u",
+            underruns, streamUnderruns, telemetryPercentile(TelemetryDecode, &decode, 99), now.heapMinimum);
+    } else {
+        LOGD(LogModuleHealth, "%u frames, decode p99 < %u us, stream fill p10 < %u%%, heap minimum %u",
+            frames, telemetryPercentile(TelemetryDecode, &decode, 99),
+            fill.count ? telemetryPercentile(TelemetryStreamFill, &fill, 10) : 0, now.heapMinimum);
+    }
+}
+
+void printTelemetry(Print *out) {
+    TelemetrySnapshot now;
+    TelemetrySnapshot before;
+
+    getTelemetrySnapshot(&before);
+    getTelemetry(&now);
+
+    out->printf("Audio health after %u s, since the last snapshot %u s ago in brackets\n",
+        now.time / 1000, (now.time - before.time) / 1000);
+    out->printf("I2S underruns     %8u (%u), about %u ms of silence\n", now.counters[TelemetryI2SUnderruns],
+        now.counters[TelemetryI2SUnderruns] - before.counters[TelemetryI2SUnderruns], now.counters[TelemetryI2SMissedMs]);
+    out->printf("Output frames     %8u (%u)\n", now.counters[TelemetryOutputFrames],
+        now.counters[TelemetryOutputFrames] - before.counters[TelemetryOutputFrames]);
+    out->printf("Stream underruns  %8u (%u)\n", now.counters[TelemetryStreamUnderruns],
+        now.counters[TelemetryStreamUnderruns] - before.counters[TelemetryStreamUnderruns]);
+    out->printf("BT packets        %8u (%u)\n", now.counters[TelemetryBTPackets],
+        now.counters[TelemetryBTPackets] - before.counters[TelemetryBTPackets]);
+    out->printf("Heap minimum      %8u, smallest largest block %u\n", now.heapMinimum, now.largestMinimum);
+
+    out->println("                     count      min      p50      p99      max  (count    p99)");
+    for (int i = 0; i < TelemetryHistogramCount; i++) {
+        TelemetryHistogram histogram = (TelemetryHistogram)i;
+        const TelemetryHistogramData *data = now.histograms + i;
+        TelemetryHistogramData delta;
+        histogramDelta(&delta, data, before.histograms + i);
+
+        out->printf("%-16s %9u", histogramNames[i], data->count);
+        if (data->count) {
+            out->printf(" %8u %8u %8u %8u", data->minimum - 1, telemetryPercentile(histogram, data, 50),
+                telemetryPercentile(histogram, data, 99), data->maximum);
+        } else {
+            out->printf(" %8s %8s %8s %8s", "-", "-", "-", "-");
+        }
+        out->printf("  (%5u %6u)\n", delta.count, telemetryPercentile(histogram, &delta, 99));
+    }
+}
@@ -0,0 +1,102 @@
+#ifndef LITTLESPEAKER_TELEMETRY_H
+#define LITTLESPEAKER_TELEMETRY_H
+
+#include <Arduino.h>
+
+#define TELEMETRY_BUCKETS 16
+
+// Every this often a snapshot is taken and the interval summed up
+#define TELEMETRY_SNAPSHOT_MS 10000
+
+// Frames the I2S DMA buffers hold, 10 buffers of 128 frames as set up in
+// main.cpp, and how often the output estimate is updated
+#define TELEMETRY_DMA_FRAMES (10 * 128)
+#define TELEMETRY_OUTPUT_BATCH 128
+
+// Output arriving this late after the DMA buffers ran empty is an underrun,
+// after a longer gap the output was idle (paused, between tracks)
+#define TELEMETRY_UNDERRUN_SLACK_US 1000
+#define TELEMETRY_IDLE_US 500000
+
+// Playlist::loop() spins while the output is full, shorter decoder calls
+// did not decode anything
+#define TELEMETRY_DECODE_MIN_US 20
+
+typedef enum _TelemetryCounter {
+    TelemetryI2SUnderruns = 0,
+    TelemetryI2SMissedMs = 1,       // Estimated silence played by the underruns
+    TelemetryOutputFrames = 2,
+    TelemetryStreamUnderruns = 3,
+    TelemetryBTPackets = 4,
+    TelemetryCounterCount
+} TelemetryCounter;
+
+typedef enum _TelemetryHistogram {
+    TelemetryDecode = 0,            // us per decoder loop() that decoded, about one frame
+    TelemetryEQBlock = 1,           // us per processBuffer() of the Bluetooth stream
+    TelemetryBTJitter = 2,          // us a packet came earlier or later than its predecessor's length
+    TelemetryStreamFill = 3,        // percent of the stream buffer filled, at each read
+    TelemetryHistogramCount
+} TelemetryHistogram;
+
+typedef struct _TelemetryHistogramData {
+    uint32_t buckets[TELEMETRY_BUCKETS];
+    uint32_t count;
+    uint32_t minimum;           // Plus one, 0 until the first value
+    uint32_t maximum;
+} TelemetryHistogramData;
+
+typedef struct _TelemetrySnapshot {
+    uint32_t time;              // millis()
+    uint32_t counters[TelemetryCounterCount];
+    TelemetryHistogramData histograms[TelemetryHistogramCount];
+    uint32_t heapMinimum;       // Lowest free heap since boot
+    uint32_t largestMinimum;    // Smallest largest free block a snapshot has seen
+} TelemetrySnapshot;
+
+//
+// Health of the audio chain, always on. Counters and histograms are
+// updated with atomic adds where they happen, a timer takes a snapshot
+// every TELEMETRY_SNAPSHOT_MS and logs what changed in the interval.
+//
+// Time histograms have power of two buckets, bucket n holds values below
+// 2^n microseconds. The stream fill has one bucket per 10 percent.
+//
+void telemetryBegin();
+
+// Everything since boot
+void getTelemetry(TelemetrySnapshot *snapshot);
+
+// The last periodic snapshot
+void getTelemetrySnapshot(TelemetrySnapshot *snapshot);
+
+// Totals since boot and the last interval, for the console
+void printTelemetry(Print *out);
+
+// The given percentile is below this bound of its bucket, 0 if empty
+uint32_t telemetryPercentile(TelemetryHistogram histogram, const TelemetryHistogramData *data, uint32_t percent);
+
+//
+// Recording, any task
+//
+
+extern TelemetrySnapshot telemetry;
+
+static inline void telemetryCount(TelemetryCounter counter, uint32_t n = 1) {
+    __atomic_fetch_add(&telemetry.counters[counter], n, __ATOMIC_RELAXED);
+}
+
+void telemetryRecord(TelemetryHistogram histogram, uint32_t value);
+
+// The I2S underrun estimate, fed by the last stage before the output
+// from one task at a time. Frames are passed in batches, a refused sample
+// means the DMA buffers are full and resynchronizes the estimate.
+void telemetryOutputRate(uint32_t rate);
+void telemetryOutputFrames(uint32_t frames);
+void telemetryOutputFull();
+void telemetryOutputStop();
+
+// A Bluetooth packet of this many frames arrived
+void telemetryBTPacket(uint32_t frames, uint32_t rate);
+
+#endif
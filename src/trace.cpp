@@ -0,0 +1,248 @@
+#include "trace.h"
+
+#if TRACING
+
+#define TRACE_CORES 2
+
+typedef struct _TraceRecord {
+    uint32_t start;
+    uint32_t duration;      // Value of instant events
+    uint32_t sequence;      // Index + 1 once the record is complete
+    uint16_t wraps;         // Of the clock at start
+    uint8_t event;
+    uint8_t instant;
+} TraceRecord;
+
+typedef struct _TraceRing {
+    TraceRecord *records;
+    uint32_t head;          // Next index to be written
+    uint32_t tail;          // Next index to be drained
+    uint32_t lastStart;
+    uint16_t wraps;
+    uint32_t dropped;
+} TraceRing;
+
+static const char *eventNames[TraceEventCount] = {
+    "decode",
+    "eq",
+    "i2s wait",
+    "sd read",
+    "bt callback",
+    "menu next",
+    "menu previous",
+    "menu enter",
+    "menu leave"
+};
+
+static TraceRing rings[TRACE_CORES];
+static bool tracing = false;
+static bool streaming = false;
+static bool streamStarted = false;
+static SemaphoreHandle_t drainMutex = NULL;
+
+//
+// Writers, any task or core
+//
+
+static void traceRecord(TraceEvent event, uint32_t start, uint32_t duration, bool instant) {
+    if (!tracing) return;
+
+    TraceRing *ring = rings + (xPortGetCoreID() ? 1 : 0);
+    uint32_t index = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+    TraceRecord *record = ring->records + (index % TRACE_BUFFER_EVENTS);
+
+    // Scopes are written when they end, an outer one after the inner ones
+    // and maybe from before the last wrap of the clock. Tasks preempting
+    // each other right here may miscount a wrap, that is accepted.
+    uint16_t wraps = ring->wraps;
+    if (index == 0) {
+        ring->lastStart = start;
+    } else if ((int32_t)(start - ring->lastStart) >= 0) {
+        if (start < ring->lastStart) wraps = ++ring->wraps;
+        ring->lastStart = start;
+    } else if (start > ring->lastStart) {
+        wraps--;
+    }
+
+    record->start = start;
+    record->duration = duration;
+    record->wraps = wraps;
+    record->event = event;
+    record->instant = instant;
+    __atomic_store_n(&record->sequence, index + 1, __ATOMIC_RELEASE);
+}
+
+void traceComplete(TraceEvent event, uint32_t start, uint32_t duration) {
+    traceRecord(event, start, duration, false);
+}
+
+void traceInstant(TraceEvent event, int32_t value) {
+    traceRecord(event, traceClock(), (uint32_t)value, true);
+}
+
+//
+// Reader
+//
+
+// One event per line. Streamed lines end with a comma and are written in
+// one go, log lines in between can be filtered out.
+static void writeLine(Print *out, const char *line, bool stream, bool *first) {
+    if (stream) {
+        out->printf("%s,\n", line);
+    } else {
+        out->printf("%s%s", *first ? "" : ",\n", line);
+    }
+    *first = false;
+}
+
+static void writeRecord(Print *out, int core, const TraceRecord *record, bool stream, bool *first) {
+    char line[160];
+    uint64_t start = ((uint64_t)record->wraps << 32) | record->start;
+    double perUs = traceClockPerUs();
+
+    if (record->instant) {
+        snprintf(line, sizeof(line), "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"value\":%d}}",
+            eventNames[record->event], core, start / perUs, (int32_t)record->duration);
+    } else {
+        snprintf(line, sizeof(line), "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+            eventNames[record->event], core, start / perUs, record->duration / perUs);
+    }
+    writeLine(out, line, stream, first);
+}
+
+static void writeHeader(Print *out, bool stream, bool *first) {
+    char line[128];
+
+    writeLine(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"littlespeaker\"}}", stream, first);
+    for (int core = 0; core < TRACE_CORES; core++) {
+        snprintf(line, sizeof(line), "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"core %d\"}}", core, core);
+        writeLine(out, line, stream, first);
+    }
+}
+
+// Writes the complete records of a core in order, call with the mutex held
+static void drainRing(Print *out, int core, bool stream, bool *first) {
+    TraceRing *ring = rings + core;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    if (head - ring->tail > TRACE_BUFFER_EVENTS) {
+        ring->dropped += head - ring->tail - TRACE_BUFFER_EVENTS;
+        ring->tail = head - TRACE_BUFFER_EVENTS;
+    }
+
+    while (ring->tail != head) {
+        TraceRecord *slot = ring->records + (ring->tail % TRACE_BUFFER_EVENTS);
+        uint32_t expected = ring->tail + 1;
+        uint32_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+
+        // Reserved but not written yet, the rest waits for the next drain
+        if ((int32_t)(sequence - expected) < 0) break;
+
+        TraceRecord record = *slot;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if ((sequence != expected) || (__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) != expected)) {
+            // Overwritten by the next round meanwhile
+            ring->dropped++;
+        } else {
+            writeRecord(out, core, &record, stream, first);
+        }
+        ring->tail++;
+    }
+}
+
+static void traceTask(void *context) {
+    while (true) {
+        vTaskDelay(pdMS_TO_TICKS(TRACE_DRAIN_INTERVAL_MS));
+        if (!streaming) continue;
+
+        xSemaphoreTake(drainMutex, portMAX_DELAY);
+        bool first = false;
+        if (!streamStarted) {
+            Serial.println("[");
+            writeHeader(&Serial, true, &first);
+            streamStarted = true;
+        }
+        for (int core = 0; core < TRACE_CORES; core++) {
+            drainRing(&Serial, core, true, &first);
+        }
+        xSemaphoreGive(drainMutex);
+    }
+}
+
+void traceBegin(UBaseType_t priority, BaseType_t core) {
+    if (tracing) return;
+
+    for (int i = 0; i < TRACE_CORES; i++) {
+        memset(rings + i, 0, sizeof(TraceRing));
+        rings[i].records = new TraceRecord[TRACE_BUFFER_EVENTS];
+        memset(rings[i].records, 0, sizeof(TraceRecord) * TRACE_BUFFER_EVENTS);
+    }
+    drainMutex = xSemaphoreCreateMutex();
+    xTaskCreatePinnedToCore(traceTask, "trace", TRACE_TASK_STACK_SIZE, NULL, priority, NULL, core);
+
+    Serial.printf("Tracing with %u records per core, clock in %s\n", TRACE_BUFFER_EVENTS, TRACE_CLOCK_UNIT);
+    tracing = true;
+}
+
+void traceDump(Print *out) {
+    if (!tracing) {
+        out->println("Tracing is not running");
+        return;
+    }
+
+    xSemaphoreTake(drainMutex, portMAX_DELAY);
+    bool first = true;
+    out->print("{\"traceEvents\":[");
+    writeHeader(out, false, &first);
+    for (int core = 0; core < TRACE_CORES; core++) {
+        drainRing(out, core, false, &first);
+    }
+    out->println("],\"displayTimeUnit\":\"ms\"}");
+    xSemaphoreGive(drainMutex);
+}
+
+void traceStream(bool enabled) {
+    if (!tracing) return;
+
+    xSemaphoreTake(drainMutex, portMAX_DELAY);
+    if (!enabled && streamStarted) {
+        Serial.println("]");
+        streamStarted = false;
+    }
+    streaming = enabled;
+    xSemaphoreGive(drainMutex);
+}
+
+bool isTraceStreaming() {
+    return streaming;
+}
+
+void getTraceStats(TraceStats *stats) {
+    memset(stats, 0, sizeof(TraceStats));
+    for (int core = 0; core < TRACE_CORES; core++) {
+        stats->recorded += __atomic_load_n(&rings[core].head, __ATOMIC_RELAXED);
+        stats->dropped += rings[core].dropped;
+    }
+}
+
+#else
+
+void traceBegin(UBaseType_t priority, BaseType_t core) {
+}
+
+void traceDump(Print *out) {
+    out->println("Tracing is not compiled in, build with -DTRACING=1");
+}
+
+void traceStream(bool enabled) {
+}
+
+bool isTraceStreaming() {
+    return false;
+}
+
+void getTraceStats(TraceStats *stats) {
+    memset(stats, 0, sizeof(TraceStats));
+}
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef LITTLESPEAKER_TRACE_H
+#define LITTLESPEAKER_TRACE_H
+
+#include <Arduino.h>
+
+// Record hot path events, without it the TRACE_ macros compile to nothing
+#ifndef TRACING
+#define TRACING 0
+#endif
+
+// Records kept per core until they are drained, 16 bytes each
+#define TRACE_BUFFER_EVENTS 512
+
+#define TRACE_TASK_STACK_SIZE 3072
+#define TRACE_DRAIN_INTERVAL_MS 50
+
+// Playlist::loop() spins while the output is full, shorter calls are not
+// decoding anything and are left out
+#define TRACE_DECODE_MIN_US 20
+
+typedef enum _TraceEvent {
+    TraceEventDecode = 0,
+    TraceEventEQ = 1,
+    TraceEventI2SWait = 2,          // The output refuses samples until it has room
+    TraceEventSDRead = 3,
+    TraceEventBTCallback = 4,
+    TraceEventMenuNext = 5,         // Instant, value: selected index, -1 in button menus
+    TraceEventMenuPrevious = 6,     // Instant, value: selected index, -1 in button menus
+    TraceEventMenuEnter = 7,        // Instant, value: selected index, -1 in button menus
+    TraceEventMenuLeave = 8,        // Instant, value: index of the left item
+    TraceEventCount
+} TraceEvent;
+
+typedef struct _TraceStats {
+    uint32_t recorded;
+    uint32_t dropped;       // Overwritten before they were drained
+} TraceStats;
+
+//
+// Clock of the trace and the benchmarks: CCOUNT of the calling core on
+// the device, nanoseconds on the host. Both wrap after a few seconds.
+//
+#if defined(ESP_PLATFORM)
+#include <xtensa/hal.h>
+
+#define TRACE_CLOCK_UNIT "cycles"
+
+static inline uint32_t traceClock() {
+    return xthal_get_ccount();
+}
+
+static inline uint32_t traceClockPerUs() {
+    return getCpuFrequencyMhz();
+}
+#else
+#include <time.h>
+
+#define TRACE_CLOCK_UNIT "ns"
+
+static inline uint32_t traceClock() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)((uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec);
+}
+
+static inline uint32_t traceClockPerUs() {
+    return 1000;
+}
+#endif
+
+//
+// Low overhead tracing of the audio path. A scope is written as one
+// record when it ends, into a lock free ring per core, nothing is
+// formatted or printed by the traced code. The records are turned into
+// Chrome trace_event JSON (chrome://tracing, ui.perfetto.dev) by
+// traceDump() or continuously by a low priority task with traceStream().
+//
+// Cores are threads of the trace. The CCOUNT registers of the two cores
+// are not synchronized, timestamps across cores may be a few microseconds
+// apart. A core quiet for longer than a clock wrap (17 s at 240 MHz) may
+// show a gap shortened by multiples of it.
+//
+void traceBegin(UBaseType_t priority = 1, BaseType_t core = 0);
+
+// Writes what was recorded since the last drain as a complete JSON file
+void traceDump(Print *out);
+
+// Drains to the serial console every TRACE_DRAIN_INTERVAL_MS, one event
+// per line. Lines starting with {"name" make a JSON array without the
+// closing bracket, which the trace viewers accept.
+void traceStream(bool enabled);
+bool isTraceStreaming();
+
+// All zero if TRACING is off
+void getTraceStats(TraceStats *stats);
+
+#if TRACING
+
+void traceComplete(TraceEvent event, uint32_t start, uint32_t duration);
+void traceInstant(TraceEvent event, int32_t value);
+
+class TraceScope {
+    public:
+        TraceScope(TraceEvent event, uint32_t minimum = 0) {
+            this->event = event;
+            this->minimum = minimum;
+            this->start = traceClock();
+        }
+
+        ~TraceScope() {
+            uint32_t duration = traceClock() - this->start;
+            if (duration >= this->minimum) traceComplete(this->event, this->start, duration);
+        }
+
+    private:
+        TraceEvent event;
+        uint32_t minimum;
+        uint32_t start;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+// Until the end of the enclosing block
+#define TRACE_SCOPE(event) TraceScope TRACE_CONCAT(traceScope, __LINE__)(event)
+
+// Same, but only if it took at least us microseconds
+#define TRACE_SCOPE_OVER(event, us) TraceScope TRACE_CONCAT(traceScope, __LINE__)(event, (us) * traceClockPerUs())
+
+#define TRACE_INSTANT(event, value) traceInstant(event, value)
+
+// From a start taken with traceClock() until now
+#define TRACE_COMPLETE(event, start) traceComplete(event, start, traceClock() - (start))
+
+#else
+
+#define TRACE_SCOPE(event) do {} while (0)
+#define TRACE_SCOPE_OVER(event, us) do {} while (0)
+#define TRACE_INSTANT(event, value) do {} while (0)
+#define TRACE_COMPLETE(event, start) do {} while (0)
+
+#endif
+
+#endif
@@ -1,60 +1,152 @@
 #include "webradio.h"
+#include "logger.h"
+#include "heapstats.h"
 #include <SD.h>
-#include <WiFi.h>
 
 static void activateWifi(Menu *menu);
 static void deactivateWifi(Menu *menu);
+static void wifiStateChanged(WifiState state, void *context);
 
 static void webPrev(Menu *item);
 static void webNext(Menu *item);
 static void webPlayPause(Menu *item);
 
-#define MAX_URL_LEN 255
-
-WebradioPlayer::WebradioPlayer(Playlist *playlist) {
+WebradioPlayer::WebradioPlayer(Playlist *playlist, WifiConnection *wifi, StreamConnector *connector) {
     this->playlist = playlist;
+    this->wifi = wifi;
+    this->connector = connector;
+    this->wifi->registerStateCallback(wifiStateChanged, this);
+    this->arena = NULL;
+    this->stations = NULL;
     this->numRadioStations = 0;
     this->currentItem = 0;
+    this->announceOnConnect = false;
+    this->fileSize = 0;
+    this->fileTime = 0;
+
+    this->loadStations();
+}
+
+WebradioPlayer::~WebradioPlayer() {
+    heapFree(this->arena);
+    heapFree(this->stations);
+}
 
-    // load playlist file
+//
+// Parse webradio.txt into the station table, does nothing if the file did
+// not change since the last call. Lines are compacted in place into the
+// arena so every URL ends up as a zero terminated string.
+//
+bool WebradioPlayer::loadStations() {
     File file = SD.open("/webradio.txt");
     if (!file) {
-        Serial.println("No webradio.txt found");
-    }
-
-    // parse playlist file
-    char buffer[MAX_URL_LEN + 1] = { 0 };
-    while (file.available()) {
-        size_t bytes;
-        
-        bytes = file.readBytesUntil(':', buffer, 6);
-        if ((bytes != 4) || (strncmp("http", buffer, 4) != 0)) {
-            // can not parse line, skip to end of line
-            buffer[bytes] = '\0';
-            Serial.printf("Line does not start with http: %s", buffer);
-            goto skipline;
-        } else {
-            Serial.printf("Station %d -> http:", this->numRadioStations + 1);
-        }
+        LOGW(LogModuleWebradio, "No webradio.txt found");
+        return false;
+    }
 
-        this->urloffset[this->numRadioStations] = file.position() - 5;
-        this->numRadioStations++;
+    size_t size = file.size();
+    time_t time = file.getLastWrite();
+    if (this->arena && (size == this->fileSize) && (time == this->fileTime)) {
+        file.close();
+        return true;
+    }
 
-        if (this->numRadioStations == MAX_WEBRADIO_STATIONS) {
-            break;
-        }
-skipline:
-        do {
-            bytes = file.readBytesUntil('\n', buffer, MAX_URL_LEN);
-            buffer[bytes] = '\0';
-            Serial.printf("%s", buffer);
-        } while (bytes == 128);
-        Serial.println();
+    heapFree(this->arena);
+    heapFree(this->stations);
+    this->stations = NULL;
+    this->numRadioStations = 0;
+    this->currentItem = 0;
+
+    this->arena = reinterpret_cast<char *>(heapAlloc(HeapTagWebradio, size + 1));
+    if (!this->arena) {
+        LOGE(LogModuleWebradio, "Not enough memory for the station list");
+        file.close();
+        return false;
     }
+    size_t bytes = file.read(reinterpret_cast<uint8_t *>(this->arena), size);
     file.close();
+    this->arena[bytes] = '\0';
+
+    // Upper bound for the table size
+    int numLines = 1;
+    for (size_t i = 0; i < bytes; i++) {
+        if (this->arena[i] == '\n') numLines++;
+    }
+    this->stations = reinterpret_cast<WebradioStation *>(heapAlloc(HeapTagWebradio, sizeof(WebradioStation) * numLines));
+    if (!this->stations) {
+        LOGE(LogModuleWebradio, "Not enough memory for the station list");
+        heapFree(this->arena);
+        this->arena = NULL;
+        return false;
+    }
+
+    char *line = this->arena;
+    char *end = this->arena + bytes;
+    uint32_t used = 0;
+    while (line < end) {
+        char *next = strchr(line, '\n');
+        if (!next) next = end;
+        size_t length = next - line;
+        while ((length > 0) && isspace(line[length - 1])) length--;
+
+        if ((length < 7) || (strncmp("http://", line, 7) != 0)) {
+            if ((length > 0) && (line[0] != '#')) {
+                LOGW(LogModuleWebradio, "Line does not start with http://: %.*s", (int)length, line);
+            }
+        } else if (length > STREAM_MAX_URL_LENGTH) {
+            LOGW(LogModuleWebradio, "URL too long: %.*s", (int)length, line);
+        } else {
+            WebradioStation *station = this->stations + this->numRadioStations;
+            memmove(this->arena + used, line, length);
+            station->url = used;
+            station->announcer = false;
+            used += length;
+            this->arena[used++] = '\0';
+            this->numRadioStations++;
+            LOGD(LogModuleWebradio, "Station %d -> %s", this->numRadioStations, this->arena + station->url);
+        }
+        line = next + 1;
+    }
+
+    // Give back what the comments and line ends used
+    char *compacted = reinterpret_cast<char *>(heapRealloc(this->arena, used ? used : 1));
+    if (compacted) this->arena = compacted;
+    if (this->numRadioStations > 0) {
+        WebradioStation *table = reinterpret_cast<WebradioStation *>(heapRealloc(this->stations, sizeof(WebradioStation) * this->numRadioStations));
+        if (table) this->stations = table;
+    }
+
+    this->fileSize = size;
+    this->fileTime = time;
+    this->findAnnouncers();
+
+    LOGI(LogModuleWebradio, "%d stations, %u bytes", this->numRadioStations, used + sizeof(WebradioStation) * this->numRadioStations);
+    return true;
 }
 
-WebradioPlayer::~WebradioPlayer() {
+// One directory scan instead of probing every station file on announce.
+// Only the exact name announce() opens counts, FAT ignores the case.
+void WebradioPlayer::findAnnouncers() {
+    File dir = SD.open("/webradio");
+    if (!dir || !dir.isDirectory()) return;
+
+    File entry;
+    while ((entry = dir.openNextFile())) {
+        const char *name = entry.name();
+        long number = strtol(name, NULL, 10);
+
+        if ((number > 0) && (number <= this->numRadioStations)) {
+            char expected[16];
+            snprintf(expected, sizeof(expected), "%02d.mp3", (int)number);
+            if (strcasecmp(name, expected) == 0) {
+                this->stations[number - 1].announcer = true;
+            } else {
+                LOGW(LogModuleWebradio, "Announcer %s ignored, station %ld needs %s", name, number, expected);
+            }
+        }
+        entry.close();
+    }
+    dir.close();
 }
 
 Menu* WebradioPlayer::makeMenu() {
@@ -69,20 +161,19 @@ void WebradioPlayer::play(int index) {
     if ((index < 0) || (index >= this->numRadioStations)) return;
 
     this->currentItem = index;
-    Serial.printf("Play index %d by index call\n", index);
+    LOGD(LogModuleWebradio, "Play index %d by index call", index);
 
-    // Load URL from SD
-    File file = SD.open("/webradio.txt");
-    if (!file) {
-        Serial.println("No webradio.txt found");
+    if (this->wifi->getState() != WifiStateConnected) {
+        LOGW(LogModuleWebradio, "Wifi not connected, playing %d once connected", index);
+        this->announceOnConnect = false;
+        if (this->wifi->getState() == WifiStateFailed) {
+            this->connectWifi();
+        }
         return;
     }
-    file.seek(this->urloffset[index]);
-    char buffer[MAX_URL_LEN + 1] = { 0 };
-    size_t bytes = file.readBytesUntil('\n', buffer, MAX_URL_LEN);
-    buffer[bytes] = '\0';
 
-    Serial.printf("URL: %s\n", buffer);
+    const char *url = this->urlOf(index);
+    LOGI(LogModuleWebradio, "URL: %s", url);
 
     // Stop playback
     if (this->playlist->getState() != PlaybackStateStopped) {
@@ -90,13 +181,42 @@ void WebradioPlayer::play(int index) {
     }
 
     // Add url to playlist and start playback
-    this->playlist->addFilename(buffer);
+    this->playlist->addFilename(url);
     this->playlist->addFilename("/system/connection_failed.mp3");
     this->playlist->play();
+
+#if WEBRADIO_WARM_STANDBY
+    int previous = (index > 0) ? index - 1 : this->numRadioStations - 1;
+    int next = (index < this->numRadioStations - 1) ? index + 1 : 0;
+    this->connector->setNeighbours(url,
+        (previous != index) ? this->urlOf(previous) : NULL,
+        (next != index) ? this->urlOf(next) : NULL
+    );
+#endif
+}
+
+const char *WebradioPlayer::urlOf(int index) {
+    return this->arena + this->stations[index].url;
+}
+
+// Switch stations right away while playing, the standby connection of the
+// neighbour is promoted by the connector
+bool WebradioPlayer::zap(int index) {
+#if WEBRADIO_WARM_STANDBY
+    PlaybackState state = this->playlist->getState();
+    if ((state == PlaybackStatePlaying) || (state == PlaybackStateConnecting)) {
+        this->play(index);
+        return true;
+    }
+#endif
+    return false;
 }
 
 
 void WebradioPlayer::previous() {
+    if (this->zap((this->currentItem > 0) ? this->currentItem - 1 : this->numRadioStations - 1)) {
+        return;
+    }
     if (this->playlist->getState() == PlaybackStatePlaying) {
         return;
     }
@@ -113,6 +233,9 @@ void WebradioPlayer::previous() {
 }
 
 void WebradioPlayer::next() {
+    if (this->zap((this->currentItem < this->numRadioStations - 1) ? this->currentItem + 1 : 0)) {
+        return;
+    }
     if (this->playlist->getState() == PlaybackStatePlaying) {
         return;
     }
@@ -128,7 +251,9 @@ void WebradioPlayer::next() {
 }
 
 void WebradioPlayer::pause() {
-    if ((this->playlist->getState() == PlaybackStatePlaying) || (this->playlist->getState() == PlaybackStatePaused)) {
+    PlaybackState state = this->playlist->getState();
+    if ((state == PlaybackStatePlaying) || (state == PlaybackStatePaused) || (state == PlaybackStateConnecting)) {
+        this->connector->setNeighbours(NULL, NULL, NULL);
         this->playlist->stopAndClear();
         this->playlist->addFilename("/system/stopped.mp3");
         this->playlist->play();
@@ -138,18 +263,16 @@ void WebradioPlayer::pause() {
 }
 
 void WebradioPlayer::announce(int index) {
-    char buffer[129] = { 0 };
+    char buffer[32];
 
-    if (this->currentItem < 10) {
-        snprintf(buffer, 128, "/webradio/0%d.mp3", this->currentItem + 1);
-    } else {
-        snprintf(buffer, 128, "/webradio/%d.mp3", this->currentItem + 1);
-    }
-    if (!SD.exists(buffer)) {
-        snprintf(buffer, 128, "/system/%d.mp3", this->currentItem + 1);
-        Serial.printf("Station %d does not have an announcer, using %s\n", this->currentItem, buffer);
+    if ((index < 0) || (index >= this->numRadioStations)) return;
+
+    if (this->stations[index].announcer) {
+        snprintf(buffer, sizeof(buffer), "/webradio/%02d.mp3", index + 1);
+        LOGD(LogModuleWebradio, "Station %d has an announcer, using %s", index, buffer);
     } else {
-        Serial.printf("Station %d has an announcer, using %s\n", this->currentItem, buffer);
+        snprintf(buffer, sizeof(buffer), "/system/%d.mp3", index + 1);
+        LOGD(LogModuleWebradio, "Station %d does not have an announcer, using %s", index, buffer);
     }
     this->playlist->stopAndClear();
     this->playlist->addFilename(buffer);
@@ -161,50 +284,71 @@ void WebradioPlayer::reset() {
     this->announce(this->currentItem);
 }
 
-static void activateWifi(Menu *menu) {
-    WebradioPlayer *player = reinterpret_cast<WebradioPlayer *>(menu->getContext());
+// Starts connecting in the background, the station is announced when done
+void WebradioPlayer::connectWifi() {
     char ssid[128] = { 0 };
     char password[128] = { 0 };
 
     File file = SD.open("/wifi.txt");
     if (!file) {
-        Serial.println("No wifi.txt found");
+        LOGW(LogModuleWebradio, "No wifi.txt found");
+        this->connectionFailed();
         return;
     }
 
     // parse wifi file
-    size_t bytes;
-    bytes = file.readBytesUntil('\n', ssid, 127);
-    bytes = file.readBytesUntil('\n', password, 127);
+    file.readBytesUntil('\n', ssid, 127);
+    file.readBytesUntil('\n', password, 127);
     file.close();
 
-    // TODO: read wifi config from SD
-    // activate wifi
-    Serial.printf("Enabling Wifi, connecting to %s...", ssid);
-    if (WiFi.getMode() != WIFI_MODE_NULL) {
-        WiFi.disconnect();
-        WiFi.softAPdisconnect(true);
-    };
-    WiFi.mode(WIFI_STA);
-    WiFi.begin(ssid, password);
-
-    while (WiFi.status() != WL_CONNECTED) {
-        Serial.println(WiFi.status());
-        Serial.println("Connecting...");
-        delay(500);
-    }
-
-    IPAddress addr = WiFi.localIP();
-    IPAddress gateway = WiFi.gatewayIP();
-    Serial.printf("IP: %s, GW: %s\n", addr.toString().c_str(), gateway.toString().c_str());
-    player->reset();
-}
-
-static void deactivateWifi(Menu *item) {
-    Serial.println("Disabling Wifi");
-    WiFi.disconnect();
-    WiFi.softAPdisconnect(true);
-    WiFi.mode(WIFI_MODE_NULL);
+    this->wifi->connect(ssid, password);
+}
+
+void WebradioPlayer::connected() {
+    if (this->announceOnConnect) {
+        this->announceOnConnect = false;
+        this->reset();
+    } else {
+        this->play(this->currentItem);
+    }
+}
+
+void WebradioPlayer::connectionFailed() {
+    this->playlist->stopAndClear();
+    this->playlist->addFilename("/system/connection_failed.mp3");
+    this->playlist->play();
+}
+
+static void activateWifi(Menu *menu) {
+    WebradioPlayer *player = reinterpret_cast<WebradioPlayer *>(menu->getContext());
+    player->playlist->setDecoderBudget(WEBRADIO_DECODER_CPU, WEBRADIO_DECODER_RAM);
+    player->playlist->setArenaMode(ArenaModeWebradio);
+    player->loadStations();
+    player->announceOnConnect = true;
+    player->connectWifi();
+}
+
+static void deactivateWifi(Menu *menu) {
+    WebradioPlayer *player = reinterpret_cast<WebradioPlayer *>(menu->getContext());
+    player->connector->setNeighbours(NULL, NULL, NULL);
+    player->wifi->disconnect();
+    player->playlist->setArenaMode(ArenaModeMenu);
+}
+
+// Called from the event dispatcher
+static void wifiStateChanged(WifiState state, void *context) {
+    WebradioPlayer *player = reinterpret_cast<WebradioPlayer *>(context);
+
+    switch (state) {
+        case WifiStateConnected:
+            player->connected();
+            break;
+        case WifiStateFailed:
+            player->connectionFailed();
+            break;
+        default:
+            break;
+    }
 }
 
 static void webPrev(Menu *menu) {
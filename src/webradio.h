@@ -4,16 +4,34 @@
 #include <Arduino.h>
 #include "menu.h"
 #include "playlist.h"
+#include "wificonnection.h"
+#include "streamconnector.h"
 
-#define MAX_WEBRADIO_STATIONS 25
+// Keep standby connections to the previous and next station so zapping
+// while playing switches instantly. Costs up to STREAM_STANDBY_HEAP_BUDGET
+// of heap and the bandwidth of two more streams.
+#ifndef WEBRADIO_WARM_STANDBY
+#define WEBRADIO_WARM_STANDBY 0
+#endif
+
+// Decoders allowed next to WiFi and the jitter buffer
+#define WEBRADIO_DECODER_CPU 60
+#define WEBRADIO_DECODER_RAM (40 * 1024)
+
+typedef struct _WebradioStation {
+    uint32_t url;       // Offset into the string arena
+    bool announcer;     // /webradio/NN.mp3 exists
+} WebradioStation;
 
 class WebradioPlayer {
     public:
-        WebradioPlayer(Playlist *playlist);
+        WebradioPlayer(Playlist *playlist, WifiConnection *wifi, StreamConnector *connector);
         ~WebradioPlayer();
 
         Menu *makeMenu();
         Playlist *playlist;
+        WifiConnection *wifi;
+        StreamConnector *connector;
     
         // Internal for menu handling
         void play(int index);
@@ -22,13 +40,30 @@ class WebradioPlayer {
         void pause();
 
         void reset();
+        bool loadStations();
+        void connectWifi();
+        void connected();
+        void connectionFailed();
+
+        // The first connect after entering the mode starts with station 0,
+        // unless one was picked while connecting. Reconnects resume.
+        bool announceOnConnect;
     private:
         void announce(int index);
+        void findAnnouncers();
+        bool zap(int index);
+        const char *urlOf(int index);
 
-        int urloffset[MAX_WEBRADIO_STATIONS];
+        // Station URLs as zero terminated strings, parsed once from webradio.txt
+        char *arena;
+        WebradioStation *stations;
         int numRadioStations;
         int currentItem;
 
+        // Reload when webradio.txt changes
+        size_t fileSize;
+        time_t fileTime;
+
 };
 
 #endif
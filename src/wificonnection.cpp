@@ -0,0 +1,286 @@
+#include "wificonnection.h"
+#include "logger.h"
+#include <Preferences.h>
+#include "esp_timer.h"
+
+static void wifiTimerCallback(TimerHandle_t timer);
+static void wifiEventHandler(const Event *event, void *context);
+
+static const char *stateNames[] = {
+    "off",
+    "connecting",
+    "waiting for retry",
+    "connected",
+    "failed"
+};
+
+// FNV-1a, only used to tell if the cache belongs to the configured SSID
+static uint32_t hashString(const char *str) {
+    uint32_t hash = 2166136261u;
+    while (*str) {
+        hash ^= (uint8_t)*str++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+WifiConnection::WifiConnection(EventBus *bus) {
+    this->bus = bus;
+    this->state = WifiStateOff;
+    this->ssid[0] = '\0';
+    this->password[0] = '\0';
+    this->cacheValid = false;
+    this->fastConnect = false;
+    this->attempt = 0;
+    this->failedAttempts = 0;
+    this->attemptStart = 0;
+    this->connectTime = 0;
+    this->stateCallback = NULL;
+    this->stateCallbackContext = NULL;
+
+    this->timer = xTimerCreateStatic("wifi", 1, pdFALSE, this, wifiTimerCallback, &this->timerBuffer);
+    this->bus->subscribe(EventWifi, wifiEventHandler, this);
+
+    // Runs on the Arduino event task, only forward to the dispatcher
+    this->eventHandler = WiFi.onEvent([this](arduino_event_id_t event, arduino_event_info_t info) {
+        switch (event) {
+            case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+                this->postSignal(WifiSignalGotIP);
+                break;
+            case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+                // Caused by our own disconnect() calls
+                if (info.wifi_sta_disconnected.reason == WIFI_REASON_ASSOC_LEAVE) break;
+                LOGW(LogModuleWifi, "Wifi disconnected, reason %d", info.wifi_sta_disconnected.reason);
+                this->postSignal(WifiSignalDisconnected);
+                break;
+            default:
+                break;
+        }
+    });
+
+    this->loadCache();
+}
+
+WifiConnection::~WifiConnection() {
+    WiFi.removeEvent(this->eventHandler);
+    xTimerStop(this->timer, portMAX_DELAY);
+}
+
+void WifiConnection::connect(const char *ssid, const char *password) {
+    strncpy(this->ssid, ssid, sizeof(this->ssid) - 1);
+    this->ssid[sizeof(this->ssid) - 1] = '\0';
+    strncpy(this->password, password, sizeof(this->password) - 1);
+    this->password[sizeof(this->password) - 1] = '\0';
+
+    // Do not write the configuration to flash on every begin() and
+    // do not let the driver retry behind our back
+    WiFi.persistent(false);
+    WiFi.mode(WIFI_STA);
+    WiFi.setAutoReconnect(false);
+
+    this->failedAttempts = 0;
+    this->fastConnect = this->cacheValid && (this->cache.ssidHash == hashString(this->ssid));
+    this->startAttempt();
+}
+
+void WifiConnection::disconnect() {
+    LOGI(LogModuleWifi, "Disabling Wifi");
+    xTimerStop(this->timer, portMAX_DELAY);
+    this->attempt++;
+
+    WiFi.disconnect();
+    WiFi.softAPdisconnect(true);
+    WiFi.mode(WIFI_MODE_NULL);
+    this->changeState(WifiStateOff);
+}
+
+WifiState WifiConnection::getState() {
+    return this->state;
+}
+
+uint32_t WifiConnection::getConnectTime() {
+    return this->connectTime;
+}
+
+void WifiConnection::registerStateCallback(void (*callback)(WifiState state, void *context), void *context) {
+    this->stateCallback = callback;
+    this->stateCallbackContext = context;
+}
+
+void WifiConnection::postSignal(WifiSignal signal) {
+    this->bus->post(EventWifi, ((this->attempt & 0x0fffffff) << 4) | signal);
+}
+
+void WifiConnection::handleSignal(WifiSignal signal, uint32_t attempt) {
+    if (attempt != (this->attempt & 0x0fffffff)) return; // stale
+
+    switch (this->state) {
+        case WifiStateConnecting:
+            if (signal == WifiSignalGotIP) {
+                this->attemptSucceeded();
+            } else if (signal == WifiSignalDisconnected) {
+                this->attemptFailed("disconnected");
+            } else {
+                this->attemptFailed("timeout");
+            }
+            break;
+        case WifiStateRetryWait:
+            if (signal == WifiSignalTimer) {
+                this->startAttempt();
+            }
+            break;
+        case WifiStateConnected:
+            if (signal == WifiSignalDisconnected) {
+                LOGW(LogModuleWifi, "Wifi connection lost, reconnecting");
+                this->failedAttempts = 0;
+                this->startAttempt();
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+void WifiConnection::startAttempt() {
+    this->attempt++;
+    this->attemptStart = esp_timer_get_time();
+
+    WiFi.disconnect();
+    if (this->fastConnect) {
+        LOGI(LogModuleWifi, "Wifi fast connect to %s on channel %d", this->ssid, this->cache.channel);
+        WiFi.config(IPAddress(this->cache.ip), IPAddress(this->cache.gateway), IPAddress(this->cache.subnet), IPAddress(this->cache.dns));
+        WiFi.begin(this->ssid, this->password, this->cache.channel, this->cache.bssid, true);
+        this->startTimer(WIFI_FAST_CONNECT_TIMEOUT_MS);
+    } else {
+        LOGI(LogModuleWifi, "Wifi connecting to %s, attempt %d", this->ssid, this->failedAttempts + 1);
+        // All zero re-enables DHCP
+        WiFi.config(IPAddress(), IPAddress(), IPAddress());
+        WiFi.begin(this->ssid, this->password);
+        this->startTimer(WIFI_CONNECT_TIMEOUT_MS);
+    }
+
+    this->changeState(WifiStateConnecting);
+}
+
+void WifiConnection::attemptFailed(const char *reason) {
+    uint32_t duration = (esp_timer_get_time() - this->attemptStart) / 1000;
+
+    xTimerStop(this->timer, portMAX_DELAY);
+    LOGW(LogModuleWifi, "Wifi %s connect failed after %u ms: %s", this->fastConnect ? "fast" : "full", duration, reason);
+
+    // AP or lease may have changed, fall back to a full connect right away
+    if (this->fastConnect) {
+        this->fastConnect = false;
+        this->invalidateCache();
+        this->startAttempt();
+        return;
+    }
+
+    this->failedAttempts++;
+    if (this->failedAttempts >= WIFI_MAX_ATTEMPTS) {
+        WiFi.disconnect();
+        this->attempt++;
+        this->changeState(WifiStateFailed);
+        return;
+    }
+
+    uint32_t backoff = WIFI_RETRY_BACKOFF_MS << (this->failedAttempts - 1);
+    LOGI(LogModuleWifi, "Wifi retry in %u ms", backoff);
+    this->startTimer(backoff);
+    this->changeState(WifiStateRetryWait);
+}
+
+void WifiConnection::attemptSucceeded() {
+    xTimerStop(this->timer, portMAX_DELAY);
+    this->connectTime = (esp_timer_get_time() - this->attemptStart) / 1000;
+    this->failedAttempts = 0;
+
+    IPAddress addr = WiFi.localIP();
+    IPAddress gateway = WiFi.gatewayIP();
+    LOGI(LogModuleWifi, "Wifi %s connect in %u ms, IP: %s, GW: %s, channel %d",
+        this->fastConnect ? "fast" : "full", this->connectTime,
+        addr.toString().c_str(), gateway.toString().c_str(), WiFi.channel()
+    );
+
+    if (!this->fastConnect) {
+        this->storeCache();
+    }
+    this->changeState(WifiStateConnected);
+}
+
+void WifiConnection::changeState(WifiState state) {
+    if (this->state == state) return;
+
+    LOGD(LogModuleWifi, "Wifi state: %s -> %s", stateNames[this->state], stateNames[state]);
+    this->state = state;
+    if (this->stateCallback) {
+        this->stateCallback(state, this->stateCallbackContext);
+    }
+}
+
+void WifiConnection::startTimer(uint32_t ms) {
+    // Changing the period (re)starts the timer
+    xTimerChangePeriod(this->timer, pdMS_TO_TICKS(ms), portMAX_DELAY);
+}
+
+//
+// Fast connect cache
+//
+
+void WifiConnection::loadCache() {
+    Preferences prefs;
+
+    this->cacheValid = false;
+    if (!prefs.begin("wifi", true)) return;
+    if (prefs.getBytes("cache", &this->cache, sizeof(WifiCache)) == sizeof(WifiCache)) {
+        this->cacheValid = (this->cache.version == WIFI_CACHE_VERSION) && (this->cache.ip != 0);
+    }
+    prefs.end();
+}
+
+void WifiConnection::storeCache() {
+    WifiCache cache;
+    Preferences prefs;
+
+    memset(&cache, 0, sizeof(WifiCache));
+    cache.version = WIFI_CACHE_VERSION;
+    cache.ssidHash = hashString(this->ssid);
+    memcpy(cache.bssid, WiFi.BSSID(), sizeof(cache.bssid));
+    cache.channel = WiFi.channel();
+    cache.ip = WiFi.localIP();
+    cache.gateway = WiFi.gatewayIP();
+    cache.subnet = WiFi.subnetMask();
+    cache.dns = WiFi.dnsIP(0);
+
+    // Avoid flash wear, the lease usually does not change
+    if (this->cacheValid && (memcmp(&cache, &this->cache, sizeof(WifiCache)) == 0)) return;
+
+    this->cache = cache;
+    this->cacheValid = true;
+    if (!prefs.begin("wifi", false)) return;
+    prefs.putBytes("cache", &this->cache, sizeof(WifiCache));
+    prefs.end();
+}
+
+void WifiConnection::invalidateCache() {
+    Preferences prefs;
+
+    this->cacheValid = false;
+    if (!prefs.begin("wifi", false)) return;
+    prefs.remove("cache");
+    prefs.end();
+}
+
+//
+// Callbacks
+//
+
+static void wifiTimerCallback(TimerHandle_t timer) {
+    WifiConnection *connection = reinterpret_cast<WifiConnection *>(pvTimerGetTimerID(timer));
+    connection->postSignal(WifiSignalTimer);
+}
+
+static void wifiEventHandler(const Event *event, void *context) {
+    WifiConnection *connection = reinterpret_cast<WifiConnection *>(context);
+    connection->handleSignal((WifiSignal)(event->value & 0x0f), (uint32_t)event->value >> 4);
+}
@@ -0,0 +1,103 @@
+#ifndef LITTLESPEAKER_WIFICONNECTION_H
+#define LITTLESPEAKER_WIFICONNECTION_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include "freertos/timers.h"
+#include "eventbus.h"
+
+// Time allowed for one connection attempt, the fast path skips the scan
+// and DHCP so it should either be done quickly or not at all
+#define WIFI_CONNECT_TIMEOUT_MS 15000
+#define WIFI_FAST_CONNECT_TIMEOUT_MS 3000
+
+// Give up after this many attempts, the wait between attempts doubles
+#define WIFI_MAX_ATTEMPTS 4
+#define WIFI_RETRY_BACKOFF_MS 1000
+
+#define WIFI_CACHE_VERSION 1
+
+typedef enum _WifiState {
+    WifiStateOff = 0,
+    WifiStateConnecting = 1,
+    WifiStateRetryWait = 2,
+    WifiStateConnected = 3,
+    WifiStateFailed = 4
+} WifiState;
+
+// Posted as the value of EventWifi, the upper bits carry the attempt number
+typedef enum _WifiSignal {
+    WifiSignalGotIP = 0,
+    WifiSignalDisconnected = 1,
+    WifiSignalTimer = 2
+} WifiSignal;
+
+// Last successful connection, stored in NVS for the fast connect path
+typedef struct _WifiCache {
+    uint32_t version;
+    uint32_t ssidHash;
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint32_t ip;
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+} WifiCache;
+
+//
+// Asynchronous WiFi station connection: connect() returns immediately,
+// the progress is driven by WiFi events and a timer which are both
+// routed through the event bus. The state callback is called from the
+// event dispatcher on every state change.
+//
+class WifiConnection {
+    public:
+        WifiConnection(EventBus *bus);
+        ~WifiConnection();
+
+        void connect(const char *ssid, const char *password);
+        void disconnect();
+
+        WifiState getState();
+        uint32_t getConnectTime();  // Milliseconds of the last successful attempt
+
+        void registerStateCallback(void (*callback)(WifiState state, void *context), void *context);
+
+        // Internal for event handling
+        void handleSignal(WifiSignal signal, uint32_t attempt);
+        void postSignal(WifiSignal signal);
+
+    private:
+        void startAttempt();
+        void attemptFailed(const char *reason);
+        void attemptSucceeded();
+        void changeState(WifiState state);
+        void startTimer(uint32_t ms);
+
+        void loadCache();
+        void storeCache();
+        void invalidateCache();
+
+        EventBus *bus;
+        WifiState state;
+        char ssid[33];
+        char password[65];
+
+        WifiCache cache;
+        bool cacheValid;
+        bool fastConnect;
+
+        uint32_t attempt;       // Increments on every attempt, stale signals are dropped
+        int failedAttempts;
+        int64_t attemptStart;
+        uint32_t connectTime;
+
+        TimerHandle_t timer;
+        StaticTimer_t timerBuffer;
+        wifi_event_id_t eventHandler;
+
+        void (*stateCallback)(WifiState state, void *context);
+        void *stateCallbackContext;
+};
+
+#endif